@@ -17,6 +17,7 @@
 #include "dir.h"
 #include "gettext.h"
 #include "path.h"
+#include "pattern-index.h"
 #include "utf8.h"
 #include "quote.h"
 #include "read-cache-ll.h"
@@ -434,6 +435,7 @@ struct attr_stack {
 	unsigned num_matches;
 	unsigned alloc;
 	struct match_attr **attrs;
+	struct pattern_index *index;	/* for long files, or NULL */
 };
 
 static void attr_stack_free(struct attr_stack *e)
@@ -457,6 +459,7 @@ static void attr_stack_free(struct attr_stack *e)
 		free(a);
 	}
 	free(e->attrs);
+	pattern_index_free(e->index);
 	free(e);
 }
 
@@ -894,6 +897,32 @@ int git_attr_system_is_enabled(void)
 
 static GIT_PATH_FUNC(git_path_info_attributes, INFOATTRIBUTES_FILE)
 
+/*
+ * Index the patterns of a long attributes file, now that we know the
+ * directory they are relative to.
+ */
+static void index_attr_stack(struct attr_stack *elem)
+{
+	unsigned i;
+
+	if (elem->num_matches < PATTERN_INDEX_MIN_PATTERNS ||
+	    !pattern_index_enabled())
+		return;
+
+	elem->index = pattern_index_new();
+	for (i = 0; i < elem->num_matches; i++) {
+		const struct match_attr *a = elem->attrs[i];
+
+		if (a->is_macro)
+			continue;
+		pattern_index_add(elem->index, i, a->u.pat.pattern,
+				  a->u.pat.patternlen, a->u.pat.nowildcardlen,
+				  a->u.pat.flags,
+				  elem->origin ? elem->origin : "",
+				  elem->originlen);
+	}
+}
+
 static void push_stack(struct attr_stack **attr_stack_p,
 		       struct attr_stack *elem, char *origin, size_t originlen)
 {
@@ -901,6 +930,7 @@ static void push_stack(struct attr_stack **attr_stack_p,
 		elem->origin = origin;
 		if (origin)
 			elem->originlen = originlen;
+		index_attr_stack(elem);
 		elem->prev = *attr_stack_p;
 		*attr_stack_p = elem;
 	}
@@ -1089,10 +1119,29 @@ static int fill(const char *path, int pathlen, int basename_offset,
 		const struct attr_stack *stack,
 		struct all_attrs_item *all_attrs, int rem)
 {
+	int isdir = (pathlen && path[pathlen - 1] == '/');
+
 	for (; rem > 0 && stack; stack = stack->prev) {
 		unsigned i;
 		const char *base = stack->origin ? stack->origin : "";
 
+		if (stack->index) {
+			struct pattern_index_lookup lookup;
+			int pos;
+
+			pattern_index_lookup(stack->index, path, pathlen - isdir,
+					     path + basename_offset, &lookup);
+			while (rem > 0 &&
+			       (pos = pattern_index_next(&lookup)) >= 0) {
+				const struct match_attr *a = stack->attrs[pos];
+				if (path_matches(path, pathlen, basename_offset,
+						 &a->u.pat, base,
+						 stack->originlen))
+					rem = fill_one(all_attrs, a, rem);
+			}
+			continue;
+		}
+
 		for (i = stack->num_matches; 0 < rem && 0 < i; i--) {
 			const struct match_attr *a = stack->attrs[i - 1];
 			if (a->is_macro)
@@ -16,6 +16,7 @@
 #include "hex.h"
 #include "ident.h"
 #include "list-objects-filter-options.h"
+#include "manifest.h"
 #include "parse-options.h"
 #include "userdiff.h"
 #include "streaming.h"
@@ -33,6 +34,8 @@
 enum batch_mode {
 	BATCH_MODE_CONTENTS,
 	BATCH_MODE_INFO,
+	BATCH_MODE_LOGICAL,
+	BATCH_MODE_CHUNKS,
 	BATCH_MODE_QUEUE_AND_DISPATCH,
 };
 
@@ -280,6 +283,15 @@ struct expand_data {
 	const char *rest;
 	struct object_id delta_base_oid;
 
+	/*
+	 * The size of the content the object stands for: for a manifest
+	 * this is the total size of its chunks, for anything else it is
+	 * the object size. Only filled in when want_logical_size is set
+	 * or when printing logical contents.
+	 */
+	unsigned long logical_size;
+	int want_logical_size;
+
 	/*
 	 * If mark_query is true, we do not expand anything, but rather
 	 * just mark the object_info with items we wish to query.
@@ -331,6 +343,14 @@ static int expand_atom(struct strbuf *sb, const char *atom, int len,
 			data->info.sizep = &data->size;
 		else
 			strbuf_addf(sb, "%"PRIuMAX , (uintmax_t)data->size);
+	} else if (is_atom("logicalsize", atom, len)) {
+		if (data->mark_query) {
+			data->info.typep = &data->type;
+			data->info.sizep = &data->size;
+			data->want_logical_size = 1;
+		} else {
+			strbuf_addf(sb, "%"PRIuMAX, (uintmax_t)data->logical_size);
+		}
 	} else if (is_atom("objectsize:disk", atom, len)) {
 		if (data->mark_query)
 			data->info.disk_sizep = &data->disk_size;
@@ -445,12 +465,123 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 	}
 }
 
+static void fill_logical_size(struct expand_data *data)
+{
+	if (data->type != OBJ_MANIFEST)
+		data->logical_size = data->size;
+	else if (get_manifest_size(the_repository, &data->oid,
+				   &data->logical_size) < 0)
+		die(_("unable to read manifest %s"), oid_to_hex(&data->oid));
+}
+
+/*
+ * Once the header announced the size, the content cannot come out
+ * shorter or longer without the reader losing its place in the
+ * stream. Make sure every chunk is there and that their sizes add up
+ * before printing anything.
+ */
+static void check_logical_size_or_die(struct expand_data *data)
+{
+	struct oid_array chunks = OID_ARRAY_INIT;
+	unsigned long total = 0, size;
+	size_t i;
+
+	if (get_manifest_chunk_oids(the_repository, &data->oid,
+				    NULL, &chunks) < 0)
+		die(_("unable to read manifest %s"), oid_to_hex(&data->oid));
+	for (i = 0; i < chunks.nr; i++) {
+		if (odb_read_object_info(the_repository->objects,
+					 &chunks.oid[i], &size) != OBJ_BLOB)
+			die(_("unable to read chunk %s of manifest %s"),
+			    oid_to_hex(&chunks.oid[i]),
+			    oid_to_hex(&data->oid));
+		total += size;
+	}
+	if (total != data->logical_size)
+		die(_("manifest %s: chunks add up to %lu bytes, manifest records %lu"),
+		    oid_to_hex(&data->oid), total, data->logical_size);
+	oid_array_clear(&chunks);
+}
+
+/*
+ * Stream the content a manifest stands for, chunk by chunk, without
+ * ever holding all of it in memory; chunks stored uncompressed in a
+ * pack are copied from the pack file without passing through us.
+ * Other objects are printed as-is. The stream fails rather than come
+ * out with another length than the header announced.
+ */
+static void print_logical_or_die(struct batch_options *opt,
+				 struct expand_data *data)
+{
+	if (data->type != OBJ_MANIFEST) {
+		print_object_or_die(opt, data);
+		return;
+	}
+
+	if (opt->buffer_output)
+		fflush(stdout);
+	if (stream_manifest_to_fd(the_repository, 1, &data->oid) < 0)
+		die("unable to stream %s to stdout", oid_to_hex(&data->oid));
+}
+
+static void print_chunk_line(struct strbuf *scratch, struct batch_options *opt,
+			     const struct object_id *oid,
+			     uintmax_t offset, unsigned long size)
+{
+	strbuf_reset(scratch);
+	strbuf_addf(scratch, "%s %"PRIuMAX" %"PRIuMAX"%c", oid_to_hex(oid),
+		    offset, (uintmax_t)size, opt->output_delim);
+	batch_write(opt, scratch->buf, scratch->len);
+}
+
+/*
+ * Print one "<chunk> <offset> <size>" line per chunk of a manifest,
+ * in content order. A blob is its own single chunk; other objects have
+ * no chunks. The table is terminated by an empty line.
+ */
+static void print_chunks_or_die(struct batch_options *opt,
+				struct strbuf *scratch,
+				struct expand_data *data)
+{
+	if (data->type == OBJ_MANIFEST) {
+		struct oid_array chunks = OID_ARRAY_INIT;
+		uintmax_t offset = 0;
+		size_t i;
+
+		if (get_manifest_chunk_oids(the_repository, &data->oid,
+					    NULL, &chunks) < 0)
+			die(_("unable to read manifest %s"),
+			    oid_to_hex(&data->oid));
+
+		for (i = 0; i < chunks.nr; i++) {
+			unsigned long size;
+
+			if (odb_read_object_info(the_repository->objects,
+						 &chunks.oid[i], &size) != OBJ_BLOB)
+				die(_("unable to read chunk %s of manifest %s"),
+				    oid_to_hex(&chunks.oid[i]),
+				    oid_to_hex(&data->oid));
+			print_chunk_line(scratch, opt, &chunks.oid[i],
+					 offset, size);
+			offset += size;
+		}
+		oid_array_clear(&chunks);
+	} else if (data->type == OBJ_BLOB) {
+		print_chunk_line(scratch, opt, &data->oid, 0, data->size);
+	}
+	batch_write(opt, &opt->output_delim, 1);
+}
+
 static void print_default_format(struct strbuf *scratch, struct expand_data *data,
 				 struct batch_options *opt)
 {
+	unsigned long size = data->size;
+
+	if (opt->batch_mode == BATCH_MODE_LOGICAL)
+		size = data->logical_size;
 	strbuf_addf(scratch, "%s %s %"PRIuMAX"%c", oid_to_hex(&data->oid),
 		    type_name(data->type),
-		    (uintmax_t)data->size, opt->output_delim);
+		    (uintmax_t)size, opt->output_delim);
 }
 
 static void report_object_status(struct batch_options *opt,
@@ -546,6 +677,13 @@ static void batch_object_write(const char *obj_name,
 
 			free(buf);
 		}
+
+		if (data->want_logical_size ||
+		    opt->batch_mode == BATCH_MODE_LOGICAL)
+			fill_logical_size(data);
+		if (opt->batch_mode == BATCH_MODE_LOGICAL &&
+		    data->type == OBJ_MANIFEST)
+			check_logical_size_or_die(data);
 	}
 
 	strbuf_reset(scratch);
@@ -562,6 +700,11 @@ static void batch_object_write(const char *obj_name,
 	if (opt->batch_mode == BATCH_MODE_CONTENTS) {
 		print_object_or_die(opt, data);
 		batch_write(opt, &opt->output_delim, 1);
+	} else if (opt->batch_mode == BATCH_MODE_LOGICAL) {
+		print_logical_or_die(opt, data);
+		batch_write(opt, &opt->output_delim, 1);
+	} else if (opt->batch_mode == BATCH_MODE_CHUNKS) {
+		print_chunks_or_die(opt, scratch, data);
 	}
 }
 
@@ -693,6 +836,24 @@ static void parse_cmd_info(struct batch_options *opt,
 	batch_one_object(line, output, opt, data);
 }
 
+static void parse_cmd_logical(struct batch_options *opt,
+			      const char *line,
+			      struct strbuf *output,
+			      struct expand_data *data)
+{
+	opt->batch_mode = BATCH_MODE_LOGICAL;
+	batch_one_object(line, output, opt, data);
+}
+
+static void parse_cmd_chunks(struct batch_options *opt,
+			     const char *line,
+			     struct strbuf *output,
+			     struct expand_data *data)
+{
+	opt->batch_mode = BATCH_MODE_CHUNKS;
+	batch_one_object(line, output, opt, data);
+}
+
 static void dispatch_calls(struct batch_options *opt,
 		struct strbuf *output,
 		struct expand_data *data,
@@ -728,6 +889,8 @@ static const struct parse_cmd {
 } commands[] = {
 	{ "contents", parse_cmd_contents, 1},
 	{ "info", parse_cmd_info, 1},
+	{ "logical", parse_cmd_logical, 1},
+	{ "chunks", parse_cmd_chunks, 1},
 	{ "flush", NULL, 0},
 };
 
@@ -900,6 +1063,16 @@ static int batch_objects(struct batch_options *opt)
 	if (opt->batch_mode == BATCH_MODE_CONTENTS)
 		data.info.typep = &data.type;
 
+	/*
+	 * The "logical" and "chunks" commands need to know whether they
+	 * are looking at a manifest, and fall back to the object size for
+	 * anything else.
+	 */
+	if (opt->batch_mode == BATCH_MODE_QUEUE_AND_DISPATCH) {
+		data.info.typep = &data.type;
+		data.info.sizep = &data.size;
+	}
+
 	if (opt->all_objects) {
 		struct object_cb_data cb;
 		struct object_info empty = OBJECT_INFO_INIT;
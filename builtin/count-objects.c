@@ -8,11 +8,19 @@
 #include "config.h"
 #include "dir.h"
 #include "gettext.h"
+#include "hex.h"
+#include "json-writer.h"
+#include "manifest.h"
+#include "odb.h"
+#include "oidmap.h"
+#include "oidset.h"
 #include "path.h"
 #include "parse-options.h"
 #include "quote.h"
 #include "packfile.h"
+#include "pack-revindex.h"
 #include "object-file.h"
+#include "trace2.h"
 
 static unsigned long garbage;
 static off_t size_garbage;
@@ -88,8 +96,352 @@ static int print_alternate(struct odb_source *alternate, void *data UNUSED)
 	return 0;
 }
 
+/*
+ * Statistics for "--manifests". Manifests are found from the object
+ * headers of packs and loose objects; the chunks they reference are
+ * then only asked for their sizes, so that the only objects read in
+ * full are the manifests themselves.
+ */
+#define CHUNK_SIZE_BUCKETS 64
+#define TOP_MANIFESTS 10
+
+struct chunk_entry {
+	struct oidmap_entry ent;
+	size_t owner;		/* first manifest referencing the chunk */
+	unsigned shared:1;	/* referenced by another manifest too */
+	unsigned has_size:1;
+	unsigned long size;
+};
+
+struct manifest_stat {
+	struct object_id oid;
+	uint64_t logical;
+	off_t unique;
+};
+
+struct manifest_stats {
+	struct oidset manifests;
+	off_t manifest_bytes;
+
+	struct manifest_stat *roots;
+	size_t roots_nr, roots_alloc;
+	size_t sub_manifests;
+	uintmax_t logical_bytes;
+
+	struct oidmap chunks;
+	size_t chunks_nr;
+	uintmax_t chunk_refs;
+	size_t shared_chunks;
+	uintmax_t chunk_bytes;
+	off_t chunk_stored_bytes;
+	size_t histogram[CHUNK_SIZE_BUCKETS];
+};
+
+static void add_manifest(struct manifest_stats *stats,
+			 const struct object_id *oid, off_t disk_size)
+{
+	if (oidset_insert(&stats->manifests, oid))
+		return; /* also in another pack */
+	stats->manifest_bytes += disk_size;
+}
+
+static int collect_loose_manifest(const struct object_id *oid,
+				  const char *path UNUSED, void *data)
+{
+	struct object_info oi = OBJECT_INFO_INIT;
+	enum object_type type;
+	off_t disk_size;
+
+	oi.typep = &type;
+	oi.disk_sizep = &disk_size;
+	if (odb_read_object_info_extended(the_repository->objects, oid, &oi,
+					  OBJECT_INFO_SKIP_FETCH_OBJECT) < 0)
+		return 0;
+	if (type == OBJ_MANIFEST)
+		add_manifest(data, oid, disk_size);
+	return 0;
+}
+
+/*
+ * Walk "p" in pack order, taking the type of each object from its
+ * header. An OFS_DELTA has the type of its base, which comes earlier
+ * in the pack and so is known by then; only REF_DELTAs, rare outside
+ * of thin packs, need their delta chain looked up.
+ */
+static void collect_packed_manifests(struct manifest_stats *stats,
+				     struct packed_git *p)
+{
+	struct pack_window *w_curs = NULL;
+	enum object_type *types;
+	uint32_t pos;
+
+	if (open_pack_index(p) || load_pack_revindex(the_repository, p))
+		return;
+
+	ALLOC_ARRAY(types, p->num_objects);
+	for (pos = 0; pos < p->num_objects; pos++) {
+		off_t offset = pack_pos_to_offset(p, pos);
+		off_t cur = offset;
+		unsigned long size;
+		enum object_type type;
+
+		type = unpack_object_header(p, &w_curs, &cur, &size);
+		if (type == OBJ_OFS_DELTA) {
+			off_t base = get_delta_base(p, &w_curs, &cur, type, offset);
+			uint32_t base_pos;
+
+			if (base && !offset_to_pack_pos(p, base, &base_pos) &&
+			    base_pos < pos)
+				type = types[base_pos];
+			else
+				type = OBJ_BAD;
+		} else if (type == OBJ_REF_DELTA) {
+			struct object_info oi = OBJECT_INFO_INIT;
+
+			oi.typep = &type;
+			if (packed_object_info(the_repository, p, offset, &oi) < 0)
+				type = OBJ_BAD;
+		}
+		types[pos] = type;
+
+		if (type == OBJ_MANIFEST) {
+			struct object_id oid;
+
+			if (nth_packed_object_id(&oid, p,
+						 pack_pos_to_index(p, pos)) < 0)
+				continue;
+			add_manifest(stats, &oid,
+				     pack_pos_to_offset(p, pos + 1) - offset);
+		}
+	}
+	unuse_pack(&w_curs);
+	free(types);
+}
+
+static int walk_manifest(struct manifest_stats *stats,
+			 const struct object_id *oid)
+{
+	struct manifest_chunk_iter iter;
+	struct manifest_header header;
+	struct manifest_stat *m;
+	int ret;
+
+	if (manifest_chunk_iter_init(&iter, the_repository, oid, &header) < 0)
+		return error(_("unable to read manifest %s"), oid_to_hex(oid));
+
+	/* sub-manifests are walked from the manifest they belong to */
+	if (is_null_oid(&header.content_oid)) {
+		manifest_chunk_iter_release(&iter);
+		stats->sub_manifests++;
+		return 0;
+	}
+
+	ALLOC_GROW(stats->roots, stats->roots_nr + 1, stats->roots_alloc);
+	m = &stats->roots[stats->roots_nr];
+	oidcpy(&m->oid, oid);
+	m->logical = header.total_size;
+	m->unique = 0;
+	stats->logical_bytes += header.total_size;
+
+	while ((ret = manifest_chunk_iter_next(&iter)) > 0) {
+		struct chunk_entry *e = oidmap_get(&stats->chunks, &iter.oid);
+
+		stats->chunk_refs++;
+		if (!e) {
+			CALLOC_ARRAY(e, 1);
+			oidcpy(&e->ent.oid, &iter.oid);
+			e->owner = stats->roots_nr;
+			e->has_size = iter.has_size;
+			e->size = iter.size;
+			oidmap_put(&stats->chunks, e);
+			stats->chunks_nr++;
+		} else if (e->owner != stats->roots_nr && !e->shared) {
+			e->shared = 1;
+			stats->shared_chunks++;
+		}
+	}
+	manifest_chunk_iter_release(&iter);
+	stats->roots_nr++;
+	if (ret < 0)
+		return error(_("unable to read manifest %s"), oid_to_hex(oid));
+	return 0;
+}
+
+static int size_bucket(unsigned long size)
+{
+	int bucket = 0;
+
+	while (bucket < CHUNK_SIZE_BUCKETS - 1 && (1UL << bucket) < size)
+		bucket++;
+	return bucket;
+}
+
+static void count_chunks(struct manifest_stats *stats)
+{
+	struct oidmap_iter iter;
+	struct chunk_entry *e;
+
+	oidmap_iter_init(&stats->chunks, &iter);
+	while ((e = oidmap_iter_next(&iter))) {
+		struct object_info oi = OBJECT_INFO_INIT;
+		off_t disk_size = 0;
+
+		oi.disk_sizep = &disk_size;
+		if (!e->has_size)
+			oi.sizep = &e->size;
+		if (odb_read_object_info_extended(the_repository->objects,
+						  &e->ent.oid, &oi,
+						  OBJECT_INFO_SKIP_FETCH_OBJECT) < 0) {
+			/* missing, e.g. in a partial clone; it costs nothing here */
+			if (!e->has_size)
+				e->size = 0;
+		}
+		stats->chunk_bytes += e->size;
+		stats->chunk_stored_bytes += disk_size;
+		stats->histogram[size_bucket(e->size)]++;
+		if (!e->shared)
+			stats->roots[e->owner].unique += disk_size;
+	}
+}
+
+static int manifest_stat_cmp(const void *va, const void *vb)
+{
+	const struct manifest_stat *a = va, *b = vb;
+
+	if (a->unique != b->unique)
+		return a->unique < b->unique ? 1 : -1;
+	return oidcmp(&a->oid, &b->oid);
+}
+
+static void format_size(struct strbuf *buf, uintmax_t size, int human_readable)
+{
+	strbuf_reset(buf);
+	if (human_readable)
+		strbuf_humanise_bytes(buf, size);
+	else
+		strbuf_addf(buf, "%"PRIuMAX, size / 1024);
+}
+
+static void trace_manifest_stats(struct manifest_stats *stats, size_t top)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	if (!trace2_is_enabled())
+		return;
+
+	trace2_data_intmax("count-objects", the_repository, "manifests",
+			   stats->roots_nr);
+	trace2_data_intmax("count-objects", the_repository, "sub-manifests",
+			   stats->sub_manifests);
+	trace2_data_intmax("count-objects", the_repository, "logical-bytes",
+			   stats->logical_bytes);
+	trace2_data_intmax("count-objects", the_repository, "manifest-bytes",
+			   stats->manifest_bytes);
+	trace2_data_intmax("count-objects", the_repository, "stored-bytes",
+			   stats->manifest_bytes + stats->chunk_stored_bytes);
+	trace2_data_intmax("count-objects", the_repository, "chunks",
+			   stats->chunks_nr);
+	trace2_data_intmax("count-objects", the_repository, "chunk-references",
+			   stats->chunk_refs);
+	trace2_data_intmax("count-objects", the_repository, "shared-chunks",
+			   stats->shared_chunks);
+	trace2_data_intmax("count-objects", the_repository, "chunk-bytes",
+			   stats->chunk_bytes);
+
+	jw_object_begin(&jw, 0);
+	for (int i = 0; i < CHUNK_SIZE_BUCKETS; i++) {
+		char key[32];
+
+		if (!stats->histogram[i])
+			continue;
+		xsnprintf(key, sizeof(key), "%"PRIuMAX, (uintmax_t)1 << i);
+		jw_object_intmax(&jw, key, stats->histogram[i]);
+	}
+	jw_end(&jw);
+	trace2_data_json("count-objects", the_repository, "chunk-size-histogram",
+			 &jw);
+	jw_release(&jw);
+
+	jw_array_begin(&jw, 0);
+	for (size_t i = 0; i < top; i++) {
+		jw_array_inline_begin_object(&jw);
+		jw_object_string(&jw, "oid", oid_to_hex(&stats->roots[i].oid));
+		jw_object_intmax(&jw, "unique-bytes", stats->roots[i].unique);
+		jw_object_intmax(&jw, "logical-bytes", stats->roots[i].logical);
+		jw_end(&jw);
+	}
+	jw_end(&jw);
+	trace2_data_json("count-objects", the_repository, "top-manifests", &jw);
+	jw_release(&jw);
+}
+
+static void count_manifests(int human_readable)
+{
+	struct manifest_stats stats = {
+		.manifests = OIDSET_INIT,
+	};
+	struct strbuf buf = STRBUF_INIT;
+	struct oidset_iter iter;
+	const struct object_id *oid;
+	struct packed_git *p;
+	size_t top;
+
+	oidmap_init(&stats.chunks, 0);
+
+	for_each_loose_object(collect_loose_manifest, &stats,
+			      FOR_EACH_OBJECT_LOCAL_ONLY);
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		if (p->pack_local)
+			collect_packed_manifests(&stats, p);
+	}
+
+	oidset_iter_init(&stats.manifests, &iter);
+	while ((oid = oidset_iter_next(&iter)))
+		walk_manifest(&stats, oid);
+	count_chunks(&stats);
+
+	QSORT(stats.roots, stats.roots_nr, manifest_stat_cmp);
+	top = stats.roots_nr < TOP_MANIFESTS ? stats.roots_nr : TOP_MANIFESTS;
+
+	printf("manifests: %"PRIuMAX"\n", (uintmax_t)stats.roots_nr);
+	printf("sub-manifests: %"PRIuMAX"\n", (uintmax_t)stats.sub_manifests);
+	format_size(&buf, stats.logical_bytes, human_readable);
+	printf("size-logical: %s\n", buf.buf);
+	format_size(&buf, stats.manifest_bytes, human_readable);
+	printf("size-manifests: %s\n", buf.buf);
+	format_size(&buf, stats.manifest_bytes + stats.chunk_stored_bytes,
+		    human_readable);
+	printf("size-stored: %s\n", buf.buf);
+	printf("chunks: %"PRIuMAX"\n", (uintmax_t)stats.chunks_nr);
+	printf("chunk-references: %"PRIuMAX"\n", stats.chunk_refs);
+	printf("shared-chunks: %"PRIuMAX"\n", (uintmax_t)stats.shared_chunks);
+	format_size(&buf, stats.chunk_bytes, human_readable);
+	printf("size-chunks: %s\n", buf.buf);
+	for (int i = 0; i < CHUNK_SIZE_BUCKETS; i++) {
+		if (!stats.histogram[i])
+			continue;
+		strbuf_reset(&buf);
+		strbuf_humanise_bytes(&buf, (uintmax_t)1 << i);
+		printf("chunk-size <= %s: %"PRIuMAX"\n", buf.buf,
+		       (uintmax_t)stats.histogram[i]);
+	}
+	for (size_t i = 0; i < top; i++) {
+		format_size(&buf, stats.roots[i].unique, human_readable);
+		printf("top-manifest: %s %s\n",
+		       oid_to_hex(&stats.roots[i].oid), buf.buf);
+	}
+
+	trace_manifest_stats(&stats, top);
+
+	strbuf_release(&buf);
+	oidmap_clear(&stats.chunks, 1);
+	oidset_clear(&stats.manifests);
+	free(stats.roots);
+}
+
 static char const * const count_objects_usage[] = {
 	"git count-objects [-v] [-H | --human-readable]",
+	"git count-objects --manifests [-H | --human-readable]",
 	NULL
 };
 
@@ -98,11 +450,13 @@ int cmd_count_objects(int argc,
 		      const char *prefix,
 		      struct repository *repo UNUSED)
 {
-	int human_readable = 0;
+	int human_readable = 0, manifests = 0;
 	struct option opts[] = {
 		OPT__VERBOSE(&verbose, N_("be verbose")),
 		OPT_BOOL('H', "human-readable", &human_readable,
 			 N_("print sizes in human readable format")),
+		OPT_BOOL(0, "manifests", &manifests,
+			 N_("report the space used and saved by manifests")),
 		OPT_END(),
 	};
 
@@ -112,6 +466,13 @@ int cmd_count_objects(int argc,
 	/* we do not take arguments other than flags for now */
 	if (argc)
 		usage_with_options(count_objects_usage, opts);
+	if (manifests) {
+		if (verbose)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--manifests", "-v");
+		count_manifests(human_readable);
+		return 0;
+	}
 	if (verbose) {
 		report_garbage = real_report_garbage;
 		report_linked_checkout_garbage(the_repository);
@@ -29,6 +29,7 @@
 #include "quote.h"
 #include "remote.h"
 #include "blob.h"
+#include "manifest.h"
 
 static const char *const fast_export_usage[] = {
 	N_("git fast-export [<rev-list-opts>]"),
@@ -300,6 +301,59 @@ static char *anonymize_blob(unsigned long *size)
 	return strbuf_detach(&out, NULL);
 }
 
+/*
+ * Export a file stored as a manifest as an ordinary blob of its
+ * content, streaming it chunk by chunk instead of assembling it in
+ * memory.
+ */
+static void export_manifest(const struct object_id *oid)
+{
+	struct manifest *manifest = lookup_manifest(the_repository, oid);
+	struct manifest_stream *stream;
+	struct object_id content_oid, actual;
+	struct git_hash_ctx c;
+	char hdr[64];
+	char buf[65536];
+	unsigned long size;
+	int hdrlen;
+	ssize_t n;
+
+	if (!manifest)
+		die("could not read manifest %s", oid_to_hex(oid));
+	if (get_manifest_content_oid(the_repository, oid, &content_oid) < 0)
+		die("could not read manifest %s", oid_to_hex(oid));
+	stream = open_manifest_stream(the_repository, oid, &size);
+	if (!stream)
+		die("could not read manifest %s", oid_to_hex(oid));
+
+	mark_next_object(&manifest->object);
+
+	printf("blob\nmark :%"PRIu32"\n", last_idnum);
+	if (show_original_ids)
+		printf("original-oid %s\n", oid_to_hex(oid));
+	printf("data %"PRIuMAX"\n", (uintmax_t)size);
+
+	hdrlen = format_object_header(hdr, sizeof(hdr), OBJ_BLOB, size);
+	the_hash_algo->init_fn(&c);
+	git_hash_update(&c, hdr, hdrlen);
+	while ((n = read_manifest_stream(stream, buf, sizeof(buf))) > 0) {
+		git_hash_update(&c, buf, n);
+		if (fwrite(buf, n, 1, stdout) != 1)
+			die_errno("could not write blob '%s'", oid_to_hex(oid));
+		size -= n;
+	}
+	if (n < 0 || size || close_manifest_stream(stream) < 0)
+		die("could not read manifest %s", oid_to_hex(oid));
+	git_hash_final_oid(&actual, &c);
+	if (!is_null_oid(&content_oid) && !oideq(&actual, &content_oid))
+		die("oid mismatch in manifest %s", oid_to_hex(oid));
+	printf("\n");
+
+	show_progress();
+
+	manifest->object.flags |= SHOWN;
+}
+
 static void export_blob(const struct object_id *oid)
 {
 	unsigned long size;
@@ -318,9 +372,18 @@ static void export_blob(const struct object_id *oid)
 	if (object && object->flags & SHOWN)
 		return;
 
+	if (!anonymize &&
+	    odb_read_object_info(the_repository->objects, oid, NULL) == OBJ_MANIFEST) {
+		export_manifest(oid);
+		return;
+	}
+
 	if (anonymize) {
 		buf = anonymize_blob(&size);
-		object = (struct object *)lookup_blob(the_repository, oid);
+		if (odb_read_object_info(the_repository->objects, oid, NULL) == OBJ_MANIFEST)
+			object = (struct object *)lookup_manifest(the_repository, oid);
+		else
+			object = (struct object *)lookup_blob(the_repository, oid);
 		eaten = 0;
 	} else {
 		buf = odb_read_object(the_repository->objects, oid, &type, &size);
@@ -485,6 +548,12 @@ static void show_filemodify(struct diff_queue_struct *q,
 		case DIFF_STATUS_TYPE_CHANGED:
 		case DIFF_STATUS_MODIFIED:
 		case DIFF_STATUS_ADDED:
+			/*
+			 * Files stored as manifests are exported as their
+			 * content, so they are ordinary files in the stream.
+			 */
+			if (S_ISMANIFEST(spec->mode))
+				spec->mode = S_IFREG | (spec->mode & 0777);
 			/*
 			 * Links refer to objects in another repositories;
 			 * output the SHA-1 verbatim.
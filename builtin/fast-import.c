@@ -29,6 +29,8 @@
 #include "commit-reach.h"
 #include "khash.h"
 #include "date.h"
+#include "manifest.h"
+#include "manifest-walk.h"
 
 #define PACK_ID_BITS 16
 #define MAX_PACK_ID ((1<<PACK_ID_BITS)-1)
@@ -222,6 +224,16 @@ static struct last_object last_blob = {
 	.data = STRBUF_INIT,
  };
 
+/* File content in a bench repository is stored as manifests of chunks */
+static int store_manifests;
+static unsigned long chunk_size = 1024 * 1024;
+static int content_defined_chunks;
+static struct {
+	struct object_id *oid;
+	unsigned long *size;
+	size_t nr, oid_alloc, size_alloc;
+} chunks;
+
 /* Tree management */
 static unsigned int tree_entry_alloc = 1000;
 static void *avail_tree_entry;
@@ -2036,12 +2048,189 @@ static void parse_and_store_blob(
 	}
 }
 
+static void add_chunk(struct strbuf *dat, struct last_object *last)
+{
+	ALLOC_GROW(chunks.oid, chunks.nr + 1, chunks.oid_alloc);
+	ALLOC_GROW(chunks.size, chunks.nr + 1, chunks.size_alloc);
+	chunks.size[chunks.nr] = dat->len;
+	store_object(OBJ_BLOB, dat, last, &chunks.oid[chunks.nr], 0);
+	chunks.nr++;
+}
+
+static int store_manifest_buffer(struct strbuf *buf, struct object_id *oid,
+				 void *data UNUSED)
+{
+	store_object(OBJ_MANIFEST, buf, NULL, oid, 0);
+	return 0;
+}
+
+static void store_chunk_manifest(uintmax_t len,
+				 const struct object_id *content_oid,
+				 struct object_id *oidout, uintmax_t mark)
+{
+	struct object_id oid;
+
+	if (len != (unsigned long)len)
+		die("data is too large to store as a manifest");
+	if (build_manifest(the_repository, &oid, len, content_oid,
+			   chunks.nr, chunks.oid, chunks.size,
+			   store_manifest_buffer, NULL) < 0)
+		die("cannot create manifest");
+	chunks.nr = 0;
+
+	if (oidout)
+		oidcpy(oidout, &oid);
+	if (mark)
+		insert_mark(&marks, mark, find_object(&oid));
+}
+
+/*
+ * Store data held in memory as a manifest. Only data that fits in a
+ * chunk is held in memory (see parse_and_store_file()); it becomes a
+ * single chunk, as "git add" does, and may be deltified against the
+ * previous blob.
+ */
+static void store_file_manifest(struct strbuf *dat, struct last_object *last,
+				struct object_id *oidout, uintmax_t mark)
+{
+	struct object_id content_oid;
+
+	add_chunk(dat, last);
+	oidcpy(&content_oid, &chunks.oid[0]);
+	store_chunk_manifest(dat->len, &content_oid, oidout, mark);
+}
+
+/*
+ * With --content-defined-chunks, chunks end where a gear hash of the
+ * last 64 bytes has its top bits clear, so that after an insertion
+ * the chunk boundaries fall back into step with the old version and
+ * the chunks after it are shared. Chunks are between a quarter and
+ * four times chunk_size long, and about chunk_size long on average.
+ */
+static uint64_t gear[256];
+
+static void init_gear(void)
+{
+	uint64_t x = 0x6a09e667f3bcc908;	/* any fixed seed will do */
+	int i;
+
+	/* splitmix64, so that every platform cuts at the same places */
+	for (i = 0; i < 256; i++) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15);
+
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+static size_t content_defined_cut(const unsigned char *buf, size_t len)
+{
+	size_t min = chunk_size / 4, i;
+	uint64_t mask = 0, h = 0;
+	int bits = 0;
+
+	if (len <= min)
+		return len;
+	while ((2UL << bits) <= chunk_size - min)
+		bits++;
+	if (bits)
+		mask = ~(uint64_t)0 << (64 - bits);
+
+	for (i = min > 64 ? min - 64 : 0; i < len; i++) {
+		h = (h << 1) + gear[buf[i]];
+		if (i + 1 >= min && !(h & mask))
+			return i + 1;
+	}
+	return len;
+}
+
+/*
+ * Store "len" bytes from the input as a manifest, one chunk at a time,
+ * so that only a single chunk is ever held in memory. Chunks that are
+ * already known (in our packs or the repository) are not written again.
+ */
+static void stream_file_manifest(uintmax_t len, struct object_id *oidout,
+				 uintmax_t mark)
+{
+	static struct strbuf chunk = STRBUF_INIT, rest = STRBUF_INIT;
+	struct object_id content_oid;
+	struct git_hash_ctx c;
+	char hdr[96];
+	int hdrlen;
+	uintmax_t remaining = len;
+	size_t max = content_defined_chunks ?
+		st_mult(chunk_size, 4) : chunk_size;
+
+	hdrlen = format_object_header(hdr, sizeof(hdr), OBJ_BLOB, len);
+	the_hash_algo->init_fn(&c);
+	git_hash_update(&c, hdr, hdrlen);
+
+	strbuf_reset(&chunk);
+	while (remaining || chunk.len) {
+		size_t n;
+
+		while (chunk.len < max && remaining) {
+			size_t want = max - chunk.len, got;
+
+			if (want > remaining)
+				want = remaining;
+			got = strbuf_fread(&chunk, want, stdin);
+			if (!got && feof(stdin))
+				die("EOF in data (%" PRIuMAX " bytes remaining)",
+				    remaining);
+			git_hash_update(&c, chunk.buf + chunk.len - got, got);
+			remaining -= got;
+		}
+
+		n = content_defined_chunks ?
+			content_defined_cut((unsigned char *)chunk.buf, chunk.len) :
+			chunk.len;
+		strbuf_reset(&rest);
+		strbuf_add(&rest, chunk.buf + n, chunk.len - n);
+		strbuf_setlen(&chunk, n);
+		add_chunk(&chunk, NULL);
+		strbuf_swap(&chunk, &rest);
+	}
+	git_hash_final_oid(&content_oid, &c);
+
+	store_chunk_manifest(len, &content_oid, oidout, mark);
+}
+
+/*
+ * Like parse_and_store_blob(), but for the content of a regular file,
+ * which a bench repository stores as a manifest.
+ */
+static void parse_and_store_file(
+	struct last_object *last,
+	struct object_id *oidout,
+	uintmax_t mark)
+{
+	static struct strbuf buf = STRBUF_INIT;
+	uintmax_t limit = repo_settings_get_big_file_threshold(the_repository);
+	uintmax_t len;
+
+	if (!store_manifests) {
+		parse_and_store_blob(last, oidout, mark);
+		return;
+	}
+
+	if (!limit || limit > chunk_size)
+		limit = chunk_size;
+	if (parse_data(&buf, limit, &len))
+		store_file_manifest(&buf, last, oidout, mark);
+	else {
+		stream_file_manifest(len, oidout, mark);
+		skip_optional_lf();
+	}
+}
+
 static void parse_new_blob(void)
 {
 	read_next_command();
 	parse_mark();
 	parse_original_identifier();
-	parse_and_store_blob(&last_blob, NULL, next_mark);
+	parse_and_store_file(&last_blob, NULL, next_mark);
 }
 
 static void unload_one_branch(void)
@@ -2352,6 +2541,8 @@ static void file_change_m(const char *p, struct branch *b)
 		mode |= S_IFREG;
 	case S_IFREG | 0644:
 	case S_IFREG | 0755:
+	case S_IFMANIFEST | 0644:
+	case S_IFMANIFEST | 0755:
 	case S_IFLNK:
 	case S_IFDIR:
 	case S_IFGITLINK:
@@ -2407,14 +2598,20 @@ static void file_change_m(const char *p, struct branch *b)
 			const char *v;
 			if (skip_prefix(command_buf.buf, "cat-blob ", &v))
 				parse_cat_blob(v);
-			else {
+			else if (S_ISLNK(mode)) {
 				parse_and_store_blob(&last_blob, &oid, 0);
 				break;
+			} else {
+				parse_and_store_file(&last_blob, &oid, 0);
+				if (store_manifests)
+					mode = S_IFMANIFEST | (mode & 0777);
+				break;
 			}
 		}
 	} else {
-		enum object_type expected = S_ISDIR(mode) ?
-						OBJ_TREE: OBJ_BLOB;
+		enum object_type expected = S_ISDIR(mode) ? OBJ_TREE :
+					    S_ISMANIFEST(mode) ? OBJ_MANIFEST :
+					    OBJ_BLOB;
 		enum object_type type = oe ? oe->type :
 					odb_read_object_info(the_repository->objects,
 							     &oid, NULL);
@@ -2422,6 +2619,11 @@ static void file_change_m(const char *p, struct branch *b)
 			die("%s not found: %s",
 					S_ISDIR(mode) ?  "Tree" : "Blob",
 					command_buf.buf);
+		/* file content from a "blob" command is a manifest here */
+		if (type == OBJ_MANIFEST && S_ISREG(mode)) {
+			mode = S_IFMANIFEST | (mode & 0777);
+			expected = OBJ_MANIFEST;
+		}
 		if (type != expected)
 			die("Not a %s (actually a %s): %s",
 				type_name(expected), type_name(type),
@@ -2991,6 +3193,55 @@ static void cat_blob_write(const char *buf, unsigned long size)
 		die_errno("Write to frontend failed");
 }
 
+static void *read_object_for_cat(const struct object_id *oid,
+				 enum object_type *type, unsigned long *size)
+{
+	struct object_entry *oe = find_object((struct object_id *)oid);
+
+	if (!oe || oe->pack_id == MAX_PACK_ID)
+		return odb_read_object(the_repository->objects, oid, type, size);
+	*type = oe->type;
+	return gfi_unpack_entry(oe, size);
+}
+
+/*
+ * Write out the content of a manifest chunk by chunk. The chunks may
+ * well be in the pack we are writing, which the streaming interface of
+ * manifest.h cannot see yet.
+ */
+static void cat_manifest_content(const struct object_id *oid,
+				 const char *buf, unsigned long size)
+{
+	struct manifest_header header;
+	struct manifest_desc desc;
+	size_t nr = 0;
+
+	if (parse_manifest_header_gently(buf, size, &header, NULL) < 0)
+		die("Corrupt manifest %s", oid_to_hex(oid));
+	init_manifest_desc(&desc, header.version, header.chunk_data,
+			   header.chunk_data_len, the_hash_algo);
+	while (manifest_entry(&desc)) {
+		enum object_type type;
+		unsigned long entry_size;
+		char *entry = read_object_for_cat(&desc.entry_oid, &type,
+						  &entry_size);
+
+		if (!entry)
+			die("Can't read object %s", oid_to_hex(&desc.entry_oid));
+		if (type == OBJ_MANIFEST)
+			cat_manifest_content(&desc.entry_oid, entry, entry_size);
+		else if (type == OBJ_BLOB)
+			cat_blob_write(entry, entry_size);
+		else
+			die("Manifest %s lists a %s", oid_to_hex(oid),
+			    type_name(type));
+		free(entry);
+		nr++;
+	}
+	if (nr != header.chunk_count)
+		die("Corrupt manifest %s", oid_to_hex(oid));
+}
+
 static void cat_blob(struct object_entry *oe, struct object_id *oid)
 {
 	struct strbuf line = STRBUF_INIT;
@@ -3018,6 +3269,22 @@ static void cat_blob(struct object_entry *oe, struct object_id *oid)
 	}
 	if (!buf)
 		die("Can't read object %s", oid_to_hex(oid));
+	if (type == OBJ_MANIFEST) {
+		struct manifest_header header;
+
+		if (parse_manifest_header_gently(buf, size, &header, NULL) < 0)
+			die("Corrupt manifest %s", oid_to_hex(oid));
+		/* frontends ask for file content; a manifest is one */
+		strbuf_reset(&line);
+		strbuf_addf(&line, "%s %s %"PRIuMAX"\n", oid_to_hex(oid),
+			    type_name(OBJ_BLOB), (uintmax_t)header.total_size);
+		cat_blob_write(line.buf, line.len);
+		strbuf_release(&line);
+		cat_manifest_content(oid, buf, size);
+		cat_blob_write("\n", 1);
+		free(buf);
+		return;
+	}
 	if (type != OBJ_BLOB)
 		die("Object %s is a %s but a blob was expected.",
 		    oid_to_hex(oid), type_name(type));
@@ -3197,6 +3464,7 @@ static void print_ls(int mode, const unsigned char *hash, const char *path)
 	const char *type =
 		S_ISGITLINK(mode) ? commit_type :
 		S_ISDIR(mode) ? tree_type :
+		S_ISMANIFEST(mode) ? manifest_type :
 		blob_type;
 
 	if (!mode) {
@@ -3426,6 +3694,14 @@ static int parse_one_option(const char *option)
 		if (!git_parse_ulong(option, &v))
 			return 0;
 		repo_settings_set_big_file_threshold(the_repository, v);
+	} else if (skip_prefix(option, "chunk-size=", &option)) {
+		unsigned long v;
+		if (!git_parse_ulong(option, &v) || !v)
+			return 0;
+		chunk_size = v;
+	} else if (!strcmp(option, "content-defined-chunks")) {
+		content_defined_chunks = 1;
+		init_gear();
 	} else if (skip_prefix(option, "depth=", &option)) {
 		option_depth(option);
 	} else if (skip_prefix(option, "active-branches=", &option)) {
@@ -3593,6 +3869,7 @@ int cmd_fast_import(int argc,
 
 	reset_pack_idx_option(&pack_idx_opts);
 	git_pack_config();
+	store_manifests = repo_has_bench_extensions(the_repository);
 
 	alloc_objects(object_entry_alloc);
 	strbuf_init(&command_buf, 0);
@@ -3698,6 +3975,8 @@ int cmd_fast_import(int argc,
 		fprintf(stderr, "      trees  :   %10" PRIuMAX " (%10" PRIuMAX " duplicates %10" PRIuMAX " deltas of %10" PRIuMAX" attempts)\n", object_count_by_type[OBJ_TREE], duplicate_count_by_type[OBJ_TREE], delta_count_by_type[OBJ_TREE], delta_count_attempts_by_type[OBJ_TREE]);
 		fprintf(stderr, "      commits:   %10" PRIuMAX " (%10" PRIuMAX " duplicates %10" PRIuMAX " deltas of %10" PRIuMAX" attempts)\n", object_count_by_type[OBJ_COMMIT], duplicate_count_by_type[OBJ_COMMIT], delta_count_by_type[OBJ_COMMIT], delta_count_attempts_by_type[OBJ_COMMIT]);
 		fprintf(stderr, "      tags   :   %10" PRIuMAX " (%10" PRIuMAX " duplicates %10" PRIuMAX " deltas of %10" PRIuMAX" attempts)\n", object_count_by_type[OBJ_TAG], duplicate_count_by_type[OBJ_TAG], delta_count_by_type[OBJ_TAG], delta_count_attempts_by_type[OBJ_TAG]);
+		if (store_manifests)
+			fprintf(stderr, "      manifests: %10" PRIuMAX " (%10" PRIuMAX " duplicates                  )\n", object_count_by_type[OBJ_MANIFEST], duplicate_count_by_type[OBJ_MANIFEST]);
 		fprintf(stderr, "Total branches:  %10lu (%10lu loads     )\n", branch_count, branch_load_count);
 		fprintf(stderr, "      marks:     %10" PRIuMAX " (%10" PRIuMAX " unique    )\n", (((uintmax_t)1) << marks->shift) * 1024, marks_set_count);
 		fprintf(stderr, "      atoms:     %10u\n", atom_cnt);
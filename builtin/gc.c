@@ -488,7 +488,7 @@ static struct packed_git *find_base_packs(struct string_list *packs,
 	struct packed_git *p, *base = NULL;
 
 	for (p = get_all_packs(the_repository); p; p = p->next) {
-		if (!p->pack_local || p->is_cruft)
+		if (!p->pack_local || p->is_cruft || p->pack_chunks)
 			continue;
 		if (limit) {
 			if (p->pack_size >= limit)
@@ -517,6 +517,9 @@ static int too_many_packs(struct gc_config *cfg)
 			continue;
 		if (p->pack_keep)
 			continue;
+		/* chunk packs are rolled up on their own schedule */
+		if (p->pack_chunks)
+			continue;
 		/*
 		 * Perhaps check the size of the pack and count only
 		 * very small ones here?
@@ -27,11 +27,16 @@
 #include "object-file.h"
 #include "object-name.h"
 #include "odb.h"
+#include "oid-array.h"
+#include "manifest.h"
 #include "packfile.h"
 #include "pager.h"
 #include "path.h"
 #include "read-cache-ll.h"
+#include "streaming.h"
+#include "userdiff.h"
 #include "write-or-die.h"
+#include "xdiff-interface.h"
 
 static const char *grep_prefix;
 
@@ -46,12 +51,46 @@ static int num_threads;
 
 static pthread_t *threads;
 
+/*
+ * The content of a manifest is grepped in segments, each a run of
+ * consecutive chunks, so that the chunks of one large file can be
+ * scanned by several consumer threads and no thread ever holds more
+ * than a single chunk, and the line that crosses into it, in memory.
+ */
+#define MANIFEST_GREP_SEGMENT_CHUNKS 16
+
+/*
+ * A line that crosses from one segment into the next belongs to the
+ * earlier segment, which reads on into the following chunks until the
+ * line ends. The later segment skips up to its first newline. Only
+ * the head of the first chunk is read to tell whether a file is binary.
+ */
+#define MANIFEST_GREP_BINARY_HEAD (8 * 1024)
+
+struct manifest_grep {
+	struct oid_array chunks;
+	/* Copy of the path's driver, with "binary" already resolved. */
+	struct userdiff_driver driver;
+	int refcnt;
+	/* Set once a segment matched in a mode that needs only one hit. */
+	int done;
+};
+
+struct manifest_segment {
+	struct manifest_grep *mg;
+	size_t first, end;
+	/* Number of the first line, when the segment starts the file. */
+	unsigned lno;
+};
+
 /* We use one producer thread and THREADS consumer
  * threads. The producer adds struct work_items to 'todo' and the
  * consumers pick work items from the same array.
  */
 struct work_item {
 	struct grep_source source;
+	/* Non-NULL when "source" names a manifest to grep in part. */
+	struct manifest_segment *segment;
 	char done;
 	struct strbuf out;
 };
@@ -103,7 +142,10 @@ static pthread_cond_t cond_result;
 
 static int skip_first_line;
 
-static void add_work(struct grep_opt *opt, struct grep_source *gs)
+static void manifest_segment_free(struct manifest_segment *seg);
+
+static void add_work(struct grep_opt *opt, struct grep_source *gs,
+		     struct manifest_segment *segment)
 {
 	if (opt->binary != GREP_BINARY_TEXT)
 		grep_source_load_driver(gs, opt->repo->index);
@@ -115,6 +157,7 @@ static void add_work(struct grep_opt *opt, struct grep_source *gs)
 	}
 
 	todo[todo_end].source = *gs;
+	todo[todo_end].segment = segment;
 	todo[todo_end].done = 0;
 	strbuf_reset(&todo[todo_end].out);
 	todo_end = (todo_end + 1) % ARRAY_SIZE(todo);
@@ -193,6 +236,10 @@ static void free_repos(void)
 	repos_to_free_alloc = 0;
 }
 
+static int grep_manifest_segment(struct grep_opt *opt,
+				 struct grep_source *gs,
+				 struct manifest_segment *seg);
+
 static void *run(void *arg)
 {
 	int hit = 0;
@@ -204,7 +251,14 @@ static void *run(void *arg)
 			break;
 
 		opt->output_priv = w;
-		hit |= grep_source(opt, &w->source);
+		if (w->segment) {
+			hit |= grep_manifest_segment(opt, &w->source,
+						     w->segment);
+			manifest_segment_free(w->segment);
+			w->segment = NULL;
+		} else {
+			hit |= grep_source(opt, &w->source);
+		}
 		grep_source_clear_data(&w->source);
 		work_done(w);
 	}
@@ -370,7 +424,7 @@ static int grep_oid(struct grep_opt *opt, const struct object_id *oid,
 		 * add_work() copies gs and thus assumes ownership of
 		 * its fields, so do not call grep_source_clear()
 		 */
-		add_work(opt, &gs);
+		add_work(opt, &gs, NULL);
 		return 0;
 	} else {
 		int hit;
@@ -396,7 +450,7 @@ static int grep_file(struct grep_opt *opt, const char *filename)
 		 * add_work() copies gs and thus assumes ownership of
 		 * its fields, so do not call grep_source_clear()
 		 */
-		add_work(opt, &gs);
+		add_work(opt, &gs, NULL);
 		return 0;
 	} else {
 		int hit;
@@ -408,6 +462,329 @@ static int grep_file(struct grep_opt *opt, const char *filename)
 	}
 }
 
+static void manifest_grep_lock(void)
+{
+	if (num_threads > 1)
+		grep_lock();
+}
+
+static void manifest_grep_unlock(void)
+{
+	if (num_threads > 1)
+		grep_unlock();
+}
+
+static void manifest_grep_unref(struct manifest_grep *mg)
+{
+	int last;
+
+	manifest_grep_lock();
+	last = !--mg->refcnt;
+	manifest_grep_unlock();
+
+	if (last) {
+		oid_array_clear(&mg->chunks);
+		free(mg);
+	}
+}
+
+static void manifest_segment_free(struct manifest_segment *seg)
+{
+	if (!seg)
+		return;
+	manifest_grep_unref(seg->mg);
+	free(seg);
+}
+
+static int manifest_grep_done(struct manifest_grep *mg)
+{
+	int done;
+
+	manifest_grep_lock();
+	done = mg->done;
+	manifest_grep_unlock();
+	return done;
+}
+
+/*
+ * Whether a manifest can be grepped a few chunks at a time, rather
+ * than by loading its full logical content: the output for a line must
+ * not depend on the lines around it, so no context, function headers
+ * or whole-file matching.
+ */
+static int manifest_grep_streamable(const struct grep_opt *opt)
+{
+	return !opt->unmatch_name_only &&
+	       !opt->pre_context && !opt->post_context &&
+	       !opt->funcname && !opt->funcbody &&
+	       !opt->all_match && !opt->no_body_match &&
+	       !opt->allow_textconv && !opt->file_break && !opt->heading &&
+	       opt->max_count < 0;
+}
+
+/*
+ * Line numbers and counts depend on everything before a line, so with
+ * those the chunks are streamed in order by a single segment.
+ */
+static int manifest_grep_segmentable(const struct grep_opt *opt)
+{
+	return manifest_grep_streamable(opt) && !opt->linenum && !opt->count;
+}
+
+/* Read up to "max" bytes from the start of a chunk. */
+static int read_chunk_head(struct repository *r, const struct object_id *oid,
+			   struct strbuf *out, size_t max)
+{
+	struct git_istream *st;
+	enum object_type type;
+	unsigned long size;
+	ssize_t readlen = 0;
+
+	obj_read_lock();
+	st = open_istream(r, oid, &type, &size, NULL);
+	if (!st) {
+		obj_read_unlock();
+		return error(_("unable to read chunk %s"), oid_to_hex(oid));
+	}
+	strbuf_grow(out, max);
+	while (out->len < max) {
+		readlen = read_istream(st, out->buf + out->len, max - out->len);
+		if (readlen <= 0)
+			break;
+		strbuf_setlen(out, out->len + readlen);
+	}
+	close_istream(st);
+	obj_read_unlock();
+	return readlen < 0 ? -1 : 0;
+}
+
+static int grep_manifest_window(struct grep_opt *opt, struct grep_source *gs,
+				struct manifest_grep *mg,
+				const char *buf, size_t len,
+				unsigned lno, unsigned *count)
+{
+	struct grep_source window;
+	int status_only = opt->status_only;
+	int hit, first;
+
+	grep_source_init_buf(&window, buf, len);
+	window.name = gs->name;
+	window.driver = &mg->driver;
+	window.lno_offset = lno - 1;
+	window.count = count;
+
+	/*
+	 * "-l", "-q" and "Binary file matches" report a file once, however
+	 * many of its segments match. The first segment to hit prints the
+	 * result and the others stop scanning.
+	 */
+	if (!opt->status_only && !opt->name_only &&
+	    !(mg->driver.binary && opt->binary == GREP_BINARY_DEFAULT &&
+	      !opt->count))
+		return grep_source(opt, &window);
+
+	opt->status_only = 1;
+	hit = grep_source(opt, &window);
+	opt->status_only = status_only;
+	if (!hit)
+		return 0;
+
+	manifest_grep_lock();
+	first = !mg->done;
+	mg->done = 1;
+	manifest_grep_unlock();
+
+	if (first && !opt->status_only)
+		grep_source(opt, &window);
+	return 1;
+}
+
+static unsigned count_lines(const char *buf, size_t len)
+{
+	const char *end = buf + len, *nl;
+	unsigned nr = 0;
+
+	for (; (nl = memchr(buf, '\n', end - buf)); buf = nl + 1)
+		nr++;
+	return nr;
+}
+
+static int grep_manifest_segment(struct grep_opt *opt, struct grep_source *gs,
+				 struct manifest_segment *seg)
+{
+	struct manifest_grep *mg = seg->mg;
+	struct strbuf carry = STRBUF_INIT;
+	unsigned lno = seg->lno, count = 0;
+	int skip = seg->first > 0;
+	size_t i;
+	int hit = 0;
+
+	for (i = seg->first; i < mg->chunks.nr; i++) {
+		const struct object_id *oid = &mg->chunks.oid[i];
+		enum object_type type;
+		unsigned long size;
+		const char *p, *eol;
+		size_t len, n;
+		char *chunk;
+
+		/*
+		 * Past our last chunk, only the line we are in the middle
+		 * of is ours; if we start in a line that runs through all
+		 * our chunks, an earlier segment has it.
+		 */
+		if (manifest_grep_done(mg) || (i >= seg->end && skip))
+			break;
+
+		chunk = odb_read_object(opt->repo->objects, oid, &type, &size);
+		if (!chunk || type != OBJ_BLOB) {
+			free(chunk);
+			error(_("'%s': unable to read chunk %s"),
+			      gs->name, oid_to_hex(oid));
+			break;
+		}
+		p = chunk;
+		len = size;
+
+		/* The line we start in belongs to the previous segment. */
+		if (skip) {
+			eol = memchr(p, '\n', len);
+			n = eol ? eol - p + 1 : len;
+			p += n;
+			len -= n;
+			skip = !eol;
+		}
+
+		/*
+		 * Complete the line carried over from the previous chunk,
+		 * or past our last chunk the line that crosses into the
+		 * next segment, however long it is.
+		 */
+		if (carry.len || i >= seg->end) {
+			eol = memchr(p, '\n', len);
+			n = eol ? eol - p + 1 : len;
+			strbuf_add(&carry, p, n);
+			p += n;
+			len -= n;
+			if (eol) {
+				hit |= grep_manifest_window(opt, gs, mg,
+							    carry.buf, carry.len,
+							    lno++, &count);
+				strbuf_reset(&carry);
+			}
+			if (i >= seg->end && eol) {
+				free(chunk);
+				break;
+			}
+		}
+
+		for (n = len; n && p[n - 1] != '\n'; n--)
+			; /* find the end of the last complete line */
+		if (n) {
+			hit |= grep_manifest_window(opt, gs, mg, p, n,
+						    lno, &count);
+			if (opt->linenum)
+				lno += count_lines(p, n);
+		}
+		strbuf_add(&carry, p + n, len - n);
+		free(chunk);
+	}
+
+	/* the last line of the file has no newline */
+	if (carry.len && !manifest_grep_done(mg))
+		hit |= grep_manifest_window(opt, gs, mg, carry.buf, carry.len,
+					    lno, &count);
+	if (opt->count && count) {
+		grep_show_count(opt, gs->name, count);
+		hit = 1;
+	}
+
+	strbuf_release(&carry);
+	return hit;
+}
+
+static int grep_manifest(struct grep_opt *opt, const struct object_id *oid,
+			 const char *filename, int tree_name_len,
+			 const char *path)
+{
+	struct strbuf pathbuf = STRBUF_INIT;
+	struct manifest_grep *mg;
+	struct grep_source gs;
+	size_t first, step;
+	int hit = 0;
+
+	if (!manifest_grep_streamable(opt))
+		return grep_oid(opt, oid, filename, tree_name_len, path);
+
+	CALLOC_ARRAY(mg, 1);
+	if (get_manifest_chunk_oids(opt->repo, oid, NULL, &mg->chunks) < 0) {
+		free(mg);
+		return error(_("'%s': unable to read manifest %s"),
+			     filename, oid_to_hex(oid));
+	}
+
+	grep_source_name(opt, filename, tree_name_len, &pathbuf);
+	grep_source_init_oid(&gs, pathbuf.buf, path, oid, opt->repo);
+	strbuf_release(&pathbuf);
+
+	grep_source_load_driver(&gs, opt->repo->index);
+	mg->driver = *gs.driver;
+	if (opt->binary == GREP_BINARY_TEXT) {
+		mg->driver.binary = 0;
+	} else if (mg->driver.binary == -1) {
+		struct strbuf head = STRBUF_INIT;
+
+		mg->driver.binary = mg->chunks.nr &&
+			!read_chunk_head(opt->repo, &mg->chunks.oid[0], &head,
+					 MANIFEST_GREP_BINARY_HEAD) &&
+			buffer_is_binary(head.buf, head.len);
+		strbuf_release(&head);
+	}
+	mg->refcnt = 1;
+
+	if (mg->driver.binary && opt->binary == GREP_BINARY_NOMATCH)
+		first = mg->chunks.nr; /* assume unmatch */
+	else
+		first = 0;
+
+	step = manifest_grep_segmentable(opt) ?
+		MANIFEST_GREP_SEGMENT_CHUNKS : mg->chunks.nr;
+	for (; first < mg->chunks.nr; first += step) {
+		struct manifest_segment *seg = xcalloc(1, sizeof(*seg));
+
+		seg->mg = mg;
+		seg->first = first;
+		seg->end = first + step;
+		seg->lno = 1;
+		if (seg->end > mg->chunks.nr)
+			seg->end = mg->chunks.nr;
+		manifest_grep_lock();
+		mg->refcnt++;
+		manifest_grep_unlock();
+
+		if (num_threads > 1) {
+			struct grep_source copy;
+
+			/*
+			 * add_work() copies the source and assumes ownership
+			 * of its fields, so give each segment its own.
+			 */
+			grep_source_init_oid(&copy, gs.name, gs.path, oid,
+					     opt->repo);
+			copy.driver = gs.driver;
+			add_work(opt, &copy, seg);
+		} else {
+			hit |= grep_manifest_segment(opt, &gs, seg);
+			manifest_segment_free(seg);
+			if (manifest_grep_done(mg))
+				break;
+		}
+	}
+
+	grep_source_clear(&gs);
+	manifest_grep_unref(mg);
+	return hit;
+}
+
 static void append_path(struct grep_opt *opt, const void *data, size_t len)
 {
 	struct string_list *path_list = opt->output_priv;
@@ -581,7 +958,7 @@ static int grep_cache(struct grep_opt *opt,
 			strbuf_setlen(&name, name_base_len);
 			strbuf_addstr(&name, ce->name);
 			free(data);
-		} else if (S_ISREG(ce->ce_mode) &&
+		} else if ((S_ISREG(ce->ce_mode) || S_ISMANIFEST(ce->ce_mode)) &&
 		    match_pathspec(repo->index, pathspec, name.buf, name.len, 0, NULL,
 				   S_ISDIR(ce->ce_mode) ||
 				   S_ISGITLINK(ce->ce_mode))) {
@@ -593,8 +970,13 @@ static int grep_cache(struct grep_opt *opt,
 			if (cached || (ce->ce_flags & CE_VALID)) {
 				if (ce_stage(ce) || ce_intent_to_add(ce))
 					continue;
-				hit |= grep_oid(opt, &ce->oid, name.buf,
-						 0, name.buf);
+				if (S_ISMANIFEST(ce->ce_mode))
+					hit |= grep_manifest(opt, &ce->oid,
+							     name.buf, 0,
+							     name.buf);
+				else
+					hit |= grep_oid(opt, &ce->oid, name.buf,
+							 0, name.buf);
 			} else {
 				hit |= grep_file(opt, name.buf);
 			}
@@ -658,6 +1040,9 @@ static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 		if (S_ISREG(entry.mode)) {
 			hit |= grep_oid(opt, &entry.oid, base->buf, tn_len,
 					 check_attr ? base->buf + tn_len : NULL);
+		} else if (S_ISMANIFEST(entry.mode)) {
+			hit |= grep_manifest(opt, &entry.oid, base->buf, tn_len,
+					     check_attr ? base->buf + tn_len : NULL);
 		} else if (S_ISDIR(entry.mode)) {
 			enum object_type type;
 			struct tree_desc sub;
@@ -696,6 +1081,8 @@ static int grep_object(struct grep_opt *opt, const struct pathspec *pathspec,
 {
 	if (obj->type == OBJ_BLOB)
 		return grep_oid(opt, &obj->oid, name, 0, path);
+	if (obj->type == OBJ_MANIFEST)
+		return grep_manifest(opt, &obj->oid, name, 0, path);
 	if (obj->type == OBJ_COMMIT || obj->type == OBJ_TREE) {
 		struct tree_desc tree;
 		void *data;
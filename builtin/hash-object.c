@@ -7,7 +7,9 @@
 #define USE_THE_REPOSITORY_VARIABLE
 #include "builtin.h"
 #include "abspath.h"
+#include "bulk-checkin.h"
 #include "config.h"
+#include "convert.h"
 #include "gettext.h"
 #include "hex.h"
 #include "object-file.h"
@@ -15,7 +17,11 @@
 #include "blob.h"
 #include "quote.h"
 #include "parse-options.h"
+#include "manifest.h"
+#include "repo-settings.h"
+#include "repository.h"
 #include "setup.h"
+#include "thread-utils.h"
 #include "strbuf.h"
 #include "write-or-die.h"
 
@@ -34,12 +40,250 @@ static void hash_fd(int fd, const char *type, const char *path, unsigned flags)
 	maybe_flush_or_die(stdout, "hash to stdout");
 }
 
+/* Store files as "git add" does in a bench repository */
+static int as_manifest;
+
 static void hash_object(const char *path, const char *type, const char *vpath,
 			unsigned flags)
 {
 	int fd;
-	fd = xopen(path, O_RDONLY);
-	hash_fd(fd, type, vpath, flags);
+	struct stat st;
+	struct object_id oid;
+
+	if (!as_manifest) {
+		fd = xopen(path, O_RDONLY);
+		hash_fd(fd, type, vpath, flags);
+		return;
+	}
+
+	if (lstat(path, &st) < 0)
+		die_errno("cannot stat '%s'", path);
+	if (index_path(the_repository->index, &oid, path, &st, flags))
+		die((flags & INDEX_WRITE_OBJECT)
+		    ? "Unable to add %s to database"
+		    : "Unable to hash %s", path);
+	printf("%s\n", oid_to_hex(&oid));
+	maybe_flush_or_die(stdout, "hash to stdout");
+}
+
+/*
+ * With --threads, paths are queued in a window of jobs. Workers take
+ * them in order, and whichever worker completes the oldest job prints
+ * every finished job from there on, so the output keeps the order of
+ * the input and an answer is printed as soon as it is known.
+ */
+struct hash_job {
+	struct strbuf path;
+	struct object_id oid;
+	unsigned done:1;
+};
+
+static struct hash_queue {
+	struct hash_job *jobs;
+	size_t window;
+	size_t nr_read, nr_taken, nr_shown;
+	int input_done;
+
+	enum object_type type;
+	int no_filters;
+	unsigned flags;
+	unsigned long big_file_threshold;
+} queue;
+
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cond_space = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Attribute lookup, filters, streaming into a bulk-checkin pack and
+ * manifest creation are not thread-safe; they happen under this lock.
+ */
+static pthread_mutex_t index_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void index_job(struct hash_job *job)
+{
+	const char *path = job->path.buf;
+	const char *vpath = queue.no_filters ? NULL : path;
+	unsigned flags = queue.flags;
+	struct stat st;
+	size_t size;
+	void *buf;
+	int fd, ret = 0, parallel;
+
+	if (as_manifest ? lstat(path, &st) : stat(path, &st))
+		die_errno("cannot stat '%s'", path);
+
+	/*
+	 * Plain regular files are read, hashed and compressed without
+	 * the lock; anything that needs filtering or would be streamed
+	 * into a pack takes the serial route through index_fd().
+	 */
+	pthread_mutex_lock(&index_mutex);
+	parallel = queue.type == OBJ_BLOB && S_ISREG(st.st_mode) &&
+		   xsize_t(st.st_size) <= queue.big_file_threshold &&
+		   !(vpath && would_convert_to_git(the_repository->index, vpath));
+	if (!parallel) {
+		if (as_manifest)
+			ret = index_path(the_repository->index, &job->oid,
+					 path, &st, flags);
+		else {
+			fd = xopen(path, O_RDONLY);
+			if (fstat(fd, &st) < 0)
+				die_errno("cannot stat '%s'", path);
+			ret = index_fd(the_repository->index, &job->oid, fd,
+				       &st, queue.type, vpath, flags);
+		}
+	}
+	pthread_mutex_unlock(&index_mutex);
+
+	if (parallel) {
+		fd = xopen(path, O_RDONLY);
+		if (fstat(fd, &st) < 0)
+			die_errno("cannot stat '%s'", path);
+		size = xsize_t(st.st_size);
+		buf = size ? xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : (void *)"";
+		close(fd);
+
+		if (flags & INDEX_WRITE_OBJECT)
+			ret = write_object_file(buf, size, OBJ_BLOB, &job->oid);
+		else
+			hash_object_file(the_hash_algo, buf, size, OBJ_BLOB,
+					 &job->oid);
+		if (size)
+			munmap(buf, size);
+
+		/* the single chunk of a manifest is the content itself */
+		if (!ret && as_manifest) {
+			struct object_id chunk_oid = job->oid;
+
+			pthread_mutex_lock(&index_mutex);
+			if (flags & INDEX_WRITE_OBJECT)
+				ret = write_manifest_object(the_repository, &job->oid,
+							    size, &chunk_oid, 1, &chunk_oid, NULL);
+			else
+				ret = hash_manifest_object(the_repository, &job->oid,
+							   size, &chunk_oid, 1, &chunk_oid, NULL);
+			pthread_mutex_unlock(&index_mutex);
+		}
+	}
+
+	if (ret)
+		die((flags & INDEX_WRITE_OBJECT)
+		    ? "Unable to add %s to database"
+		    : "Unable to hash %s", path);
+}
+
+static void *hash_thread(void *data UNUSED)
+{
+	for (;;) {
+		struct hash_job *job;
+
+		pthread_mutex_lock(&queue_mutex);
+		while (queue.nr_taken == queue.nr_read && !queue.input_done)
+			pthread_cond_wait(&cond_work, &queue_mutex);
+		if (queue.nr_taken == queue.nr_read) {
+			pthread_mutex_unlock(&queue_mutex);
+			return NULL;
+		}
+		job = &queue.jobs[queue.nr_taken++ % queue.window];
+		pthread_mutex_unlock(&queue_mutex);
+
+		index_job(job);
+
+		pthread_mutex_lock(&queue_mutex);
+		job->done = 1;
+		while (queue.nr_shown < queue.nr_taken) {
+			struct hash_job *next = &queue.jobs[queue.nr_shown % queue.window];
+
+			if (!next->done)
+				break;
+			printf("%s\n", oid_to_hex(&next->oid));
+			next->done = 0;
+			queue.nr_shown++;
+		}
+		maybe_flush_or_die(stdout, "hash to stdout");
+		pthread_cond_signal(&cond_space);
+		pthread_mutex_unlock(&queue_mutex);
+	}
+}
+
+static void hash_stdin_paths_threaded(const char *type, int no_filters,
+				      unsigned flags, size_t nr_threads)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct strbuf unquoted = STRBUF_INIT;
+	pthread_t *threads;
+	size_t i;
+
+	queue.type = type_from_string(type);
+	queue.no_filters = no_filters;
+	queue.flags = flags;
+	queue.big_file_threshold =
+		repo_settings_get_big_file_threshold(the_repository);
+	queue.window = st_mult(nr_threads, 4);
+	CALLOC_ARRAY(queue.jobs, queue.window);
+	for (i = 0; i < queue.window; i++)
+		strbuf_init(&queue.jobs[i].path, 0);
+
+	/*
+	 * Share one transaction, so the objects are synced only once.
+	 * Writing a loose object would set up the temporary object
+	 * directory for that lazily, which is not safe with threads.
+	 */
+	if (flags & INDEX_WRITE_OBJECT) {
+		begin_odb_transaction();
+		if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT))
+			prepare_loose_object_bulk_checkin();
+	}
+	prepare_repo_settings(the_repository);
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL, hash_thread, NULL);
+		if (err)
+			die(_("hash-object: unable to create thread: %s"),
+			    strerror(err));
+	}
+
+	while (strbuf_getline(&buf, stdin) != EOF) {
+		struct hash_job *job;
+
+		if (buf.buf[0] == '"') {
+			strbuf_reset(&unquoted);
+			if (unquote_c_style(&unquoted, buf.buf, NULL))
+				die("line is badly quoted");
+			strbuf_swap(&buf, &unquoted);
+		}
+
+		pthread_mutex_lock(&queue_mutex);
+		while (queue.nr_read - queue.nr_shown == queue.window)
+			pthread_cond_wait(&cond_space, &queue_mutex);
+		job = &queue.jobs[queue.nr_read % queue.window];
+		strbuf_swap(&job->path, &buf);
+		queue.nr_read++;
+		pthread_cond_signal(&cond_work);
+		pthread_mutex_unlock(&queue_mutex);
+	}
+
+	pthread_mutex_lock(&queue_mutex);
+	queue.input_done = 1;
+	pthread_cond_broadcast(&cond_work);
+	pthread_mutex_unlock(&queue_mutex);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	disable_obj_read_lock();
+	if (flags & INDEX_WRITE_OBJECT)
+		end_odb_transaction();
+
+	for (i = 0; i < queue.window; i++)
+		strbuf_release(&queue.jobs[i].path);
+	free(queue.jobs);
+	strbuf_release(&buf);
+	strbuf_release(&unquoted);
 }
 
 static void hash_stdin_paths(const char *type, int no_filters, unsigned flags)
@@ -68,7 +312,9 @@ int cmd_hash_object(int argc,
 	static const char * const hash_object_usage[] = {
 		N_("git hash-object [-t <type>] [-w] [--path=<file> | --no-filters]\n"
 		   "                [--stdin [--literally]] [--] <file>..."),
-		N_("git hash-object [-t <type>] [-w] --stdin-paths [--no-filters]"),
+		N_("git hash-object [-t <type>] [-w] --stdin-paths [--no-filters]\n"
+		   "                [--threads=<n>]"),
+		N_("git hash-object [-w] --manifest [--stdin-paths [--threads=<n>]] [--] <file>..."),
 		NULL
 	};
 	const char *type = blob_type;
@@ -76,6 +322,7 @@ int cmd_hash_object(int argc,
 	int stdin_paths = 0;
 	int no_filters = 0;
 	int nongit = 0;
+	int nr_threads = 1;
 	unsigned flags = INDEX_FORMAT_CHECK;
 	const char *vpath = NULL;
 	char *vpath_free = NULL;
@@ -90,6 +337,10 @@ int cmd_hash_object(int argc,
 			    N_("just hash any random garbage to create corrupt objects for debugging Git"),
 			    INDEX_FORMAT_CHECK),
 		OPT_STRING( 0 , "path", &vpath, N_("file"), N_("process file as it were from this path")),
+		OPT_BOOL(0, "manifest", &as_manifest,
+			 N_("store files as manifests, as 'git add' does in a bench repository")),
+		OPT_INTEGER(0, "threads", &nr_threads,
+			    N_("hash --stdin-paths with <n> threads")),
 		OPT_END()
 	};
 	int i;
@@ -128,6 +379,23 @@ int cmd_hash_object(int argc,
 			errstr = "Can't use --path with --no-filters";
 	}
 
+	if (!errstr && as_manifest) {
+		if (hashstdin)
+			errstr = "Can't use --manifest with --stdin";
+		else if (vpath || no_filters)
+			errstr = "Can't use --manifest with --path or --no-filters";
+		else if (strcmp(type, blob_type))
+			errstr = "Can't use --manifest with -t";
+		else if (nongit || !repo_has_bench_extensions(the_repository))
+			errstr = "--manifest needs a bench repository";
+	}
+	if (!errstr) {
+		if (nr_threads < 0)
+			errstr = "--threads must not be negative";
+		else if (nr_threads != 1 && !stdin_paths)
+			errstr = "--threads only works with --stdin-paths";
+	}
+
 	if (errstr) {
 		error("%s", errstr);
 		usage_with_options(hash_object_usage, hash_object_options);
@@ -147,7 +415,16 @@ int cmd_hash_object(int argc,
 		free(to_free);
 	}
 
-	if (stdin_paths)
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (!HAVE_THREADS && nr_threads > 1) {
+		warning(_("no threads support, ignoring --threads"));
+		nr_threads = 1;
+	}
+
+	if (stdin_paths && nr_threads > 1)
+		hash_stdin_paths_threaded(type, no_filters, flags, nr_threads);
+	else if (stdin_paths)
 		hash_stdin_paths(type, no_filters, flags);
 
 	free(vpath_free);
@@ -8,6 +8,8 @@
 #include "gettext.h"
 #include "hex.h"
 #include "pack.h"
+#include "manifest.h"
+#include "manifest-walk.h"
 #include "csum-file.h"
 #include "blob.h"
 #include "commit.h"
@@ -33,7 +35,7 @@
 #include "strvec.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--[no-]rev-index] [--verify] [--strict[=<msg-id>=<severity>...]] [--fsck-objects[=<msg-id>=<severity>...]] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--[no-]rev-index] [--verify] [--strict[=<msg-id>=<severity>...]] [--fsck-objects[=<msg-id>=<severity>...]] [--check-manifests] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -105,6 +107,8 @@ static size_t base_cache_limit;
 struct thread_local_data {
 	pthread_t thread;
 	int pack_fd;
+	/* the part of manifest_entries checked by this thread */
+	size_t entries_begin, entries_end;
 };
 
 /* Remember to update object flag allocation in object.h */
@@ -163,6 +167,42 @@ static const char *curr_pack;
 static struct oidset outgoing_links = OIDSET_INIT;
 static int record_outgoing_links;
 
+/*
+ * With --check-manifests, the entries of the manifests in the pack are
+ * collected while objects are hashed, and looked up once all objects
+ * are known by check_received_manifests().
+ *
+ * received_manifests and manifest_entries are guarded by read_mutex
+ * while they are collected; check_manifests is read-only in a thread.
+ */
+struct received_manifest {
+	struct object_id oid;
+	unsigned long total_size;
+	int version;
+};
+
+struct received_manifest_entry {
+	struct object_id oid;
+	uint32_t manifest;	/* index in received_manifests */
+	uint32_t nr;		/* position in that manifest */
+	enum object_type type;
+	unsigned long size;	/* as recorded by a version 2 manifest */
+
+	/* what the entry turned out to be, OBJ_BAD if missing */
+	enum object_type found_type;
+	unsigned long found_size;
+};
+
+static int check_manifests;
+static struct received_manifest *received_manifests;
+static size_t nr_received_manifests, received_manifests_alloc;
+static struct received_manifest **sorted_manifests;
+static struct received_manifest_entry *manifest_entries;
+static size_t nr_manifest_entries, manifest_entries_alloc;
+static struct object_entry **sorted_objects;
+/* objects[].size of a delta is that of the delta, not of the result */
+static unsigned long *delta_result_sizes;
+
 static struct thread_local_data *thread_data;
 static int nr_dispatched;
 static int threads_active;
@@ -883,6 +923,49 @@ static void do_record_outgoing_links(struct object *obj)
 	}
 }
 
+static void record_received_manifest(const struct object_id *oid,
+				     const void *data, unsigned long size)
+{
+	struct manifest_header header;
+	struct manifest_desc desc;
+	struct strbuf err = STRBUF_INIT;
+	struct received_manifest *m;
+	uint32_t nr = 0;
+
+	if (parse_manifest_header_gently(data, size, &header, &err))
+		die(_("invalid manifest %s: %s"), oid_to_hex(oid), err.buf);
+
+	read_lock();
+	ALLOC_GROW(received_manifests, nr_received_manifests + 1,
+		   received_manifests_alloc);
+	m = &received_manifests[nr_received_manifests];
+	oidcpy(&m->oid, oid);
+	m->total_size = header.total_size;
+	m->version = header.version;
+
+	init_manifest_desc(&desc, header.version, header.chunk_data,
+			   header.chunk_data_len, the_hash_algo);
+	while (manifest_entry(&desc)) {
+		struct received_manifest_entry *e;
+
+		ALLOC_GROW(manifest_entries, nr_manifest_entries + 1,
+			   manifest_entries_alloc);
+		e = &manifest_entries[nr_manifest_entries++];
+		oidcpy(&e->oid, &desc.entry_oid);
+		e->manifest = nr_received_manifests;
+		e->nr = nr++;
+		e->type = desc.entry_type;
+		e->size = desc.entry_size;
+		e->found_type = OBJ_BAD;
+		e->found_size = 0;
+	}
+	if (desc.size)
+		die(_("invalid manifest %s: entry %"PRIu32" is malformed"),
+		    oid_to_hex(oid), nr);
+	nr_received_manifests++;
+	read_unlock();
+}
+
 static void sha1_object(const void *data, struct object_entry *obj_entry,
 			unsigned long size, enum object_type type,
 			const struct object_id *oid)
@@ -978,6 +1061,11 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 		read_unlock();
 	}
 
+	if (check_manifests && type == OBJ_MANIFEST) {
+		assert(data && "data can only be NULL for large _blobs_");
+		record_received_manifest(oid, data, size);
+	}
+
 	free(new_data);
 }
 
@@ -1072,6 +1160,8 @@ static struct base_data *resolve_delta(struct object_entry *delta_obj,
 		bad_object(delta_obj->idx.offset, _("failed to apply delta"));
 	hash_object_file(the_hash_algo, result_data, result_size,
 			 delta_obj->real_type, &delta_obj->idx.oid);
+	if (delta_result_sizes)
+		delta_result_sizes[delta_obj - objects] = result_size;
 	sha1_object(result_data, NULL, result_size, delta_obj->real_type,
 		    &delta_obj->idx.oid);
 
@@ -1365,6 +1455,201 @@ static void resolve_deltas(struct pack_idx_option *opts)
 	threaded_second_pass(&nothread_data);
 }
 
+static int object_entry_oid_cmp(const void *a_, const void *b_)
+{
+	const struct object_entry *a = *(const struct object_entry **)a_;
+	const struct object_entry *b = *(const struct object_entry **)b_;
+
+	return oidcmp(&a->idx.oid, &b->idx.oid);
+}
+
+static int received_manifest_cmp(const void *a_, const void *b_)
+{
+	const struct received_manifest *a = *(const struct received_manifest **)a_;
+	const struct received_manifest *b = *(const struct received_manifest **)b_;
+
+	return oidcmp(&a->oid, &b->oid);
+}
+
+static int manifest_entry_oid_cmp(const void *a_, const void *b_)
+{
+	const struct received_manifest_entry *a = a_, *b = b_;
+
+	return oidcmp(&a->oid, &b->oid);
+}
+
+static struct received_manifest *find_received_manifest(const struct object_id *oid)
+{
+	size_t lo = 0, hi = nr_received_manifests;
+
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		int cmp = oidcmp(oid, &sorted_manifests[mi]->oid);
+
+		if (!cmp)
+			return sorted_manifests[mi];
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return NULL;
+}
+
+static void find_manifest_entry(struct received_manifest_entry *e,
+				struct object_entry *obj)
+{
+	struct received_manifest *m;
+
+	if (obj && obj->real_type != OBJ_MANIFEST) {
+		e->found_type = obj->real_type;
+		if (is_delta_type(obj->type))
+			e->found_size = delta_result_sizes[obj - objects];
+		else
+			e->found_size = obj->size;
+		return;
+	}
+	/* bases added by --fix-thin were not recorded */
+	if (obj && (m = find_received_manifest(&e->oid))) {
+		e->found_type = OBJ_MANIFEST;
+		e->found_size = m->total_size;
+		return;
+	}
+
+	read_lock();
+	e->found_type = odb_read_object_info(the_repository->objects,
+					     &e->oid, &e->found_size);
+	if (e->found_type == OBJ_MANIFEST &&
+	    get_manifest_size(the_repository, &e->oid, &e->found_size) < 0)
+		e->found_type = OBJ_BAD;
+	read_unlock();
+}
+
+/*
+ * Look up a range of the sorted manifest_entries in the sorted objects
+ * of the pack in a single merge pass, falling back to the object store
+ * for entries the pack does not have.
+ */
+static void *check_manifest_entries(void *data)
+{
+	struct thread_local_data *td = data;
+	size_t i = td->entries_begin, lo = 0, hi = nr_objects;
+
+	if (i >= td->entries_end)
+		return NULL;
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+
+		if (oidcmp(&sorted_objects[mi]->idx.oid,
+			   &manifest_entries[i].oid) < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+
+	for (; i < td->entries_end; i++) {
+		struct received_manifest_entry *e = &manifest_entries[i];
+		int cmp = -1;
+
+		if (i > td->entries_begin && oideq(&e[-1].oid, &e->oid)) {
+			e->found_type = e[-1].found_type;
+			e->found_size = e[-1].found_size;
+			continue;
+		}
+		while (lo < nr_objects &&
+		       (cmp = oidcmp(&sorted_objects[lo]->idx.oid, &e->oid)) < 0)
+			lo++;
+		find_manifest_entry(e, cmp ? NULL : sorted_objects[lo]);
+	}
+	return NULL;
+}
+
+/*
+ * Make sure that every entry of every manifest in the pack is either
+ * in the pack or in the repository, has the type the manifest says,
+ * and that the entry sizes add up to what the manifest records.
+ */
+static void check_received_manifests(void)
+{
+	unsigned long *totals;
+	size_t i, work;
+	int threads = nr_threads;
+
+	if (!nr_received_manifests)
+		return;
+
+	ALLOC_ARRAY(sorted_objects, nr_objects);
+	for (i = 0; i < nr_objects; i++)
+		sorted_objects[i] = &objects[i];
+	QSORT(sorted_objects, nr_objects, object_entry_oid_cmp);
+	ALLOC_ARRAY(sorted_manifests, nr_received_manifests);
+	for (i = 0; i < nr_received_manifests; i++)
+		sorted_manifests[i] = &received_manifests[i];
+	QSORT(sorted_manifests, nr_received_manifests, received_manifest_cmp);
+	QSORT(manifest_entries, nr_manifest_entries, manifest_entry_oid_cmp);
+
+	/* a thread per few thousand entries at most */
+	if (threads > DIV_ROUND_UP(nr_manifest_entries, 4096))
+		threads = DIV_ROUND_UP(nr_manifest_entries, 4096);
+	if (threads > 1 || (threads && getenv("GIT_FORCE_THREADS"))) {
+		int saved_nr_threads = nr_threads;
+
+		nr_threads = threads;
+		init_thread();
+		work = DIV_ROUND_UP(nr_manifest_entries, threads);
+		for (i = 0; i < threads; i++) {
+			struct thread_local_data *td = &thread_data[i];
+			int ret;
+
+			td->entries_begin = st_mult(i, work);
+			td->entries_end = td->entries_begin + work;
+			if (td->entries_end > nr_manifest_entries)
+				td->entries_end = nr_manifest_entries;
+			ret = pthread_create(&td->thread, NULL,
+					     check_manifest_entries, td);
+			if (ret)
+				die(_("unable to create thread: %s"),
+				    strerror(ret));
+		}
+		for (i = 0; i < threads; i++)
+			pthread_join(thread_data[i].thread, NULL);
+		cleanup_thread();
+		nr_threads = saved_nr_threads;
+	} else {
+		nothread_data.entries_begin = 0;
+		nothread_data.entries_end = nr_manifest_entries;
+		check_manifest_entries(&nothread_data);
+	}
+
+	CALLOC_ARRAY(totals, nr_received_manifests);
+	for (i = 0; i < nr_manifest_entries; i++) {
+		struct received_manifest_entry *e = &manifest_entries[i];
+		struct received_manifest *m = &received_manifests[e->manifest];
+
+		if (e->found_type <= OBJ_NONE)
+			die(_("manifest %s: entry %"PRIu32" (%s) is missing"),
+			    oid_to_hex(&m->oid), e->nr, oid_to_hex(&e->oid));
+		if (e->found_type != e->type)
+			die(_("manifest %s: entry %"PRIu32" (%s) is a %s, not a %s"),
+			    oid_to_hex(&m->oid), e->nr, oid_to_hex(&e->oid),
+			    type_name(e->found_type), type_name(e->type));
+		if (m->version >= 2 && e->found_size != e->size)
+			die(_("manifest %s: entry %"PRIu32" (%s) has %lu bytes, manifest records %lu"),
+			    oid_to_hex(&m->oid), e->nr, oid_to_hex(&e->oid),
+			    e->found_size, e->size);
+		totals[e->manifest] += e->found_size;
+	}
+	for (i = 0; i < nr_received_manifests; i++)
+		if (totals[i] != received_manifests[i].total_size)
+			die(_("manifest %s: chunks add up to %lu bytes, manifest records %lu"),
+			    oid_to_hex(&received_manifests[i].oid),
+			    totals[i], received_manifests[i].total_size);
+
+	free(totals);
+	FREE_AND_NULL(sorted_objects);
+	FREE_AND_NULL(sorted_manifests);
+}
+
 /*
  * Third pass:
  * - append objects to convert thin pack to full pack if required
@@ -1945,6 +2230,8 @@ int cmd_index_pack(int argc,
 			} else if (skip_to_optional_arg(arg, "--fsck-objects", &arg)) {
 				do_fsck_object = 1;
 				fsck_set_msg_types(&fsck_options, arg);
+			} else if (!strcmp(arg, "--check-manifests")) {
+				check_manifests = 1;
 			} else if (!strcmp(arg, "--verify")) {
 				verify = 1;
 			} else if (!strcmp(arg, "--verify-stat")) {
@@ -2082,6 +2369,8 @@ int cmd_index_pack(int argc,
 	if (show_stat)
 		CALLOC_ARRAY(obj_stat, st_add(nr_objects, 1));
 	CALLOC_ARRAY(ofs_deltas, nr_objects);
+	if (check_manifests)
+		CALLOC_ARRAY(delta_result_sizes, st_add(nr_objects, 1));
 	parse_pack_objects(pack_hash);
 	if (report_end_of_input)
 		write_in_full(2, "\0", 1);
@@ -2089,6 +2378,8 @@ int cmd_index_pack(int argc,
 	conclude_pack(fix_thin_pack, curr_pack, pack_hash);
 	free(ofs_deltas);
 	free(ref_deltas);
+	if (check_manifests)
+		check_received_manifests();
 	if (strict)
 		foreign_nr = check_objects();
 
@@ -2120,6 +2411,9 @@ int cmd_index_pack(int argc,
 
 	free(opts.anomaly);
 	free(objects);
+	free(delta_result_sizes);
+	free(received_manifests);
+	free(manifest_entries);
 	strbuf_release(&index_name_buf);
 	strbuf_release(&rev_index_name_buf);
 	if (!pack_name)
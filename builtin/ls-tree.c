@@ -12,6 +12,7 @@
 #include "object-name.h"
 #include "odb.h"
 #include "tree.h"
+#include "tree-size.h"
 #include "path.h"
 #include "quote.h"
 #include "parse-options.h"
@@ -19,6 +20,7 @@
 
 static const char * const ls_tree_usage[] = {
 	N_("git ls-tree [<options>] <tree-ish> [<path>...]"),
+	N_("git ls-tree --size-summary <tree-ish>"),
 	NULL
 };
 
@@ -296,6 +298,7 @@ enum ls_tree_cmdmode {
 	MODE_NAME_ONLY,
 	MODE_NAME_STATUS,
 	MODE_OBJECT_ONLY,
+	MODE_SIZE_SUMMARY,
 };
 
 struct ls_tree_cmdmode_to_fmt {
@@ -361,6 +364,9 @@ int cmd_ls_tree(int argc,
 			    MODE_NAME_STATUS),
 		OPT_CMDMODE(0, "object-only", &cmdmode, N_("list only objects"),
 			    MODE_OBJECT_ONLY),
+		OPT_CMDMODE(0, "size-summary", &cmdmode,
+			    N_("show checkout size and number of files"),
+			    MODE_SIZE_SUMMARY),
 		OPT_BOOL(0, "full-name", &full_name, N_("use full path names")),
 		OPT_BOOL(0, "full-tree", &full_tree,
 			 N_("list entire tree; not just current directory "
@@ -409,6 +415,21 @@ int cmd_ls_tree(int argc,
 				 &obj_context))
 		die("Not a valid object name %s", argv[0]);
 
+	if (cmdmode == MODE_SIZE_SUMMARY) {
+		struct tree_size size;
+
+		if (argc > 1)
+			usage_msg_opt(_("--size-summary does not take paths"),
+				      ls_tree_usage, ls_tree_options);
+		if (repo_logical_size(the_repository, &oid, &size))
+			die(_("unable to compute size of %s"), argv[0]);
+		printf("%"PRIuMAX" %"PRIuMAX"\n",
+		       (uintmax_t)size.bytes, (uintmax_t)size.files);
+		write_tree_size_cache(the_repository);
+		object_context_release(&obj_context);
+		return 0;
+	}
+
 	/*
 	 * show_recursive() rolls its own matching code and is
 	 * generally ignorant of 'struct pathspec'. The magic mask
@@ -255,8 +255,10 @@ static uint16_t write_bitmap_options = BITMAP_OPT_HASH_CACHE;
 
 static int exclude_promisor_objects;
 static int exclude_promisor_objects_best_effort;
+static int chunks_only;
 
 static int use_delta_islands;
+static int store_incompressible;
 
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = DEFAULT_DELTA_CACHE_SIZE;
@@ -379,13 +381,13 @@ static void *get_delta(struct object_entry *entry)
 	return delta_buf;
 }
 
-static unsigned long do_compress(void **pptr, unsigned long size)
+static unsigned long do_compress(void **pptr, unsigned long size, int level)
 {
 	git_zstream stream;
 	void *in, *out;
 	unsigned long maxsize;
 
-	git_deflate_init(&stream, pack_compression_level);
+	git_deflate_init(&stream, level);
 	maxsize = git_deflate_bound(&stream, size);
 
 	in = *pptr;
@@ -405,14 +407,14 @@ static unsigned long do_compress(void **pptr, unsigned long size)
 }
 
 static unsigned long write_large_blob_data(struct git_istream *st, struct hashfile *f,
-					   const struct object_id *oid)
+					   const struct object_id *oid, int level)
 {
 	git_zstream stream;
 	unsigned char ibuf[1024 * 16];
 	unsigned char obuf[1024 * 16];
 	unsigned long olen = 0;
 
-	git_deflate_init(&stream, pack_compression_level);
+	git_deflate_init(&stream, level);
 
 	for (;;) {
 		ssize_t readlen;
@@ -515,6 +517,7 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 	void *buf;
 	struct git_istream *st = NULL;
 	const unsigned hashsz = the_hash_algo->rawsz;
+	int level = pack_compression_level;
 
 	if (!usable_delta) {
 		if (oe_type(entry) == OBJ_BLOB &&
@@ -537,6 +540,11 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 		 */
 		FREE_AND_NULL(entry->delta_data);
 		entry->z_delta_size = 0;
+
+		if (entry->incompressible ||
+		    (buf && type == OBJ_BLOB && store_incompressible &&
+		     git_deflate_looks_incompressible(buf, size)))
+			level = Z_NO_COMPRESSION;
 	} else if (entry->delta_data) {
 		size = DELTA_SIZE(entry);
 		buf = entry->delta_data;
@@ -555,7 +563,7 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 	else if (entry->z_delta_size)
 		datalen = entry->z_delta_size;
 	else
-		datalen = do_compress(&buf, size);
+		datalen = do_compress(&buf, size, level);
 
 	/*
 	 * The object header is a byte of 'type' followed by zero or
@@ -608,7 +616,7 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 		hashwrite(f, header, hdrlen);
 	}
 	if (st) {
-		datalen = write_large_blob_data(st, f, &entry->idx.oid);
+		datalen = write_large_blob_data(st, f, &entry->idx.oid, level);
 		close_istream(st);
 	} else {
 		hashwrite(f, buf, datalen);
@@ -2195,6 +2203,30 @@ static void prefetch_to_pack(uint32_t object_index_start) {
 	oid_array_clear(&to_fetch);
 }
 
+/*
+ * Chunks that were stored without compression when they were written
+ * (see git_deflate_looks_incompressible()) are already-compressed
+ * data: looking for deltas among them is a waste of time, and they are
+ * kept stored when we have to write them out again.
+ */
+static void mark_incompressible(struct object_entry *entry)
+{
+	entry->incompressible = 1;
+	entry->no_try_delta = 1;
+}
+
+static void check_loose_incompressible(struct object_entry *entry)
+{
+	unsigned long mapsize;
+	void *map = map_loose_object(the_repository, &entry->idx.oid, &mapsize);
+
+	if (!map)
+		return;
+	if (git_zlib_stream_is_stored(map, mapsize))
+		mark_incompressible(entry);
+	munmap(map, mapsize);
+}
+
 static void check_object(struct object_entry *entry, uint32_t object_index)
 {
 	unsigned long canonical_size;
@@ -2241,6 +2273,9 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 			oe_set_type(entry, entry->in_pack_type);
 			SET_SIZE(entry, in_pack_size);
 			entry->in_pack_header_size = used;
+			if (store_incompressible && type == OBJ_BLOB &&
+			    git_zlib_stream_is_stored(buf + used, avail - used))
+				mark_incompressible(entry);
 			if (oe_type(entry) < OBJ_COMMIT || 
 			    (oe_type(entry) > OBJ_BLOB && oe_type(entry) != OBJ_MANIFEST))
 				goto give_up;
@@ -2349,6 +2384,8 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 	oe_set_type(entry, type);
 	if (entry->type_valid) {
 		SET_SIZE(entry, canonical_size);
+		if (store_incompressible && type == OBJ_BLOB && !IN_PACK(entry))
+			check_loose_incompressible(entry);
 	} else {
 		/*
 		 * Bad object type is checked in prepare_pack().  This is
@@ -2622,6 +2659,16 @@ static int type_size_sort(const void *_a, const void *_b)
 		if (island_cmp)
 			return island_cmp;
 	}
+	if (to_pack.chunk_pos) {
+		/* the same region of the other versions of the file */
+		const uint64_t a_pos = oe_chunk_pos(&to_pack, a);
+		const uint64_t b_pos = oe_chunk_pos(&to_pack, b);
+
+		if (a_pos < b_pos)
+			return -1;
+		if (a_pos > b_pos)
+			return 1;
+	}
 	if (a_size > b_size)
 		return -1;
 	if (a_size < b_size)
@@ -3002,7 +3049,8 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		if (entry->delta_data && !pack_to_stdout) {
 			unsigned long size;
 
-			size = do_compress(&entry->delta_data, DELTA_SIZE(entry));
+			size = do_compress(&entry->delta_data, DELTA_SIZE(entry),
+					   pack_compression_level);
 			if (size < (1U << OE_Z_DELTA_BITS)) {
 				entry->z_delta_size = size;
 				cache_lock();
@@ -4236,6 +4284,16 @@ static void show_object(struct object *obj, const char *name,
 	}
 }
 
+static void record_chunk_position(struct object *obj, uint64_t offset,
+				  void *data UNUSED)
+{
+	struct object_entry *ent = packlist_find(&to_pack, &obj->oid);
+
+	/* a chunk shared by several files stays with the first one */
+	if (ent && !oe_chunk_pos(&to_pack, ent))
+		oe_set_chunk_pos(&to_pack, ent, offset);
+}
+
 static void show_object__ma_allow_any(struct object *obj, const char *name, void *data)
 {
 	assert(arg_missing_action == MA_ALLOW_ANY);
@@ -4699,6 +4757,14 @@ static void get_object_list(struct rev_info *revs, int ac, const char **av)
 	if (!fn_show_object)
 		fn_show_object = show_object;
 
+	/*
+	 * Chunks share the name hash of their file; sort them by where
+	 * they are in it too, so that the delta window compares each
+	 * with the same region of the other versions.
+	 */
+	if (window && depth)
+		revs->chunk_position = record_chunk_position;
+
 	if (path_walk) {
 		get_object_list_path_walk(revs);
 	} else {
@@ -4967,6 +5033,8 @@ int cmd_pack_objects(int argc,
 		OPT_BOOL(0, "exclude-promisor-objects-best-effort",
 			 &exclude_promisor_objects_best_effort,
 			 N_("implies --missing=allow-any")),
+		OPT_BOOL(0, "chunks-only", &chunks_only,
+			 N_("pack only the chunks of the manifests reached by the revisions")),
 		OPT_BOOL(0, "delta-islands", &use_delta_islands,
 			 N_("respect islands during delta compression")),
 		OPT_STRING_LIST(0, "uri-protocol", &uri_protocols,
@@ -4987,6 +5055,8 @@ int cmd_pack_objects(int argc,
 		prepare_repo_settings(the_repository);
 		if (sparse < 0)
 			sparse = the_repository->settings.pack_use_sparse;
+		store_incompressible =
+			the_repository->settings.store_incompressible;
 		if (the_repository->settings.pack_use_multi_pack_reuse)
 			allow_pack_reuse = MULTI_PACK_REUSE;
 	}
@@ -5008,6 +5078,15 @@ int cmd_pack_objects(int argc,
 	if (pack_to_stdout != !base_name || argc)
 		usage_with_options(pack_usage, pack_objects_options);
 
+	if (chunks_only) {
+		/* neither knows which blobs are chunks */
+		if (path_walk > 0)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--chunks-only", "--path-walk");
+		path_walk = 0;
+		use_bitmap_index = 0;
+	}
+
 	if (path_walk < 0) {
 		if (use_bitmap_index > 0 ||
 		    !use_internal_rev_list)
@@ -5095,7 +5174,8 @@ int cmd_pack_objects(int argc,
 		option_parse_missing_action(NULL, "allow-any", 0);
 		/* revs configured below */
 	}
-	if (unpack_unreachable || keep_unreachable || pack_loose_unreachable)
+	if (unpack_unreachable || keep_unreachable || pack_loose_unreachable ||
+	    chunks_only)
 		use_internal_rev_list = 1;
 
 	if (!reuse_object)
@@ -5160,7 +5240,7 @@ int cmd_pack_objects(int argc,
 	if (!use_internal_rev_list || (!pack_to_stdout && write_bitmap_index) || is_repository_shallow(the_repository))
 		use_bitmap_index = 0;
 
-	if (pack_to_stdout || !rev_list_all)
+	if (pack_to_stdout || !rev_list_all || chunks_only)
 		write_bitmap_index = 0;
 
 	if (name_hash_version < 0)
@@ -5216,6 +5296,7 @@ int cmd_pack_objects(int argc,
 
 		repo_init_revisions(the_repository, &revs, NULL);
 		list_objects_filter_copy(&revs.filter, &filter_options);
+		revs.chunk_objects_only = chunks_only;
 		if (exclude_promisor_objects_best_effort) {
 			revs.include_check = is_not_in_promisor_pack;
 			revs.include_check_obj = is_not_in_promisor_pack_obj;
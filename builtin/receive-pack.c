@@ -2337,6 +2337,8 @@ static const char *unpack(int err_fd, struct shallow_info *si)
 		if (fsck_objects)
 			strvec_pushf(&child.args, "--strict%s",
 				     fsck_msg_types.buf);
+		if (fsck_objects)
+			strvec_push(&child.args, "--check-manifests");
 		if (max_input_size)
 			strvec_pushf(&child.args, "--max-input-size=%"PRIuMAX,
 				     (uintmax_t)max_input_size);
@@ -2367,6 +2369,8 @@ static const char *unpack(int err_fd, struct shallow_info *si)
 		if (fsck_objects)
 			strvec_pushf(&child.args, "--strict%s",
 				     fsck_msg_types.buf);
+		if (fsck_objects)
+			strvec_push(&child.args, "--check-manifests");
 		if (!reject_thin)
 			strvec_push(&child.args, "--fix-thin");
 		if (max_input_size)
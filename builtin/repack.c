@@ -40,11 +40,13 @@ static int use_delta_islands;
 static int run_update_server_info = 1;
 static char *packdir, *packtmp_name, *packtmp;
 static int midx_must_contain_cruft = 1;
+static int use_chunk_packs;
+static int chunk_pack_factor = 2;
 
 static const char *const git_repack_usage[] = {
 	N_("git repack [-a] [-A] [-d] [-f] [-F] [-l] [-n] [-q] [-b] [-m]\n"
 	   "[--window=<n>] [--depth=<n>] [--threads=<n>] [--keep-pack=<pack-name>]\n"
-	   "[--write-midx] [--name-hash-version=<n>] [--path-walk]"),
+	   "[--write-midx] [--name-hash-version=<n>] [--path-walk] [--chunk-packs]"),
 	NULL
 };
 
@@ -113,6 +115,14 @@ static int repack_config(const char *var, const char *value,
 		midx_must_contain_cruft = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "repack.chunkpacks")) {
+		use_chunk_packs = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "repack.chunkpackfactor")) {
+		chunk_pack_factor = git_config_int(var, value, ctx->kvi);
+		return 0;
+	}
 	return git_default_config(var, value, ctx, cb);
 }
 
@@ -129,17 +139,20 @@ struct existing_packs {
 	struct string_list kept_packs;
 	struct string_list non_kept_packs;
 	struct string_list cruft_packs;
+	struct string_list chunk_packs;
 };
 
 #define EXISTING_PACKS_INIT { \
 	.kept_packs = STRING_LIST_INIT_DUP, \
 	.non_kept_packs = STRING_LIST_INIT_DUP, \
 	.cruft_packs = STRING_LIST_INIT_DUP, \
+	.chunk_packs = STRING_LIST_INIT_DUP, \
 }
 
 static int has_existing_non_kept_packs(const struct existing_packs *existing)
 {
-	return existing->non_kept_packs.nr || existing->cruft_packs.nr;
+	return existing->non_kept_packs.nr || existing->cruft_packs.nr ||
+		existing->chunk_packs.nr;
 }
 
 static void pack_mark_for_deletion(struct string_list_item *item)
@@ -246,6 +259,7 @@ static void remove_redundant_existing_packs(struct existing_packs *existing)
 {
 	remove_redundant_packs_1(&existing->non_kept_packs);
 	remove_redundant_packs_1(&existing->cruft_packs);
+	remove_redundant_packs_1(&existing->chunk_packs);
 }
 
 static void existing_packs_release(struct existing_packs *existing)
@@ -253,13 +267,16 @@ static void existing_packs_release(struct existing_packs *existing)
 	string_list_clear(&existing->kept_packs, 0);
 	string_list_clear(&existing->non_kept_packs, 0);
 	string_list_clear(&existing->cruft_packs, 0);
+	string_list_clear(&existing->chunk_packs, 0);
 }
 
 /*
  * Adds all packs hex strings (pack-$HASH) to either packs->non_kept
  * or packs->kept based on whether each pack has a corresponding
  * .keep file or not.  Packs without a .keep file are not to be kept
- * if we are going to pack everything into one file.
+ * if we are going to pack everything into one file.  With
+ * --chunk-packs, packs with a .chunks file go to packs->chunk_packs,
+ * which are left alone unless they are rolled up.
  */
 static void collect_pack_filenames(struct existing_packs *existing,
 				   const struct string_list *extra_keep)
@@ -288,6 +305,8 @@ static void collect_pack_filenames(struct existing_packs *existing,
 			string_list_append(&existing->kept_packs, buf.buf);
 		else if (p->is_cruft)
 			string_list_append(&existing->cruft_packs, buf.buf);
+		else if (p->pack_chunks && use_chunk_packs)
+			string_list_append(&existing->chunk_packs, buf.buf);
 		else
 			string_list_append(&existing->non_kept_packs, buf.buf);
 	}
@@ -295,6 +314,7 @@ static void collect_pack_filenames(struct existing_packs *existing,
 	string_list_sort(&existing->kept_packs);
 	string_list_sort(&existing->non_kept_packs);
 	string_list_sort(&existing->cruft_packs);
+	string_list_sort(&existing->chunk_packs);
 	strbuf_release(&buf);
 }
 
@@ -374,6 +394,7 @@ static struct {
 	{".mtimes", 1},
 	{".bitmap", 1},
 	{".promisor", 1},
+	{".chunks", 1},
 	{".idx"},
 };
 
@@ -544,6 +565,8 @@ static void init_pack_geometry(struct pack_geometry *geometry,
 		}
 		if (p->is_cruft)
 			continue;
+		if (p->pack_chunks && use_chunk_packs)
+			continue;
 
 		ALLOC_GROW(geometry->pack,
 			   geometry->pack_nr + 1,
@@ -707,6 +730,290 @@ static void free_pack_geometry(struct pack_geometry *geometry)
 	free(geometry->pack);
 }
 
+/*
+ * Chunk packs hold the chunks of manifests, and nothing else. Chunks
+ * are immutable and rarely delta well against each other, so they are
+ * stored whole and kept out of the way of the other packs: a repack
+ * writes the new chunks to a chunk pack of their own, and existing chunk
+ * packs are only rolled up when they no longer form a geometric
+ * progression (with factor repack.chunkPackFactor), independently of
+ * what happens to the other packs.
+ */
+static void init_chunk_pack_geometry(struct pack_geometry *geometry,
+				     struct existing_packs *existing)
+{
+	struct packed_git *p;
+	struct strbuf buf = STRBUF_INIT;
+	uint32_t i;
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		if (!p->pack_local || !p->pack_chunks)
+			continue;
+
+		strbuf_reset(&buf);
+		strbuf_addstr(&buf, pack_basename(p));
+		strbuf_strip_suffix(&buf, ".pack");
+
+		/* kept by .keep or --keep-pack */
+		if (!string_list_has_string(&existing->chunk_packs, buf.buf))
+			continue;
+
+		ALLOC_GROW(geometry->pack,
+			   geometry->pack_nr + 1,
+			   geometry->pack_alloc);
+
+		geometry->pack[geometry->pack_nr] = p;
+		geometry->pack_nr++;
+	}
+
+	QSORT(geometry->pack, geometry->pack_nr, geometry_cmp);
+	split_pack_geometry(geometry);
+
+	/* rolling up a single pack would only copy it */
+	if (geometry->split < 2)
+		geometry->split = 0;
+
+	for (i = 0; i < geometry->split; i++) {
+		struct string_list_item *item;
+
+		strbuf_reset(&buf);
+		strbuf_addstr(&buf, pack_basename(geometry->pack[i]));
+		strbuf_strip_suffix(&buf, ".pack");
+
+		item = string_list_lookup(&existing->chunk_packs, buf.buf);
+		pack_mark_for_deletion(item);
+	}
+
+	strbuf_release(&buf);
+}
+
+/*
+ * With -a, the chunk packs that are not rolled up are kept as they are,
+ * which would keep their unreachable chunks forever. Count the
+ * reachable objects in each, and roll up those with any unreachable
+ * chunk, too, so that the chunks go the way of the other unreachable
+ * objects.
+ */
+static int mark_chunk_packs_with_unreachable(struct existing_packs *existing)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct packed_git *p, **packs = NULL;
+	uint32_t *reached = NULL;
+	size_t i, nr = 0, alloc = 0;
+	FILE *out;
+	int ret = 0;
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		struct string_list_item *item;
+
+		if (!p->pack_local || !p->pack_chunks)
+			continue;
+
+		strbuf_reset(&buf);
+		strbuf_addstr(&buf, pack_basename(p));
+		strbuf_strip_suffix(&buf, ".pack");
+
+		item = string_list_lookup(&existing->chunk_packs, buf.buf);
+		if (!item || pack_is_marked_for_deletion(item))
+			continue;
+
+		ALLOC_GROW(packs, nr + 1, alloc);
+		packs[nr++] = p;
+	}
+	if (!nr)
+		goto out;
+	CALLOC_ARRAY(reached, nr);
+
+	strvec_pushl(&cmd.args, "rev-list", "--objects", "--no-object-names",
+		     "--all", "--reflog", "--indexed-objects", NULL);
+	if (repo_has_promisor_remote(the_repository))
+		strvec_push(&cmd.args, "--exclude-promisor-objects");
+	cmd.git_cmd = 1;
+	cmd.no_stdin = 1;
+	cmd.out = -1;
+
+	ret = start_command(&cmd);
+	if (ret)
+		goto out;
+
+	out = xfdopen(cmd.out, "r");
+	while (strbuf_getline_lf(&buf, out) != EOF) {
+		struct object_id oid;
+
+		if (get_oid_hex(buf.buf, &oid))
+			die(_("repack: Expecting full hex object ID lines only from rev-list."));
+		for (i = 0; i < nr; i++)
+			if (find_pack_entry_one(&oid, packs[i]))
+				reached[i]++;
+	}
+	fclose(out);
+
+	ret = finish_command(&cmd);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < nr; i++) {
+		if (reached[i] == packs[i]->num_objects)
+			continue;
+
+		strbuf_reset(&buf);
+		strbuf_addstr(&buf, pack_basename(packs[i]));
+		strbuf_strip_suffix(&buf, ".pack");
+		pack_mark_for_deletion(string_list_lookup(&existing->chunk_packs,
+							  buf.buf));
+	}
+
+out:
+	free(packs);
+	free(reached);
+	strbuf_release(&buf);
+	return ret;
+}
+
+static void prepare_chunk_pack_objects(struct child_process *cmd,
+				       const struct pack_objects_args *args)
+{
+	/* path-walk and the delta options do not apply */
+	struct pack_objects_args chunk_args = {
+		.threads = args->threads,
+		.max_pack_size = args->max_pack_size,
+		.local = args->local,
+		.quiet = args->quiet,
+	};
+
+	prepare_pack_objects(cmd, &chunk_args, packtmp);
+	strvec_pushl(&cmd->args, "--window=0", "--depth=0",
+		     "--no-reuse-delta", "--non-empty", NULL);
+}
+
+/*
+ * Read the names of the packs written by "cmd" into "names", and mark
+ * them as chunk packs.
+ */
+static int finish_chunk_pack_cmd(struct child_process *cmd,
+				 struct string_list *names)
+{
+	struct strbuf line = STRBUF_INIT;
+	FILE *out;
+
+	out = xfdopen(cmd->out, "r");
+	while (strbuf_getline_lf(&line, out) != EOF) {
+		struct string_list_item *item;
+		char *chunks_name;
+		int fd;
+
+		if (line.len != the_hash_algo->hexsz)
+			die(_("repack: Expecting full hex object ID lines only from pack-objects."));
+		item = string_list_append(names, line.buf);
+
+		/* like .promisor, the .chunks file is empty */
+		chunks_name = mkpathdup("%s-%s.chunks", packtmp, line.buf);
+		fd = xopen(chunks_name, O_WRONLY | O_CREAT | O_TRUNC, 0444);
+		close(fd);
+
+		item->util = populate_pack_exts(item->string);
+
+		free(chunks_name);
+	}
+	fclose(out);
+	strbuf_release(&line);
+
+	return finish_command(cmd);
+}
+
+/*
+ * Write the reachable chunks that are not in a chunk pack we keep to a
+ * new chunk pack. With -a, that includes the chunks of the chunk packs
+ * being rolled up, so that unreachable ones are left behind with the
+ * packs being deleted. Otherwise, only loose chunks are packed, and
+ * roll_up_chunk_packs() takes care of the rest.
+ */
+static int write_chunk_pack(const struct pack_objects_args *args,
+			    struct existing_packs *existing,
+			    const struct string_list *keep_pack_list,
+			    struct string_list *names)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	struct string_list_item *item;
+	int ret;
+
+	prepare_chunk_pack_objects(&cmd, args);
+
+	strvec_push(&cmd.args, "--chunks-only");
+	strvec_push(&cmd.args, "--keep-true-parents");
+	if (!pack_kept_objects)
+		strvec_push(&cmd.args, "--honor-pack-keep");
+	for_each_string_list_item(item, keep_pack_list)
+		strvec_pushf(&cmd.args, "--keep-pack=%s", item->string);
+	for_each_string_list_item(item, &existing->chunk_packs) {
+		if (!(pack_everything & ALL_INTO_ONE) ||
+		    !pack_is_marked_for_deletion(item))
+			strvec_pushf(&cmd.args, "--keep-pack=%s.pack",
+				     item->string);
+	}
+	strvec_push(&cmd.args, "--all");
+	strvec_push(&cmd.args, "--reflog");
+	strvec_push(&cmd.args, "--indexed-objects");
+	if (!(pack_everything & ALL_INTO_ONE))
+		strvec_push(&cmd.args, "--unpacked");
+	if (repo_has_promisor_remote(the_repository))
+		strvec_push(&cmd.args, "--exclude-promisor-objects");
+	cmd.no_stdin = 1;
+
+	ret = start_command(&cmd);
+	if (ret)
+		return ret;
+	return finish_chunk_pack_cmd(&cmd, names);
+}
+
+/*
+ * Copy the chunk packs below the split line of "geometry" into a new
+ * chunk pack, unreachable chunks and all, as --geometric does.
+ */
+static int roll_up_chunk_packs(const struct pack_objects_args *args,
+			       struct pack_geometry *geometry,
+			       struct string_list *names)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	FILE *in;
+	uint32_t i;
+	int ret;
+
+	if (!geometry->split)
+		return 0;
+
+	prepare_chunk_pack_objects(&cmd, args);
+	strvec_push(&cmd.args, "--stdin-packs");
+	cmd.in = -1;
+
+	ret = start_command(&cmd);
+	if (ret)
+		return ret;
+
+	in = xfdopen(cmd.in, "w");
+	for (i = 0; i < geometry->split; i++)
+		fprintf(in, "%s\n", pack_basename(geometry->pack[i]));
+	for (i = geometry->split; i < geometry->pack_nr; i++)
+		fprintf(in, "^%s\n", pack_basename(geometry->pack[i]));
+	fclose(in);
+
+	return finish_chunk_pack_cmd(&cmd, names);
+}
+
+static int is_existing_chunk_pack(struct existing_packs *existing,
+				  const char *idx_name)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int ret;
+
+	strbuf_addstr(&buf, idx_name);
+	strbuf_strip_suffix(&buf, ".idx");
+	ret = string_list_has_string(&existing->chunk_packs, buf.buf);
+	strbuf_release(&buf);
+	return ret;
+}
+
 static int midx_has_unknown_packs(char **midx_pack_names,
 				  size_t midx_pack_names_nr,
 				  struct string_list *include,
@@ -739,6 +1046,12 @@ static int midx_has_unknown_packs(char **midx_pack_names,
 		 */
 		if (string_list_has_string(include, pack_name)) {
 			continue;
+		} else if (is_existing_chunk_pack(existing, pack_name)) {
+			/*
+			 * Chunk packs are either included or rolled up,
+			 * like the packs around a geometric split.
+			 */
+			continue;
 		} else if (geometry) {
 			struct strbuf buf = STRBUF_INIT;
 			uint32_t j;
@@ -901,6 +1214,15 @@ static void midx_included_packs(struct string_list *include,
 		}
 	}
 
+	for_each_string_list_item(item, &existing->chunk_packs) {
+		if (pack_is_marked_for_deletion(item))
+			continue;
+
+		strbuf_reset(&buf);
+		strbuf_addf(&buf, "%s.idx", item->string);
+		string_list_insert(include, buf.buf);
+	}
+
 	if (midx_must_contain_cruft ||
 	    midx_has_unknown_packs(midx_pack_names, midx_pack_names_nr,
 				   include, geometry, existing)) {
@@ -1236,6 +1558,11 @@ static int write_cruft_pack(const struct pack_objects_args *args,
 	}
 	for_each_string_list_item(item, &existing->kept_packs)
 		fprintf(in, "%s.pack\n", item->string);
+	/* unreachable chunks of rolled-up chunk packs become cruft */
+	for_each_string_list_item(item, &existing->chunk_packs)
+		fprintf(in, "%s%s.pack\n",
+			pack_is_marked_for_deletion(item) ? "-" : "",
+			item->string);
 	fclose(in);
 
 	return finish_pack_objects_cmd(&cmd, names, local);
@@ -1262,6 +1589,7 @@ int cmd_repack(int argc,
 	struct string_list names = STRING_LIST_INIT_DUP;
 	struct existing_packs existing = EXISTING_PACKS_INIT;
 	struct pack_geometry geometry = { 0 };
+	struct pack_geometry chunk_geometry = { 0 };
 	struct tempfile *refs_snapshot = NULL;
 	int i, ext, ret;
 	int show_progress;
@@ -1343,6 +1671,8 @@ int cmd_repack(int argc,
 			    N_("find a geometric progression with factor <N>")),
 		OPT_BOOL('m', "write-midx", &write_midx,
 			   N_("write a multi-pack index of the resulting packs")),
+		OPT_BOOL(0, "chunk-packs", &use_chunk_packs,
+			 N_("keep manifest chunks in chunk packs of their own")),
 		OPT_STRING(0, "expire-to", &expire_to, N_("dir"),
 			   N_("pack prefix to store a pack containing pruned objects")),
 		OPT_STRING(0, "filter-to", &filter_to, N_("dir"),
@@ -1412,8 +1742,16 @@ int cmd_repack(int argc,
 	packtmp_name = xstrfmt(".tmp-%d-pack", (int)getpid());
 	packtmp = mkpathdup("%s/%s", packdir, packtmp_name);
 
+	if (use_chunk_packs && chunk_pack_factor < 2)
+		die(_("repack.chunkPackFactor must be at least 2"));
+
 	collect_pack_filenames(&existing, &keep_pack_list);
 
+	if (use_chunk_packs) {
+		chunk_geometry.split_factor = chunk_pack_factor;
+		init_chunk_pack_geometry(&chunk_geometry, &existing);
+	}
+
 	if (geometry.split_factor) {
 		if (pack_everything)
 			die(_("options '%s' and '%s' cannot be used together"), "--geometric", "-A/-a");
@@ -1500,6 +1838,37 @@ int cmd_repack(int argc,
 	else if (filter_to)
 		die(_("option '%s' can only be used along with '%s'"), "--filter-to", "--filter");
 
+	if (use_chunk_packs) {
+		size_t nr = names.nr;
+
+		if ((pack_everything & ALL_INTO_ONE) && delete_redundant &&
+		    !keep_unreachable) {
+			ret = mark_chunk_packs_with_unreachable(&existing);
+			if (ret)
+				goto cleanup;
+		}
+
+		/*
+		 * Write the chunk packs first, so that the other packs
+		 * can leave out everything in them.
+		 */
+		ret = write_chunk_pack(&po_args, &existing, &keep_pack_list,
+				       &names);
+		if (!ret && !(pack_everything & ALL_INTO_ONE))
+			ret = roll_up_chunk_packs(&po_args, &chunk_geometry,
+						  &names);
+		if (ret)
+			goto cleanup;
+
+		for (i = nr; i < names.nr; i++)
+			strvec_pushf(&cmd.args, "--keep-pack=%s-%s.pack",
+				     packtmp_name, names.items[i].string);
+		for_each_string_list_item(item, &existing.chunk_packs)
+			if (!pack_is_marked_for_deletion(item))
+				strvec_pushf(&cmd.args, "--keep-pack=%s.pack",
+					     item->string);
+	}
+
 	if (geometry.split_factor)
 		cmd.in = -1;
 	else
@@ -1732,6 +2101,7 @@ int cmd_repack(int argc,
 	string_list_clear(&names, 1);
 	existing_packs_release(&existing);
 	free_pack_geometry(&geometry);
+	free_pack_geometry(&chunk_geometry);
 	for (size_t i = 0; i < midx_pack_names_nr; i++)
 		free(midx_pack_names[i]);
 	free(midx_pack_names);
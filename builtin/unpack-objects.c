@@ -21,9 +21,11 @@
 #include "fsck.h"
 #include "packfile.h"
 #include "manifest.h"
+#include "manifest-walk.h"
+#include "oid-array.h"
 
-static int dry_run, quiet, recover, has_errors, strict;
-static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict]";
+static int dry_run, quiet, recover, has_errors, strict, check_manifests;
+static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict] [--check-manifests]";
 
 /* We always read in 4kB chunks. */
 static unsigned char buffer[4096];
@@ -197,6 +199,73 @@ struct obj_info {
 static struct obj_info *obj_list;
 static unsigned nr_objects;
 
+/* manifests written so far, for --check-manifests */
+static struct oid_array received_manifests = OID_ARRAY_INIT;
+
+/*
+ * Once every object is written, make sure that each entry of every
+ * received manifest is in the repository, has the type the manifest
+ * gives it, and that the entry sizes add up to what the manifest
+ * records. This is the unpack-objects side of "index-pack
+ * --check-manifests"; with few objects a lookup per entry is fine.
+ */
+static void check_received_manifests(void)
+{
+	size_t i;
+
+	for (i = 0; i < received_manifests.nr; i++) {
+		const struct object_id *oid = &received_manifests.oid[i];
+		struct manifest_header header;
+		struct manifest_desc desc;
+		struct strbuf err = STRBUF_INIT;
+		enum object_type type;
+		unsigned long size, total = 0;
+		uint32_t nr = 0;
+		void *data;
+
+		data = odb_read_object(the_repository->objects, oid, &type, &size);
+		if (!data || type != OBJ_MANIFEST)
+			die(_("unable to read manifest %s"), oid_to_hex(oid));
+		if (parse_manifest_header_gently(data, size, &header, &err))
+			die(_("invalid manifest %s: %s"), oid_to_hex(oid), err.buf);
+
+		init_manifest_desc(&desc, header.version, header.chunk_data,
+				   header.chunk_data_len, the_hash_algo);
+		while (manifest_entry(&desc)) {
+			unsigned long found_size;
+			enum object_type found_type;
+
+			found_type = odb_read_object_info(the_repository->objects,
+							  &desc.entry_oid, &found_size);
+			if (found_type == OBJ_MANIFEST &&
+			    get_manifest_size(the_repository, &desc.entry_oid,
+					      &found_size) < 0)
+				found_type = OBJ_BAD;
+			if (found_type <= OBJ_NONE)
+				die(_("manifest %s: entry %"PRIu32" (%s) is missing"),
+				    oid_to_hex(oid), nr, oid_to_hex(&desc.entry_oid));
+			if (found_type != desc.entry_type)
+				die(_("manifest %s: entry %"PRIu32" (%s) is a %s, not a %s"),
+				    oid_to_hex(oid), nr, oid_to_hex(&desc.entry_oid),
+				    type_name(found_type), type_name(desc.entry_type));
+			if (header.version >= 2 && found_size != desc.entry_size)
+				die(_("manifest %s: entry %"PRIu32" (%s) has %lu bytes, manifest records %lu"),
+				    oid_to_hex(oid), nr, oid_to_hex(&desc.entry_oid),
+				    found_size, desc.entry_size);
+			total += found_size;
+			nr++;
+		}
+		if (desc.size)
+			die(_("invalid manifest %s: entry %"PRIu32" is malformed"),
+			    oid_to_hex(oid), nr);
+		if (total != header.total_size)
+			die(_("manifest %s: chunks add up to %lu bytes, manifest records %lu"),
+			    oid_to_hex(oid), total, header.total_size);
+		free(data);
+	}
+	oid_array_clear(&received_manifests);
+}
+
 /*
  * Called only from check_object() after it verified this object
  * is Ok.
@@ -276,6 +345,8 @@ static void write_object(unsigned nr, enum object_type type,
 		if (write_object_file(buf, size, type,
 				      &obj_list[nr].oid) < 0)
 			die("failed to write object");
+		if (type == OBJ_MANIFEST && check_manifests)
+			oid_array_append(&received_manifests, &obj_list[nr].oid);
 		added_object(nr, type, buf, size);
 		free(buf);
 		obj_list[nr].obj = NULL;
@@ -298,6 +369,8 @@ static void write_object(unsigned nr, enum object_type type,
 		if (write_object_file(buf, size, type,
 				      &obj_list[nr].oid) < 0)
 			die("failed to write object");
+		if (check_manifests)
+			oid_array_append(&received_manifests, &obj_list[nr].oid);
 		added_object(nr, type, buf, size);
 		free(buf);
 
@@ -455,6 +528,8 @@ static void stream_manifest(unsigned long size, unsigned nr)
 		die(_("inflate returned (%d)"), data.status);
 	git_inflate_end(&zstream);
 
+	if (check_manifests)
+		oid_array_append(&received_manifests, &info->oid);
 	if (strict) {
 		struct manifest *manifest = lookup_manifest(the_repository, &info->oid);
 
@@ -704,6 +779,10 @@ int cmd_unpack_objects(int argc,
 				fsck_set_msg_types(&fsck_options, arg);
 				continue;
 			}
+			if (!strcmp(arg, "--check-manifests")) {
+				check_manifests = 1;
+				continue;
+			}
 			if (skip_prefix(arg, "--pack_header=", &arg)) {
 				if (parse_pack_header_option(arg,
 							     buffer, &len) < 0)
@@ -731,6 +810,8 @@ int cmd_unpack_objects(int argc,
 		if (fsck_finish(&fsck_options))
 			die(_("fsck error in pack objects"));
 	}
+	if (check_manifests && !dry_run)
+		check_received_manifests();
 	if (!hasheq(fill(the_hash_algo->rawsz), oid.hash,
 		    the_repository->hash_algo))
 		die("final sha1 did not match");
@@ -125,6 +125,9 @@ static void flush_batch_fsync(void)
 	 */
 	tmp_objdir_migrate(bulk_fsync_objdir);
 	bulk_fsync_objdir = NULL;
+
+	/* a pack may have moved along */
+	reprepare_packed_git(the_repository);
 }
 
 static int already_written(struct bulk_checkin_packfile *state, struct object_id *oid)
@@ -161,7 +164,7 @@ static int already_written(struct bulk_checkin_packfile *state, struct object_id
 static int stream_blob_to_pack(struct bulk_checkin_packfile *state,
 			       struct git_hash_ctx *ctx, off_t *already_hashed_to,
 			       int fd, size_t size, const char *path,
-			       unsigned flags)
+			       int level, unsigned flags)
 {
 	git_zstream s;
 	unsigned char ibuf[16384];
@@ -171,7 +174,7 @@ static int stream_blob_to_pack(struct bulk_checkin_packfile *state,
 	int write_object = (flags & INDEX_WRITE_OBJECT);
 	off_t offset = 0;
 
-	git_deflate_init(&s, pack_compression_level);
+	git_deflate_init(&s, level);
 
 	hdrlen = encode_in_pack_object_header(obuf, sizeof(obuf), OBJ_BLOB, size);
 	s.next_out = obuf + hdrlen;
@@ -250,6 +253,39 @@ static void prepare_to_stream(struct bulk_checkin_packfile *state,
 		die_errno("unable to write pack header");
 }
 
+/*
+ * Read samples from the start, middle and end of the blob we are about
+ * to stream and decide whether it is worth deflating at all.
+ */
+static int blob_compression_level(int fd, off_t start, size_t size)
+{
+	struct repository *repo = the_repository;
+	const size_t sample = 16 * 1024;
+	unsigned char *buf;
+	size_t len = 0;
+	int i, level = pack_compression_level;
+
+	if (level == Z_NO_COMPRESSION || size < 3 * sample)
+		return level;
+	prepare_repo_settings(repo);
+	if (!repo->settings.store_incompressible)
+		return level;
+
+	buf = xmalloc(3 * sample);
+	for (i = 0; i < 3; i++) {
+		off_t offset = start + (off_t)((size - sample) / 2) * i;
+		ssize_t got = pread_in_full(fd, buf + len, sample, offset);
+
+		if (got < 0)
+			break;
+		len += got;
+	}
+	if (i == 3 && git_deflate_looks_incompressible(buf, len))
+		level = Z_NO_COMPRESSION;
+	free(buf);
+	return level;
+}
+
 static int deflate_blob_to_pack(struct bulk_checkin_packfile *state,
 				struct object_id *result_oid,
 				int fd, size_t size,
@@ -261,10 +297,12 @@ static int deflate_blob_to_pack(struct bulk_checkin_packfile *state,
 	unsigned header_len;
 	struct hashfile_checkpoint checkpoint;
 	struct pack_idx_entry *idx = NULL;
+	int level;
 
 	seekback = lseek(fd, 0, SEEK_CUR);
 	if (seekback == (off_t) -1)
 		return error("cannot find the current offset");
+	level = blob_compression_level(fd, seekback, size);
 
 	header_len = format_object_header((char *)obuf, sizeof(obuf),
 					  OBJ_BLOB, size);
@@ -289,7 +327,7 @@ static int deflate_blob_to_pack(struct bulk_checkin_packfile *state,
 			crc32_begin(state->f);
 		}
 		if (!stream_blob_to_pack(state, &ctx, &already_hashed_to,
-					 fd, size, path, flags))
+					 fd, size, path, level, flags))
 			break;
 		/*
 		 * Writing this object to the current pack will make
@@ -374,8 +412,13 @@ void begin_odb_transaction(void)
 
 void flush_odb_transaction(void)
 {
-	flush_batch_fsync();
+	/*
+	 * A pack started once loose objects go to the temporary object
+	 * directory is written there, too; finish it before the directory
+	 * is migrated, which then moves it along with the loose objects.
+	 */
 	flush_bulk_checkin_packfile(&bulk_checkin_packfile);
+	flush_batch_fsync();
 }
 
 void end_odb_transaction(void)
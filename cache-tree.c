@@ -9,8 +9,10 @@
 #include "tree-walk.h"
 #include "cache-tree.h"
 #include "bulk-checkin.h"
+#include "config.h"
 #include "object-file.h"
 #include "odb.h"
+#include "parse.h"
 #include "read-cache-ll.h"
 #include "replace-object.h"
 #include "repository.h"
@@ -18,6 +20,7 @@
 #include "trace.h"
 #include "trace2.h"
 #include "setup.h"
+#include "thread-utils.h"
 
 #ifndef DEBUG_CACHE_TREE
 #define DEBUG_CACHE_TREE 0
@@ -255,18 +258,52 @@ static int must_check_existence(const struct cache_entry *ce)
 	return !(repo_has_promisor_remote(the_repository) && ce_skip_worktree(ce));
 }
 
+/*
+ * With several threads, invalid subtrees are first split into jobs
+ * that worker threads rebuild, and the main pass then builds the trees
+ * above them, taking the result of a job instead of descending into
+ * its subtree.  The jobs are in index order, so the main pass meets
+ * them in the order they were collected.
+ */
+struct update_job {
+	struct cache_tree *it;
+	struct cache_entry **cache;
+	int entries;
+	const char *base;
+	int baselen;
+	int ret, skip;
+};
+
+struct update_jobs {
+	struct update_job *job;
+	int nr, alloc;
+	/* the next job for a worker, and for the main pass */
+	int taken, next;
+	int flags;
+	pthread_mutex_t mutex;
+};
+
+/*
+ * Split the work so that the threads get a few jobs each, but do not
+ * bother with threads for fewer entries than this per thread.
+ */
+#define UPDATE_THREAD_COST 10000
+#define UPDATE_JOBS_PER_THREAD 8
+
 static int update_one(struct cache_tree *it,
 		      struct cache_entry **cache,
 		      int entries,
 		      const char *base,
 		      int baselen,
 		      int *skip_count,
-		      int flags)
+		      int flags,
+		      struct update_jobs *jobs)
 {
 	struct strbuf buffer;
 	int missing_ok = flags & WRITE_TREE_MISSING_OK;
 	int dryrun = flags & WRITE_TREE_DRY_RUN;
 	int repair = flags & WRITE_TREE_REPAIR;
+	int bench = repo_has_bench_extensions(the_repository);
 	int to_invalidate = 0;
 	int i;
 
@@ -334,12 +371,23 @@ static int update_one(struct cache_tree *it,
 		sub = find_subtree(it, path + baselen, sublen, 1);
 		if (!sub->cache_tree)
 			sub->cache_tree = cache_tree();
-		subcnt = update_one(sub->cache_tree,
-				    cache + i, entries - i,
-				    path,
-				    baselen + sublen + 1,
-				    &subskip,
-				    flags);
+		while (jobs && jobs->next < jobs->nr &&
+		       jobs->job[jobs->next].cache < cache + i)
+			jobs->next++;
+		if (jobs && jobs->next < jobs->nr &&
+		    jobs->job[jobs->next].cache == cache + i &&
+		    jobs->job[jobs->next].it == sub->cache_tree) {
+			struct update_job *job = &jobs->job[jobs->next++];
+
+			subcnt = job->ret;
+			subskip = job->skip;
+		} else
+			subcnt = update_one(sub->cache_tree,
+					    cache + i, entries - i,
+					    path,
+					    baselen + sublen + 1,
+					    &subskip,
+					    flags, jobs);
 		if (subcnt < 0)
 			return subcnt;
 		if (!subcnt)
@@ -367,6 +415,7 @@ static int update_one(struct cache_tree *it,
 		unsigned mode;
 		int expected_missing = 0;
 		int contains_ita = 0;
+		int known_to_exist = 0;
 		int ce_missing_ok;
 
 		path = ce->name;
@@ -398,12 +447,14 @@ static int update_one(struct cache_tree *it,
 			 * In Bench repositories, check if this object is actually a manifest.
 			 * If so, update the mode to use S_IFMANIFEST instead of S_IFREG.
 			 */
-			if (repo_has_bench_extensions(the_repository) && S_ISREG(mode)) {
+			if (bench && S_ISREG(mode)) {
 				enum object_type actual_type = oid_object_info(the_repository, oid, NULL);
 				if (actual_type == OBJ_MANIFEST) {
 					/* Convert regular file mode to manifest mode */
 					mode = S_IFMANIFEST | (mode & 0777);
 				}
+				/* no need to look the object up again below */
+				known_to_exist = actual_type > 0;
 			}
 			
 			entlen = pathlen - baselen;
@@ -413,7 +464,7 @@ static int update_one(struct cache_tree *it,
 		ce_missing_ok = mode == S_IFGITLINK || missing_ok ||
 			!must_check_existence(ce);
 		if (is_null_oid(oid) ||
-		    (!ce_missing_ok &&
+		    (!ce_missing_ok && !known_to_exist &&
 		     !odb_has_object(the_repository->objects, oid,
 				     HAS_OBJECT_RECHECK_PACKED | HAS_OBJECT_FETCH_PROMISOR))) {
 			strbuf_release(&buffer);
@@ -487,9 +538,159 @@ static int update_one(struct cache_tree *it,
 	return i;
 }
 
+static int cache_tree_is_valid(struct cache_tree *it)
+{
+	return 0 <= it->entry_count &&
+		odb_has_object(the_repository->objects, &it->oid,
+			       HAS_OBJECT_RECHECK_PACKED | HAS_OBJECT_FETCH_PROMISOR);
+}
+
+/*
+ * Walk down the invalid trees like update_one() does, and queue a job
+ * for each subtree with no more than "split" entries, or that cannot
+ * be split further.  Valid subtrees are queued too; the job finds out
+ * quickly that there is nothing to do.
+ */
+static void collect_update_jobs(struct update_jobs *jobs,
+				struct cache_tree *it,
+				struct cache_entry **cache, int entries,
+				const char *base, int baselen, int split)
+{
+	int i = 0;
+
+	while (i < entries) {
+		const struct cache_entry *ce = cache[i];
+		struct cache_tree_sub *sub;
+		const char *path, *slash;
+		int pathlen, sublen, cnt;
+
+		path = ce->name;
+		pathlen = ce_namelen(ce);
+		if (pathlen <= baselen || memcmp(base, path, baselen))
+			break;
+
+		slash = strchr(path + baselen, '/');
+		if (!slash) {
+			i++;
+			continue;
+		}
+		sublen = slash - (path + baselen);
+		for (cnt = 1; i + cnt < entries; cnt++) {
+			const struct cache_entry *next = cache[i + cnt];
+
+			if (ce_namelen(next) <= baselen + sublen + 1 ||
+			    memcmp(next->name, path, baselen + sublen + 1))
+				break;
+		}
+
+		sub = find_subtree(it, path + baselen, sublen, 1);
+		if (!sub->cache_tree)
+			sub->cache_tree = cache_tree();
+		if (cnt > split && !S_ISSPARSEDIR(ce->ce_mode) &&
+		    !cache_tree_is_valid(sub->cache_tree)) {
+			collect_update_jobs(jobs, sub->cache_tree, cache + i, cnt,
+					    path, baselen + sublen + 1, split);
+		} else {
+			struct update_job *job;
+
+			ALLOC_GROW(jobs->job, jobs->nr + 1, jobs->alloc);
+			job = &jobs->job[jobs->nr++];
+			job->it = sub->cache_tree;
+			job->cache = cache + i;
+			job->entries = entries - i;
+			job->base = path;
+			job->baselen = baselen + sublen + 1;
+		}
+		i += cnt;
+	}
+}
+
+static void *update_thread(void *data)
+{
+	struct update_jobs *jobs = data;
+
+	for (;;) {
+		struct update_job *job;
+
+		pthread_mutex_lock(&jobs->mutex);
+		job = jobs->taken < jobs->nr ? &jobs->job[jobs->taken++] : NULL;
+		pthread_mutex_unlock(&jobs->mutex);
+		if (!job)
+			return NULL;
+		job->ret = update_one(job->it, job->cache, job->entries,
+				      job->base, job->baselen, &job->skip,
+				      jobs->flags, NULL);
+	}
+}
+
+static int update_nr_threads(struct index_state *istate)
+{
+	int nr_threads, max;
+
+	if (!HAVE_THREADS)
+		return 1;
+	nr_threads = git_env_ulong("GIT_TEST_CACHE_TREE_THREADS", 0);
+	if (nr_threads)
+		return nr_threads;
+	if (repo_config_get_index_threads(the_repository, &nr_threads))
+		nr_threads = 0;
+	max = istate->cache_nr / UPDATE_THREAD_COST;
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads > max)
+		nr_threads = max;
+	return nr_threads;
+}
+
+/*
+ * Rebuild the subtrees of the invalid trees on "nr_threads" threads,
+ * leaving the jobs for the main pass to pick up.
+ */
+static void update_subtrees_threaded(struct index_state *istate,
+				     struct update_jobs *jobs,
+				     int nr_threads, int flags)
+{
+	int split = istate->cache_nr / (nr_threads * UPDATE_JOBS_PER_THREAD);
+	pthread_t *threads;
+	int i;
+
+	collect_update_jobs(jobs, istate->cache_tree, istate->cache,
+			    istate->cache_nr, "", 0, split);
+	if (jobs->nr < 2)
+		return;
+	if (nr_threads > jobs->nr)
+		nr_threads = jobs->nr;
+
+	/* read lazily initialized state before the threads look at it */
+	repo_has_promisor_remote(the_repository);
+	repo_has_bench_extensions(the_repository);
+
+	jobs->flags = flags;
+	pthread_mutex_init(&jobs->mutex, NULL);
+	enable_obj_read_lock();
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL, update_thread, jobs);
+		if (err)
+			die(_("unable to create cache-tree thread: %s"),
+			    strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i], NULL))
+			die(_("unable to join cache-tree thread"));
+	free(threads);
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&jobs->mutex);
+	trace2_data_intmax("cache_tree", the_repository, "update/jobs",
+			   jobs->nr);
+	trace2_data_intmax("cache_tree", the_repository, "update/threads",
+			   nr_threads);
+}
+
 int cache_tree_update(struct index_state *istate, int flags)
 {
-	int skip, i;
+	struct update_jobs jobs = { 0 };
+	int skip, i, nr_threads;
 
 	i = verify_cache(istate, flags);
 
@@ -505,9 +706,13 @@ int cache_tree_update(struct index_state *istate, int flags)
 	trace_performance_enter();
 	trace2_region_enter("cache_tree", "update", the_repository);
 	begin_odb_transaction();
+	nr_threads = update_nr_threads(istate);
+	if (nr_threads > 1 && !cache_tree_is_valid(istate->cache_tree))
+		update_subtrees_threaded(istate, &jobs, nr_threads, flags);
 	i = update_one(istate->cache_tree, istate->cache, istate->cache_nr,
-		       "", 0, &skip, flags);
+		       "", 0, &skip, flags, jobs.nr > 1 ? &jobs : NULL);
 	end_odb_transaction();
+	free(jobs.job);
 	trace2_region_leave("cache_tree", "update", the_repository);
 	trace_performance_leave("cache_tree_update");
 	if (i < 0)
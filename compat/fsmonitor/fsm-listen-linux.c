@@ -0,0 +1,563 @@
+#include "git-compat-util.h"
+#include "dir.h"
+#include "fsmonitor-ll.h"
+#include "fsm-listen.h"
+#include "fsmonitor--daemon.h"
+#include "fsmonitor-path-utils.h"
+#include "gettext.h"
+#include "hashmap.h"
+#include "simple-ipc.h"
+#include "string-list.h"
+#include "trace.h"
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+/*
+ * inotify watches single directories rather than trees, so we add a
+ * watch for every directory of the worktree (and for new directories
+ * as they appear), and map each watch descriptor back to the absolute
+ * path of its directory to make sense of the events.
+ *
+ * In <gitdir>, we only watch the cookie directory, and <gitdir> itself
+ * for its deletion.
+ */
+struct watch_entry {
+	struct hashmap_entry ent;
+	int wd;
+	char *path;
+};
+
+struct fsm_listen_data
+{
+	int fd_inotify;
+	int fd_stop[2];
+	char *buf;
+
+	struct hashmap watches;
+	int wd_worktree;
+	int wd_gitdir;
+
+	enum shutdown_style {
+		SHUTDOWN_EVENT = 0,
+		FORCE_SHUTDOWN,
+		FORCE_ERROR_STOP,
+	} shutdown_style;
+};
+
+/* Room for at least a few hundred events with their names */
+#define EVENT_BUF_SIZE (64 * 1024)
+
+#define WATCH_DIR_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+			IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | \
+			IN_DELETE_SELF | IN_MOVE_SELF | \
+			IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+#define WATCH_ROOT_MASK (IN_DELETE_SELF | IN_MOVE_SELF | \
+			 IN_ONLYDIR | IN_DONT_FOLLOW)
+
+static int watch_entry_cmp(const void *cmp_data UNUSED,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *keydata UNUSED)
+{
+	const struct watch_entry *a, *b;
+
+	a = container_of(eptr, const struct watch_entry, ent);
+	b = container_of(entry_or_key, const struct watch_entry, ent);
+	return a->wd != b->wd;
+}
+
+static struct watch_entry *find_watch(struct fsm_listen_data *data, int wd)
+{
+	struct watch_entry key;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+	return hashmap_get_entry(&data->watches, &key, ent, NULL);
+}
+
+static void forget_watch(struct fsm_listen_data *data, int wd)
+{
+	struct watch_entry key, *w;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+	w = hashmap_remove_entry(&data->watches, &key, ent, NULL);
+	if (w) {
+		free(w->path);
+		free(w);
+	}
+}
+
+/*
+ * Watch the directory "path". Adding a watch for a directory that is
+ * already watched (after a rename, or when rescanning after an
+ * overflow) returns the same descriptor; only its path is updated.
+ *
+ * Returns the watch descriptor, 0 if the directory vanished in the
+ * meantime, or -1 on error.
+ */
+static int add_watch(struct fsm_listen_data *data, const char *path,
+		     uint32_t mask)
+{
+	struct watch_entry *w;
+	int wd;
+
+	wd = inotify_add_watch(data->fd_inotify, path, mask);
+	if (wd < 0) {
+		if (errno == ENOENT || errno == ENOTDIR)
+			return 0;
+		if (errno == ENOSPC)
+			return error(_("cannot watch '%s': out of inotify watches; "
+				       "see /proc/sys/fs/inotify/max_user_watches"),
+				     path);
+		return error_errno(_("inotify_add_watch('%s') failed"), path);
+	}
+
+	w = find_watch(data, wd);
+	if (w) {
+		if (strcmp(w->path, path)) {
+			free(w->path);
+			w->path = xstrdup(path);
+		}
+		return wd;
+	}
+
+	CALLOC_ARRAY(w, 1);
+	hashmap_entry_init(&w->ent, memhash(&wd, sizeof(wd)));
+	w->wd = wd;
+	w->path = xstrdup(path);
+	hashmap_add(&data->watches, &w->ent);
+	return wd;
+}
+
+/*
+ * Watch the directory "path" and all directories below it that are
+ * part of the worktree proper. "path" is used as scratch space and
+ * restored before returning.
+ */
+static int watch_tree(struct fsmonitor_daemon_state *state,
+		      struct strbuf *path)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	size_t len = path->len;
+	struct dirent *de;
+	DIR *dir;
+	int ret = 0;
+
+	ret = add_watch(data, path->buf, WATCH_DIR_MASK);
+	if (ret <= 0)
+		return ret;
+	ret = 0;
+
+	dir = opendir(path->buf);
+	if (!dir)
+		return 0; /* removed since, its parent tells us */
+
+	while (!ret && (de = readdir(dir))) {
+		struct stat st;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN)
+			continue;
+
+		strbuf_setlen(path, len);
+		strbuf_addch(path, '/');
+		strbuf_addstr(path, de->d_name);
+
+		if (de->d_type == DT_UNKNOWN &&
+		    (lstat(path->buf, &st) || !S_ISDIR(st.st_mode)))
+			continue;
+
+		/* <gitdir> is watched on its own, see fsm_listen__loop() */
+		if (fsmonitor_classify_path_absolute(state, path->buf) !=
+		    IS_WORKDIR_PATH)
+			continue;
+
+		ret = watch_tree(state, path);
+	}
+	strbuf_setlen(path, len);
+	closedir(dir);
+	return ret;
+}
+
+/*
+ * A directory was moved away: its watches (and those below it) now
+ * describe paths that no longer exist. Drop them; if the directory was
+ * moved elsewhere in the worktree, IN_MOVED_TO watches it again.
+ */
+static void unwatch_tree(struct fsm_listen_data *data, const char *path)
+{
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+	size_t len = strlen(path);
+	int *wds = NULL;
+	size_t nr = 0, alloc = 0;
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent) {
+		if (strncmp(w->path, path, len) ||
+		    (w->path[len] && w->path[len] != '/'))
+			continue;
+		ALLOC_GROW(wds, nr + 1, alloc);
+		wds[nr++] = w->wd;
+	}
+	for (size_t i = 0; i < nr; i++) {
+		inotify_rm_watch(data->fd_inotify, wds[i]);
+		forget_watch(data, wds[i]);
+	}
+	free(wds);
+}
+
+static void log_mask_set(const char *path, uint32_t mask)
+{
+	struct strbuf msg = STRBUF_INIT;
+
+	if (mask & IN_ACCESS)
+		strbuf_addstr(&msg, "IN_ACCESS|");
+	if (mask & IN_MODIFY)
+		strbuf_addstr(&msg, "IN_MODIFY|");
+	if (mask & IN_ATTRIB)
+		strbuf_addstr(&msg, "IN_ATTRIB|");
+	if (mask & IN_CLOSE_WRITE)
+		strbuf_addstr(&msg, "IN_CLOSE_WRITE|");
+	if (mask & IN_MOVED_FROM)
+		strbuf_addstr(&msg, "IN_MOVED_FROM|");
+	if (mask & IN_MOVED_TO)
+		strbuf_addstr(&msg, "IN_MOVED_TO|");
+	if (mask & IN_CREATE)
+		strbuf_addstr(&msg, "IN_CREATE|");
+	if (mask & IN_DELETE)
+		strbuf_addstr(&msg, "IN_DELETE|");
+	if (mask & IN_DELETE_SELF)
+		strbuf_addstr(&msg, "IN_DELETE_SELF|");
+	if (mask & IN_MOVE_SELF)
+		strbuf_addstr(&msg, "IN_MOVE_SELF|");
+	if (mask & IN_UNMOUNT)
+		strbuf_addstr(&msg, "IN_UNMOUNT|");
+	if (mask & IN_Q_OVERFLOW)
+		strbuf_addstr(&msg, "IN_Q_OVERFLOW|");
+	if (mask & IN_IGNORED)
+		strbuf_addstr(&msg, "IN_IGNORED|");
+	if (mask & IN_ISDIR)
+		strbuf_addstr(&msg, "IN_ISDIR|");
+
+	trace_printf_key(&trace_fsmonitor, "inotify: '%s', mask=0x%x %s",
+			 path, mask, msg.buf);
+
+	strbuf_release(&msg);
+}
+
+/*
+ * Read the pending events and publish them as one batch.
+ *
+ * Returns 0 on success, or -1 after setting data->shutdown_style if
+ * the daemon has to stop.
+ */
+static int process_events(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct fsmonitor_batch *batch = NULL;
+	struct string_list cookie_list = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+	const struct inotify_event *ev;
+	int rescan = 0;
+	ssize_t len;
+	char *p;
+
+	len = read(data->fd_inotify, data->buf, EVENT_BUF_SIZE);
+	if (len < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 0;
+		error_errno(_("could not read inotify events"));
+		data->shutdown_style = FORCE_ERROR_STOP;
+		return -1;
+	}
+
+	for (p = data->buf; p < data->buf + len;
+	     p += sizeof(*ev) + ev->len) {
+		struct watch_entry *w;
+		const char *rel;
+
+		ev = (const struct inotify_event *)p;
+
+		/*
+		 * The kernel queue overflowed and events were lost. Flush
+		 * our cached data like the other backends do when they
+		 * drop events, and catch up with any directory created
+		 * meanwhile once this buffer is processed.
+		 */
+		if (ev->mask & IN_Q_OVERFLOW) {
+			trace_printf_key(&trace_fsmonitor, "inotify: overflow");
+			fsmonitor_force_resync(state);
+			fsmonitor_batch__free_list(batch);
+			string_list_clear(&cookie_list, 0);
+			batch = NULL;
+			rescan = 1;
+			continue;
+		}
+		if (ev->mask & IN_IGNORED) {
+			forget_watch(data, ev->wd);
+			continue;
+		}
+
+		w = find_watch(data, ev->wd);
+		if (!w)
+			continue; /* queued before we dropped the watch */
+
+		if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT)) {
+			/*
+			 * Other directories are reported by their parent,
+			 * but the roots have no watched parent. The Unix
+			 * domain socket is inside <gitdir>; clients would
+			 * not find us anymore.
+			 */
+			if (ev->wd == data->wd_worktree ||
+			    ev->wd == data->wd_gitdir) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: root '%s' went away",
+						 w->path);
+				goto force_shutdown;
+			}
+			continue;
+		}
+		if (!ev->len)
+			continue; /* the directory itself; its parent reports it */
+
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", w->path, ev->name);
+
+		switch (fsmonitor_classify_path_absolute(state, path.buf)) {
+
+		case IS_INSIDE_DOT_GIT_WITH_COOKIE_PREFIX:
+		case IS_INSIDE_GITDIR_WITH_COOKIE_PREFIX:
+			/* special case cookie files within .git or gitdir */
+
+			/* Use just the filename of the cookie file. */
+			string_list_append(&cookie_list, ev->name);
+			break;
+
+		case IS_INSIDE_DOT_GIT:
+		case IS_INSIDE_GITDIR:
+			/* ignore all other paths inside of .git or gitdir */
+			break;
+
+		case IS_DOT_GIT:
+		case IS_GITDIR:
+			/*
+			 * If .git directory is deleted or renamed away,
+			 * we have to quit.
+			 */
+			if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: gitdir removed or renamed");
+				goto force_shutdown;
+			}
+			break;
+
+		case IS_WORKDIR_PATH:
+			if (trace_pass_fl(&trace_fsmonitor))
+				log_mask_set(path.buf, ev->mask);
+
+			if (!batch)
+				batch = fsmonitor_batch__new();
+			rel = path.buf + state->path_worktree_watch.len + 1;
+
+			if (!(ev->mask & IN_ISDIR)) {
+				fsmonitor_batch__add_path(batch, rel);
+				break;
+			}
+
+			/*
+			 * Report directories with a trailing slash so that
+			 * clients invalidate everything below them: what
+			 * was created inside a new directory before we
+			 * could watch it never gets an event of its own.
+			 */
+			strbuf_addch(&path, '/');
+			fsmonitor_batch__add_path(batch, rel);
+			strbuf_setlen(&path, path.len - 1);
+
+			if (ev->mask & IN_MOVED_FROM)
+				unwatch_tree(data, path.buf);
+			if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) &&
+			    watch_tree(state, &path) < 0)
+				goto force_error_stop;
+			break;
+
+		case IS_OUTSIDE_CONE:
+		default:
+			trace_printf_key(&trace_fsmonitor,
+					 "ignoring '%s'", path.buf);
+			break;
+		}
+	}
+
+	if (rescan) {
+		strbuf_reset(&path);
+		strbuf_addbuf(&path, &state->path_worktree_watch);
+		if (watch_tree(state, &path) < 0)
+			goto force_error_stop;
+	}
+
+	fsmonitor_publish(state, batch, &cookie_list);
+	string_list_clear(&cookie_list, 0);
+	strbuf_release(&path);
+	return 0;
+
+force_error_stop:
+	data->shutdown_style = FORCE_ERROR_STOP;
+	goto stop;
+force_shutdown:
+	data->shutdown_style = FORCE_SHUTDOWN;
+stop:
+	fsmonitor_batch__free_list(batch);
+	string_list_clear(&cookie_list, 0);
+	strbuf_release(&path);
+	return -1;
+}
+
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	CALLOC_ARRAY(data, 1);
+	data->fd_stop[0] = data->fd_stop[1] = -1;
+	hashmap_init(&data->watches, watch_entry_cmp, NULL, 0);
+
+	data->fd_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (data->fd_inotify < 0) {
+		error_errno(_("inotify_init1() failed"));
+		goto failed;
+	}
+	if (pipe(data->fd_stop) < 0) {
+		error_errno(_("could not create shutdown pipe"));
+		goto failed;
+	}
+	data->buf = xmalloc(EVENT_BUF_SIZE);
+
+	state->listen_data = data;
+	return 0;
+
+failed:
+	if (data->fd_inotify >= 0)
+		close(data->fd_inotify);
+	hashmap_clear(&data->watches);
+	free(data);
+	return -1;
+}
+
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+
+	if (!state || !state->listen_data)
+		return;
+
+	data = state->listen_data;
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent)
+		free(w->path);
+	hashmap_clear_and_free(&data->watches, struct watch_entry, ent);
+
+	close(data->fd_inotify);
+	close(data->fd_stop[0]);
+	close(data->fd_stop[1]);
+	free(data->buf);
+
+	FREE_AND_NULL(state->listen_data);
+}
+
+void fsm_listen__stop_async(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	data = state->listen_data;
+
+	data->shutdown_style = SHUTDOWN_EVENT;
+	if (write(data->fd_stop[1], "", 1) < 0)
+		warning_errno(_("could not stop the inotify listener"));
+}
+
+void fsm_listen__loop(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct strbuf path = STRBUF_INIT;
+
+	data = state->listen_data;
+
+	/*
+	 * Watch everything before we serve clients, or changes made
+	 * before the first query could go unnoticed. This is where
+	 * the daemon spends its startup time on a large worktree.
+	 */
+	data->wd_worktree = add_watch(data, state->path_worktree_watch.buf,
+				      WATCH_DIR_MASK);
+	strbuf_addbuf(&path, &state->path_worktree_watch);
+	if (data->wd_worktree <= 0 || watch_tree(state, &path) < 0)
+		goto force_error_stop_without_loop;
+
+	data->wd_gitdir = add_watch(data, state->path_gitdir_watch.buf,
+				    WATCH_ROOT_MASK);
+	if (data->wd_gitdir <= 0)
+		goto force_error_stop_without_loop;
+
+	strbuf_reset(&path);
+	strbuf_addbuf(&path, &state->path_cookie_prefix);
+	strbuf_strip_suffix(&path, "/");
+	if (add_watch(data, path.buf, WATCH_DIR_MASK) <= 0)
+		goto force_error_stop_without_loop;
+	strbuf_release(&path);
+
+	trace_printf_key(&trace_fsmonitor, "inotify: watching %u directories",
+			 hashmap_get_size(&data->watches));
+
+	/*
+	 * Our fs event listener is now running, so it's safe to start
+	 * serving client requests.
+	 */
+	ipc_server_start_async(state->ipc_server_data);
+
+	for (;;) {
+		struct pollfd pfd[2];
+
+		pfd[0].fd = data->fd_inotify;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = data->fd_stop[0];
+		pfd[1].events = POLLIN;
+
+		if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error_errno(_("could not poll for inotify events"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+		if (pfd[1].revents)
+			break;
+		if ((pfd[0].revents & POLLIN) && process_events(state) < 0)
+			break;
+	}
+
+	switch (data->shutdown_style) {
+	case FORCE_ERROR_STOP:
+		state->listen_error_code = -1;
+		/* fall thru */
+	case FORCE_SHUTDOWN:
+		ipc_server_stop_async(state->ipc_server_data);
+		/* fall thru */
+	case SHUTDOWN_EVENT:
+	default:
+		break;
+	}
+	return;
+
+force_error_stop_without_loop:
+	strbuf_release(&path);
+	state->listen_error_code = -1;
+	ipc_server_stop_async(state->ipc_server_data);
+	return;
+}
@@ -0,0 +1,92 @@
+#include "git-compat-util.h"
+#include "fsmonitor-ll.h"
+#include "fsmonitor-path-utils.h"
+#include "gettext.h"
+#include "trace.h"
+#include <sys/vfs.h>
+
+/*
+ * Linux has no f_fstypename in "struct statfs", only the magic number
+ * of the filesystem, so name the ones we care about here: those that
+ * can be changed behind the back of inotify from another machine, and
+ * those that cannot hold the Unix domain socket.
+ */
+static const struct {
+	unsigned long magic;
+	const char *typename;
+	int is_remote;
+} fs_types[] = {
+	{ 0x6969, "nfs", 1 },			/* NFS_SUPER_MAGIC */
+	{ 0x517b, "smbfs", 1 },			/* SMB_SUPER_MAGIC */
+	{ 0xff534d42, "cifs", 1 },		/* CIFS_SUPER_MAGIC */
+	{ 0xfe534d42, "smb2", 1 },		/* SMB2_SUPER_MAGIC */
+	{ 0x73757245, "coda", 1 },		/* CODA_SUPER_MAGIC */
+	{ 0x5346414f, "afs", 1 },		/* AFS_SUPER_MAGIC */
+	{ 0x6b414653, "afs", 1 },		/* AFS_FS_MAGIC */
+	{ 0x01021997, "9p", 1 },		/* V9FS_MAGIC */
+	{ 0x47504653, "gpfs", 1 },		/* GPFS_SUPER_MAGIC */
+	{ 0x0bd00bd0, "lustre", 1 },		/* LL_SUPER_MAGIC */
+	{ 0x00c36400, "ceph", 1 },		/* CEPH_SUPER_MAGIC */
+	{ 0x4d44, "msdos", 0 },			/* MSDOS_SUPER_MAGIC */
+	{ 0x5346544e, "ntfs", 0 },		/* NTFS_SB_MAGIC */
+	{ 0x65735546, "fuse", 0 },		/* FUSE_SUPER_MAGIC */
+};
+
+int fsmonitor__get_fs_info(const char *path, struct fs_info *fs_info)
+{
+	struct statfs fs;
+	size_t i;
+
+	if (statfs(path, &fs) == -1) {
+		int saved_errno = errno;
+		trace_printf_key(&trace_fsmonitor, "statfs('%s') failed: %s",
+				 path, strerror(saved_errno));
+		errno = saved_errno;
+		return -1;
+	}
+
+	fs_info->is_remote = 0;
+	fs_info->typename = NULL;
+	for (i = 0; i < ARRAY_SIZE(fs_types); i++) {
+		if ((unsigned long)fs.f_type != fs_types[i].magic)
+			continue;
+		fs_info->is_remote = fs_types[i].is_remote;
+		fs_info->typename = xstrdup(fs_types[i].typename);
+		break;
+	}
+	if (!fs_info->typename)
+		fs_info->typename = xstrfmt("0x%08lx", (unsigned long)fs.f_type);
+
+	trace_printf_key(&trace_fsmonitor,
+			 "statfs('%s') [type 0x%08lx] '%s' is_remote: %d",
+			 path, (unsigned long)fs.f_type, fs_info->typename,
+			 fs_info->is_remote);
+	return 0;
+}
+
+int fsmonitor__is_fs_remote(const char *path)
+{
+	struct fs_info fs;
+	if (fsmonitor__get_fs_info(path, &fs))
+		return -1;
+
+	free(fs.typename);
+
+	return fs.is_remote;
+}
+
+/*
+ * Linux has no firmlinks; bind mounts and symlinks to the worktree are
+ * resolved by the real path the daemon watches.
+ */
+int fsmonitor__get_alias(const char *path UNUSED,
+			 struct alias_info *info UNUSED)
+{
+	return 0;
+}
+
+char *fsmonitor__resolve_alias(const char *path UNUSED,
+			       const struct alias_info *info UNUSED)
+{
+	return NULL;
+}
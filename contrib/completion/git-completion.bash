@@ -1631,7 +1631,7 @@ _git_bisect ()
 	esac
 }
 
-__git_ref_fieldlist="refname objecttype objectsize objectname upstream push HEAD symref"
+__git_ref_fieldlist="refname objecttype objectsize objectname logicalsize filecount upstream push HEAD symref"
 
 _git_branch ()
 {
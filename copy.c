@@ -6,6 +6,9 @@
 #include "gettext.h"
 #include "strbuf.h"
 #include "abspath.h"
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
 
 int copy_fd(int ifd, int ofd)
 {
@@ -22,6 +25,48 @@ int copy_fd(int ifd, int ofd)
 	return 0;
 }
 
+int copy_fd_range(int ifd, off_t offset, size_t len, int ofd)
+{
+	char buffer[8192];
+
+#ifdef HAVE_COPY_FILE_RANGE
+	while (len) {
+		ssize_t copied = copy_file_range(ifd, &offset, ofd, NULL,
+						 len, 0);
+		if (copied <= 0) {
+			if (copied < 0 && errno == EINTR)
+				continue;
+			/* not supported between these files; try the next way */
+			break;
+		}
+		len -= copied;
+	}
+#endif
+#ifdef HAVE_SENDFILE
+	while (len) {
+		ssize_t copied = sendfile(ofd, ifd, &offset, len);
+		if (copied <= 0) {
+			if (copied < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+		len -= copied;
+	}
+#endif
+	while (len) {
+		ssize_t got = pread_in_full(ifd, buffer,
+					    len < sizeof(buffer) ? len : sizeof(buffer),
+					    offset);
+		if (got <= 0)
+			return COPY_READ_ERROR;
+		if (write_in_full(ofd, buffer, got) < 0)
+			return COPY_WRITE_ERROR;
+		offset += got;
+		len -= got;
+	}
+	return 0;
+}
+
 static int copy_times(const char *dst, const char *src)
 {
 	struct stat st;
@@ -4,6 +4,15 @@
 #define COPY_READ_ERROR (-2)
 #define COPY_WRITE_ERROR (-3)
 int copy_fd(int ifd, int ofd);
+
+/*
+ * Copy "len" bytes starting at "offset" in "ifd" to the current
+ * position of "ofd", letting the kernel move the data (and share
+ * extents on filesystems that support it) where possible. The file
+ * position of "ifd" is left untouched. Returns 0 on success, or
+ * COPY_READ_ERROR / COPY_WRITE_ERROR.
+ */
+int copy_fd_range(int ifd, off_t offset, size_t len, int ofd);
 int copy_file(const char *dst, const char *src, int mode);
 int copy_file_with_time(const char *dst, const char *src, int mode);
 
@@ -9,6 +9,7 @@
  */
 
 #include "git-compat-util.h"
+#include "copy.h"
 #include "csum-file.h"
 #include "git-zlib.h"
 #include "hash.h"
@@ -55,6 +56,32 @@ void hashflush(struct hashfile *f)
 	}
 }
 
+void hashwrite_unhashed(struct hashfile *f, const void *buf, unsigned int count)
+{
+	hashflush(f);
+	if (f->do_crc)
+		f->crc32 = crc32(f->crc32, buf, count);
+	flush(f, buf, count);
+}
+
+void hashcopy_unhashed(struct hashfile *f, int fd, off_t offset, size_t len)
+{
+	if (0 <= f->check_fd || f->do_crc)
+		BUG("cannot copy into a checked hashfile");
+	hashflush(f);
+	if (copy_fd_range(fd, offset, len, f->fd))
+		die_errno("sha1 file '%s' write error", f->name);
+	f->total += len;
+	display_throughput(f->tp, f->total);
+}
+
+void hashfile_update(struct hashfile *f, const void *buf, size_t len)
+{
+	hashflush(f);
+	if (!f->skip_hash)
+		git_hash_update(&f->ctx, buf, len);
+}
+
 void free_hashfile(struct hashfile *f)
 {
 	free(f->buffer);
@@ -65,6 +65,20 @@ int finalize_hashfile(struct hashfile *, unsigned char *, enum fsync_component,
 void discard_hashfile(struct hashfile *);
 void hashwrite(struct hashfile *, const void *, unsigned int);
 void hashflush(struct hashfile *f);
+
+/*
+ * Write data that is covered by checksums of its own, which the caller
+ * feeds to the file's checksum in its place with hashfile_update().
+ * Both flush what is buffered first, so that the checksum is still
+ * computed in file order.  hashcopy_unhashed() copies the data from a
+ * range of another file, possibly without reading it (see
+ * copy_fd_range()).
+ */
+void hashwrite_unhashed(struct hashfile *f, const void *buf, unsigned int count);
+void hashcopy_unhashed(struct hashfile *f, int fd, off_t offset, size_t len);
+
+/* Feed data to the checksum without writing it. */
+void hashfile_update(struct hashfile *f, const void *buf, size_t len);
 void crc32_begin(struct hashfile *);
 uint32_t crc32_end(struct hashfile *);
 
@@ -16,6 +16,7 @@
 #include "dir.h"
 #include "environment.h"
 #include "gettext.h"
+#include "hashmap.h"
 #include "name-hash.h"
 #include "object-file.h"
 #include "path.h"
@@ -23,6 +24,7 @@
 #include "repository.h"
 #include "wildmatch.h"
 #include "pathspec.h"
+#include "pattern-index.h"
 #include "utf8.h"
 #include "varint.h"
 #include "ewah/ewok.h"
@@ -32,6 +34,7 @@
 #include "sparse-index.h"
 #include "submodule-config.h"
 #include "symlinks.h"
+#include "thread-utils.h"
 #include "trace2.h"
 #include "tree.h"
 #include "hex.h"
@@ -60,6 +63,8 @@ enum path_treatment {
  */
 struct cached_dir {
 	DIR *fdir;
+	struct dir_listing *listing;
+	size_t listing_pos;
 	struct untracked_cache_dir *untracked;
 	int nr_files;
 	int nr_dirs;
@@ -992,6 +997,7 @@ void clear_pattern_list(struct pattern_list *pl)
 	for (i = 0; i < pl->nr; i++)
 		free(pl->patterns[i]);
 	free(pl->patterns);
+	pattern_index_free(pl->index);
 	clear_pattern_entry_hashmap(&pl->recursive_hashmap);
 	clear_pattern_entry_hashmap(&pl->parent_hashmap);
 
@@ -1028,14 +1034,17 @@ static void trim_trailing_spaces(char *buf)
  *
  * If "name" has the trailing slash, it'll be excluded in the search.
  */
-static struct untracked_cache_dir *lookup_untracked(struct untracked_cache *uc,
-						    struct untracked_cache_dir *dir,
-						    const char *name, int len)
+/*
+ * Find the subdirectory "name" of "dir" in the untracked cache. If it
+ * is not there, return NULL and store where it would go in "pos".
+ */
+static struct untracked_cache_dir *find_untracked(struct untracked_cache_dir *dir,
+						  const char *name, int len,
+						  int *pos)
 {
 	int first, last;
 	struct untracked_cache_dir *d;
-	if (!dir)
-		return NULL;
+
 	if (len && name[len - 1] == '/')
 		len--;
 	first = 0;
@@ -1054,6 +1063,23 @@ static struct untracked_cache_dir *lookup_untracked(struct untracked_cache *uc,
 		}
 		first = next+1;
 	}
+	*pos = first;
+	return NULL;
+}
+
+static struct untracked_cache_dir *lookup_untracked(struct untracked_cache *uc,
+						    struct untracked_cache_dir *dir,
+						    const char *name, int len)
+{
+	int first;
+	struct untracked_cache_dir *d;
+	if (!dir)
+		return NULL;
+	d = find_untracked(dir, name, len, &first);
+	if (d)
+		return d;
+	if (len && name[len - 1] == '/')
+		len--;
 
 	uc->dir_created++;
 	FLEX_ALLOC_MEM(d, name, name, len);
@@ -1379,6 +1405,59 @@ int match_pathname(const char *pathname, int pathlen,
 				 WM_PATHNAME) == 0;
 }
 
+static int path_pattern_matches(struct path_pattern *pattern,
+				const char *pathname, int pathlen,
+				const char *basename, int *dtype,
+				struct index_state *istate)
+{
+	const char *exclude = pattern->pattern;
+	int prefix = pattern->nowildcardlen;
+
+	if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
+		*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
+		if (*dtype != DT_DIR)
+			return 0;
+	}
+
+	if (pattern->flags & PATTERN_FLAG_NODIR)
+		return match_basename(basename,
+				      pathlen - (basename - pathname),
+				      exclude, prefix, pattern->patternlen,
+				      pattern->flags);
+
+	assert(pattern->baselen == 0 ||
+	       pattern->base[pattern->baselen - 1] == '/');
+	return match_pathname(pathname, pathlen,
+			      pattern->base,
+			      pattern->baselen ? pattern->baselen - 1 : 0,
+			      exclude, prefix, pattern->patternlen);
+}
+
+/*
+ * (Re)build the index of a long pattern list if patterns were added
+ * since it was last built.
+ */
+static struct pattern_index *prepare_pattern_index(struct pattern_list *pl)
+{
+	int i;
+
+	if (pl->nr < PATTERN_INDEX_MIN_PATTERNS || !pattern_index_enabled())
+		return NULL;
+	if (pl->index && pattern_index_nr(pl->index) == pl->nr)
+		return pl->index;
+
+	pattern_index_free(pl->index);
+	pl->index = pattern_index_new();
+	for (i = 0; i < pl->nr; i++) {
+		struct path_pattern *p = pl->patterns[i];
+
+		pattern_index_add(pl->index, i, p->pattern, p->patternlen,
+				  p->nowildcardlen, p->flags, p->base,
+				  p->baselen ? p->baselen - 1 : 0);
+	}
+	return pl->index;
+}
+
 /*
  * Scan the given exclude list in reverse to see whether pathname
  * should be ignored.  The first match (i.e. the last on the list), if
@@ -1392,45 +1471,32 @@ static struct path_pattern *last_matching_pattern_from_list(const char *pathname
 						       struct pattern_list *pl,
 						       struct index_state *istate)
 {
-	struct path_pattern *res = NULL; /* undecided */
+	struct pattern_index *index;
 	int i;
 
 	if (!pl->nr)
 		return NULL;	/* undefined */
 
-	for (i = pl->nr - 1; 0 <= i; i--) {
-		struct path_pattern *pattern = pl->patterns[i];
-		const char *exclude = pattern->pattern;
-		int prefix = pattern->nowildcardlen;
-
-		if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
-			*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
-			if (*dtype != DT_DIR)
-				continue;
-		}
-
-		if (pattern->flags & PATTERN_FLAG_NODIR) {
-			if (match_basename(basename,
-					   pathlen - (basename - pathname),
-					   exclude, prefix, pattern->patternlen,
-					   pattern->flags)) {
-				res = pattern;
-				break;
-			}
-			continue;
-		}
-
-		assert(pattern->baselen == 0 ||
-		       pattern->base[pattern->baselen - 1] == '/');
-		if (match_pathname(pathname, pathlen,
-				   pattern->base,
-				   pattern->baselen ? pattern->baselen - 1 : 0,
-				   exclude, prefix, pattern->patternlen)) {
-			res = pattern;
-			break;
-		}
+	index = prepare_pattern_index(pl);
+	if (index) {
+		struct pattern_index_lookup lookup;
+
+		/* Only try the patterns that can match, still in reverse */
+		pattern_index_lookup(index, pathname, pathlen, basename,
+				     &lookup);
+		while ((i = pattern_index_next(&lookup)) >= 0)
+			if (path_pattern_matches(pl->patterns[i], pathname,
+						 pathlen, basename, dtype,
+						 istate))
+				return pl->patterns[i];
+		return NULL;
 	}
-	return res;
+
+	for (i = pl->nr - 1; 0 <= i; i--)
+		if (path_pattern_matches(pl->patterns[i], pathname, pathlen,
+					 basename, dtype, istate))
+			return pl->patterns[i];
+	return NULL;
 }
 
 /*
@@ -2483,6 +2549,335 @@ static void add_untracked(struct untracked_cache_dir *dir, const char *name)
 	dir->untracked[dir->untracked_nr++] = xstrdup(name);
 }
 
+/*
+ * Directory prefetching for read_directory_recursive().
+ *
+ * The traversal itself has to stay on one thread: the exclude stack,
+ * the untracked cache and the result lists all depend on visiting the
+ * directories depth-first and in order.  What dominates on a cold cache
+ * or a network file system, though, is waiting for opendir(), readdir()
+ * and lstat(), and that can be done ahead of time.
+ *
+ * Whenever the traversal reads a directory, it queues the
+ * subdirectories it found.  A pool of threads takes the most recently
+ * queued directory first (which is the one a depth-first traversal will
+ * need soonest), reads it into a dir_listing and resolves unknown
+ * d_types.  When the traversal gets to a directory, it takes the
+ * listing if it is ready, waits for it if a thread is reading it, or
+ * reads it itself if no thread has started on it yet.  The order in
+ * which entries are seen is that of readdir(), so the results are the
+ * same as without prefetching.
+ */
+struct dir_listing_entry {
+	size_t name;	/* offset into dir_listing.names */
+	int d_type;
+};
+
+struct dir_listing {
+	struct dir_listing_entry *entries;
+	size_t nr, alloc;
+	struct strbuf names;
+	struct stat st;	/* of the directory, taken before reading it */
+	int err;	/* errno from lstat() or opendir(), or 0 */
+};
+
+enum prefetch_state {
+	PREFETCH_QUEUED,
+	PREFETCH_READING,
+	PREFETCH_DONE,
+};
+
+struct prefetch_item {
+	struct hashmap_entry ent;
+	enum prefetch_state state;
+	struct dir_listing *listing;
+	char path[FLEX_ARRAY];
+};
+
+struct dir_prefetch {
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct hashmap items;
+	struct prefetch_item **stack;
+	size_t stack_nr, stack_alloc;
+	pthread_t *threads;
+	int nr_threads;
+	int stop;
+};
+
+/* Cap on the number of prefetching threads. */
+#define MAX_PREFETCH_THREADS 32
+
+static int prefetch_item_cmp(const void *cmp_data UNUSED,
+			     const struct hashmap_entry *eptr,
+			     const struct hashmap_entry *entry_or_key,
+			     const void *keydata)
+{
+	const struct prefetch_item *a, *b;
+
+	a = container_of(eptr, const struct prefetch_item, ent);
+	b = container_of(entry_or_key, const struct prefetch_item, ent);
+	return strcmp(a->path, keydata ? (const char *)keydata : b->path);
+}
+
+static void free_dir_listing(struct dir_listing *listing)
+{
+	if (!listing)
+		return;
+	free(listing->entries);
+	strbuf_release(&listing->names);
+	free(listing);
+}
+
+/*
+ * Read the directory "path" into a new listing.  This is called from
+ * the prefetch threads, so it must not touch anything but its
+ * arguments.
+ *
+ * The listing may be used long after it was read, so it carries the
+ * stat data of the directory from before the readdir() for the
+ * untracked cache: if the directory changes in between, the next scan
+ * sees that it did and reads it again.
+ */
+static struct dir_listing *read_dir_listing(const char *path)
+{
+	struct dir_listing *listing = xcalloc(1, sizeof(*listing));
+	struct strbuf sb = STRBUF_INIT;
+	struct dirent *de;
+	size_t baselen;
+	DIR *fdir;
+
+	strbuf_init(&listing->names, 0);
+	if (lstat(path, &listing->st)) {
+		listing->err = errno;
+		return listing;
+	}
+	fdir = opendir(path);
+	if (!fdir) {
+		listing->err = errno;
+		return listing;
+	}
+
+	strbuf_addstr(&sb, path);
+	if (!strcmp(path, "."))
+		strbuf_reset(&sb);
+	baselen = sb.len;
+
+	while ((de = readdir_skip_dot_and_dotdot(fdir))) {
+		struct dir_listing_entry *e;
+		struct stat st;
+
+		ALLOC_GROW(listing->entries, listing->nr + 1, listing->alloc);
+		e = &listing->entries[listing->nr++];
+		e->name = listing->names.len;
+		e->d_type = DTYPE(de);
+		strbuf_addstr(&listing->names, de->d_name);
+		strbuf_addch(&listing->names, '\0');
+
+		if (e->d_type != DT_UNKNOWN)
+			continue;
+		strbuf_setlen(&sb, baselen);
+		strbuf_addstr(&sb, de->d_name);
+		if (lstat(sb.buf, &st))
+			continue;
+		if (S_ISREG(st.st_mode))
+			e->d_type = DT_REG;
+		else if (S_ISDIR(st.st_mode))
+			e->d_type = DT_DIR;
+		else if (S_ISLNK(st.st_mode))
+			e->d_type = DT_LNK;
+	}
+	closedir(fdir);
+	strbuf_release(&sb);
+	return listing;
+}
+
+static void *prefetch_thread(void *data)
+{
+	struct dir_prefetch *p = data;
+
+	pthread_mutex_lock(&p->mutex);
+	for (;;) {
+		struct prefetch_item *item;
+		struct dir_listing *listing;
+
+		while (!p->stop && !p->stack_nr)
+			pthread_cond_wait(&p->work_cond, &p->mutex);
+		if (p->stop)
+			break;
+
+		item = p->stack[--p->stack_nr];
+		item->state = PREFETCH_READING;
+		pthread_mutex_unlock(&p->mutex);
+
+		listing = read_dir_listing(item->path);
+
+		pthread_mutex_lock(&p->mutex);
+		item->listing = listing;
+		item->state = PREFETCH_DONE;
+		pthread_cond_broadcast(&p->done_cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+	return NULL;
+}
+
+static struct dir_prefetch *start_dir_prefetch(int nr_threads)
+{
+	struct dir_prefetch *p;
+	int i;
+
+	if (nr_threads > MAX_PREFETCH_THREADS)
+		nr_threads = MAX_PREFETCH_THREADS;
+
+	CALLOC_ARRAY(p, 1);
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->work_cond, NULL);
+	pthread_cond_init(&p->done_cond, NULL);
+	hashmap_init(&p->items, prefetch_item_cmp, NULL, 0);
+
+	CALLOC_ARRAY(p->threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&p->threads[i], NULL,
+					 prefetch_thread, p);
+		if (err) {
+			warning(_("unable to create prefetch thread: %s"),
+				strerror(err));
+			break;
+		}
+	}
+	p->nr_threads = i;
+	return p;
+}
+
+static void stop_dir_prefetch(struct dir_prefetch *p)
+{
+	struct hashmap_iter iter;
+	struct prefetch_item *item;
+	int i;
+
+	if (!p)
+		return;
+
+	pthread_mutex_lock(&p->mutex);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->work_cond);
+	pthread_mutex_unlock(&p->mutex);
+	for (i = 0; i < p->nr_threads; i++)
+		pthread_join(p->threads[i], NULL);
+
+	/* Listings of directories that the traversal skipped */
+	hashmap_for_each_entry(&p->items, &iter, item, ent)
+		free_dir_listing(item->listing);
+	hashmap_clear_and_free(&p->items, struct prefetch_item, ent);
+
+	pthread_cond_destroy(&p->done_cond);
+	pthread_cond_destroy(&p->work_cond);
+	pthread_mutex_destroy(&p->mutex);
+	free(p->stack);
+	free(p->threads);
+	free(p);
+}
+
+static void queue_dir_prefetch(struct dir_prefetch *p, const char *path)
+{
+	struct prefetch_item *item;
+	unsigned int hash = strhash(path);
+
+	if (hashmap_get_from_hash(&p->items, hash, path))
+		return;
+
+	FLEX_ALLOC_STR(item, path, path);
+	hashmap_entry_init(&item->ent, hash);
+	item->state = PREFETCH_QUEUED;
+	hashmap_add(&p->items, &item->ent);
+
+	ALLOC_GROW(p->stack, p->stack_nr + 1, p->stack_alloc);
+	p->stack[p->stack_nr++] = item;
+}
+
+/*
+ * Return the listing of "path" if it was queued, NULL if the caller
+ * has to read it itself.
+ */
+static struct dir_listing *take_dir_prefetch(struct dir_prefetch *p,
+					     const char *path)
+{
+	struct prefetch_item *item;
+	struct dir_listing *listing = NULL;
+	unsigned int hash = strhash(path);
+
+	pthread_mutex_lock(&p->mutex);
+	item = hashmap_get_entry_from_hash(&p->items, hash, path,
+					   struct prefetch_item, ent);
+	if (!item)
+		goto out;
+
+	if (item->state == PREFETCH_QUEUED) {
+		/*
+		 * No thread got to it yet; it is usually near the top
+		 * of the stack.  Reading it ourselves beats waiting.
+		 */
+		size_t i = p->stack_nr;
+
+		while (i-- > 0) {
+			if (p->stack[i] != item)
+				continue;
+			MOVE_ARRAY(p->stack + i, p->stack + i + 1,
+				   p->stack_nr - i - 1);
+			p->stack_nr--;
+			break;
+		}
+	} else {
+		while (item->state != PREFETCH_DONE)
+			pthread_cond_wait(&p->done_cond, &p->mutex);
+		listing = item->listing;
+	}
+
+	hashmap_remove(&p->items, &item->ent, path);
+	free(item);
+out:
+	pthread_mutex_unlock(&p->mutex);
+	return listing;
+}
+
+/*
+ * Queue the subdirectories of the directory that "cdir" just read.
+ * Those which the untracked cache already knows to be valid will most
+ * likely not be opened, so leave them alone.
+ */
+static void queue_subdirs(struct dir_prefetch *p, struct cached_dir *cdir,
+			  struct strbuf *path)
+{
+	struct dir_listing *listing = cdir->listing;
+	size_t baselen = path->len;
+	size_t i = listing->nr;
+
+	pthread_mutex_lock(&p->mutex);
+	/* Backwards, so that the first one ends up on top. */
+	while (i-- > 0) {
+		const char *name = listing->names.buf + listing->entries[i].name;
+		struct untracked_cache_dir *ucd;
+		int pos;
+
+		if (listing->entries[i].d_type != DT_DIR ||
+		    !fspathcmp(name, ".bench"))
+			continue;
+		if (cdir->untracked &&
+		    (ucd = find_untracked(cdir->untracked, name,
+					  strlen(name), &pos)) &&
+		    ucd->valid)
+			continue;
+
+		strbuf_addstr(path, name);
+		strbuf_addch(path, '/');
+		queue_dir_prefetch(p, path->buf);
+		strbuf_setlen(path, baselen);
+	}
+	pthread_cond_broadcast(&p->work_cond);
+	pthread_mutex_unlock(&p->mutex);
+}
+
 static int valid_cached_dir(struct dir_struct *dir,
 			    struct untracked_cache_dir *untracked,
 			    struct index_state *istate,
@@ -2545,14 +2940,39 @@ static int open_cached_dir(struct cached_dir *cdir,
 	if (valid_cached_dir(dir, untracked, istate, path, check_only))
 		return 0;
 	c_path = path->len ? path->buf : ".";
-	cdir->fdir = opendir(c_path);
-	if (!cdir->fdir)
-		warning_errno(_("could not open directory '%s'"), c_path);
+	if (dir->internal.prefetch_threads > 1 && !dir->internal.prefetch)
+		dir->internal.prefetch =
+			start_dir_prefetch(dir->internal.prefetch_threads);
+	if (dir->internal.prefetch) {
+		cdir->listing = take_dir_prefetch(dir->internal.prefetch,
+						  c_path);
+		if (!cdir->listing)
+			cdir->listing = read_dir_listing(c_path);
+		if (cdir->listing->err) {
+			errno = cdir->listing->err;
+			warning_errno(_("could not open directory '%s'"), c_path);
+			FREE_AND_NULL(cdir->listing);
+		} else {
+			/*
+			 * valid_cached_dir() looked at the directory
+			 * after it was read; record what it was like
+			 * when it was read instead.
+			 */
+			if (untracked)
+				fill_stat_data(&untracked->stat_data,
+					       &cdir->listing->st);
+			queue_subdirs(dir->internal.prefetch, cdir, path);
+		}
+	} else {
+		cdir->fdir = opendir(c_path);
+		if (!cdir->fdir)
+			warning_errno(_("could not open directory '%s'"), c_path);
+	}
 	if (dir->untracked) {
 		invalidate_directory(dir->untracked, untracked);
 		dir->untracked->dir_opened++;
 	}
-	if (!cdir->fdir)
+	if (!cdir->fdir && !cdir->listing)
 		return -1;
 	return 0;
 }
@@ -2572,6 +2992,19 @@ static int read_cached_dir(struct cached_dir *cdir)
 		cdir->d_type = DTYPE(de);
 		return 0;
 	}
+	if (cdir->listing) {
+		struct dir_listing_entry *e;
+
+		if (cdir->listing_pos >= cdir->listing->nr) {
+			cdir->d_name = NULL;
+			cdir->d_type = DT_UNKNOWN;
+			return -1;
+		}
+		e = &cdir->listing->entries[cdir->listing_pos++];
+		cdir->d_name = cdir->listing->names.buf + e->name;
+		cdir->d_type = e->d_type;
+		return 0;
+	}
 	while (cdir->nr_dirs < cdir->untracked->dirs_nr) {
 		struct untracked_cache_dir *d = cdir->untracked->dirs[cdir->nr_dirs];
 		if (!d->recurse) {
@@ -2595,6 +3028,7 @@ static void close_cached_dir(struct cached_dir *cdir)
 {
 	if (cdir->fdir)
 		closedir(cdir->fdir);
+	free_dir_listing(cdir->listing);
 	/*
 	 * We have gone through this directory and found no untracked
 	 * entries. Mark it valid.
@@ -2630,7 +3064,7 @@ static void add_path_to_appropriate_result_list(struct dir_struct *dir,
 		if (dir->flags & DIR_SHOW_IGNORED)
 			break;
 		dir_add_name(dir, istate, path->buf, path->len);
-		if (cdir->fdir)
+		if (cdir->fdir || cdir->listing)
 			add_untracked(untracked, path->buf + baselen);
 		break;
 
@@ -2736,7 +3170,7 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 
 			/* abort early if maximum state has been reached */
 			if (dir_state == path_untracked) {
-				if (cdir.fdir)
+				if (cdir.fdir || cdir.listing)
 					add_untracked(untracked, path.buf + baselen);
 				break;
 			}
@@ -3095,6 +3529,19 @@ static void emit_traversal_statistics(struct dir_struct *dir,
 			   "opendir", dir->untracked->dir_opened);
 }
 
+static int dir_scan_threads(struct repository *r)
+{
+	int nr_threads;
+
+	if (!HAVE_THREADS || !r)
+		return 1;
+	prepare_repo_settings(r);
+	nr_threads = r->settings.core_dir_scan_threads;
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
 int read_directory(struct dir_struct *dir, struct index_state *istate,
 		   const char *path, int len, const struct pathspec *pathspec)
 {
@@ -3116,8 +3563,13 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
-	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
+	if (!len || treat_leading_path(dir, istate, path, len, pathspec)) {
+		dir->internal.prefetch_threads = dir_scan_threads(istate->repo);
 		read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
+		stop_dir_prefetch(dir->internal.prefetch);
+		dir->internal.prefetch = NULL;
+		dir->internal.prefetch_threads = 0;
+	}
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
 	QSORT(dir->ignored, dir->ignored_nr, cmp_dir_entry);
 
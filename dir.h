@@ -99,6 +99,13 @@ struct pattern_list {
 
 	struct path_pattern **patterns;
 
+	/*
+	 * Lookup structure over the patterns of a long list, built by
+	 * the first match after patterns were added (see
+	 * pattern-index.h).
+	 */
+	struct pattern_index *index;
+
 	/*
 	 * While scanning the excludes, we attempt to match the patterns
 	 * with a more restricted set that allows us to use hashsets for
@@ -350,6 +357,14 @@ struct dir_struct {
 		struct oid_stat ss_excludes_file;
 		unsigned unmanaged_exclude_files;
 
+		/*
+		 * Threads reading directories ahead of the traversal
+		 * (see core.dirScanThreads).  The pool is only started
+		 * once a directory actually has to be read.
+		 */
+		int prefetch_threads;
+		struct dir_prefetch *prefetch;
+
 		/* Stats about the traversal */
 		unsigned visited_paths;
 		unsigned visited_directories;
@@ -1,6 +1,7 @@
 #define USE_THE_REPOSITORY_VARIABLE
 
 #include "git-compat-util.h"
+#include "config.h"
 #include "odb.h"
 #include "dir.h"
 #include "environment.h"
@@ -16,7 +17,10 @@
 #include "entry.h"
 #include "parallel-checkout.h"
 #include "manifest.h"
+#include "manifest-cache.h"
+#include "read-cache-ll.h"
 #include "repository.h"
+#include "trace2.h"
 
 static void create_directories(const char *path, int path_len,
 			       const struct checkout *state)
@@ -136,6 +140,51 @@ int fstat_checkout_output(int fd, const struct checkout *state, struct stat *st)
 	return 0;
 }
 
+/*
+ * Get ready to write the content of a manifest to "fd". The size of the
+ * file is known up front unless a filter changes it, so reserve the
+ * space in one go (checkout.preallocate) instead of letting the file
+ * grow a piece at a time, and write it with O_DIRECT if asked to
+ * (checkout.directIO). Either may not be supported by the platform or
+ * the filesystem, which is fine: they only make the checkout faster.
+ */
+static void prepare_manifest_output(int fd, const struct cache_entry *ce,
+				    const struct checkout *state,
+				    struct stream_filter *filter)
+{
+	static int preallocate = 1, direct_io = 0, config_read;
+
+	if (!config_read) {
+		repo_config_get_bool(the_repository, "checkout.preallocate", &preallocate);
+		repo_config_get_bool(the_repository, "checkout.directio", &direct_io);
+		config_read = 1;
+	}
+
+#ifdef HAVE_FALLOCATE
+	if (preallocate && (!filter || is_null_stream_filter(filter))) {
+		struct manifest_cache_info info;
+		unsigned long size;
+
+		if (state->istate && !manifest_cache_get(state->istate, &ce->oid, &info))
+			size = info.size;
+		else if (get_manifest_size(the_repository, &ce->oid, &size) < 0)
+			size = 0;
+		if (size && !fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size))
+			trace2_data_intmax("checkout", the_repository,
+					   "manifest/preallocated", size);
+	}
+#endif
+#ifdef O_DIRECT
+	if (direct_io) {
+		int flags = fcntl(fd, F_GETFL);
+
+		if (flags != -1 && !fcntl(fd, F_SETFL, flags | O_DIRECT))
+			trace2_data_string("checkout", the_repository,
+					   "manifest/direct-io", ce->name);
+	}
+#endif
+}
+
 static int streaming_write_entry(const struct cache_entry *ce, char *path,
 				 struct stream_filter *filter,
 				 const struct checkout *state, int to_tempfile,
@@ -154,6 +203,7 @@ static int streaming_write_entry(const struct cache_entry *ce, char *path,
 	type = oid_object_info(the_repository, &ce->oid, &size);
 	if (type == OBJ_MANIFEST) {
 		/* For manifests, use our filtered streaming function */
+		prepare_manifest_output(fd, ce, state, filter);
 		result |= stream_manifest_to_fd_filtered(the_repository, fd, &ce->oid, filter);
 	} else {
 		/* For blobs, use the original streaming function */
@@ -19,6 +19,7 @@
 #include "url.h"
 #include "utf8.h"
 #include "manifest.h"
+#include "manifest-walk.h"
 #include "oidset.h"
 #include "packfile.h"
 #include "submodule-config.h"
@@ -281,6 +282,28 @@ static int report(struct fsck_options *options,
 	return result;
 }
 
+int fsck_report_manifest(struct fsck_options *options,
+			 const struct object_id *oid,
+			 enum fsck_msg_id msg_id,
+			 const char *fmt, ...)
+{
+	va_list ap;
+	struct fsck_object_report report = {
+		.oid = oid,
+		.object_type = OBJ_MANIFEST
+	};
+	int result;
+
+	if (object_on_skiplist(options, oid))
+		return 0;
+
+	va_start(ap, fmt);
+	result = fsck_vreport(options, &report, msg_id, fmt, ap);
+	va_end(ap);
+
+	return result;
+}
+
 int fsck_report_ref(struct fsck_options *options,
 		    struct fsck_ref_report *report,
 		    enum fsck_msg_id msg_id,
@@ -381,7 +404,8 @@ static int fsck_walk_tree(struct tree *tree, void *data, struct fsck_options *op
 						     name, entry.path);
 			result = options->walk(obj, OBJ_TREE, data, options);
 		}
-		else if (S_ISREG(entry.mode) || S_ISLNK(entry.mode)) {
+		else if (S_ISREG(entry.mode) || S_ISLNK(entry.mode) ||
+			 S_ISMANIFEST(entry.mode)) {
 			/* Regular files can be blobs or manifests depending on mode */
 			if (object_type(entry.mode) == OBJ_MANIFEST) {
 				obj = (struct object *)lookup_manifest(the_repository, &entry.oid);
@@ -410,6 +434,66 @@ static int fsck_walk_tree(struct tree *tree, void *data, struct fsck_options *op
 	return res;
 }
 
+static int fsck_walk_manifest(struct manifest *manifest, void *data,
+			      struct fsck_options *options)
+{
+	struct manifest_header header;
+	struct manifest_desc desc;
+	struct strbuf err = STRBUF_INIT;
+	const void *buffer = manifest->buffer;
+	unsigned long size = manifest->size;
+	void *to_free = NULL;
+	const char *name;
+	uintmax_t nr = 0;
+	int res = 0;
+
+	if (!buffer) {
+		enum object_type type;
+
+		buffer = to_free = odb_read_object(the_repository->objects,
+						   &manifest->object.oid,
+						   &type, &size);
+		if (!buffer || type != OBJ_MANIFEST) {
+			free(to_free);
+			return -1;
+		}
+	}
+
+	/* A malformed header is reported by fsck_manifest() */
+	if (parse_manifest_header_gently(buffer, size, &header, &err)) {
+		strbuf_release(&err);
+		free(to_free);
+		return -1;
+	}
+
+	name = fsck_get_object_name(options, &manifest->object.oid);
+	init_manifest_desc(&desc, header.version, header.chunk_data,
+			   header.chunk_data_len, the_hash_algo);
+	while (manifest_entry(&desc)) {
+		struct object *obj;
+		int result;
+
+		if (desc.entry_type == OBJ_MANIFEST)
+			obj = (struct object *)lookup_manifest(the_repository, &desc.entry_oid);
+		else
+			obj = (struct object *)lookup_blob(the_repository, &desc.entry_oid);
+		if (name && obj)
+			fsck_put_object_name(options, &desc.entry_oid,
+					     "%s#%"PRIuMAX, name, nr);
+		nr++;
+		result = options->walk(obj, desc.entry_type, data, options);
+		if (result < 0) {
+			res = result;
+			break;
+		}
+		if (!res)
+			res = result;
+	}
+
+	free(to_free);
+	return res;
+}
+
 static int fsck_walk_commit(struct commit *commit, void *data, struct fsck_options *options)
 {
 	int counter = 0, generation = 0, name_prefix_len = 0;
@@ -507,6 +591,8 @@ int fsck_walk(struct object *obj, void *data, struct fsck_options *options)
 		return fsck_walk_commit((struct commit *)obj, data, options);
 	case OBJ_TAG:
 		return fsck_walk_tag((struct tag *)obj, data, options);
+	case OBJ_MANIFEST:
+		return fsck_walk_manifest((struct manifest *)obj, data, options);
 	default:
 		error("Unknown object type for %s",
 		      fsck_describe_object(options, &obj->oid));
@@ -739,6 +825,8 @@ static int fsck_tree(const struct object_id *tree_oid,
 		case S_IFLNK:
 		case S_IFDIR:
 		case S_IFGITLINK:
+		case S_IFMANIFEST | 0755:
+		case S_IFMANIFEST | 0644:
 			break;
 		/*
 		 * This is nonstandard, but we had a few of these
@@ -1224,18 +1312,87 @@ int fsck_object(struct object *obj, void *data, unsigned long size,
 	return fsck_buffer(&obj->oid, obj->type, data, size, options);
 }
 
+/*
+ * Check the structure of a manifest: its header, and that it lists
+ * exactly the announced number of well-formed chunk OIDs (or, from
+ * version 2 on, typed entries whose recorded sizes add up to the total).
+ * Whether the chunks exist and have those sizes needs the object store
+ * and is left to the caller (see builtin/fsck.c).
+ */
 static int fsck_manifest(const struct object_id *oid, const char *buf,
 			 unsigned long size, struct fsck_options *options)
 {
-	/*
-	 * For v1 manifests, we just need to verify basic structure.
-	 * In the future, we'll validate chunk OID references.
-	 */
+	struct manifest_header header;
+	struct strbuf err = STRBUF_INIT;
+	const char *p, *end;
+	size_t nr = 0;
+	uintmax_t total = 0;
+	int ret = 0;
+
 	if (object_on_skiplist(options, oid))
 		return 0;
 
-	/* For now, manifests are valid if they exist */
-	return 0;
+	if (parse_manifest_header_gently(buf, size, &header, &err)) {
+		ret = report(options, oid, OBJ_MANIFEST, FSCK_MSG_BAD_MANIFEST,
+			     "%s", err.buf);
+		strbuf_release(&err);
+		return ret;
+	}
+
+	p = header.chunk_data;
+	end = p + header.chunk_data_len;
+	while (p < end) {
+		struct object_id chunk;
+		const char *eol = memchr(p, '\n', end - p);
+
+		if (!eol)
+			return report(options, oid, OBJ_MANIFEST,
+				      FSCK_MSG_BAD_MANIFEST_CHUNK,
+				      "chunk %"PRIuMAX" is not terminated by a newline",
+				      (uintmax_t)nr);
+		if (header.version >= 2) {
+			struct manifest_desc desc;
+
+			init_manifest_desc(&desc, header.version, p,
+					   eol + 1 - p, the_hash_algo);
+			if (!manifest_entry(&desc) || desc.size)
+				return report(options, oid, OBJ_MANIFEST,
+					      FSCK_MSG_BAD_MANIFEST_CHUNK,
+					      "entry %"PRIuMAX" is malformed",
+					      (uintmax_t)nr);
+			oidcpy(&chunk, &desc.entry_oid);
+			total += desc.entry_size;
+		} else if ((size_t)(eol - p) != the_hash_algo->hexsz ||
+			   get_oid_hex_algop(p, &chunk, the_hash_algo))
+			return report(options, oid, OBJ_MANIFEST,
+				      FSCK_MSG_BAD_MANIFEST_CHUNK,
+				      "chunk %"PRIuMAX" has an invalid OID",
+				      (uintmax_t)nr);
+		if (is_null_oid(&chunk))
+			ret |= report(options, oid, OBJ_MANIFEST,
+				      FSCK_MSG_BAD_MANIFEST_CHUNK,
+				      "chunk %"PRIuMAX" has a null OID",
+				      (uintmax_t)nr);
+		nr++;
+		p = eol + 1;
+	}
+
+	if (nr != header.chunk_count)
+		ret |= report(options, oid, OBJ_MANIFEST,
+			      FSCK_MSG_BAD_MANIFEST_CHUNK,
+			      "lists %"PRIuMAX" chunks, header announces %"PRIuMAX,
+			      (uintmax_t)nr, (uintmax_t)header.chunk_count);
+	if (!nr && header.total_size)
+		ret |= report(options, oid, OBJ_MANIFEST,
+			      FSCK_MSG_BAD_MANIFEST_SIZE,
+			      "has no chunks but a size of %"PRIuMAX,
+			      (uintmax_t)header.total_size);
+	else if (header.version >= 2 && total != header.total_size)
+		ret |= report(options, oid, OBJ_MANIFEST,
+			      FSCK_MSG_BAD_MANIFEST_SIZE,
+			      "entries add up to %"PRIuMAX" bytes, header records %"PRIuMAX,
+			      total, (uintmax_t)header.total_size);
+	return ret;
 }
 
 int fsck_buffer(const struct object_id *oid, enum object_type type,
@@ -28,6 +28,10 @@ enum fsck_msg_type {
 	FUNC(BAD_DATE, ERROR) \
 	FUNC(BAD_DATE_OVERFLOW, ERROR) \
 	FUNC(BAD_EMAIL, ERROR) \
+	FUNC(BAD_MANIFEST, ERROR) \
+	FUNC(BAD_MANIFEST_CHUNK, ERROR) \
+	FUNC(BAD_MANIFEST_CONTENT, ERROR) \
+	FUNC(BAD_MANIFEST_SIZE, ERROR) \
 	FUNC(BAD_NAME, ERROR) \
 	FUNC(BAD_OBJECT_SHA1, ERROR) \
 	FUNC(BAD_PACKED_REF_ENTRY, ERROR) \
@@ -259,6 +263,15 @@ int fsck_report_ref(struct fsck_options *options,
 		    enum fsck_msg_id msg_id,
 		    const char *fmt, ...);
 
+/*
+ * Report an error or warning for a manifest whose chunks were checked
+ * outside of fsck_object(), e.g. by a worker thread.
+ */
+__attribute__((format (printf, 4, 5)))
+int fsck_report_manifest(struct fsck_options *options,
+			 const struct object_id *oid,
+			 enum fsck_msg_id msg_id,
+			 const char *fmt, ...);
 
 /*
  * Subsystem for storing human-readable names for each object.
@@ -59,6 +59,14 @@ struct fsmonitor_daemon_state {
 	struct ipc_server_data *ipc_server_data;
 	struct strbuf path_ipc;
 
+	/*
+	 * The most recent untracked-cache extension that a client
+	 * shared with us and the token that it is valid for.  Empty
+	 * if we have none for the current <token_id>.
+	 */
+	struct strbuf untracked_cache_token;
+	struct strbuf untracked_cache_data;
+	uint64_t untracked_cache_seq_nr;
 };
 
 /*
@@ -43,6 +43,17 @@ int fsmonitor_ipc__send_command(const char *command UNUSED,
 	return -1;
 }
 
+int fsmonitor_ipc__get_untracked_cache(struct strbuf *answer UNUSED)
+{
+	return -1;
+}
+
+int fsmonitor_ipc__put_untracked_cache(const char *token UNUSED,
+				       const struct strbuf *data UNUSED)
+{
+	return -1;
+}
+
 #else
 
 int fsmonitor_ipc__is_supported(void)
@@ -173,4 +184,70 @@ int fsmonitor_ipc__send_command(const char *command,
 	return 0;
 }
 
+/*
+ * Send a message to the daemon if one is already listening.  Unlike
+ * fsmonitor_ipc__send_command(), a missing daemon is not an error
+ * worth dying for: the untracked-cache is just an optimization.
+ */
+static int send_if_listening(const char *message, size_t message_len,
+			     struct strbuf *answer)
+{
+	struct ipc_client_connection *connection = NULL;
+	struct ipc_client_connect_options options
+		= IPC_CLIENT_CONNECT_OPTIONS_INIT;
+	enum ipc_active_state state;
+	int ret;
+
+	options.wait_if_busy = 1;
+	options.wait_if_not_found = 0;
+
+	state = ipc_client_try_connect(fsmonitor_ipc__get_path(the_repository),
+				       &options, &connection);
+	if (state != IPC_STATE__LISTENING)
+		return -1;
+
+	ret = ipc_client_send_command_to_connection(connection, message,
+						    message_len, answer);
+	ipc_client_close_connection(connection);
+
+	return ret;
+}
+
+int fsmonitor_ipc__get_untracked_cache(struct strbuf *answer)
+{
+	int ret;
+
+	strbuf_reset(answer);
+
+	trace2_region_enter("fsm_client", "get-untracked-cache", NULL);
+	ret = send_if_listening("untracked-cache", strlen("untracked-cache"),
+				answer);
+	trace2_data_intmax("fsm_client", NULL, "untracked-cache/length",
+			   answer->len);
+	trace2_region_leave("fsm_client", "get-untracked-cache", NULL);
+
+	return ret;
+}
+
+int fsmonitor_ipc__put_untracked_cache(const char *token,
+				       const struct strbuf *data)
+{
+	struct strbuf message = STRBUF_INIT;
+	struct strbuf answer = STRBUF_INIT;
+	int ret;
+
+	/* The token is NUL terminated and followed by the binary data. */
+	strbuf_addf(&message, "untracked-cache:%s", token);
+	strbuf_addch(&message, '\0');
+	strbuf_addbuf(&message, data);
+
+	trace2_region_enter("fsm_client", "put-untracked-cache", NULL);
+	ret = send_if_listening(message.buf, message.len, &answer);
+	trace2_region_leave("fsm_client", "put-untracked-cache", NULL);
+
+	strbuf_release(&message);
+	strbuf_release(&answer);
+	return ret;
+}
+
 #endif
@@ -47,4 +47,24 @@ int fsmonitor_ipc__send_query(const char *since_token,
 int fsmonitor_ipc__send_command(const char *command,
 				struct strbuf *answer);
 
+/*
+ * Ask a running `git-fsmonitor--daemon` process for the untracked
+ * cache extension that was last shared with it.  On success, `answer`
+ * holds the token that the data is valid for, a NUL and the data; it
+ * is empty if the daemon has none.  We DO NOT try to start a daemon.
+ *
+ * Returns -1 on error; 0 on success.
+ */
+int fsmonitor_ipc__get_untracked_cache(struct strbuf *answer);
+
+/*
+ * Share the untracked cache extension `data`, which is valid relative
+ * to `token`, with a running `git-fsmonitor--daemon` process.  We DO
+ * NOT try to start a daemon.
+ *
+ * Returns -1 on error; 0 on success.
+ */
+int fsmonitor_ipc__put_untracked_cache(const char *token,
+				       const struct strbuf *data);
+
 #endif /* FSMONITOR_IPC_H */
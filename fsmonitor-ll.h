@@ -44,6 +44,14 @@ void tweak_fsmonitor(struct index_state *istate);
  */
 void refresh_fsmonitor(struct index_state *istate);
 
+/*
+ * Hand the untracked cache of the index to the builtin fsmonitor
+ * daemon along with the token it is valid for, so that a later command
+ * reading an index without one can start from it rather than scan the
+ * whole worktree.
+ */
+void fsmonitor_share_untracked_cache(struct index_state *istate);
+
 /*
  * Does the received result contain the "trivial" response?
  */
@@ -503,6 +503,142 @@ static void fsmonitor_refresh_callback(struct index_state *istate, char *name)
  */
 static int fsmonitor_force_update_threshold = 100;
 
+/*
+ * What a shared untracked-cache lists in a directory depends on which
+ * paths the index tracks there, and removing a path from the index
+ * does not touch the worktree, so the daemon would not tell us about
+ * it.  The copy we share is therefore prefixed with a hash of the
+ * paths of the index that it was built against.
+ */
+static void hash_index_paths(struct index_state *istate, unsigned char *hash)
+{
+	const struct git_hash_algo *algo = unsafe_hash_algo(the_hash_algo);
+	struct git_hash_ctx c;
+	unsigned int i;
+
+	algo->init_fn(&c);
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		git_hash_update(&c, ce->name, ce_namelen(ce) + 1);
+	}
+	git_hash_final(hash, &c);
+}
+
+/*
+ * Our index has an untracked-cache, but nothing in it (the extension
+ * was dropped when the index was rewritten, or core.untrackedCache was
+ * just turned on).  Rather than scanning the whole worktree to build
+ * it again, ask the daemon for the last one that a client shared with
+ * it and then for the paths that changed since, and invalidate those.
+ * A copy built against an index that tracks other paths is no good.
+ *
+ * This is called after the regular query has been applied, so the
+ * changes up to now are covered even if that query was older or
+ * trivial.  Case-insensitive file systems are left out because the
+ * daemon may report paths in a different case than we cached.
+ */
+static void warm_untracked_cache(struct index_state *istate)
+{
+	struct strbuf answer = STRBUF_INIT;
+	struct strbuf changes = STRBUF_INIT;
+	struct untracked_cache *uc = NULL;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	size_t rawsz = the_hash_algo->rawsz;
+	const char *token;
+	size_t token_len, bol, i;
+	int count = 0;
+
+	if (ignore_case || fsmonitor_ipc__get_untracked_cache(&answer) ||
+	    !answer.len)
+		goto done;
+
+	token = answer.buf;
+	token_len = strlen(token);
+	if (token_len + 1 + rawsz >= answer.len)
+		goto done;
+
+	hash_index_paths(istate, hash);
+	if (memcmp(answer.buf + token_len + 1, hash, rawsz)) {
+		trace2_data_intmax("fsm_client", NULL,
+				   "untracked-cache/index-mismatch", 1);
+		goto done;
+	}
+
+	uc = read_untracked_extension(answer.buf + token_len + 1 + rawsz,
+				      answer.len - token_len - 1 - rawsz);
+	if (!uc || !uc->root)
+		goto done;
+
+	/*
+	 * The response is the new token and the paths that changed
+	 * since the token of the shared cache.  If it is trivial, the
+	 * daemon has lost track of that token and the cache is no good.
+	 */
+	if (fsmonitor_ipc__send_query(token, &changes) || !changes.len)
+		goto done;
+	bol = strlen(changes.buf) + 1;
+	if (bol < changes.len && changes.buf[bol] == '/') {
+		trace2_data_intmax("fsm_client", NULL,
+				   "untracked-cache/trivial-response", 1);
+		goto done;
+	}
+
+	free_untracked_cache(istate->untracked);
+	istate->untracked = uc;
+	uc->use_fsmonitor = 1;
+	uc = NULL;
+
+	for (i = bol; i < changes.len; i++) {
+		if (changes.buf[i] != '\0')
+			continue;
+		untracked_cache_invalidate_trimmed_path(istate,
+							changes.buf + bol, 0);
+		bol = i + 1;
+		count++;
+	}
+	if (bol < changes.len) {
+		untracked_cache_invalidate_trimmed_path(istate,
+							changes.buf + bol, 0);
+		count++;
+	}
+
+	istate->cache_changed |= UNTRACKED_CHANGED;
+	trace2_data_intmax("fsm_client", NULL, "untracked-cache/warm-count",
+			   count);
+
+done:
+	if (uc)
+		free_untracked_cache(uc);
+	strbuf_release(&answer);
+	strbuf_release(&changes);
+}
+
+void fsmonitor_share_untracked_cache(struct index_state *istate)
+{
+	struct strbuf data = STRBUF_INIT;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	const char *token = istate->fsmonitor_last_update;
+
+	/*
+	 * A cache that was rebuilt after a trivial response is shared
+	 * too: the worktree was scanned after the daemon handed us the
+	 * token, so it holds for that token.
+	 */
+	if (fsm_settings__get_mode(istate->repo) != FSMONITOR_MODE_IPC ||
+	    !istate->untracked || !istate->untracked->root || !token ||
+	    !starts_with(token, "builtin:") || !strcmp(token, "builtin:fake"))
+		return;
+
+	hash_index_paths(istate, hash);
+	strbuf_add(&data, hash, the_hash_algo->rawsz);
+	write_untracked_extension(&data, istate->untracked);
+	fsmonitor_ipc__put_untracked_cache(token, &data);
+	strbuf_release(&data);
+}
+
 void refresh_fsmonitor(struct index_state *istate)
 {
 	static int warn_once = 0;
@@ -718,6 +854,10 @@ void refresh_fsmonitor(struct index_state *istate)
 	}
 	trace2_region_leave("fsmonitor", "apply_results", istate->repo);
 
+	if (fsm_mode == FSMONITOR_MODE_IPC && query_success &&
+	    istate->untracked && !istate->untracked->root)
+		warm_untracked_cache(istate);
+
 	strbuf_release(&query_result);
 
 	/* Now that we've updated istate, save the last_update_token */
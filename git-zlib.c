@@ -274,3 +274,62 @@ int git_deflate(git_zstream *strm, int flush)
 	      strm->z.msg ? strm->z.msg : "no message");
 	return status;
 }
+
+/*
+ * Sample sizes for git_deflate_looks_incompressible(): a few windows
+ * from the start, middle and end of the buffer are enough to tell
+ * already-compressed media from text, at a fraction of the cost of
+ * deflating the whole thing.
+ */
+#define INCOMPRESSIBLE_MIN_SIZE 4096
+#define INCOMPRESSIBLE_SAMPLE_SIZE (16 * 1024)
+#define INCOMPRESSIBLE_SAMPLES 3
+
+int git_deflate_looks_incompressible(const void *buf, unsigned long size)
+{
+	unsigned char out[INCOMPRESSIBLE_SAMPLE_SIZE + 1024];
+	unsigned long in_total = 0, out_total = 0;
+	int i;
+
+	if (size < INCOMPRESSIBLE_MIN_SIZE)
+		return 0;
+
+	for (i = 0; i < INCOMPRESSIBLE_SAMPLES; i++) {
+		unsigned long len = size < INCOMPRESSIBLE_SAMPLE_SIZE ?
+				    size : INCOMPRESSIBLE_SAMPLE_SIZE;
+		unsigned long offset = (size - len) / (INCOMPRESSIBLE_SAMPLES - 1) * i;
+		git_zstream stream;
+
+		git_deflate_init(&stream, Z_BEST_SPEED);
+		stream.next_in = (unsigned char *)buf + offset;
+		stream.avail_in = len;
+		stream.next_out = out;
+		stream.avail_out = sizeof(out);
+		while (git_deflate(&stream, Z_FINISH) == Z_OK)
+			; /* nothing */
+		out_total += stream.total_out;
+		in_total += len;
+		git_deflate_end(&stream);
+
+		if (len == size)
+			break;
+	}
+
+	/* Not even 1/32 saved at the fastest level: not worth deflating */
+	return out_total >= in_total - in_total / 32;
+}
+
+int git_zlib_stream_is_stored(const unsigned char *buf, unsigned long len)
+{
+	if (len < 3)
+		return 0;
+	/* CMF: deflate with a window of at most 32K, and a valid FCHECK */
+	if ((buf[0] & 0x0f) != Z_DEFLATED || (buf[0] >> 4) > 7 ||
+	    ((buf[0] << 8) | buf[1]) % 31)
+		return 0;
+	/* a preset dictionary would come before the first block */
+	if (buf[1] & 0x20)
+		return 0;
+	/* BTYPE of the first block, 00 being "stored" */
+	return !((buf[2] >> 1) & 3);
+}
@@ -27,4 +27,18 @@ int git_deflate_end_gently(git_zstream *);
 int git_deflate(git_zstream *, int flush);
 unsigned long git_deflate_bound(git_zstream *, unsigned long);
 
+/*
+ * Trial-compress a few samples of "buf" at the fastest level and
+ * return 1 if deflating it is unlikely to save anything, i.e. it is
+ * better stored with Z_NO_COMPRESSION.
+ */
+int git_deflate_looks_incompressible(const void *buf, unsigned long size);
+
+/*
+ * Return 1 if "buf" is the start of a zlib stream whose first block is
+ * stored rather than compressed, as written at Z_NO_COMPRESSION (or
+ * by zlib itself for data it could not compress).
+ */
+int git_zlib_stream_is_stored(const unsigned char *buf, unsigned long len);
+
 #endif /* GIT_ZLIB_H */
@@ -5,6 +5,7 @@
 #include "gettext.h"
 #include "grep.h"
 #include "hex.h"
+#include "manifest.h"
 #include "odb.h"
 #include "pretty.h"
 #include "userdiff.h"
@@ -1567,7 +1568,7 @@ static int grep_source_1(struct grep_opt *opt, struct grep_source *gs, int colle
 	const char *bol;
 	const char *peek_bol = NULL;
 	unsigned long left;
-	unsigned lno = 1;
+	unsigned lno = gs->lno_offset + 1;
 	unsigned last_hit = 0;
 	int binary_match_only = 0;
 	unsigned count = 0;
@@ -1787,20 +1788,30 @@ static int grep_source_1(struct grep_opt *opt, struct grep_source *gs, int colle
 	 * which feels mostly useless but sometimes useful.  Maybe
 	 * make it another option?  For now suppress them.
 	 */
+	if (opt->count && gs->count) {
+		*gs->count += count;
+		return !!count;
+	}
 	if (opt->count && count) {
-		char buf[32];
-		if (opt->pathname) {
-			output_color(opt, gs->name, strlen(gs->name),
-				     opt->colors[GREP_COLOR_FILENAME]);
-			output_sep(opt, ':');
-		}
-		xsnprintf(buf, sizeof(buf), "%u\n", count);
-		opt->output(opt, buf, strlen(buf));
+		grep_show_count(opt, gs->name, count);
 		return 1;
 	}
 	return !!last_hit;
 }
 
+void grep_show_count(struct grep_opt *opt, const char *name, unsigned count)
+{
+	char buf[32];
+
+	if (opt->pathname) {
+		output_color(opt, name, strlen(name),
+			     opt->colors[GREP_COLOR_FILENAME]);
+		output_sep(opt, ':');
+	}
+	xsnprintf(buf, sizeof(buf), "%u\n", count);
+	opt->output(opt, buf, strlen(buf));
+}
+
 static void clr_hit_marker(struct grep_expr *x)
 {
 	/* All-hit markers are meaningful only at the very top level
@@ -1851,9 +1862,9 @@ int grep_source(struct grep_opt *opt, struct grep_source *gs)
 	return grep_source_1(opt, gs, 0);
 }
 
-static void grep_source_init_buf(struct grep_source *gs,
-				 const char *buf,
-				 unsigned long size)
+void grep_source_init_buf(struct grep_source *gs,
+			  const char *buf,
+			  unsigned long size)
 {
 	gs->type = GREP_SOURCE_BUF;
 	gs->name = NULL;
@@ -1862,6 +1873,8 @@ static void grep_source_init_buf(struct grep_source *gs,
 	gs->size = size;
 	gs->driver = NULL;
 	gs->identifier = NULL;
+	gs->lno_offset = 0;
+	gs->count = NULL;
 }
 
 int grep_buffer(struct grep_opt *opt, const char *buf, unsigned long size)
@@ -1887,6 +1900,8 @@ void grep_source_init_file(struct grep_source *gs, const char *name,
 	gs->size = 0;
 	gs->driver = NULL;
 	gs->identifier = xstrdup(path);
+	gs->lno_offset = 0;
+	gs->count = NULL;
 }
 
 void grep_source_init_oid(struct grep_source *gs, const char *name,
@@ -1901,6 +1916,8 @@ void grep_source_init_oid(struct grep_source *gs, const char *name,
 	gs->driver = NULL;
 	gs->identifier = oiddup(oid);
 	gs->repo = repo;
+	gs->lno_offset = 0;
+	gs->count = NULL;
 }
 
 void grep_source_clear(struct grep_source *gs)
@@ -1933,6 +1950,18 @@ static int grep_source_load_oid(struct grep_source *gs)
 
 	gs->buf = odb_read_object(gs->repo->objects, gs->identifier,
 				  &type, &gs->size);
+	if (gs->buf && type == OBJ_MANIFEST) {
+		/*
+		 * Grep the logical content, not the list of chunk OIDs.
+		 * The manifest stream reads packs directly, so it must
+		 * hold the object read lock when called from a worker.
+		 */
+		free((char *)gs->buf);
+		obj_read_lock();
+		gs->buf = read_manifest_content(gs->repo, gs->identifier,
+						&gs->size);
+		obj_read_unlock();
+	}
 	if (!gs->buf)
 		return error(_("'%s': unable to read %s"),
 			     gs->name,
@@ -239,8 +239,18 @@ struct grep_source {
 
 	char *path; /* for attribute lookups */
 	struct userdiff_driver *driver;
+
+	/*
+	 * When the buffer is a window into a larger file: the number of
+	 * lines that come before it, and where to add up the matching
+	 * lines for "--count" instead of printing them.
+	 */
+	unsigned lno_offset;
+	unsigned *count;
 };
 
+void grep_source_init_buf(struct grep_source *gs, const char *buf,
+			  unsigned long size);
 void grep_source_init_file(struct grep_source *gs, const char *name,
 			   const char *path);
 void grep_source_init_oid(struct grep_source *gs, const char *name,
@@ -254,6 +264,9 @@ void grep_source_load_driver(struct grep_source *gs,
 
 int grep_source(struct grep_opt *opt, struct grep_source *gs);
 
+/* Show the "--count" line of a file whose windows added up "count". */
+void grep_show_count(struct grep_opt *opt, const char *name, unsigned count);
+
 struct grep_opt *grep_opt_dup(const struct grep_opt *opt);
 
 /*
@@ -357,16 +357,23 @@ static enum list_objects_filter_result filter_blobs_limit(
 		 * potentially large file content.
 		 */
 		{
-			unsigned long total_size = 0;
+			struct manifest *manifest = (struct manifest *)obj;
+			struct manifest_header header;
 			
-			/* Get only the total size from the manifest header - no need for chunk OIDs */
-			if (get_manifest_chunk_oids(r, &obj->oid, &total_size, NULL) < 0) {
+			/*
+			 * Get only the total size from the manifest header;
+			 * the traversal has usually parsed the manifest already.
+			 */
+			if (parse_manifest_gently(r, manifest, 1) < 0 ||
+			    parse_manifest_header_gently(manifest->buffer,
+							 manifest->size,
+							 &header, NULL) < 0) {
 				/* Can't read manifest - be conservative and include it */
 				goto include_it;
 			}
 			
 			/* Apply size filter using the total logical size */
-			if (total_size < filter_data->max_bytes)
+			if (header.total_size < filter_data->max_bytes)
 				goto include_it;
 			
 			if (omits)
@@ -20,7 +20,6 @@
 #include "manifest.h"
 #include "manifest-walk.h"
 #include "repository.h"
-#include "oid-array.h"
 
 struct traversal_context {
 	struct rev_info *revs;
@@ -34,14 +33,14 @@ struct traversal_context {
 static void show_commit(struct traversal_context *ctx,
 			struct commit *commit)
 {
-	if (!ctx->show_commit)
+	if (!ctx->show_commit || ctx->revs->chunk_objects_only)
 		return;
 	ctx->show_commit(commit, ctx->show_data);
 }
 
-static void show_object(struct traversal_context *ctx,
-			struct object *object,
-			const char *name)
+static void show_object_1(struct traversal_context *ctx,
+			  struct object *object,
+			  const char *name)
 {
 	if (!ctx->show_object)
 		return;
@@ -52,6 +51,15 @@ static void show_object(struct traversal_context *ctx,
 	ctx->show_object(object, name, ctx->show_data);
 }
 
+static void show_object(struct traversal_context *ctx,
+			struct object *object,
+			const char *name)
+{
+	if (ctx->revs->chunk_objects_only)
+		return;
+	show_object_1(ctx, object, name);
+}
+
 static void process_blob(struct traversal_context *ctx,
 			 struct blob *blob,
 			 struct strbuf *path,
@@ -103,7 +111,94 @@ static void process_tree(struct traversal_context *ctx,
 
 static void process_chunk(struct traversal_context *ctx,
 			 const struct object_id *chunk_oid,
-			 const char *manifest_name);
+			 const char *manifest_name,
+			 uint64_t offset);
+
+/*
+ * The size of a manifest entry, for the offset of the chunks after it
+ * (see rev_info.chunk_position). Version 2 manifests record it, even
+ * for the sub-manifests that are skipped without reading because they
+ * were seen before. Version 1 manifests only list chunks, whose sizes
+ * are looked up if anyone wants the offset.
+ */
+static uint64_t manifest_entry_size(struct traversal_context *ctx,
+				    const struct manifest_desc *desc)
+{
+	unsigned long size;
+	struct object_info oi = OBJECT_INFO_INIT;
+
+	if (desc->version >= 2 || !ctx->revs->chunk_position)
+		return desc->entry_size;
+
+	oi.sizep = &size;
+	if (odb_read_object_info_extended(ctx->revs->repo->objects,
+					  &desc->entry_oid, &oi,
+					  OBJECT_INFO_SKIP_FETCH_OBJECT |
+					  OBJECT_INFO_QUICK) < 0)
+		return 0;
+	return size;
+}
+
+/*
+ * Process the entries of a shown manifest: its chunks and, for a
+ * hierarchical (version 2) manifest, its sub-manifests, recursively.
+ * Like chunks, sub-manifests come along with their parent and are not
+ * subject to filtering of their own. Entries are read in place from the
+ * parsed manifest buffer.
+ */
+static void process_manifest_entries(struct traversal_context *ctx,
+				     struct manifest *manifest,
+				     const char *name,
+				     uint64_t *offset,
+				     int depth)
+{
+	struct repository *r = ctx->revs->repo;
+	struct manifest_header header;
+	struct manifest_desc desc;
+
+	if (depth >= MANIFEST_MAX_DEPTH)
+		die("manifest %s is nested too deeply",
+		    oid_to_hex(&manifest->object.oid));
+	if (parse_manifest_header_gently(manifest->buffer, manifest->size,
+					 &header, NULL) < 0)
+		return;
+
+	init_manifest_desc(&desc, header.version, header.chunk_data,
+			   header.chunk_data_len, r->hash_algo);
+	while (manifest_entry(&desc)) {
+		struct object *o = lookup_object(r, &desc.entry_oid);
+		uint64_t end = *offset + manifest_entry_size(ctx, &desc);
+		struct manifest *sub;
+
+		/*
+		 * Most chunks of a new version of a file are shared with
+		 * the versions already walked; skip them before creating
+		 * or type-checking anything.
+		 */
+		if (o && (o->flags & SEEN)) {
+			*offset = end;
+			continue;
+		}
+
+		if (desc.entry_type != OBJ_MANIFEST) {
+			process_chunk(ctx, &desc.entry_oid, name, *offset);
+			*offset = end;
+			continue;
+		}
+
+		sub = lookup_manifest(r, &desc.entry_oid);
+		if (sub) {
+			sub->object.flags |= SEEN | NOT_USER_GIVEN;
+			if (ctx->show_object)
+				show_object(ctx, &sub->object, name);
+			if (!parse_manifest_gently(r, sub, 1))
+				process_manifest_entries(ctx, sub, name, offset,
+							 depth + 1);
+			free_manifest(sub);
+		}
+		*offset = end;
+	}
+}
 
 static void process_manifest(struct traversal_context *ctx,
 			     struct manifest *manifest,
@@ -113,9 +208,6 @@ static void process_manifest(struct traversal_context *ctx,
 	struct object *obj = &manifest->object;
 	size_t pathlen;
 	enum list_objects_filter_result r;
-	unsigned long total_size = 0;
-	struct oid_array chunk_oids = OID_ARRAY_INIT;
-	size_t i;
 
 	/* Similar to blob processing, check if we should process manifests */
 	if (!ctx->revs->blob_objects)
@@ -135,11 +227,9 @@ static void process_manifest(struct traversal_context *ctx,
 	    is_promisor_object(ctx->revs->repo, &obj->oid))
 		return;
 
-	/* Get manifest total size for potential filtering */
-	if (get_manifest_chunk_oids(ctx->revs->repo, &obj->oid, &total_size, &chunk_oids) < 0) {
-		oid_array_clear(&chunk_oids);
+	/* Skip manifests we cannot read */
+	if (parse_manifest_gently(ctx->revs->repo, manifest, 1) < 0)
 		return;
-	}
 
 	pathlen = path->len;
 	strbuf_addstr(path, name);
@@ -167,18 +257,19 @@ static void process_manifest(struct traversal_context *ctx,
 	 * its chunks shouldn't be included either.
 	 */
 	if (r & LOFR_DO_SHOW) {
-		for (i = 0; i < chunk_oids.nr; i++) {
-			process_chunk(ctx, &chunk_oids.oid[i], name);
-		}
+		uint64_t offset = 0;
+
+		process_manifest_entries(ctx, manifest, path->buf, &offset, 0);
 	}
 	
 	strbuf_setlen(path, pathlen);
-	oid_array_clear(&chunk_oids);
+	free_manifest(manifest);
 }
 
 static void process_chunk(struct traversal_context *ctx,
 			 const struct object_id *chunk_oid,
-			 const char *manifest_name)
+			 const char *manifest_name,
+			 uint64_t offset)
 {
 	struct blob *b = lookup_blob(ctx->revs->repo, chunk_oid);
 	if (!b)
@@ -192,9 +283,16 @@ static void process_chunk(struct traversal_context *ctx,
 	 */
 	b->object.flags |= SEEN | NOT_USER_GIVEN;
 	
-	/* Include chunk in pack/output if showing objects */
-	if (ctx->show_object)
-		show_object(ctx, &b->object, manifest_name);
+	/*
+	 * Include chunk in pack/output if showing objects, even when
+	 * only chunks are shown.
+	 */
+	if (ctx->show_object) {
+		show_object_1(ctx, &b->object, manifest_name);
+		if (ctx->revs->chunk_position)
+			ctx->revs->chunk_position(&b->object, offset,
+						  ctx->show_data);
+	}
 }
 
 static void process_tree_contents(struct traversal_context *ctx,
@@ -0,0 +1,292 @@
+/*
+ * manifest-cache.c: the "MNFT" index extension.
+ *
+ * For every manifest used by an S_IFMANIFEST entry of the index, the
+ * extension records what refreshing the entry needs from the manifest,
+ * so that a refresh does not read manifests from the object store:
+ *
+ *   4-byte version (1)
+ *   sorted records of:
+ *     raw manifest OID
+ *     raw content OID
+ *     8-byte logical size
+ *     4-byte manifest version
+ *     4-byte number of top-level manifest entries
+ *
+ * All numbers are in network byte order. Manifests are immutable, so a
+ * record never goes stale; records for manifests no longer in the index
+ * are dropped when it is written again.
+ */
+#define USE_THE_REPOSITORY_VARIABLE
+
+#include "git-compat-util.h"
+#include "manifest-cache.h"
+#include "gettext.h"
+#include "manifest.h"
+#include "odb.h"
+#include "oidmap.h"
+#include "read-cache-ll.h"
+#include "repository.h"
+#include "strbuf.h"
+
+#define MANIFEST_CACHE_VERSION 1
+
+struct manifest_cache_entry {
+	struct oidmap_entry ent;
+	struct manifest_cache_info info;
+};
+
+struct manifest_cache {
+	/* the extension as read from the index, checked on first use */
+	char *data;
+	unsigned long sz;
+	const unsigned char *records;
+	size_t nr;
+	int checked;
+
+	/* manifests read since, written out with the index */
+	struct oidmap added;
+};
+
+static size_t record_size(const struct git_hash_algo *algo)
+{
+	return 2 * algo->rawsz + 16;
+}
+
+void read_manifest_cache_extension(struct index_state *istate,
+				   const char *data, unsigned long sz)
+{
+	struct manifest_cache *cache;
+
+	free_manifest_cache(istate);
+	CALLOC_ARRAY(cache, 1);
+	cache->data = xmemdupz(data, sz);
+	cache->sz = sz;
+	oidmap_init(&cache->added, 0);
+	istate->manifest_cache = cache;
+}
+
+static struct manifest_cache *get_manifest_cache(struct index_state *istate)
+{
+	struct manifest_cache *cache = istate->manifest_cache;
+	size_t rsz = record_size(the_hash_algo);
+
+	if (!cache) {
+		CALLOC_ARRAY(cache, 1);
+		cache->checked = 1;
+		oidmap_init(&cache->added, 0);
+		istate->manifest_cache = cache;
+	}
+	if (cache->checked)
+		return cache;
+
+	cache->checked = 1;
+	if (cache->sz < 4 || get_be32(cache->data) != MANIFEST_CACHE_VERSION ||
+	    (cache->sz - 4) % rsz) {
+		warning(_("ignoring malformed manifest cache in the index"));
+		return cache;
+	}
+	cache->records = (const unsigned char *)cache->data + 4;
+	cache->nr = (cache->sz - 4) / rsz;
+	return cache;
+}
+
+static void parse_record(const unsigned char *rec,
+			 struct manifest_cache_info *info,
+			 const struct git_hash_algo *algo)
+{
+	oidread(&info->content_oid, rec, algo);
+	rec += algo->rawsz;
+	info->size = get_be64(rec);
+	info->version = get_be32(rec + 8);
+	info->nr_entries = get_be32(rec + 12);
+}
+
+static int lookup_record(struct manifest_cache *cache,
+			 const struct object_id *oid,
+			 struct manifest_cache_info *info)
+{
+	const struct git_hash_algo *algo = the_hash_algo;
+	size_t rsz = record_size(algo);
+	size_t lo = 0, hi = cache->nr;
+
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		const unsigned char *rec = cache->records + st_mult(mi, rsz);
+		int cmp = memcmp(oid->hash, rec, algo->rawsz);
+
+		if (!cmp) {
+			parse_record(rec + algo->rawsz, info, algo);
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static int lookup_cached(struct manifest_cache *cache,
+			 const struct object_id *oid,
+			 struct manifest_cache_info *info)
+{
+	struct manifest_cache_entry *e = oidmap_get(&cache->added, oid);
+
+	if (e) {
+		*info = e->info;
+		return 1;
+	}
+	return lookup_record(cache, oid, info);
+}
+
+static int read_manifest_info(struct repository *r,
+			      const struct object_id *oid,
+			      struct manifest_cache_info *info,
+			      unsigned flags)
+{
+	struct object_info oi = OBJECT_INFO_INIT;
+	struct manifest_header header;
+	enum object_type type;
+	unsigned long size;
+	void *buffer = NULL;
+	int ret = -1;
+
+	oi.typep = &type;
+	oi.sizep = &size;
+	oi.contentp = &buffer;
+	if (odb_read_object_info_extended(r->objects, oid, &oi, flags) < 0)
+		return -1;
+	if (type == OBJ_MANIFEST &&
+	    !parse_manifest_header_gently(buffer, size, &header, NULL)) {
+		oidcpy(&info->content_oid, &header.content_oid);
+		info->size = header.total_size;
+		info->version = header.version;
+		info->nr_entries = header.chunk_count;
+		ret = 0;
+	}
+	free(buffer);
+	return ret;
+}
+
+int manifest_cache_get(struct index_state *istate,
+		       const struct object_id *oid,
+		       struct manifest_cache_info *info)
+{
+	struct manifest_cache *cache = get_manifest_cache(istate);
+	struct manifest_cache_entry *e;
+
+	if (lookup_cached(cache, oid, info))
+		return 0;
+	if (read_manifest_info(istate->repo ? istate->repo : the_repository,
+			       oid, info, 0) < 0)
+		return -1;
+
+	CALLOC_ARRAY(e, 1);
+	oidcpy(&e->ent.oid, oid);
+	e->info = *info;
+	oidmap_put(&cache->added, e);
+	return 0;
+}
+
+int want_manifest_cache_extension(struct index_state *istate)
+{
+	struct repository *r = istate->repo ? istate->repo : the_repository;
+
+	prepare_repo_settings(r);
+	if (!r->settings.index_manifest_cache)
+		return 0;
+	for (unsigned int i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (S_ISMANIFEST(ce->ce_mode) && !(ce->ce_flags & CE_REMOVE))
+			return 1;
+	}
+	return 0;
+}
+
+struct manifest_cache_record {
+	struct object_id oid;
+	struct manifest_cache_info info;
+};
+
+static int manifest_cache_record_cmp(const void *va, const void *vb)
+{
+	const struct manifest_cache_record *a = va, *b = vb;
+	return oidcmp(&a->oid, &b->oid);
+}
+
+void write_manifest_cache_extension(struct strbuf *sb,
+				    struct index_state *istate)
+{
+	struct repository *r = istate->repo ? istate->repo : the_repository;
+	const struct git_hash_algo *algo = the_hash_algo;
+	struct manifest_cache *cache = get_manifest_cache(istate);
+	struct manifest_cache_record *records = NULL;
+	size_t i, nr = 0, alloc = 0;
+	unsigned char be[16];
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (!S_ISMANIFEST(ce->ce_mode) || (ce->ce_flags & CE_REMOVE))
+			continue;
+		ALLOC_GROW(records, nr + 1, alloc);
+		if (!lookup_cached(cache, &ce->oid, &records[nr].info) &&
+		    read_manifest_info(r, &ce->oid, &records[nr].info,
+				       OBJECT_INFO_SKIP_FETCH_OBJECT |
+				       OBJECT_INFO_QUICK) < 0)
+			continue;
+		oidcpy(&records[nr].oid, &ce->oid);
+		nr++;
+	}
+	QSORT(records, nr, manifest_cache_record_cmp);
+
+	put_be32(be, MANIFEST_CACHE_VERSION);
+	strbuf_add(sb, be, 4);
+	for (i = 0; i < nr; i++) {
+		if (i && oideq(&records[i].oid, &records[i - 1].oid))
+			continue;
+		strbuf_add(sb, records[i].oid.hash, algo->rawsz);
+		strbuf_add(sb, records[i].info.content_oid.hash, algo->rawsz);
+		put_be64(be, records[i].info.size);
+		put_be32(be + 8, records[i].info.version);
+		put_be32(be + 12, records[i].info.nr_entries);
+		strbuf_add(sb, be, sizeof(be));
+	}
+	free(records);
+}
+
+int for_each_manifest_cache_record(struct index_state *istate,
+				   manifest_cache_fn fn, void *data)
+{
+	const struct git_hash_algo *algo = the_hash_algo;
+	struct manifest_cache *cache = istate->manifest_cache;
+	size_t rsz = record_size(algo);
+
+	if (!cache || !cache->data)
+		return -1;
+	cache = get_manifest_cache(istate);
+	for (size_t i = 0; i < cache->nr; i++) {
+		const unsigned char *rec = cache->records + st_mult(i, rsz);
+		struct manifest_cache_info info;
+		struct object_id oid;
+
+		oidread(&oid, rec, algo);
+		parse_record(rec + algo->rawsz, &info, algo);
+		fn(&oid, &info, data);
+	}
+	return 0;
+}
+
+void free_manifest_cache(struct index_state *istate)
+{
+	struct manifest_cache *cache = istate->manifest_cache;
+
+	if (!cache)
+		return;
+	free(cache->data);
+	oidmap_clear(&cache->added, 1);
+	free(cache);
+	istate->manifest_cache = NULL;
+}
@@ -0,0 +1,66 @@
+#ifndef MANIFEST_CACHE_H
+#define MANIFEST_CACHE_H
+
+#include "hash.h"
+
+struct index_state;
+struct strbuf;
+
+/*
+ * What the index remembers about the manifest of an S_IFMANIFEST entry,
+ * enough to compare the entry with the working tree without reading the
+ * manifest object: the OID and size of the file content it describes,
+ * and the version and number of top-level entries of the manifest as a
+ * cheap fingerprint of its chunk list.
+ */
+struct manifest_cache_info {
+	struct object_id content_oid;
+	uint64_t size;
+	uint32_t version;
+	uint32_t nr_entries;
+};
+
+/*
+ * Keep the data of a "MNFT" index extension. It is only looked at when
+ * the first manifest entry is looked up.
+ */
+void read_manifest_cache_extension(struct index_state *istate,
+				   const char *data, unsigned long sz);
+
+/*
+ * Look up what is known about the manifest "oid" of an entry in
+ * "istate", reading the manifest (and remembering what it says for the
+ * next index write) only if the extension does not have it.
+ * Returns 0 on success, -1 if the manifest cannot be read.
+ */
+int manifest_cache_get(struct index_state *istate,
+		       const struct object_id *oid,
+		       struct manifest_cache_info *info);
+
+/*
+ * Whether an index written for "istate" should carry the extension:
+ * index.manifestCache is enabled and there is a manifest entry.
+ */
+int want_manifest_cache_extension(struct index_state *istate);
+
+/*
+ * Append the extension data for the manifest entries of "istate" to
+ * "sb". Manifests that are missing from the object store are left out.
+ */
+void write_manifest_cache_extension(struct strbuf *sb,
+				    struct index_state *istate);
+
+typedef void manifest_cache_fn(const struct object_id *oid,
+			       const struct manifest_cache_info *info,
+			       void *data);
+
+/*
+ * Call "fn" for each record of the extension as it was read from the
+ * index, in order. Returns -1 if the index had no extension.
+ */
+int for_each_manifest_cache_record(struct index_state *istate,
+				   manifest_cache_fn fn, void *data);
+
+void free_manifest_cache(struct index_state *istate);
+
+#endif /* MANIFEST_CACHE_H */
@@ -2,17 +2,52 @@
 #include "manifest-walk.h"
 #include "hex.h"
 
-void init_manifest_desc(struct manifest_desc *desc, const void *buffer, unsigned long size, const struct git_hash_algo *algo)
+void init_manifest_desc(struct manifest_desc *desc, int version,
+			const void *buffer, unsigned long size,
+			const struct git_hash_algo *algo)
 {
 	desc->buffer = buffer;
 	desc->size = size;
 	desc->algo = algo;
+	desc->version = version;
 	oidclr(&desc->entry_oid, algo);
+	desc->entry_type = OBJ_BLOB;
+	desc->entry_size = 0;
 }
 
 /*
- * Parse the next OID from the manifest buffer.
- * Manifest format: one hex OID per line (40 chars for SHA-1, 64 for SHA-256)
+ * Parse a version 2 entry: "<type> <oid> <size>", where type is "blob"
+ * for a chunk or "manifest" for a sub-manifest.
+ */
+static int parse_entry_v2(struct manifest_desc *desc, const char *buf,
+			  const char *end)
+{
+	const char *p;
+	char *size_end;
+
+	if (skip_prefix(buf, "blob ", &p))
+		desc->entry_type = OBJ_BLOB;
+	else if (skip_prefix(buf, "manifest ", &p))
+		desc->entry_type = OBJ_MANIFEST;
+	else
+		return -1;
+
+	if ((size_t)(end - p) < desc->algo->hexsz + 2 ||
+	    get_oid_hex_algop(p, &desc->entry_oid, desc->algo) < 0)
+		return -1;
+	p += desc->algo->hexsz;
+	if (*p++ != ' ' || !isdigit(*p))
+		return -1;
+	desc->entry_size = strtoul(p, &size_end, 10);
+	if (size_end != end)
+		return -1;
+	return 0;
+}
+
+/*
+ * Parse the next entry from the manifest buffer.
+ * Version 1: one hex OID per line (40 chars for SHA-1, 64 for SHA-256)
+ * Version 2: "<type> <oid> <size>" per line
  */
 int manifest_entry(struct manifest_desc *desc)
 {
@@ -37,9 +72,14 @@ int manifest_entry(struct manifest_desc *desc)
 		return manifest_entry(desc);
 	}
 
-	/* Parse the OID */
-	if (get_oid_hex_algop(buf, &desc->entry_oid, desc->algo) < 0)
-		return 0; /* Invalid OID */
+	if (desc->version >= 2) {
+		if (parse_entry_v2(desc, buf, end) < 0)
+			return 0; /* Invalid entry */
+	} else {
+		/* Parse the OID */
+		if (get_oid_hex_algop(buf, &desc->entry_oid, desc->algo) < 0)
+			return 0; /* Invalid OID */
+	}
 
 	/* Advance buffer past this line */
 	if (*end == '\n') {
@@ -51,4 +91,4 @@ int manifest_entry(struct manifest_desc *desc)
 	}
 
 	return 1;
-}
\ No newline at end of file
+}
@@ -2,25 +2,39 @@
 #define MANIFEST_WALK_H
 
 #include "hash.h"
+#include "object.h"
 
 struct manifest_desc {
 	const void *buffer;
 	unsigned long size;
 	const struct git_hash_algo *algo;
+	int version;
 	struct object_id entry_oid;
+	/*
+	 * Version 2 manifests name the type of each entry (a chunk blob
+	 * or a sub-manifest) and record its logical size. Version 1
+	 * entries are always chunks of unrecorded size (entry_size is 0).
+	 */
+	enum object_type entry_type;
+	unsigned long entry_size;
 };
 
 /*
- * Initialize a manifest descriptor for walking through chunk OIDs.
- * Points the descriptor at the beginning of the manifest content.
+ * Initialize a manifest descriptor for walking through the entries of
+ * a manifest of the given version. Points the descriptor at the
+ * beginning of the entry data (see "struct manifest_header").
  */
-void init_manifest_desc(struct manifest_desc *desc, const void *buffer, unsigned long size, const struct git_hash_algo *algo);
+void init_manifest_desc(struct manifest_desc *desc, int version,
+			const void *buffer, unsigned long size,
+			const struct git_hash_algo *algo);
 
 /*
- * Get the next chunk OID from the manifest.
- * Returns 1 if an OID was read, 0 if at end of manifest.
- * On success, the OID is stored in desc->entry_oid.
+ * Get the next entry from the manifest.
+ * Returns 1 if an entry was read, 0 at the end of the manifest or on
+ * a malformed entry.
+ * On success, the OID is stored in desc->entry_oid, and the type and
+ * size in desc->entry_type and desc->entry_size.
  */
 int manifest_entry(struct manifest_desc *desc);
 
-#endif /* MANIFEST_WALK_H */
\ No newline at end of file
+#endif /* MANIFEST_WALK_H */
@@ -14,6 +14,12 @@
 #include "write-or-die.h"
 #include "oid-array.h"
 #include "environment.h"
+#include "copy.h"
+#include "gettext.h"
+#include "git-zlib.h"
+#include "packfile.h"
+#include "pack-revindex.h"
+#include "pack.h"
 
 const char *manifest_type = "manifest";
 
@@ -40,137 +46,307 @@ int parse_manifest_buffer(struct repository *r, struct manifest *item, void *buf
 	return 0;
 }
 
+int parse_manifest_gently(struct repository *r, struct manifest *item,
+			  int quiet_on_missing)
+{
+	enum object_type type;
+	void *buffer;
+	unsigned long size;
+
+	if (item->object.parsed)
+		return 0;
+	buffer = odb_read_object(r->objects, &item->object.oid, &type, &size);
+	if (!buffer)
+		return quiet_on_missing ? -1 :
+			error("Could not read %s",
+			      oid_to_hex(&item->object.oid));
+	if (type != OBJ_MANIFEST) {
+		free(buffer);
+		return error("Object %s not a manifest",
+			     oid_to_hex(&item->object.oid));
+	}
+	return parse_manifest_buffer(r, item, buffer, size);
+}
+
 void free_manifest(struct manifest *m)
 {
 	if (!m)
 		return;
 	FREE_AND_NULL(m->buffer);
 	m->size = 0;
+	m->object.parsed = 0;
 }
 
+/*
+ * Number of chunks resolved to pack locations (and announced to the
+ * kernel for read-ahead) at a time.
+ */
+#define MANIFEST_CHUNK_BATCH 32
+
+struct manifest_chunk_loc {
+	struct object_id oid;
+	struct pack_entry e;  /* e.p is NULL for chunks that are not packed */
+};
+
 struct manifest_stream {
 	struct repository *repo;
-	struct manifest_desc desc;
-	void *manifest_buffer;  /* Manifest content buffer */
-	unsigned long manifest_size;  /* Size of manifest */
+	struct manifest_chunk_iter iter;
+
+	/* The next chunks in manifest order, with their pack locations */
+	struct manifest_chunk_loc batch[MANIFEST_CHUNK_BATCH];
+	struct manifest_chunk_loc *sorted[MANIFEST_CHUNK_BATCH];
+	size_t batch_nr, batch_pos;
+
 	struct git_istream *current_chunk_stream;
 	struct object_id current_chunk_oid;
 	unsigned long total_size;
 	unsigned long bytes_read;
 	int initialized;
 	int at_end;
-};
 
-/* Internal structure for parsed manifest header */
-struct manifest_header {
-	int version;
-	unsigned long total_size;
-	struct object_id content_oid;  /* OID of complete file content (after filters) */
-	size_t chunk_count;
-	const char *chunk_data;  /* Pointer to start of chunk OID data */
-	size_t chunk_data_len;   /* Length of chunk OID data */
+	/* For seeking: the manifest, and bytes of the next chunk to skip */
+	struct object_id oid;
+	unsigned long skip;
 };
 
 /*
- * Parse manifest header from buffer.
- * This centralizes all manifest version parsing logic.
- * Returns 0 on success, -1 on error.
+ * Record a header parse failure, either in "err" for callers that
+ * report problems themselves (like fsck), or as an error().
  */
-static int parse_manifest_header(const void *buffer, unsigned long size,
-                                 struct manifest_header *header)
+__attribute__((format (printf, 2, 3)))
+static int manifest_header_error(struct strbuf *err, const char *fmt, ...)
+{
+	struct strbuf msg = STRBUF_INIT;
+	va_list ap;
+
+	va_start(ap, fmt);
+	strbuf_vaddf(&msg, fmt, ap);
+	va_end(ap);
+
+	if (err)
+		strbuf_addbuf(err, &msg);
+	else
+		error("%s", msg.buf);
+	strbuf_release(&msg);
+	return -1;
+}
+
+int parse_manifest_header_gently(const void *buffer, unsigned long size,
+				 struct manifest_header *header,
+				 struct strbuf *err)
 {
 	const char *p = buffer;
 	const char *end = (const char *)buffer + size;
 	
 	/* Parse version */
 	header->version = strtol(p, (char **)&p, 10);
-	if (p >= end || *p++ != '\n') {
-		error("manifest missing version number");
-		return -1;
-	}
+	if (p >= end || *p++ != '\n')
+		return manifest_header_error(err, "manifest missing version number");
 	
-	/* Version check: We currently only support version 1 */
-	if (header->version < 1) {
-		error("manifest has invalid version %d", header->version);
-		return -1;
-	}
-	if (header->version > 1) {
-		error("manifest version %d is newer than supported version 1", header->version);
-		return -1;
-	}
+	/* Version check */
+	if (header->version < 1)
+		return manifest_header_error(err, "manifest has invalid version %d",
+					     header->version);
+	if (header->version > MANIFEST_VERSION_MAX)
+		return manifest_header_error(err, "manifest version %d is newer than supported version %d",
+					     header->version, MANIFEST_VERSION_MAX);
 	
-	/* Version 1 parsing - in future, use switch(version) for other versions */
-	if (header->version == 1) {
+	/* Versions 1 and 2 share the header; they differ in their entries */
+	if (header->version <= 2) {
+		int algo_idx;
+
 		/* Parse total size */
 		header->total_size = strtoul(p, (char **)&p, 10);
-		if (p >= end || *p++ != '\n') {
-			error("manifest missing total size");
-			return -1;
-		}
+		if (p >= end || *p++ != '\n')
+			return manifest_header_error(err, "manifest missing total size");
 		
 		/* Parse content OID (complete file hash after filters) */
-		int algo_idx = get_oid_hex_any(p, &header->content_oid);
-		if (algo_idx == GIT_HASH_UNKNOWN) {
-			error("manifest missing or invalid content OID");
-			return -1;
-		}
+		algo_idx = get_oid_hex_any(p, &header->content_oid);
+		if (algo_idx == GIT_HASH_UNKNOWN)
+			return manifest_header_error(err, "manifest missing or invalid content OID");
 		p += hash_algos[algo_idx].hexsz;
-		if (p >= end || *p++ != '\n') {
-			error("manifest content OID not followed by newline");
-			return -1;
-		}
+		if (p >= end || *p++ != '\n')
+			return manifest_header_error(err, "manifest content OID not followed by newline");
 		
 		/* Parse chunk count */
 		header->chunk_count = strtoul(p, (char **)&p, 10);
-		if (p >= end || *p++ != '\n') {
-			error("manifest missing chunk count");
-			return -1;
-		}
+		if (p >= end || *p++ != '\n')
+			return manifest_header_error(err, "manifest missing chunk count");
 	}
 	/* Future versions would have their parsing logic here */
 	
-	/* Set pointer to chunk OID data */
+	/* Set pointer to entry data */
 	header->chunk_data = p;
 	header->chunk_data_len = end - p;
 	
 	return 0;
 }
 
+/*
+ * Parse manifest header from buffer.
+ * This centralizes all manifest version parsing logic.
+ * Returns 0 on success, -1 on error.
+ */
+static int parse_manifest_header(const void *buffer, unsigned long size,
+                                 struct manifest_header *header)
+{
+	return parse_manifest_header_gently(buffer, size, header, NULL);
+}
+
+struct manifest_iter_frame {
+	void *buffer;
+	struct manifest_desc desc;
+};
+
+static int manifest_iter_push(struct manifest_chunk_iter *iter,
+			      const struct object_id *oid,
+			      struct manifest_header *header_out)
+{
+	struct manifest_iter_frame *frame;
+	struct manifest_header header;
+	enum object_type type;
+	unsigned long size;
+	void *buffer;
+
+	if (iter->nr >= MANIFEST_MAX_DEPTH)
+		return error(_("manifest %s is nested too deeply"),
+			     oid_to_hex(oid));
+
+	buffer = repo_read_object_file(iter->repo, oid, &type, &size);
+	if (!buffer)
+		return error(_("unable to read manifest %s"), oid_to_hex(oid));
+	if (type != OBJ_MANIFEST) {
+		free(buffer);
+		return error(_("object %s is a %s, not a manifest"),
+			     oid_to_hex(oid), type_name(type));
+	}
+	if (parse_manifest_header(buffer, size, &header) < 0) {
+		free(buffer);
+		return -1;
+	}
+
+	ALLOC_GROW(iter->stack, iter->nr + 1, iter->alloc);
+	frame = &iter->stack[iter->nr++];
+	frame->buffer = buffer;
+	init_manifest_desc(&frame->desc, header.version, header.chunk_data,
+			   header.chunk_data_len, iter->repo->hash_algo);
+	if (header_out)
+		*header_out = header;
+	return 0;
+}
+
+int manifest_chunk_iter_init(struct manifest_chunk_iter *iter,
+			     struct repository *r,
+			     const struct object_id *manifest_oid,
+			     struct manifest_header *header)
+{
+	memset(iter, 0, sizeof(*iter));
+	iter->repo = r;
+	if (manifest_iter_push(iter, manifest_oid, header) < 0) {
+		manifest_chunk_iter_release(iter);
+		return -1;
+	}
+	return 0;
+}
+
+int manifest_chunk_iter_next(struct manifest_chunk_iter *iter)
+{
+	while (iter->nr) {
+		struct manifest_desc *desc = &iter->stack[iter->nr - 1].desc;
+		struct object_id sub;
+
+		if (!manifest_entry(desc)) {
+			free(iter->stack[--iter->nr].buffer);
+			continue;
+		}
+		if (desc->entry_type == OBJ_MANIFEST) {
+			/* pushing may move the stack; "desc" is stale after it */
+			oidcpy(&sub, &desc->entry_oid);
+			if (manifest_iter_push(iter, &sub, NULL) < 0)
+				return -1;
+			continue;
+		}
+
+		oidcpy(&iter->oid, &desc->entry_oid);
+		iter->size = desc->entry_size;
+		iter->has_size = desc->version >= 2;
+		return 1;
+	}
+	return 0;
+}
+
+int manifest_chunk_iter_seek(struct manifest_chunk_iter *iter,
+			     unsigned long offset, unsigned long *chunk_start)
+{
+	unsigned long pos = 0;
+
+	while (iter->nr) {
+		struct manifest_desc *desc = &iter->stack[iter->nr - 1].desc;
+		struct manifest_desc saved = *desc;
+		unsigned long size;
+		struct object_id sub;
+
+		if (!manifest_entry(desc)) {
+			free(iter->stack[--iter->nr].buffer);
+			continue;
+		}
+		if (desc->version >= 2)
+			size = desc->entry_size;
+		else if (odb_read_object_info(iter->repo->objects,
+					      &desc->entry_oid, &size) != OBJ_BLOB)
+			return error(_("manifest chunk %s is not a blob"),
+				     oid_to_hex(&desc->entry_oid));
+
+		/* skip whole entries, sub-manifests without reading them */
+		if (size <= offset - pos) {
+			pos += size;
+			continue;
+		}
+		if (desc->entry_type == OBJ_MANIFEST) {
+			oidcpy(&sub, &desc->entry_oid);
+			if (manifest_iter_push(iter, &sub, NULL) < 0)
+				return -1;
+			continue;
+		}
+
+		/* leave the chunk holding "offset" for the next call */
+		*desc = saved;
+		break;
+	}
+	*chunk_start = pos;
+	return 0;
+}
+
+void manifest_chunk_iter_release(struct manifest_chunk_iter *iter)
+{
+	while (iter->nr)
+		free(iter->stack[--iter->nr].buffer);
+	FREE_AND_NULL(iter->stack);
+	iter->alloc = 0;
+}
+
 struct manifest_stream *open_manifest_stream(struct repository *r,
                                              const struct object_id *manifest_oid,
                                              unsigned long *size)
 {
 	struct manifest_stream *stream;
 	enum object_type type;
-	unsigned long manifest_size;
-	void *manifest_buffer;
 	struct manifest_header header;
 	
 	/* First verify this is actually a manifest */
-	type = oid_object_info(r, manifest_oid, &manifest_size);
+	type = oid_object_info(r, manifest_oid, NULL);
 	if (type != OBJ_MANIFEST)
 		return NULL;
 	
-	/* Read the manifest to get its content */
-	manifest_buffer = repo_read_object_file(r, manifest_oid, &type, &manifest_size);
-	if (!manifest_buffer)
-		return NULL;
-	
-	/* Parse the manifest header using shared function */
-	if (parse_manifest_header(manifest_buffer, manifest_size, &header) < 0) {
-		free(manifest_buffer);
-		return NULL;
-	}
-	
 	stream = xcalloc(1, sizeof(*stream));
 	stream->repo = r;
-	stream->manifest_buffer = manifest_buffer;
-	stream->manifest_size = manifest_size;
+	oidcpy(&stream->oid, manifest_oid);
+	if (manifest_chunk_iter_init(&stream->iter, r, manifest_oid, &header) < 0) {
+		free(stream);
+		return NULL;
+	}
 	stream->total_size = header.total_size;
 	
-	/* Initialize descriptor to point at chunk OID data */
-	init_manifest_desc(&stream->desc, header.chunk_data, header.chunk_data_len, r->hash_algo);
-	
 	if (size)
 		*size = stream->total_size;
 	
@@ -178,8 +354,127 @@ struct manifest_stream *open_manifest_stream(struct repository *r,
 	return stream;
 }
 
+static int chunk_loc_cmp_oid(const void *va, const void *vb)
+{
+	const struct manifest_chunk_loc *a = *(const struct manifest_chunk_loc **)va;
+	const struct manifest_chunk_loc *b = *(const struct manifest_chunk_loc **)vb;
+
+	return oidcmp(&a->oid, &b->oid);
+}
+
+static int chunk_loc_cmp_offset(const void *va, const void *vb)
+{
+	const struct manifest_chunk_loc *a = *(const struct manifest_chunk_loc **)va;
+	const struct manifest_chunk_loc *b = *(const struct manifest_chunk_loc **)vb;
+
+	/* chunks that are not in a pack go last */
+	if (!a->e.p != !b->e.p)
+		return a->e.p ? -1 : 1;
+	if (a->e.p != b->e.p)
+		return (uintptr_t)a->e.p < (uintptr_t)b->e.p ? -1 : 1;
+	if (a->e.offset != b->e.offset)
+		return a->e.offset < b->e.offset ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Announce the pack ranges of the current batch to the kernel, in pack
+ * order and merging neighbours, so that chunks scattered over a long
+ * lived pack are read in ahead of time instead of seeking back and
+ * forth once per chunk.
+ */
+static void prefetch_chunk_batch(struct manifest_stream *stream)
+{
+	struct packed_git *p = NULL;
+	off_t start = 0, end = 0;
+	size_t i;
+
+	for (i = 0; i < stream->batch_nr; i++) {
+		struct manifest_chunk_loc *loc = stream->sorted[i];
+		uint32_t pos;
+		off_t next;
+
+		if (!loc->e.p)
+			break; /* unpacked chunks sort last */
+		if (offset_to_pack_pos(loc->e.p, loc->e.offset, &pos) < 0)
+			continue;
+		next = pack_pos_to_offset(loc->e.p, pos + 1);
+
+		if (p == loc->e.p && loc->e.offset <= end) {
+			if (next > end)
+				end = next;
+			continue;
+		}
+		if (p)
+			pack_prefetch_range(p, start, end - start);
+		p = loc->e.p;
+		start = loc->e.offset;
+		end = next;
+	}
+	if (p)
+		pack_prefetch_range(p, start, end - start);
+}
+
+/*
+ * Take the next MANIFEST_CHUNK_BATCH chunks off the manifest and look
+ * them all up at once: in OID order, which walks the (multi-)pack index
+ * front to back, and keeping the locations for the readers below.
+ * Returns 1 if there are chunks, 0 at the end and -1 on error.
+ */
+static int fill_chunk_batch(struct manifest_stream *stream)
+{
+	size_t i;
+	int ret = 0;
+
+	stream->batch_nr = stream->batch_pos = 0;
+	while (stream->batch_nr < MANIFEST_CHUNK_BATCH &&
+	       (ret = manifest_chunk_iter_next(&stream->iter)) > 0) {
+		struct manifest_chunk_loc *loc = &stream->batch[stream->batch_nr];
+
+		oidcpy(&loc->oid, &stream->iter.oid);
+		stream->sorted[stream->batch_nr++] = loc;
+	}
+	if (ret < 0)
+		return -1;
+	if (!stream->batch_nr)
+		return 0;
+
+	QSORT(stream->sorted, stream->batch_nr, chunk_loc_cmp_oid);
+	for (i = 0; i < stream->batch_nr; i++) {
+		struct manifest_chunk_loc *loc = stream->sorted[i];
+
+		if (!find_pack_entry(stream->repo, &loc->oid, &loc->e))
+			loc->e.p = NULL;
+	}
+
+	/* only worth it when there is more than one chunk to order */
+	if (stream->batch_nr > 1) {
+		QSORT(stream->sorted, stream->batch_nr, chunk_loc_cmp_offset);
+		prefetch_chunk_batch(stream);
+	}
+	return 1;
+}
+
+/*
+ * Return the next chunk in manifest order in "*loc".
+ * Returns 1 if there is one, 0 at the end and -1 on error.
+ */
+static int next_chunk(struct manifest_stream *stream,
+		      struct manifest_chunk_loc **loc)
+{
+	if (stream->batch_pos == stream->batch_nr) {
+		int ret = fill_chunk_batch(stream);
+		if (ret <= 0)
+			return ret;
+	}
+	*loc = &stream->batch[stream->batch_pos++];
+	return 1;
+}
+
 static int open_next_chunk(struct manifest_stream *stream)
 {
+	struct manifest_chunk_loc *loc;
+	int ret;
 	enum object_type type;
 	unsigned long chunk_size;
 	
@@ -189,22 +484,31 @@ static int open_next_chunk(struct manifest_stream *stream)
 		stream->current_chunk_stream = NULL;
 	}
 	
-	/* Get next chunk OID from manifest */
-	if (!manifest_entry(&stream->desc)) {
+	/* Get next chunk OID from manifest, descending into sub-manifests */
+	ret = next_chunk(stream, &loc);
+	if (ret < 0)
+		return -1;
+	if (!ret) {
 		stream->at_end = 1;
 		return 0; /* End of manifest */
 	}
 	
-	oidcpy(&stream->current_chunk_oid, &stream->desc.entry_oid);
+	oidcpy(&stream->current_chunk_oid, &loc->oid);
 	
 	/* Open stream for this chunk
 	 * TODO: For checkout operations (Phase 4), we'll need to pass
 	 * a filter here instead of NULL to handle CRLF conversion,
 	 * clean/smudge filters, and ident expansion.
 	 */
-	stream->current_chunk_stream = open_istream(stream->repo,
-	                                           &stream->current_chunk_oid,
-	                                           &type, &chunk_size, NULL);
+	if (loc->e.p)
+		stream->current_chunk_stream =
+			open_istream_pack_entry(stream->repo, &loc->e,
+						&stream->current_chunk_oid,
+						&type, &chunk_size);
+	else
+		stream->current_chunk_stream =
+			open_istream(stream->repo, &stream->current_chunk_oid,
+				     &type, &chunk_size, NULL);
 	if (!stream->current_chunk_stream)
 		return -1;
 	
@@ -213,7 +517,19 @@ static int open_next_chunk(struct manifest_stream *stream)
 		stream->current_chunk_stream = NULL;
 		return -1;
 	}
-	
+
+	/* after a seek, start inside the chunk */
+	while (stream->skip) {
+		char buf[4096];
+		ssize_t n = read_istream(stream->current_chunk_stream, buf,
+					 stream->skip < sizeof(buf) ?
+					 stream->skip : sizeof(buf));
+
+		if (n <= 0)
+			return -1;
+		stream->skip -= n;
+	}
+
 	return 0;
 }
 
@@ -263,6 +579,34 @@ ssize_t read_manifest_stream(struct manifest_stream *stream, void *buf, size_t c
 	return total_read;
 }
 
+int seek_manifest_stream(struct manifest_stream *stream, unsigned long offset)
+{
+	unsigned long chunk_start;
+
+	if (!stream || !stream->initialized)
+		return -1;
+
+	if (stream->current_chunk_stream) {
+		close_istream(stream->current_chunk_stream);
+		stream->current_chunk_stream = NULL;
+	}
+	manifest_chunk_iter_release(&stream->iter);
+	stream->batch_nr = stream->batch_pos = 0;
+	stream->at_end = 0;
+	stream->skip = 0;
+
+	if (manifest_chunk_iter_init(&stream->iter, stream->repo,
+				     &stream->oid, NULL) < 0 ||
+	    manifest_chunk_iter_seek(&stream->iter, offset, &chunk_start) < 0) {
+		stream->initialized = 0;
+		return -1;
+	}
+	stream->skip = offset - chunk_start;
+	stream->bytes_read = offset < stream->total_size ?
+		offset : stream->total_size;
+	return 0;
+}
+
 int close_manifest_stream(struct manifest_stream *stream)
 {
 	if (!stream)
@@ -273,169 +617,549 @@ int close_manifest_stream(struct manifest_stream *stream)
 		stream->current_chunk_stream = NULL;
 	}
 	
-	free(stream->manifest_buffer);
+	manifest_chunk_iter_release(&stream->iter);
 	free(stream);
 	return 0;
 }
 
-int stream_manifest_to_fd(struct repository *r, int fd, const struct object_id *manifest_oid)
+/*
+ * Write "len" bytes at "offset" in pack "p" to "fd", through the kernel
+ * when the pack file is still open, or from the mapped window otherwise.
+ */
+static int copy_pack_range(struct packed_git *p, struct pack_window **w_curs,
+			   off_t offset, unsigned long len, int fd)
 {
-	struct manifest_stream *stream;
+	if (p->pack_fd >= 0)
+		return copy_fd_range(p->pack_fd, offset, len, fd) ? -1 : 0;
+
+	while (len) {
+		unsigned long avail;
+		unsigned char *in = use_pack(p, w_curs, offset, &avail);
+
+		if (avail > len)
+			avail = len;
+		if (write_in_full(fd, in, avail) < 0)
+			return -1;
+		offset += avail;
+		len -= avail;
+	}
+	return 0;
+}
+
+/*
+ * Whether "e" is a blob that copy_stored_chunk() can copy: packed with
+ * a version 2 index, and deflated into a first block that is stored
+ * and byte-aligned. Leaves "*curpos" at the zlib stream and "*size" at
+ * the size of the blob.
+ */
+static int find_stored_chunk(const struct pack_entry *e,
+			     struct pack_window **w_curs,
+			     off_t *curpos, unsigned long *size)
+{
+	unsigned char *in;
+	unsigned long avail;
+
+	if (!e->p || e->p->index_version < 2)
+		return 0;
+	*curpos = e->offset;
+	if (unpack_object_header(e->p, w_curs, curpos, size) != OBJ_BLOB)
+		return 0;
+	in = use_pack(e->p, w_curs, *curpos, &avail);
+	return git_zlib_stream_is_stored(in, avail) && !(in[2] & ~1);
+}
+
+static int can_copy_stored_chunk(const struct manifest_chunk_loc *loc)
+{
+	struct pack_window *w_curs = NULL;
 	unsigned long size;
-	char buf[1024 * 16]; /* 16KB buffer like Git's streaming */
-	ssize_t bytes_read;
-	
-	stream = open_manifest_stream(r, manifest_oid, &size);
-	if (!stream)
+	off_t curpos;
+	int ret = find_stored_chunk(&loc->e, &w_curs, &curpos, &size);
+
+	unuse_pack(&w_curs);
+	return ret;
+}
+
+/*
+ * Chunks written with Z_NO_COMPRESSION (see bench.storeIncompressible)
+ * are a sequence of stored deflate blocks: a one-byte block header
+ * followed by LEN and NLEN and LEN raw bytes. When such a chunk sits in
+ * a pack as a non-delta blob, copy those bytes straight from the pack
+ * instead of inflating them.
+ *
+ * Returns 0 when the whole chunk was copied and 1 when the caller has to
+ * stream (the rest of) it; "*done" tells how many bytes were already
+ * written. Returns -1 on I/O errors and on corrupt chunks. As bytes
+ * copied this way never pass through zlib, its checksum is never
+ * checked; like reusing packed data in pack-objects, check the CRC
+ * that version 2 pack indexes record for every object instead.
+ */
+static int copy_stored_chunk(int fd, const struct manifest_chunk_loc *loc,
+			     unsigned long *done)
+{
+	const struct object_id *oid = &loc->oid;
+	struct pack_entry e = loc->e;
+	struct pack_window *w_curs = NULL;
+	unsigned long size, avail;
+	unsigned char *in;
+	uint32_t pos;
+	off_t curpos;
+	int ret = 1;
+
+	*done = 0;
+	if (!find_stored_chunk(&e, &w_curs, &curpos, &size))
+		goto out;
+	if (offset_to_pack_pos(e.p, e.offset, &pos) < 0)
+		goto out;
+	if (check_pack_crc(e.p, &w_curs, e.offset,
+			   pack_pos_to_offset(e.p, pos + 1) - e.offset,
+			   pack_pos_to_index(e.p, pos))) {
+		ret = error(_("bad packed object CRC for chunk %s in %s"),
+			    oid_to_hex(oid), e.p->pack_name);
+		goto out;
+	}
+	curpos += 2;
+
+	for (;;) {
+		unsigned len, nlen;
+		int final;
+
+		in = use_pack(e.p, &w_curs, curpos, &avail);
+		/* stop at anything but a byte-aligned stored block */
+		if (avail < 5 || (in[0] & ~1))
+			break;
+		final = in[0] & 1;
+		len = in[1] | (in[2] << 8);
+		nlen = in[3] | (in[4] << 8);
+		if ((len ^ 0xffff) != nlen || len > size - *done)
+			break;
+		curpos += 5;
+
+		if (len && copy_pack_range(e.p, &w_curs, curpos, len, fd) < 0) {
+			ret = error_errno(_("unable to copy chunk %s"),
+					  oid_to_hex(oid));
+			break;
+		}
+		curpos += len;
+		*done += len;
+
+		if (final) {
+			if (*done == size)
+				ret = 0;
+			else
+				ret = error(_("chunk %s is truncated in %s"),
+					    oid_to_hex(oid), e.p->pack_name);
+			break;
+		}
+	}
+
+out:
+	unuse_pack(&w_curs);
+	return ret;
+}
+
+/*
+ * Manifest content is written through one large buffer, so that many
+ * small chunks, or a large one read back in small pieces, still reach
+ * the file in a few big writes. When the file was opened with O_DIRECT
+ * the buffer is aligned and only whole buffers are written, until the
+ * unaligned tail, which is written with O_DIRECT turned off again.
+ */
+#define MANIFEST_WRITE_BUFFER (1024 * 1024)
+#define MANIFEST_WRITE_ALIGN 4096
+
+struct manifest_writer {
+	int fd;
+	unsigned direct:1;
+	char *mem, *buf;
+	size_t len;
+	uintmax_t written;	/* bytes that reached fd so far */
+};
+
+static void manifest_writer_init(struct manifest_writer *w, int fd)
+{
+	memset(w, 0, sizeof(*w));
+	w->fd = fd;
+#ifdef O_DIRECT
+	{
+		int flags = fcntl(fd, F_GETFL);
+		w->direct = flags != -1 && (flags & O_DIRECT);
+	}
+#endif
+	w->mem = xmalloc(MANIFEST_WRITE_BUFFER + MANIFEST_WRITE_ALIGN);
+	w->buf = w->mem + (MANIFEST_WRITE_ALIGN -
+			   (uintptr_t)w->mem % MANIFEST_WRITE_ALIGN);
+}
+
+static int manifest_writer_flush(struct manifest_writer *w)
+{
+	if (!w->len)
+		return 0;
+#ifdef O_DIRECT
+	if (w->direct && w->len % MANIFEST_WRITE_ALIGN) {
+		int flags = fcntl(w->fd, F_GETFL);
+
+		if (flags == -1 || fcntl(w->fd, F_SETFL, flags & ~O_DIRECT))
+			return -1;
+		w->direct = 0;
+	}
+#endif
+	if (write_in_full(w->fd, w->buf, w->len) < 0)
 		return -1;
-	
-	while ((bytes_read = read_manifest_stream(stream, buf, sizeof(buf))) > 0) {
-		if (write_in_full(fd, buf, bytes_read) < 0) {
-			close_manifest_stream(stream);
+	w->written += w->len;
+	w->len = 0;
+	return 0;
+}
+
+static int manifest_writer_finish(struct manifest_writer *w)
+{
+	int ret = manifest_writer_flush(w);
+
+	free(w->mem);
+	return ret;
+}
+
+/* Make room in the buffer, writing it out when it is full */
+static char *manifest_writer_space(struct manifest_writer *w, size_t *avail)
+{
+	if (w->len == MANIFEST_WRITE_BUFFER && manifest_writer_flush(w) < 0)
+		return NULL;
+	*avail = MANIFEST_WRITE_BUFFER - w->len;
+	return w->buf + w->len;
+}
+
+static int write_chunk(struct repository *r, struct manifest_writer *w,
+		       const struct manifest_chunk_loc *loc)
+{
+	struct git_istream *st;
+	enum object_type type;
+	unsigned long size, skip = 0;
+	ssize_t readlen;
+	int ret;
+
+	/*
+	 * The zero-copy path writes behind the buffer's back, and cannot
+	 * keep the alignment O_DIRECT needs. Only flush the buffer for
+	 * chunks that path takes, so that small chunks still pile up.
+	 */
+	if (!w->direct && can_copy_stored_chunk(loc)) {
+		if (manifest_writer_flush(w) < 0)
+			return -1;
+		ret = copy_stored_chunk(w->fd, loc, &skip);
+		w->written += skip;
+		if (ret <= 0)
+			return ret;
+	}
+
+	if (loc->e.p)
+		st = open_istream_pack_entry(r, &loc->e, &loc->oid,
+					     &type, &size);
+	else
+		st = open_istream(r, &loc->oid, &type, &size, NULL);
+	if (!st)
+		return -1;
+	if (type != OBJ_BLOB) {
+		close_istream(st);
+		return -1;
+	}
+
+	/* The zero-copy path may have stopped half-way through the chunk */
+	for (;;) {
+		size_t avail;
+		char *buf = manifest_writer_space(w, &avail);
+
+		if (!buf) {
+			readlen = -1;
+			break;
+		}
+		readlen = read_istream(st, buf, avail);
+		if (readlen <= 0)
+			break;
+		if (skip >= (unsigned long)readlen) {
+			skip -= readlen;
+			continue;
+		}
+		if (skip) {
+			memmove(buf, buf + skip, readlen - skip);
+			readlen -= skip;
+			skip = 0;
+		}
+		w->len += readlen;
+	}
+
+	close_istream(st);
+	return readlen < 0 || skip ? -1 : 0;
+}
+
+int stream_manifest_to_fd(struct repository *r, int fd, const struct object_id *manifest_oid)
+{
+	return stream_manifest_to_fd_filtered(r, fd, manifest_oid, NULL);
+}
+
+/* Feed "len" bytes of "in" (NULL to drain) through "filter" into "w" */
+static int filter_to_writer(struct stream_filter *filter,
+			    const char *in, size_t len,
+			    struct manifest_writer *w)
+{
+	for (;;) {
+		size_t avail, to_feed = len, to_receive;
+		char *out = manifest_writer_space(w, &avail);
+
+		if (!out)
+			return -1;
+		to_receive = avail;
+		if (stream_filter(filter, in, in ? &to_feed : NULL,
+				  out, &to_receive))
 			return -1;
+		w->len += avail - to_receive;
+		if (in) {
+			in += len - to_feed;
+			len = to_feed;
+			if (!len)
+				return 0;
+		} else if (to_receive == avail) {
+			return 0; /* drained */
 		}
 	}
-	
-	close_manifest_stream(stream);
-	return bytes_read < 0 ? -1 : 0;
 }
 
-int stream_manifest_to_fd_filtered(struct repository *r, int fd, 
-                                   const struct object_id *manifest_oid,
-                                   struct stream_filter *filter)
+int stream_manifest_to_fd_filtered(struct repository *r, int fd,
+				   const struct object_id *manifest_oid,
+				   struct stream_filter *filter)
 {
 	struct manifest_stream *stream;
+	struct manifest_writer w;
 	unsigned long size;
-	char ibuf[1024 * 16]; /* Input buffer */
-	char obuf[1024 * 16]; /* Output buffer for filtered content */
-	ssize_t bytes_read;
-	int result = 0;
-	
+	int result = 0, check_size;
+
+	if (filter && is_null_stream_filter(filter)) {
+		free_stream_filter(filter);
+		filter = NULL;
+	}
+	check_size = !filter;
+
 	stream = open_manifest_stream(r, manifest_oid, &size);
 	if (!stream) {
 		if (filter)
 			free_stream_filter(filter);
 		return -1;
 	}
-	
-	if (!filter || is_null_stream_filter(filter)) {
-		/* No filtering needed, use simple streaming */
-		while ((bytes_read = read_manifest_stream(stream, ibuf, sizeof(ibuf))) > 0) {
-			if (write_in_full(fd, ibuf, bytes_read) < 0) {
+	manifest_writer_init(&w, fd);
+
+	if (!filter) {
+		/* No filtering needed, chunks can be copied as they are */
+		struct manifest_chunk_loc *loc;
+
+		while ((result = next_chunk(stream, &loc)) > 0) {
+			if (write_chunk(r, &w, loc) < 0) {
 				result = -1;
 				break;
 			}
 		}
-		if (bytes_read < 0)
-			result = -1;
 	} else {
+		char *ibuf = xmalloc(MANIFEST_WRITE_BUFFER);
+		ssize_t bytes_read;
+
 		/* Apply filters while streaming */
-		while ((bytes_read = read_manifest_stream(stream, ibuf, sizeof(ibuf))) > 0) {
-			size_t to_feed = bytes_read;
-			size_t to_receive = sizeof(obuf);
-			
-			if (stream_filter(filter, ibuf, &to_feed, obuf, &to_receive)) {
+		while ((bytes_read = read_manifest_stream(stream, ibuf,
+							  MANIFEST_WRITE_BUFFER)) > 0) {
+			if (filter_to_writer(filter, ibuf, bytes_read, &w) < 0) {
 				result = -1;
 				break;
 			}
-			
-			size_t filtered_size = sizeof(obuf) - to_receive;
-			if (filtered_size > 0 && write_in_full(fd, obuf, filtered_size) < 0) {
-				result = -1;
-				break;
-			}
-			
-			/* Handle any unconsumed input */
-			if (to_feed > 0) {
-				/* This shouldn't happen with our simple streaming,
-				 * but if it does, we'd need more complex buffering */
-				warning("manifest streaming: filter did not consume all input");
-			}
 		}
-		
 		if (bytes_read < 0)
 			result = -1;
-		
-		/* Drain any remaining filtered output */
-		if (result == 0) {
-			size_t to_receive = sizeof(obuf);
-			if (stream_filter(filter, NULL, NULL, obuf, &to_receive) == 0) {
-				size_t final_size = sizeof(obuf) - to_receive;
-				if (final_size > 0 && write_in_full(fd, obuf, final_size) < 0)
-					result = -1;
-			}
-		}
-		
+		if (!result && filter_to_writer(filter, NULL, 0, &w) < 0)
+			result = -1;
+		free(ibuf);
 		free_stream_filter(filter);
 	}
-	
+
+	if (manifest_writer_finish(&w) < 0)
+		result = -1;
+	/* a filter may change the length, but the chunks alone may not */
+	if (!result && check_size && w.written != size)
+		result = error(_("manifest %s: wrote %"PRIuMAX" bytes, expected %lu"),
+			       oid_to_hex(manifest_oid), w.written, size);
 	close_manifest_stream(stream);
 	return result;
 }
 
 /*
- * Internal function to build manifest content based on the configured version.
- * The caller is responsible for freeing the strbuf.
- * Returns 0 on success, -1 on error.
+ * Determine which manifest version to create. The configured
+ * bench.manifestversion may not exceed what the repository format
+ * (extensions.benchmanifestversion) allows readers to understand.
+ */
+static int manifest_version_to_write(struct repository *r)
+{
+	int version, allowed;
+
+	if (repo_config_get_int(r, "bench.manifestversion", &version))
+		version = 1; /* Default to version 1 if not configured */
+	if (repo_config_get_int(r, "extensions.benchmanifestversion", &allowed))
+		allowed = 1;
+
+	if (version < 1 || version > MANIFEST_VERSION_MAX)
+		return error(_("unsupported manifest version %d for creation"),
+			     version);
+	if (version > allowed)
+		return error(_("bench.manifestversion=%d requires "
+			       "extensions.benchmanifestversion=%d"),
+			     version, version);
+	return version;
+}
+
+/* One entry of a manifest being built: a chunk or a sub-manifest */
+struct manifest_node_entry {
+	struct object_id oid;
+	unsigned long size;
+	enum object_type type;
+};
+
+/*
+ * Serialize a single manifest object and hand it to "store".
+ *
+ * Manifest format v1:
+ *   Line 1: Version number ("1")
+ *   Line 2: Total size of all chunks combined
+ *   Line 3: Content OID (complete file hash after filters)
+ *   Line 4: Number of chunks
+ *   Line 5+: Chunk OIDs (one per line)
+ *
+ * Version 2 keeps the header and lists "<type> <oid> <size>" entries,
+ * where <type> is "blob" for a chunk or "manifest" for a sub-manifest
+ * covering the next <size> bytes of the file.
  */
-static int build_manifest_content(struct repository *r, struct strbuf *buf,
-                                 unsigned long total_size,
-                                 const struct object_id *content_oid,
-                                 size_t chunk_count,
-                                 const struct object_id *chunk_oids)
+static int store_manifest(struct object_id *oid,
+			  int version, unsigned long total_size,
+			  const struct object_id *content_oid,
+			  size_t nr, const struct manifest_node_entry *entries,
+			  manifest_store_fn store, void *data)
 {
-	int manifest_version;
+	struct strbuf buf = STRBUF_INIT;
 	size_t i;
+	int ret;
 
-	/*
-	 * Read manifest version from config. If not set, default to 1.
-	 * This allows us to control which manifest format version to use
-	 * when creating new manifests.
-	 */
-	if (repo_config_get_int(r, "bench.manifestversion", &manifest_version))
-		manifest_version = 1; /* Default to version 1 if not configured */
+	strbuf_addf(&buf, "%d\n", version);
+	strbuf_addf(&buf, "%lu\n", total_size);
+	strbuf_addf(&buf, "%s\n", oid_to_hex(content_oid));
+	strbuf_addf(&buf, "%"PRIuMAX"\n", (uintmax_t)nr);
 
-	/*
-	 * Currently we only support creating version 1 manifests.
-	 * When we add support for new versions, add cases here.
-	 */
-	if (manifest_version != 1) {
-		error("unsupported manifest version %d for creation (only version 1 is supported)",
-		      manifest_version);
-		return -1;
+	for (i = 0; i < nr; i++) {
+		if (version >= 2)
+			strbuf_addf(&buf, "%s %s %lu\n",
+				    type_name(entries[i].type),
+				    oid_to_hex(&entries[i].oid),
+				    entries[i].size);
+		else
+			strbuf_addf(&buf, "%s\n", oid_to_hex(&entries[i].oid));
 	}
 
-	/* Build manifest based on version */
-	switch (manifest_version) {
-	case 1:
-		/*
-		 * Manifest format v1:
-		 * Line 1: Version number ("1")
-		 * Line 2: Total size of all chunks combined
-		 * Line 3: Content OID (complete file hash after filters)
-		 * Line 4: Number of chunks
-		 * Line 5+: Chunk OIDs (one per line)
-		 */
-		strbuf_addf(buf, "%d\n", manifest_version);
-		strbuf_addf(buf, "%lu\n", total_size);
-		strbuf_addf(buf, "%s\n", oid_to_hex(content_oid));
-		strbuf_addf(buf, "%zu\n", chunk_count);
-		
-		/* Add all chunk OIDs */
-		for (i = 0; i < chunk_count; i++) {
-			strbuf_addstr(buf, oid_to_hex(&chunk_oids[i]));
-			strbuf_addch(buf, '\n');
-		}
-		break;
+	ret = store(&buf, oid, data);
+	strbuf_release(&buf);
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Version 2 manifests cut their entries into sub-manifests after every
+ * entry whose OID has its low bits clear, so that where a group ends
+ * depends on the entries around it rather than on their position in the
+ * file. Inserting a chunk then changes the one sub-manifest it lands in
+ * (and its parents) instead of shifting every group after it. Groups
+ * hold at least MANIFEST_GROUP_MIN entries, which guarantees that each
+ * level is smaller than the one below, and at most MANIFEST_FANOUT.
+ */
+#define MANIFEST_GROUP_MIN 16
+#define MANIFEST_GROUP_MASK 127
 
-	/* Future versions would have their own cases here */
+static int ends_manifest_group(const struct manifest_node_entry *entry,
+			       size_t n)
+{
+	if (n >= MANIFEST_FANOUT)
+		return 1;
+	return n >= MANIFEST_GROUP_MIN &&
+	       !(get_be32(entry->oid.hash) & MANIFEST_GROUP_MASK);
+}
 
-	default:
-		/* This should not happen due to check above, but be defensive */
-		error("BUG: unhandled manifest version %d", manifest_version);
+/*
+ * Build the manifest for a file made of "chunk_count" chunks. Version 1
+ * lists every chunk in one object. Version 2 folds groups of entries
+ * (see ends_manifest_group()) into sub-manifests, level by level, until
+ * the root fits in MANIFEST_FANOUT entries, so no single manifest grows
+ * with the size of the file. Sub-manifests cover an arbitrary slice of
+ * the file and so record the null OID as their content OID.
+ */
+int build_manifest(struct repository *r, struct object_id *oid,
+		   unsigned long total_size,
+		   const struct object_id *content_oid,
+		   size_t chunk_count,
+		   const struct object_id *chunk_oids,
+		   const unsigned long *chunk_sizes,
+		   manifest_store_fn store, void *data)
+{
+	struct manifest_node_entry *entries;
+	int version = manifest_version_to_write(r);
+	size_t i, n, nr = chunk_count;
+	int ret = 0;
+
+	if (version < 0)
 		return -1;
+	if (chunk_count > 1 && !chunk_sizes)
+		BUG("build_manifest() needs the sizes of the chunks");
+
+	ALLOC_ARRAY(entries, chunk_count ? chunk_count : 1);
+	for (i = 0; i < chunk_count; i++) {
+		oidcpy(&entries[i].oid, &chunk_oids[i]);
+		entries[i].type = OBJ_BLOB;
+		entries[i].size = 0;
+		if (version < 2)
+			continue;
+		entries[i].size = chunk_sizes ? chunk_sizes[i] : total_size;
 	}
 
+	while (version >= 2 && nr > MANIFEST_FANOUT) {
+		size_t out = 0;
+
+		for (i = 0; i < nr; i += n) {
+			struct manifest_node_entry node = { .type = OBJ_MANIFEST };
+
+			n = 0;
+			do {
+				node.size += entries[i + n].size;
+				n++;
+			} while (i + n < nr &&
+				 !ends_manifest_group(&entries[i + n - 1], n));
+			if (store_manifest(&node.oid, version, node.size,
+					   null_oid(r->hash_algo), n,
+					   entries + i, store, data) < 0) {
+				ret = -1;
+				goto out;
+			}
+			/* out <= i, so this never clobbers unread entries */
+			entries[out++] = node;
+		}
+		nr = out;
+	}
+
+	ret = store_manifest(oid, version, total_size, content_oid,
+			     nr, entries, store, data);
+out:
+	free(entries);
+	return ret;
+}
+
+static int write_manifest_buffer(struct strbuf *buf, struct object_id *oid,
+				 void *data UNUSED)
+{
+	return write_object_file(buf->buf, buf->len, OBJ_MANIFEST, oid);
+}
+
+static int hash_manifest_buffer(struct strbuf *buf, struct object_id *oid,
+				void *data)
+{
+	struct repository *r = data;
+
+	hash_object_file(r->hash_algo, buf->buf, buf->len, OBJ_MANIFEST, oid);
 	return 0;
 }
 
@@ -443,43 +1167,24 @@ int write_manifest_object(struct repository *r, struct object_id *oid,
                          unsigned long total_size,
                          const struct object_id *content_oid,
                          size_t chunk_count,
-                         const struct object_id *chunk_oids)
+                         const struct object_id *chunk_oids,
+                         const unsigned long *chunk_sizes)
 {
-	struct strbuf buf = STRBUF_INIT;
-	int ret;
-
-	/* Build the manifest content */
-	if (build_manifest_content(r, &buf, total_size, content_oid, chunk_count, chunk_oids) < 0) {
-		strbuf_release(&buf);
-		return -1;
-	}
-
-	/* Write manifest object */
-	ret = write_object_file(buf.buf, buf.len, OBJ_MANIFEST, oid);
-	strbuf_release(&buf);
-	
-	return ret < 0 ? -1 : 0;
+	return build_manifest(r, oid, total_size, content_oid,
+			      chunk_count, chunk_oids, chunk_sizes,
+			      write_manifest_buffer, NULL);
 }
 
 int hash_manifest_object(struct repository *r, struct object_id *oid,
                         unsigned long total_size,
                         const struct object_id *content_oid,
                         size_t chunk_count,
-                        const struct object_id *chunk_oids)
+                        const struct object_id *chunk_oids,
+                        const unsigned long *chunk_sizes)
 {
-	struct strbuf buf = STRBUF_INIT;
-
-	/* Build the manifest content */
-	if (build_manifest_content(r, &buf, total_size, content_oid, chunk_count, chunk_oids) < 0) {
-		strbuf_release(&buf);
-		return -1;
-	}
-
-	/* Hash the manifest object without writing it */
-	hash_object_file(r->hash_algo, buf.buf, buf.len, OBJ_MANIFEST, oid);
-	strbuf_release(&buf);
-	
-	return 0;
+	return build_manifest(r, oid, total_size, content_oid,
+			      chunk_count, chunk_oids, chunk_sizes,
+			      hash_manifest_buffer, r);
 }
 
 int get_manifest_content_oid(struct repository *r,
@@ -512,44 +1217,29 @@ int get_manifest_chunk_oids(struct repository *r,
                            unsigned long *total_size,
                            struct oid_array *chunk_oids)
 {
-	enum object_type type;
-	unsigned long manifest_size;
-	void *manifest_buffer;
+	struct manifest_chunk_iter iter;
 	struct manifest_header header;
-	struct manifest_desc desc;
+	int ret = 0;
 	
 	/* Verify this is actually a manifest */
-	type = oid_object_info(r, manifest_oid, &manifest_size);
-	if (type != OBJ_MANIFEST)
-		return -1;
-	
-	/* Read the manifest content */
-	manifest_buffer = repo_read_object_file(r, manifest_oid, &type, &manifest_size);
-	if (!manifest_buffer)
+	if (oid_object_info(r, manifest_oid, NULL) != OBJ_MANIFEST)
 		return -1;
 	
-	/* Parse the manifest header using shared function */
-	if (parse_manifest_header(manifest_buffer, manifest_size, &header) < 0) {
-		free(manifest_buffer);
+	if (manifest_chunk_iter_init(&iter, r, manifest_oid, &header) < 0)
 		return -1;
-	}
 	
-	/* Collect chunk OIDs if requested */
+	/* Collect the leaf chunk OIDs, flattening any sub-manifests */
 	if (chunk_oids) {
-		/* Initialize descriptor to iterate through chunk OIDs */
-		init_manifest_desc(&desc, header.chunk_data, header.chunk_data_len, r->hash_algo);
-		
 		oid_array_clear(chunk_oids);
-		while (manifest_entry(&desc)) {
-			oid_array_append(chunk_oids, &desc.entry_oid);
-		}
+		while ((ret = manifest_chunk_iter_next(&iter)) > 0)
+			oid_array_append(chunk_oids, &iter.oid);
 	}
 	
 	if (total_size)
 		*total_size = header.total_size;
 	
-	free(manifest_buffer);
-	return 0;
+	manifest_chunk_iter_release(&iter);
+	return ret;
 }
 
 void *read_manifest_content(struct repository *r,
@@ -4,6 +4,7 @@
 #include "object.h"
 
 struct oid_array;
+struct strbuf;
 
 extern const char *manifest_type;
 
@@ -20,6 +21,41 @@ struct manifest {
 
 struct manifest *lookup_manifest(struct repository *r, const struct object_id *oid);
 
+/* Newest manifest format this code can read and write */
+#define MANIFEST_VERSION_MAX 2
+
+/*
+ * Maximum number of entries in a version 2 manifest before chunks are
+ * folded into sub-manifests.
+ */
+#define MANIFEST_FANOUT 512
+
+/*
+ * Sub-manifests form a tree whose depth grows with the logarithm of the
+ * chunk count; anything deeper than this is corrupt (or hostile).
+ */
+#define MANIFEST_MAX_DEPTH 16
+
+/* Parsed manifest header */
+struct manifest_header {
+	int version;
+	unsigned long total_size;
+	struct object_id content_oid;  /* OID of complete file content (after filters) */
+	size_t chunk_count;      /* Number of entries (chunks or sub-manifests in v2) */
+	const char *chunk_data;  /* Pointer to start of entry data */
+	size_t chunk_data_len;   /* Length of entry data */
+};
+
+/**
+ * Parse the header of a manifest object's buffer. On failure the
+ * reason is appended to "err", or reported with error() if "err" is
+ * NULL.
+ * Returns 0 on success, -1 on error.
+ **/
+int parse_manifest_header_gently(const void *buffer, unsigned long size,
+				 struct manifest_header *header,
+				 struct strbuf *err);
+
 /**
  * Parse a manifest buffer and extract the chunk OID references.
  * Format: One hex OID per line (40 chars for SHA-1, 64 for SHA-256).
@@ -27,6 +63,19 @@ struct manifest *lookup_manifest(struct repository *r, const struct object_id *o
  **/
 int parse_manifest_buffer(struct repository *r, struct manifest *item, void *buffer, unsigned long size);
 
+/**
+ * Read a manifest object into item->buffer unless it already is, so
+ * its entries can be walked in place with manifest-walk.h. Release the
+ * buffer with free_manifest() when done.
+ * Returns 0 on success, -1 on error.
+ **/
+int parse_manifest_gently(struct repository *r, struct manifest *item,
+			  int quiet_on_missing);
+static inline int parse_manifest(struct repository *r, struct manifest *item)
+{
+	return parse_manifest_gently(r, item, 0);
+}
+
 
 /**
  * Write a manifest object directly to the object database.
@@ -38,7 +87,8 @@ int write_manifest_object(struct repository *r, struct object_id *oid,
                          unsigned long total_size,
                          const struct object_id *content_oid,
                          size_t chunk_count,
-                         const struct object_id *chunk_oids);
+                         const struct object_id *chunk_oids,
+                         const unsigned long *chunk_sizes);
 
 /**
  * Hash a manifest object without writing it to the database.
@@ -50,7 +100,33 @@ int hash_manifest_object(struct repository *r, struct object_id *oid,
                         unsigned long total_size,
                         const struct object_id *content_oid,
                         size_t chunk_count,
-                        const struct object_id *chunk_oids);
+                        const struct object_id *chunk_oids,
+                        const unsigned long *chunk_sizes);
+
+/*
+ * Called by build_manifest() with each serialized manifest object,
+ * sub-manifests before the manifests listing them. It must store (or
+ * hash) the buffer as an OBJ_MANIFEST and set "oid"; "buf" may be
+ * modified. Returns 0 on success, -1 on error.
+ */
+typedef int (*manifest_store_fn)(struct strbuf *buf, struct object_id *oid,
+				 void *data);
+
+/**
+ * Build the manifest for a file made of the given chunks in the
+ * configured format, leaving the storage of the manifest objects to
+ * "store" (for callers such as fast-import that write their own packs).
+ * "chunk_sizes" gives the size of each chunk, as the chunker knows it;
+ * it may be NULL only for a single chunk, whose size is "total_size".
+ * Returns 0 on success, -1 on error.
+ **/
+int build_manifest(struct repository *r, struct object_id *oid,
+		   unsigned long total_size,
+		   const struct object_id *content_oid,
+		   size_t chunk_count,
+		   const struct object_id *chunk_oids,
+		   const unsigned long *chunk_sizes,
+		   manifest_store_fn store, void *data);
 
 /**
  * Get the content OID from a manifest object.
@@ -61,6 +137,55 @@ int get_manifest_content_oid(struct repository *r,
                              const struct object_id *manifest_oid,
                              struct object_id *content_oid);
 
+/*
+ * Iterate over the leaf chunks of a manifest in file order, descending
+ * into the sub-manifests of a version 2 manifest as they are met. Only
+ * one manifest buffer per level of the tree is held at any time.
+ */
+struct manifest_iter_frame;
+struct manifest_chunk_iter {
+	struct repository *repo;
+	struct manifest_iter_frame *stack;
+	size_t nr, alloc;
+
+	/* The current chunk, valid after manifest_chunk_iter_next() returns 1 */
+	struct object_id oid;
+	unsigned long size;
+	unsigned has_size:1; /* "size" is only recorded by version 2 */
+};
+
+/**
+ * Start iterating over the chunks of "manifest_oid". If "header" is not
+ * NULL it receives the root manifest's header; its entry data pointer
+ * must not be used once iteration has begun.
+ * Returns 0 on success, -1 on error.
+ **/
+int manifest_chunk_iter_init(struct manifest_chunk_iter *iter,
+			     struct repository *r,
+			     const struct object_id *manifest_oid,
+			     struct manifest_header *header);
+
+/**
+ * Advance to the next chunk.
+ * Returns 1 if a chunk is available, 0 at the end, -1 on error.
+ **/
+int manifest_chunk_iter_next(struct manifest_chunk_iter *iter);
+
+/**
+ * Move a freshly started iterator to the chunk holding byte "offset" of
+ * the content, so that the next manifest_chunk_iter_next() returns it.
+ * A version 2 manifest is descended using the recorded sizes, without
+ * reading the sub-manifests before "offset"; the chunks of a version 1
+ * manifest have their sizes looked up one by one. "chunk_start" gets
+ * the offset at which that chunk starts. Past the end of the content,
+ * the iterator is left at the end.
+ * Returns 0 on success, -1 on error.
+ **/
+int manifest_chunk_iter_seek(struct manifest_chunk_iter *iter,
+			     unsigned long offset, unsigned long *chunk_start);
+
+void manifest_chunk_iter_release(struct manifest_chunk_iter *iter);
+
 /**
  * Free the memory associated with a manifest's chunk list.
  **/
@@ -86,6 +211,13 @@ struct manifest_stream *open_manifest_stream(struct repository *r,
  **/
 ssize_t read_manifest_stream(struct manifest_stream *stream, void *buf, size_t count);
 
+/**
+ * Continue reading the stream at byte "offset" of the content (see
+ * manifest_chunk_iter_seek()).
+ * Returns 0 on success, -1 on error.
+ **/
+int seek_manifest_stream(struct manifest_stream *stream, unsigned long offset);
+
 /**
  * Close a manifest stream and free associated resources.
  * Returns 0 on success, -1 on error.
@@ -85,6 +85,15 @@ void mem_pool_discard(struct mem_pool *pool, int invalidate_memory)
 
 	pool->mp_block = NULL;
 	pool->pool_alloc = 0;
+
+	/* an unmapped range is invalid memory already */
+	while (pool->mappings) {
+		struct mp_mapping *m = pool->mappings;
+
+		pool->mappings = m->next;
+		munmap(m->start, m->len);
+		free(m);
+	}
 }
 
 void *mem_pool_alloc(struct mem_pool *pool, size_t len)
@@ -177,9 +186,20 @@ char *mem_pool_strndup(struct mem_pool *pool, const char *str, size_t len)
 	return memcpy(ret, str, actual_len);
 }
 
+void mem_pool_add_mapping(struct mem_pool *pool, void *start, size_t len)
+{
+	struct mp_mapping *m = xmalloc(sizeof(*m));
+
+	m->start = start;
+	m->len = len;
+	m->next = pool->mappings;
+	pool->mappings = m;
+}
+
 int mem_pool_contains(struct mem_pool *pool, void *mem)
 {
 	struct mp_block *p;
+	struct mp_mapping *m;
 
 	/* Check if memory is allocated in a block */
 	for (p = pool->mp_block; p; p = p->next_block)
@@ -187,6 +207,10 @@ int mem_pool_contains(struct mem_pool *pool, void *mem)
 		    (mem < ((void *)p->end)))
 			return 1;
 
+	for (m = pool->mappings; m; m = m->next)
+		if (mem >= m->start && (char *)mem < (char *)m->start + m->len)
+			return 1;
+
 	return 0;
 }
 
@@ -217,4 +241,13 @@ void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src)
 	dst->pool_alloc += src->pool_alloc;
 	src->pool_alloc = 0;
 	src->mp_block = NULL;
+
+	if (src->mappings) {
+		struct mp_mapping **tail = &dst->mappings;
+
+		while (*tail)
+			tail = &(*tail)->next;
+		*tail = src->mappings;
+		src->mappings = NULL;
+	}
 }
@@ -8,6 +8,13 @@ struct mp_block {
 	uintmax_t space[FLEX_ARRAY]; /* more */
 };
 
+/* A memory mapping owned by a pool, see mem_pool_add_mapping(). */
+struct mp_mapping {
+	struct mp_mapping *next;
+	void *start;
+	size_t len;
+};
+
 struct mem_pool {
 	struct mp_block *mp_block;
 
@@ -19,6 +26,9 @@ struct mem_pool {
 
 	/* The total amount of memory allocated by the pool. */
 	size_t pool_alloc;
+
+	/* Memory mappings handed over to the pool. */
+	struct mp_mapping *mappings;
 };
 
 /*
@@ -60,6 +70,14 @@ char *mem_pool_strfmt(struct mem_pool *pool, const char *fmt, ...);
  */
 void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src);
 
+/*
+ * Hand the memory mapping of 'len' bytes at 'start' over to the pool.
+ * Objects that live in the mapping are then owned by the pool like
+ * those allocated from it: they move with `mem_pool_combine` and the
+ * mapping is unmapped by `mem_pool_discard`.
+ */
+void mem_pool_add_mapping(struct mem_pool *pool, void *start, size_t len);
+
 /*
  * Check if a memory pointed at by 'mem' is part of the range of
  * memory managed by the specified mem_pool.
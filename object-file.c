@@ -770,7 +770,7 @@ static int create_tmpfile(struct strbuf *tmp, const char *filename)
  */
 static int start_loose_object_common(struct strbuf *tmp_file,
 				     const char *filename, unsigned flags,
-				     git_zstream *stream,
+				     int level, git_zstream *stream,
 				     unsigned char *buf, size_t buflen,
 				     struct git_hash_ctx *c, struct git_hash_ctx *compat_c,
 				     char *hdr, int hdrlen)
@@ -794,7 +794,7 @@ static int start_loose_object_common(struct strbuf *tmp_file,
 	}
 
 	/*  Setup zlib stream for compression */
-	git_deflate_init(stream, zlib_compression_level);
+	git_deflate_init(stream, level);
 	stream->next_out = buf;
 	stream->avail_out = buflen;
 	algo->init_fn(c);
@@ -863,28 +863,53 @@ static int end_loose_object_common(struct git_hash_ctx *c, struct git_hash_ctx *
 	return Z_OK;
 }
 
+/*
+ * Blobs that would not shrink anyway (already-compressed media and
+ * the like) are written with stored deflate blocks, so that neither
+ * writing nor reading them spends time in zlib.
+ */
+static int loose_compression_level(enum object_type type,
+				   const void *buf, unsigned long len)
+{
+	struct repository *repo = the_repository;
+
+	if (type != OBJ_BLOB || zlib_compression_level == Z_NO_COMPRESSION)
+		return zlib_compression_level;
+	obj_read_lock();
+	prepare_repo_settings(repo);
+	obj_read_unlock();
+	if (repo->settings.store_incompressible &&
+	    git_deflate_looks_incompressible(buf, len))
+		return Z_NO_COMPRESSION;
+	return zlib_compression_level;
+}
+
 static int write_loose_object(const struct object_id *oid, char *hdr,
 			      int hdrlen, const void *buf, unsigned long len,
-			      time_t mtime, unsigned flags)
+			      int level, time_t mtime, unsigned flags)
 {
 	int fd, ret;
 	unsigned char compressed[4096];
 	git_zstream stream;
 	struct git_hash_ctx c;
 	struct object_id parano_oid;
-	static struct strbuf tmp_file = STRBUF_INIT;
-	static struct strbuf filename = STRBUF_INIT;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct strbuf filename = STRBUF_INIT;
 
+	/* the lock makes this safe to call from several threads */
+	obj_read_lock();
 	if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT))
 		prepare_loose_object_bulk_checkin();
-
 	odb_loose_path(the_repository->objects->sources, &filename, oid);
+	obj_read_unlock();
 
 	fd = start_loose_object_common(&tmp_file, filename.buf, flags,
-				       &stream, compressed, sizeof(compressed),
+				       level, &stream, compressed, sizeof(compressed),
 				       &c, NULL, hdr, hdrlen);
-	if (fd < 0)
-		return -1;
+	if (fd < 0) {
+		ret = -1;
+		goto out;
+	}
 
 	/* Then the data itself.. */
 	stream.next_in = (void *)buf;
@@ -918,8 +943,12 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 			warning_errno(_("failed utime() on %s"), tmp_file.buf);
 	}
 
-	return finalize_object_file_flags(tmp_file.buf, filename.buf,
-					  FOF_SKIP_COLLISION_CHECK);
+	ret = finalize_object_file_flags(tmp_file.buf, filename.buf,
+					 FOF_SKIP_COLLISION_CHECK);
+out:
+	strbuf_release(&tmp_file);
+	strbuf_release(&filename);
+	return ret;
 }
 
 static int freshen_loose_object(const struct object_id *oid)
@@ -979,7 +1008,7 @@ int stream_loose_object_with_type(struct input_stream *in_stream, size_t len,
 	 *  - Start to feed header to zlib stream.
 	 */
 	fd = start_loose_object_common(&tmp_file, filename.buf, 0,
-				       &stream, compressed, sizeof(compressed),
+				       zlib_compression_level, &stream, compressed, sizeof(compressed),
 				       &c, &compat_c, hdr, hdrlen);
 	if (fd < 0) {
 		err = -1;
@@ -1068,6 +1097,7 @@ int write_object_file_flags(const void *buf, unsigned long len,
 	struct object_id compat_oid;
 	char hdr[MAX_HEADER_LEN];
 	int hdrlen = sizeof(hdr);
+	int ret;
 
 	/* Generate compat_oid */
 	if (compat) {
@@ -1089,12 +1119,20 @@ int write_object_file_flags(const void *buf, unsigned long len,
 	 * it out into .git/objects/??/?{38} file.
 	 */
 	write_object_file_prepare(algo, buf, len, type, oid, hdr, &hdrlen);
-	if (freshen_packed_object(oid) || freshen_loose_object(oid))
+	obj_read_lock();
+	ret = freshen_packed_object(oid) || freshen_loose_object(oid);
+	obj_read_unlock();
+	if (ret)
 		return 0;
-	if (write_loose_object(oid, hdr, hdrlen, buf, len, 0, flags))
+	if (write_loose_object(oid, hdr, hdrlen, buf, len,
+			       loose_compression_level(type, buf, len), 0, flags))
 		return -1;
-	if (compat)
-		return repo_add_loose_object_map(repo, oid, &compat_oid);
+	if (compat) {
+		obj_read_lock();
+		ret = repo_add_loose_object_map(repo, oid, &compat_oid);
+		obj_read_unlock();
+		return ret;
+	}
 	return 0;
 }
 
@@ -1124,7 +1162,8 @@ int force_object_loose(const struct object_id *oid, time_t mtime)
 				     oid_to_hex(oid), compat->name);
 	}
 	hdrlen = format_object_header(hdr, sizeof(hdr), type, len);
-	ret = write_loose_object(oid, hdr, hdrlen, buf, len, mtime, 0);
+	ret = write_loose_object(oid, hdr, hdrlen, buf, len,
+				 loose_compression_level(type, buf, len), mtime, 0);
 	if (!ret && compat)
 		ret = repo_add_loose_object_map(the_repository, oid, &compat_oid);
 	free(buf);
@@ -1320,12 +1359,12 @@ int index_path(struct index_state *istate, struct object_id *oid,
 			 */
 			if (flags & INDEX_WRITE_OBJECT) {
 				/* For single chunk, content OID equals chunk OID */
-				if (write_manifest_object(repo, oid, st->st_size, &chunk_oid, 1, &chunk_oid) < 0)
+				if (write_manifest_object(repo, oid, st->st_size, &chunk_oid, 1, &chunk_oid, NULL) < 0)
 					rc = error(_("%s: failed to create manifest"), path);
 			} else {
 				/* Just hashing - create manifest hash without writing */
 				/* For single chunk, content OID equals chunk OID */
-				if (hash_manifest_object(repo, oid, st->st_size, &chunk_oid, 1, &chunk_oid) < 0)
+				if (hash_manifest_object(repo, oid, st->st_size, &chunk_oid, 1, &chunk_oid, NULL) < 0)
 					rc = error(_("%s: failed to hash manifest"), path);
 			}
 		} else {
@@ -1347,7 +1386,7 @@ int index_path(struct index_state *istate, struct object_id *oid,
 				/* Just hashing */
 				hash_object_file(the_hash_algo, sb.buf, sb.len,
 						 OBJ_BLOB, &chunk_oid);
-				if (hash_manifest_object(repo, oid, sb.len, &chunk_oid, 1, &chunk_oid) < 0)
+				if (hash_manifest_object(repo, oid, sb.len, &chunk_oid, 1, &chunk_oid, NULL) < 0)
 					rc = error(_("%s: failed to hash manifest"), path);
 			} else {
 				/* Write chunk */
@@ -1355,7 +1394,7 @@ int index_path(struct index_state *istate, struct object_id *oid,
 					rc = error(_("%s: failed to insert chunk into database"), path);
 				else {
 					/* Create manifest */
-					if (write_manifest_object(repo, oid, sb.len, &chunk_oid, 1, &chunk_oid) < 0)
+					if (write_manifest_object(repo, oid, sb.len, &chunk_oid, 1, &chunk_oid, NULL) < 0)
 						rc = error(_("%s: failed to create manifest"), path);
 				}
 			}
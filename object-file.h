@@ -172,6 +172,12 @@ enum {
 	WRITE_OBJECT_FILE_SILENT = (1 << 1),
 };
 
+/*
+ * Write a loose object (unless it already exists). With the object read
+ * lock enabled (see enable_obj_read_lock()), several threads may write
+ * objects at the same time; only the bookkeeping is serialized, not the
+ * compression.
+ */
 int write_object_file_flags(const void *buf, unsigned long len,
 			    enum object_type type, struct object_id *oid,
 			    struct object_id *compat_oid_in, unsigned flags);
@@ -280,9 +280,14 @@ struct object *parse_object_buffer(struct repository *r, const struct object_id
 	} else if (type == OBJ_MANIFEST) {
 		struct manifest *manifest = lookup_manifest(r, oid);
 		if (manifest) {
-			if (parse_manifest_buffer(r, manifest, buffer, size) < 0)
-				return NULL;
 			obj = &manifest->object;
+			if (!manifest->buffer)
+				manifest->object.parsed = 0;
+			if (!manifest->object.parsed) {
+				if (parse_manifest_buffer(r, manifest, buffer, size) < 0)
+					return NULL;
+				*eaten_p = 1;
+			}
 		}
 	} else {
 		warning(_("object %s has unknown type id %d"), oid_to_hex(oid), type);
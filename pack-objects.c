@@ -162,6 +162,7 @@ void clear_packing_data(struct packing_data *pdata)
 	free(pdata->in_pack_pos);
 	free(pdata->index);
 	free(pdata->layer);
+	free(pdata->chunk_pos);
 	free(pdata->objects);
 	free(pdata->tree_depth);
 }
@@ -186,6 +187,9 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 		if (pdata->layer)
 			REALLOC_ARRAY(pdata->layer, pdata->nr_alloc);
 
+		if (pdata->chunk_pos)
+			REALLOC_ARRAY(pdata->chunk_pos, pdata->nr_alloc);
+
 		if (pdata->cruft_mtime)
 			REALLOC_ARRAY(pdata->cruft_mtime, pdata->nr_alloc);
 	}
@@ -216,6 +220,9 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 	if (pdata->layer)
 		pdata->layer[pdata->nr_objects - 1] = 0;
 
+	if (pdata->chunk_pos)
+		pdata->chunk_pos[pdata->nr_objects - 1] = 0;
+
 	if (pdata->cruft_mtime)
 		pdata->cruft_mtime[pdata->nr_objects - 1] = 0;
 
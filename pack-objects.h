@@ -105,6 +105,7 @@ struct object_entry {
 	unsigned z_delta_size:OE_Z_DELTA_BITS;
 	unsigned type_valid:1;
 	unsigned no_try_delta:1;
+	unsigned incompressible:1; /* stored without deflate, never deltified */
 	unsigned type_:TYPE_BITS;
 	unsigned in_pack_type:TYPE_BITS; /* could be delta */
 
@@ -173,6 +174,14 @@ struct packing_data {
 	unsigned int *tree_depth;
 	unsigned char *layer;
 
+	/*
+	 * Offset of manifest chunks in their file (see
+	 * rev_info.chunk_position) plus one, 0 for other objects, used
+	 * to line up the same region of different versions of a file
+	 * in the delta search.
+	 */
+	uint64_t *chunk_pos;
+
 	/*
 	 * Used when writing cruft packs.
 	 *
@@ -330,6 +339,24 @@ static inline void oe_set_layer(struct packing_data *pack,
 	pack->layer[e - pack->objects] = layer;
 }
 
+static inline uint64_t oe_chunk_pos(struct packing_data *pack,
+				    const struct object_entry *e)
+{
+	if (!pack->chunk_pos)
+		return 0;
+	return pack->chunk_pos[e - pack->objects];
+}
+
+static inline void oe_set_chunk_pos(struct packing_data *pack,
+				    struct object_entry *e,
+				    uint64_t offset)
+{
+	if (!pack->chunk_pos)
+		CALLOC_ARRAY(pack->chunk_pos, pack->nr_alloc);
+	pack->chunk_pos[e - pack->objects] =
+		offset < UINT64_MAX ? offset + 1 : UINT64_MAX;
+}
+
 static inline uint32_t oe_cruft_mtime(struct packing_data *pack,
 				      struct object_entry *e)
 {
@@ -379,7 +379,7 @@ void close_object_store(struct object_database *o)
 
 void unlink_pack_path(const char *pack_name, int force_delete)
 {
-	static const char *exts[] = {".idx", ".pack", ".rev", ".keep", ".bitmap", ".promisor", ".mtimes"};
+	static const char *exts[] = {".idx", ".pack", ".rev", ".keep", ".bitmap", ".promisor", ".mtimes", ".chunks"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -760,6 +760,10 @@ struct packed_git *add_packed_git(struct repository *r, const char *path,
 	if (!access(p->pack_name, F_OK))
 		p->is_cruft = 1;
 
+	xsnprintf(p->pack_name + path_len, alloc - path_len, ".chunks");
+	if (!access(p->pack_name, F_OK))
+		p->pack_chunks = 1;
+
 	xsnprintf(p->pack_name + path_len, alloc - path_len, ".pack");
 	if (stat(p->pack_name, &st) || !S_ISREG(st.st_mode)) {
 		free(p);
@@ -927,7 +931,8 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	    ends_with(file_name, ".bitmap") ||
 	    ends_with(file_name, ".keep") ||
 	    ends_with(file_name, ".promisor") ||
-	    ends_with(file_name, ".mtimes"))
+	    ends_with(file_name, ".mtimes") ||
+	    ends_with(file_name, ".chunks"))
 		string_list_append(data->garbage, full_name);
 	else
 		report_garbage(PACKDIR_FILE_GARBAGE, full_name);
@@ -2041,6 +2046,14 @@ int is_pack_valid(struct packed_git *p)
 	return !open_packed_git(p);
 }
 
+void pack_prefetch_range(struct packed_git *p, off_t offset, off_t len)
+{
+#ifdef HAVE_POSIX_FADVISE
+	if (p->pack_fd >= 0)
+		posix_fadvise(p->pack_fd, offset, len, POSIX_FADV_WILLNEED);
+#endif
+}
+
 struct packed_git *find_oid_pack(const struct object_id *oid,
 				 struct packed_git *packs)
 {
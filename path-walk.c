@@ -10,6 +10,7 @@
 #include "hex.h"
 #include "list-objects.h"
 #include "object.h"
+#include "odb.h"
 #include "oid-array.h"
 #include "prio-queue.h"
 #include "repository.h"
@@ -17,6 +18,7 @@
 #include "string-list.h"
 #include "strmap.h"
 #include "manifest.h"
+#include "manifest-walk.h"
 #include "tag.h"
 #include "trace2.h"
 #include "tree.h"
@@ -106,6 +108,25 @@ static void push_to_stack(struct path_walk_context *ctx,
 	prio_queue_put(&ctx->path_stack, xstrdup(path));
 }
 
+static void add_to_path_list(struct path_walk_context *ctx,
+			     const char *path, enum object_type type,
+			     struct object *o)
+{
+	struct type_and_oid_list *list;
+
+	if (!(list = strmap_get(&ctx->paths_to_lists, path))) {
+		CALLOC_ARRAY(list, 1);
+		list->type = type;
+		strmap_put(&ctx->paths_to_lists, path, list);
+	}
+	push_to_stack(ctx, path);
+
+	if (!(o->flags & UNINTERESTING))
+		list->maybe_interesting = 1;
+
+	oid_array_append(&list->oids, &o->oid);
+}
+
 static int add_tree_entries(struct path_walk_context *ctx,
 			    const char *base_path,
 			    struct object_id *oid)
@@ -130,17 +151,16 @@ static int add_tree_entries(struct path_walk_context *ctx,
 
 	init_tree_desc(&desc, &tree->object.oid, tree->buffer, tree->size);
 	while (tree_entry(&desc, &entry)) {
-		struct type_and_oid_list *list;
 		struct object *o;
-		/* Not actually true, but we will ignore submodules later. */
-		enum object_type type = S_ISDIR(entry.mode) ? OBJ_TREE : OBJ_BLOB;
+		enum object_type type = object_type(entry.mode);
 
 		/* Skip submodules. */
 		if (S_ISGITLINK(entry.mode))
 			continue;
 
 		/* If the caller doesn't want blobs, then don't bother. */
-		if (!ctx->info->blobs && type == OBJ_BLOB)
+		if (!ctx->info->blobs &&
+		    (type == OBJ_BLOB || type == OBJ_MANIFEST))
 			continue;
 
 		if (type == OBJ_TREE) {
@@ -172,10 +192,13 @@ static int add_tree_entries(struct path_walk_context *ctx,
 
 		/*
 		 * Trees will end with "/" for concatenation and distinction
-		 * from blobs at the same path.
+		 * from blobs at the same path; manifests end with "//" (see
+		 * add_manifest_entries()).
 		 */
 		if (type == OBJ_TREE)
 			strbuf_addch(&path, '/');
+		else if (type == OBJ_MANIFEST)
+			strbuf_addstr(&path, "//");
 
 		if (ctx->info->pl) {
 			int dtype;
@@ -189,22 +212,12 @@ static int add_tree_entries(struct path_walk_context *ctx,
 			    match == NOT_MATCHED)
 				continue;
 			else if (!ctx->info->pl->use_cone_patterns &&
-				 type == OBJ_BLOB &&
+				 type != OBJ_TREE &&
 				 match != MATCHED)
 				continue;
 		}
 
-		if (!(list = strmap_get(&ctx->paths_to_lists, path.buf))) {
-			CALLOC_ARRAY(list, 1);
-			list->type = type;
-			strmap_put(&ctx->paths_to_lists, path.buf, list);
-		}
-		push_to_stack(ctx, path.buf);
-
-		if (!(o->flags & UNINTERESTING))
-			list->maybe_interesting = 1;
-
-		oid_array_append(&list->oids, &entry.oid);
+		add_to_path_list(ctx, path.buf, type, o);
 	}
 
 	free_tree_buffer(tree);
@@ -212,6 +225,79 @@ static int add_tree_entries(struct path_walk_context *ctx,
 	return 0;
 }
 
+/*
+ * Manifests at "<path>" are listed under "<path>//", which cannot collide
+ * with a tree entry as names are never empty. Add the manifest's chunks
+ * to "<path>//chunks" and, for a hierarchical manifest, its
+ * sub-manifests (at all depths) to "<path>//sub". Keeping the chunks of
+ * one file together lets delta compression see the versions of a chunk
+ * side by side.
+ */
+static int add_manifest_entries(struct path_walk_context *ctx,
+				const char *path,
+				const struct object_id *oid,
+				int depth)
+{
+	struct manifest_header header;
+	struct manifest_desc desc;
+	struct strbuf key = STRBUF_INIT;
+	enum object_type type;
+	unsigned long size;
+	size_t path_len;
+	void *buffer;
+	int ret = 0;
+
+	if (depth >= MANIFEST_MAX_DEPTH)
+		return error(_("manifest %s is nested too deeply"),
+			     oid_to_hex(oid));
+
+	buffer = odb_read_object(ctx->repo->objects, oid, &type, &size);
+	if (!buffer || type != OBJ_MANIFEST ||
+	    parse_manifest_header_gently(buffer, size, &header, NULL) < 0) {
+		free(buffer);
+		return error(_("bad manifest object %s"), oid_to_hex(oid));
+	}
+
+	strbuf_addstr(&key, path);
+	path_len = key.len;
+	init_manifest_desc(&desc, header.version, header.chunk_data,
+			   header.chunk_data_len, ctx->repo->hash_algo);
+	while (!ret && manifest_entry(&desc)) {
+		struct object *o;
+
+		if (desc.entry_type == OBJ_MANIFEST) {
+			struct manifest *m = lookup_manifest(ctx->repo, &desc.entry_oid);
+			o = m ? &m->object : NULL;
+		} else {
+			struct blob *b = lookup_blob(ctx->repo, &desc.entry_oid);
+			o = b ? &b->object : NULL;
+		}
+		if (!o) {
+			ret = error(_("failed to find object %s"),
+				    oid_to_hex(&desc.entry_oid));
+			break;
+		}
+		if (o->flags & SEEN)
+			continue;
+		o->flags |= SEEN;
+
+		strbuf_setlen(&key, path_len);
+		if (desc.entry_type == OBJ_MANIFEST) {
+			strbuf_addstr(&key, "sub");
+			add_to_path_list(ctx, key.buf, OBJ_MANIFEST, o);
+			ret = add_manifest_entries(ctx, path, &desc.entry_oid,
+						   depth + 1);
+		} else {
+			strbuf_addstr(&key, "chunks");
+			add_to_path_list(ctx, key.buf, OBJ_BLOB, o);
+		}
+	}
+
+	strbuf_release(&key);
+	free(buffer);
+	return ret;
+}
+
 /*
  * For each path in paths_to_explore, walk the trees another level
  * and add any found blobs to the batch (but only if they exist and
@@ -257,6 +343,11 @@ static int walk_path(struct path_walk_context *ctx,
 							     &list->oids.oid[i]);
 				if (b && !(b->object.flags & UNINTERESTING))
 					list->maybe_interesting = 1;
+			} else if (list->type == OBJ_MANIFEST) {
+				struct manifest *m = lookup_manifest(ctx->repo,
+								     &list->oids.oid[i]);
+				if (m && !(m->object.flags & UNINTERESTING))
+					list->maybe_interesting = 1;
 			} else {
 				/* Tags are always interesting if visited. */
 				list->maybe_interesting = 1;
@@ -271,6 +362,7 @@ static int walk_path(struct path_walk_context *ctx,
 	/* Evaluate function pointer on this data, if requested. */
 	if ((list->type == OBJ_TREE && ctx->info->trees) ||
 	    (list->type == OBJ_BLOB && ctx->info->blobs) ||
+	    (list->type == OBJ_MANIFEST && ctx->info->blobs) ||
 	    (list->type == OBJ_TAG && ctx->info->tags))
 		ret = ctx->info->path_fn(path, &list->oids, list->type,
 					ctx->info->path_fn_data);
@@ -282,6 +374,13 @@ static int walk_path(struct path_walk_context *ctx,
 					    path,
 					    &list->oids.oid[i]);
 		}
+	} else if (list->type == OBJ_MANIFEST && ends_with(path, "//")) {
+		/* Sub-manifests were expanded along with their root. */
+		for (size_t i = 0; i < list->oids.nr; i++) {
+			ret |= add_manifest_entries(ctx,
+						    path,
+						    &list->oids.oid[i], 0);
+		}
 	}
 
 	oid_array_clear(&list->oids);
@@ -398,16 +497,36 @@ static int setup_pending_objects(struct path_walk_info *info,
 			break;
 
 		case OBJ_BLOB:
+		case OBJ_MANIFEST:
 			if (!info->blobs)
 				continue;
 			if (pending->path) {
 				struct type_and_oid_list *list;
-				char *path = pending->path;
+				char *path = obj->type == OBJ_MANIFEST ?
+					xstrfmt("%s//", pending->path) :
+					xstrdup(pending->path);
 				if (!(list = strmap_get(&ctx->paths_to_lists, path))) {
 					CALLOC_ARRAY(list, 1);
-					list->type = OBJ_BLOB;
+					list->type = obj->type;
 					strmap_put(&ctx->paths_to_lists, path, list);
 				}
+				/*
+				 * The tree walk skips these now-SEEN objects,
+				 * so it will not mark the path interesting.
+				 */
+				if (!(obj->flags & UNINTERESTING))
+					list->maybe_interesting = 1;
+				oid_array_append(&list->oids, &obj->oid);
+				free(path);
+			} else if (obj->type == OBJ_MANIFEST) {
+				/* a tagged manifest has no path but its own */
+				struct type_and_oid_list *list;
+				if (!(list = strmap_get(&ctx->paths_to_lists, "//"))) {
+					CALLOC_ARRAY(list, 1);
+					list->type = OBJ_MANIFEST;
+					list->maybe_interesting = 1;
+					strmap_put(&ctx->paths_to_lists, "//", list);
+				}
 				oid_array_append(&list->oids, &obj->oid);
 			} else {
 				/* assume a root tree, such as a lightweight tag. */
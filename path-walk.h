@@ -35,7 +35,10 @@ struct path_walk_info {
 
 	/**
 	 * Initialize which object types the path_fn should be called on. This
-	 * could also limit the walk to skip blobs if not set.
+	 * could also limit the walk to skip blobs if not set. Manifests and
+	 * their chunks count as blobs; a manifest at "<path>" is reported
+	 * at "<path>//", its sub-manifests at "<path>//sub" and its chunks
+	 * at "<path>//chunks".
 	 */
 	int commits;
 	int trees;
@@ -0,0 +1,238 @@
+#define USE_THE_REPOSITORY_VARIABLE
+
+#include "git-compat-util.h"
+#include "dir.h"
+#include "environment.h"
+#include "hashmap.h"
+#include "parse.h"
+#include "pattern-index.h"
+
+/* The positions of the patterns hashed under one literal. */
+struct pattern_bucket {
+	struct hashmap_entry ent;
+	int *pos;
+	size_t nr, alloc;
+	size_t keylen;
+	char key[FLEX_ARRAY];
+};
+
+struct bucket_key {
+	const char *key;
+	size_t keylen;
+};
+
+struct pattern_index {
+	struct hashmap basenames;
+	struct hashmap extensions;
+	struct hashmap paths;
+	int *residual;
+	size_t residual_nr, residual_alloc;
+	int nr;
+};
+
+static unsigned int fspathmemhash(const char *s, size_t len)
+{
+	return ignore_case ? memihash(s, len) : memhash(s, len);
+}
+
+static int bucket_cmp(const void *cmp_data UNUSED,
+		      const struct hashmap_entry *eptr,
+		      const struct hashmap_entry *entry_or_key,
+		      const void *keydata)
+{
+	const struct pattern_bucket *a, *b;
+	const struct bucket_key *k = keydata;
+	const char *key;
+	size_t keylen;
+
+	a = container_of(eptr, const struct pattern_bucket, ent);
+	if (k) {
+		key = k->key;
+		keylen = k->keylen;
+	} else {
+		b = container_of(entry_or_key, const struct pattern_bucket, ent);
+		key = b->key;
+		keylen = b->keylen;
+	}
+	return a->keylen != keylen || fspathncmp(a->key, key, keylen);
+}
+
+static struct pattern_bucket *find_bucket(const struct hashmap *map,
+					  const char *key, size_t keylen)
+{
+	struct bucket_key k = { key, keylen };
+
+	return hashmap_get_entry_from_hash(map, fspathmemhash(key, keylen),
+					   &k, struct pattern_bucket, ent);
+}
+
+static void add_to_bucket(struct hashmap *map, const char *key,
+			  size_t keylen, int pos)
+{
+	struct pattern_bucket *b = find_bucket(map, key, keylen);
+
+	if (!b) {
+		FLEX_ALLOC_MEM(b, key, key, keylen);
+		b->keylen = keylen;
+		hashmap_entry_init(&b->ent, fspathmemhash(key, keylen));
+		hashmap_add(map, &b->ent);
+	}
+	ALLOC_GROW(b->pos, b->nr + 1, b->alloc);
+	b->pos[b->nr++] = pos;
+}
+
+struct pattern_index *pattern_index_new(void)
+{
+	struct pattern_index *index;
+
+	CALLOC_ARRAY(index, 1);
+	hashmap_init(&index->basenames, bucket_cmp, NULL, 0);
+	hashmap_init(&index->extensions, bucket_cmp, NULL, 0);
+	hashmap_init(&index->paths, bucket_cmp, NULL, 0);
+	return index;
+}
+
+static void free_buckets(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct pattern_bucket *b;
+
+	hashmap_for_each_entry(map, &iter, b, ent)
+		free(b->pos);
+	hashmap_clear_and_free(map, struct pattern_bucket, ent);
+}
+
+void pattern_index_free(struct pattern_index *index)
+{
+	if (!index)
+		return;
+	free_buckets(&index->basenames);
+	free_buckets(&index->extensions);
+	free_buckets(&index->paths);
+	free(index->residual);
+	free(index);
+}
+
+/*
+ * "*.ext" with no other dot in the suffix: a basename ends with it
+ * exactly when its own extension (from the last dot) is the suffix.
+ */
+static int is_extension_pattern(const char *pattern, int patternlen,
+				unsigned flags)
+{
+	return (flags & PATTERN_FLAG_ENDSWITH) &&
+		patternlen >= 2 && pattern[1] == '.' &&
+		!memchr(pattern + 2, '.', patternlen - 2);
+}
+
+void pattern_index_add(struct pattern_index *index, int pos,
+		       const char *pattern, int patternlen,
+		       int nowildcardlen, unsigned flags,
+		       const char *base, int baselen)
+{
+	if (pos < index->nr)
+		BUG("patterns must be added to the index in order");
+	index->nr = pos + 1;
+
+	if (flags & PATTERN_FLAG_NODIR) {
+		if (nowildcardlen == patternlen)
+			add_to_bucket(&index->basenames, pattern, patternlen,
+				      pos);
+		else if (is_extension_pattern(pattern, patternlen, flags))
+			add_to_bucket(&index->extensions, pattern + 1,
+				      patternlen - 1, pos);
+		else
+			goto residual;
+		return;
+	}
+
+	if (nowildcardlen == patternlen) {
+		/* match_pathname() anchors the pattern at its base */
+		struct strbuf path = STRBUF_INIT;
+
+		strbuf_add(&path, base, baselen);
+		if (baselen)
+			strbuf_addch(&path, '/');
+		if (*pattern == '/')
+			strbuf_add(&path, pattern + 1, patternlen - 1);
+		else
+			strbuf_add(&path, pattern, patternlen);
+		add_to_bucket(&index->paths, path.buf, path.len, pos);
+		strbuf_release(&path);
+		return;
+	}
+
+residual:
+	ALLOC_GROW(index->residual, index->residual_nr + 1,
+		   index->residual_alloc);
+	index->residual[index->residual_nr++] = pos;
+}
+
+int pattern_index_nr(const struct pattern_index *index)
+{
+	return index->nr;
+}
+
+static void lookup_bucket(struct pattern_index_lookup *lookup, int slot,
+			  const struct hashmap *map,
+			  const char *key, size_t keylen)
+{
+	struct pattern_bucket *b = find_bucket(map, key, keylen);
+
+	lookup->list[slot] = b ? b->pos : NULL;
+	lookup->nr[slot] = b ? b->nr : 0;
+}
+
+void pattern_index_lookup(const struct pattern_index *index,
+			  const char *pathname, int pathlen,
+			  const char *basename,
+			  struct pattern_index_lookup *lookup)
+{
+	const char *end = pathname + pathlen;
+	const char *ext = end;
+
+	while (ext > basename && ext[-1] != '.')
+		ext--;
+	if (ext > basename)
+		ext--;	/* include the dot */
+	else
+		ext = NULL;
+
+	lookup_bucket(lookup, 0, &index->basenames, basename, end - basename);
+	if (ext)
+		lookup_bucket(lookup, 1, &index->extensions, ext, end - ext);
+	else
+		lookup->nr[1] = 0;
+	lookup_bucket(lookup, 2, &index->paths, pathname, pathlen);
+	lookup->list[3] = index->residual;
+	lookup->nr[3] = index->residual_nr;
+}
+
+int pattern_index_next(struct pattern_index_lookup *lookup)
+{
+	int i, best = -1, pos = -1;
+
+	for (i = 0; i < 4; i++) {
+		int p;
+
+		if (!lookup->nr[i])
+			continue;
+		p = lookup->list[i][lookup->nr[i] - 1];
+		if (p > pos) {
+			pos = p;
+			best = i;
+		}
+	}
+	if (best >= 0)
+		lookup->nr[best]--;
+	return pos;
+}
+
+int pattern_index_enabled(void)
+{
+	static int enabled = -1;
+
+	if (enabled < 0)
+		enabled = git_env_bool("GIT_TEST_PATTERN_INDEX", 1);
+	return enabled;
+}
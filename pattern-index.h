@@ -0,0 +1,69 @@
+#ifndef PATTERN_INDEX_H
+#define PATTERN_INDEX_H
+
+/*
+ * A lookup structure over a list of ignore or attribute patterns (as
+ * parsed by parse_path_pattern()), so that matching a path does not
+ * have to try every pattern in turn.
+ *
+ * Patterns that are a literal basename ("Makefile"), a literal
+ * extension ("*.o") or a literal path ("/build", "doc/html") are
+ * hashed by that literal; everything else is kept on a residual list.
+ * A lookup returns, from the highest position down, the patterns that
+ * may match: those hashed under the basename, extension or path being
+ * looked up, and all residual ones.  Every pattern that can match is
+ * returned, so callers keep their "last one wins" rules by trying the
+ * candidates in the order they come with the matcher they already use.
+ */
+
+struct pattern_index;
+
+/*
+ * Lists with fewer patterns than this are cheaper to walk than to
+ * index.
+ */
+#define PATTERN_INDEX_MIN_PATTERNS 16
+
+struct pattern_index *pattern_index_new(void);
+void pattern_index_free(struct pattern_index *index);
+
+/*
+ * Add the pattern at position "pos" of the list; positions must be
+ * added in increasing order.  "base" is the directory the pattern is
+ * relative to, without a trailing slash.
+ */
+void pattern_index_add(struct pattern_index *index, int pos,
+		       const char *pattern, int patternlen,
+		       int nowildcardlen, unsigned flags,
+		       const char *base, int baselen);
+
+/* Number of patterns that were added. */
+int pattern_index_nr(const struct pattern_index *index);
+
+struct pattern_index_lookup {
+	const int *list[4];
+	int nr[4];
+};
+
+/*
+ * Start looking up "pathname" (without a trailing slash), whose last
+ * component starts at "basename".
+ */
+void pattern_index_lookup(const struct pattern_index *index,
+			  const char *pathname, int pathlen,
+			  const char *basename,
+			  struct pattern_index_lookup *lookup);
+
+/*
+ * Return the position of the next candidate pattern, in decreasing
+ * order, or -1 when there are no more.
+ */
+int pattern_index_next(struct pattern_index_lookup *lookup);
+
+/*
+ * Whether lists should be indexed.  GIT_TEST_PATTERN_INDEX=0 turns
+ * it off, to compare the results with a plain walk.
+ */
+int pattern_index_enabled(void);
+
+#endif /* PATTERN_INDEX_H */
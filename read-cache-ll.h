@@ -17,7 +17,7 @@ struct cache_header {
 };
 
 #define INDEX_FORMAT_LB 2
-#define INDEX_FORMAT_UB 4
+#define INDEX_FORMAT_UB 5
 
 struct cache_entry {
 	struct hashmap_entry ent;
@@ -137,6 +137,8 @@ static inline unsigned create_ce_flags(unsigned stage)
 
 struct split_index;
 struct untracked_cache;
+struct manifest_cache;
+struct index_blocks;
 struct progress;
 struct pattern_list;
 
@@ -184,6 +186,8 @@ struct index_state {
 	struct untracked_cache *untracked;
 	char *fsmonitor_last_update;
 	struct ewah_bitmap *fsmonitor_dirty;
+	struct manifest_cache *manifest_cache;
+	struct index_blocks *blocks;
 	struct mem_pool *ce_mem_pool;
 	struct progress *progress;
 	struct repository *repo;
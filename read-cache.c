@@ -10,6 +10,7 @@
 #include "git-compat-util.h"
 #include "bulk-checkin.h"
 #include "config.h"
+#include "convert.h"
 #include "date.h"
 #include "diff.h"
 #include "diffcore.h"
@@ -49,6 +50,7 @@
 #include "promisor-remote.h"
 #include "hook.h"
 #include "manifest.h"
+#include "manifest-cache.h"
 
 /* Mask for the name length in ce_flags in the on-disk index */
 
@@ -72,6 +74,8 @@
 #define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
 #define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
 #define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
+#define CACHE_EXT_MANIFEST 0x4d4e4654	  /* "MNFT" */
+#define CACHE_EXT_BLOCKS 0x626c636b	  /* "blck" */
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
@@ -248,14 +252,19 @@ static int ce_compare_manifest_with_file(struct index_state *istate,
 					 const struct cache_entry *ce,
 					 struct stat *st)
 {
-	struct object_id manifest_content_oid;
+	struct manifest_cache_info info;
 	int match = -1;
 	int fd;
-	
-	/* Get content OID from manifest */
-	if (get_manifest_content_oid(istate->repo, &ce->oid, &manifest_content_oid) < 0)
+
+	/* Content OID and size of the manifest, from the index if we can */
+	if (manifest_cache_get(istate, &ce->oid, &info) < 0)
 		return 1; /* Error reading manifest - assume changed */
-	
+
+	/* Without conversion, a file of another size cannot match */
+	if (info.size != (uint64_t)st->st_size &&
+	    !would_convert_to_git(istate, ce->name))
+		return 1;
+
 	/* Hash working tree file and compare with manifest's content OID */
 	fd = git_open_cloexec(ce->name, O_RDONLY);
 	if (fd >= 0) {
@@ -263,7 +272,7 @@ static int ce_compare_manifest_with_file(struct index_state *istate,
 		/* Use Git's standard file hashing (includes filters) */
 		if (!index_fd(istate, &file_oid, fd, st, OBJ_BLOB, ce->name, 0)) {
 			/* Compare file hash with manifest's content hash */
-			match = !oideq(&file_oid, &manifest_content_oid);
+			match = !oideq(&file_oid, &info.content_oid);
 		}
 		/* index_fd() closed the file descriptor already */
 	}
@@ -1744,12 +1753,113 @@ struct ondisk_cache_entry {
 #define ondisk_data_size_max(len) (ondisk_data_size(CE_EXTENDED, len))
 #define ondisk_ce_size(ce) (ondisk_cache_entry_size(ondisk_data_size((ce)->ce_flags, ce_namelen(ce))))
 
+/*
+ * Version 5 stores each entry as a fixed-size header followed by the
+ * NUL-terminated name, padded to a multiple of eight bytes.  The header
+ * has the layout of the in-core "struct cache_entry" of a 64-bit
+ * little-endian host, so that there the entries are used right where
+ * they are in a private, copy-on-write mapping of the index file,
+ * without parsing or copying them (see ce_v5_in_place()).  Other hosts
+ * decode the fields one by one.  All fields are 32-bit little-endian:
+ *
+ *    0  16 bytes of zero (hashmap_entry in core)
+ *   16  ctime sec, ctime nsec, mtime sec, mtime nsec, dev, ino, uid,
+ *       gid, size
+ *   52  mode
+ *   56  flags as in core, limited to CE_V5_ONDISK_FLAGS
+ *   60  1 (the entry is not allocated on its own)
+ *   64  name length
+ *   68  zero (split index position in core)
+ *   72  object name, padded with zeros to GIT_MAX_RAWSZ bytes
+ *  104  hash algorithm
+ *  108  name
+ *
+ * The index header is followed by the size of the entry header as a
+ * 32-bit word in network byte order, which also aligns the first entry.
+ */
+#define CE_V5_CTIME 16
+#define CE_V5_MTIME 24
+#define CE_V5_DEV 32
+#define CE_V5_INO 36
+#define CE_V5_UID 40
+#define CE_V5_GID 44
+#define CE_V5_SIZE 48
+#define CE_V5_MODE 52
+#define CE_V5_FLAGS 56
+#define CE_V5_POOL 60
+#define CE_V5_NAMELEN 64
+#define CE_V5_INDEX 68
+#define CE_V5_OID 72
+#define CE_V5_ALGO 104
+#define CE_V5_NAME 108
+#define CE_V5_ONDISK_FLAGS (CE_STAGEMASK | CE_EXTENDED | CE_VALID | CE_EXTENDED_FLAGS)
+#define ce_v5_size(len) ((CE_V5_NAME + (len) + 8) & ~7)
+
+/*
+ * Whether version 5 entries can be used in place on this host.  Not on
+ * Windows, where the index could not be replaced while the mapping
+ * that holds its entries is alive.
+ */
+static int ce_v5_in_place(void)
+{
+#if defined(NO_MMAP) || defined(GIT_WINDOWS_NATIVE) || \
+	GIT_BYTE_ORDER != GIT_LITTLE_ENDIAN
+	return 0;
+#else
+	return offsetof(struct cache_entry, ent) == 0 &&
+		sizeof(struct hashmap_entry) == CE_V5_CTIME &&
+		offsetof(struct cache_entry, ce_stat_data) == CE_V5_CTIME &&
+		sizeof(struct stat_data) == CE_V5_MODE - CE_V5_CTIME &&
+		offsetof(struct cache_entry, ce_mode) == CE_V5_MODE &&
+		offsetof(struct cache_entry, ce_flags) == CE_V5_FLAGS &&
+		offsetof(struct cache_entry, mem_pool_allocated) == CE_V5_POOL &&
+		offsetof(struct cache_entry, ce_namelen) == CE_V5_NAMELEN &&
+		offsetof(struct cache_entry, index) == CE_V5_INDEX &&
+		offsetof(struct cache_entry, oid) == CE_V5_OID &&
+		offsetof(struct object_id, algo) == CE_V5_ALGO - CE_V5_OID &&
+		offsetof(struct cache_entry, name) == CE_V5_NAME;
+#endif
+}
+
 /* Allow fsck to force verification of the index checksum. */
 int verify_index_checksum;
 
 /* Allow fsck to force verification of the cache entry order. */
 int verify_ce_order;
 
+/*
+ * With index.blockChecksums, the entries are cut into blocks of a few
+ * kilobytes, and the "blck" extension records the length and checksum
+ * of each block.  The trailing checksum of the file is then computed
+ * over the checksums of the blocks instead of their contents.  When the
+ * index is written again, blocks that come out the same as in the file
+ * being replaced are copied from it along with their checksums, so that
+ * only blocks with changed entries are hashed (see write_entry_block()).
+ */
+struct index_block {
+	uint32_t len;
+	unsigned char hash[GIT_MAX_RAWSZ];
+};
+
+struct index_blocks {
+	/* the file the blocks are in, and its trailing checksum */
+	char *path;
+	struct object_id oid;
+	/* where the first block starts in that file */
+	size_t offset;
+	struct index_block *block;
+	size_t nr, alloc;
+};
+
+static void free_index_blocks(struct index_blocks *blocks);
+static struct index_blocks *read_blocks_extension(const char *data, unsigned long sz);
+static void write_blocks_extension(struct strbuf *sb, const struct index_blocks *blocks);
+static int verify_index_blocks(const char *mmap, size_t mmap_size,
+			       unsigned char *result);
+
+static size_t read_eoie_extension(const char *mmap, size_t mmap_size);
+static void write_eoie_extension(struct strbuf *sb, struct git_hash_ctx *eoie_context, size_t offset);
+
 static int verify_hdr(const struct cache_header *hdr, unsigned long size)
 {
 	struct git_hash_ctx c;
@@ -1757,6 +1867,7 @@ static int verify_hdr(const struct cache_header *hdr, unsigned long size)
 	int hdr_version;
 	unsigned char *start, *end;
 	struct object_id oid;
+	int ret;
 
 	if (hdr->hdr_signature != htonl(CACHE_SIGNATURE))
 		return error(_("bad signature 0x%08x"), hdr->hdr_signature);
@@ -1773,9 +1884,14 @@ static int verify_hdr(const struct cache_header *hdr, unsigned long size)
 	if (oideq(&oid, null_oid(the_hash_algo)))
 		return 0;
 
-	the_hash_algo->init_fn(&c);
-	git_hash_update(&c, hdr, size - the_hash_algo->rawsz);
-	git_hash_final(hash, &c);
+	ret = verify_index_blocks((const char *)hdr, size, hash);
+	if (ret < 0)
+		return -1;
+	if (ret > 0) {
+		the_hash_algo->init_fn(&c);
+		git_hash_update(&c, hdr, size - the_hash_algo->rawsz);
+		git_hash_final(hash, &c);
+	}
 	if (!hasheq(hash, start, the_repository->hash_algo))
 		return error(_("bad index file sha1 signature"));
 	return 0;
@@ -1801,6 +1917,15 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_FSMONITOR:
 		read_fsmonitor_extension(istate, data, sz);
 		break;
+	case CACHE_EXT_MANIFEST:
+		read_manifest_cache_extension(istate, data, sz);
+		break;
+	case CACHE_EXT_BLOCKS:
+		free_index_blocks(istate->blocks);
+		istate->blocks = read_blocks_extension(data, sz);
+		if (!istate->blocks)
+			return -1;
+		break;
 	case CACHE_EXT_ENDOFINDEXENTRIES:
 	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
 		/* already handled in do_read_index() */
@@ -2036,9 +2161,6 @@ struct index_entry_offset_table
 static struct index_entry_offset_table *read_ieot_extension(const char *mmap, size_t mmap_size, size_t offset);
 static void write_ieot_extension(struct strbuf *sb, struct index_entry_offset_table *ieot);
 
-static size_t read_eoie_extension(const char *mmap, size_t mmap_size);
-static void write_eoie_extension(struct strbuf *sb, struct git_hash_ctx *eoie_context, size_t offset);
-
 struct load_index_extensions
 {
 	pthread_t pthread;
@@ -2120,6 +2242,77 @@ static unsigned long load_all_cache_entries(struct index_state *istate,
 	return consumed;
 }
 
+/*
+ * Load the version 5 entries.  With "in_place", the mapping must be
+ * writable and is handed over to the caller's pool afterwards; the
+ * entries are only checked, so that a corrupt file cannot give us
+ * entries that get free()d or that run past the end of the mapping.
+ */
+static unsigned long load_v5_cache_entries(struct index_state *istate,
+			const char *mmap, size_t mmap_size,
+			unsigned long src_offset, int in_place)
+{
+	unsigned long start_offset = src_offset;
+	size_t end = mmap_size - the_hash_algo->rawsz;
+	uint32_t algo = hash_algo_by_ptr(the_hash_algo);
+	unsigned int i;
+
+	if (end - src_offset < 4 ||
+	    get_be32(mmap + src_offset) != CE_V5_NAME)
+		die(_("index uses an unsupported entry layout"));
+	src_offset += 4;
+
+	istate->ce_mem_pool = xmalloc(sizeof(*istate->ce_mem_pool));
+	mem_pool_init(istate->ce_mem_pool, in_place ? 0 : mmap_size);
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		const char *ondisk = mmap + src_offset;
+		struct cache_entry *ce;
+		size_t namelen, size;
+		unsigned int flags;
+
+		if (end - src_offset < CE_V5_NAME + 1)
+			die(_("index file corrupt"));
+		namelen = get_le32(ondisk + CE_V5_NAMELEN);
+		size = ce_v5_size(namelen);
+		if (namelen > end - src_offset - CE_V5_NAME - 1 ||
+		    size > end - src_offset ||
+		    ondisk[CE_V5_NAME + namelen] ||
+		    get_le32(ondisk + CE_V5_POOL) != 1 ||
+		    get_le32(ondisk + CE_V5_INDEX) ||
+		    get_le32(ondisk + CE_V5_ALGO) != algo)
+			die(_("index file corrupt"));
+		flags = get_le32(ondisk + CE_V5_FLAGS);
+		if (flags & ~CE_V5_ONDISK_FLAGS)
+			die(_("unknown index entry format 0x%08x"), flags);
+
+		if (in_place) {
+			ce = (struct cache_entry *)ondisk;
+		} else {
+			ce = mem_pool__ce_alloc(istate->ce_mem_pool, namelen);
+			ce->ce_stat_data.sd_ctime.sec = get_le32(ondisk + CE_V5_CTIME);
+			ce->ce_stat_data.sd_ctime.nsec = get_le32(ondisk + CE_V5_CTIME + 4);
+			ce->ce_stat_data.sd_mtime.sec = get_le32(ondisk + CE_V5_MTIME);
+			ce->ce_stat_data.sd_mtime.nsec = get_le32(ondisk + CE_V5_MTIME + 4);
+			ce->ce_stat_data.sd_dev = get_le32(ondisk + CE_V5_DEV);
+			ce->ce_stat_data.sd_ino = get_le32(ondisk + CE_V5_INO);
+			ce->ce_stat_data.sd_uid = get_le32(ondisk + CE_V5_UID);
+			ce->ce_stat_data.sd_gid = get_le32(ondisk + CE_V5_GID);
+			ce->ce_stat_data.sd_size = get_le32(ondisk + CE_V5_SIZE);
+			ce->ce_mode = get_le32(ondisk + CE_V5_MODE);
+			ce->ce_flags = flags;
+			ce->ce_namelen = namelen;
+			ce->index = 0;
+			oidread(&ce->oid, (const unsigned char *)ondisk + CE_V5_OID,
+				the_hash_algo);
+			memcpy(ce->name, ondisk + CE_V5_NAME, namelen + 1);
+		}
+		set_index_entry(istate, i, ce);
+		src_offset += size;
+	}
+	return src_offset - start_offset;
+}
+
 /*
  * Mostly randomly chosen maximum thread counts: we
  * cap the parallelism to online_cpus() threads, and we want
@@ -2246,6 +2439,15 @@ static void set_new_index_sparsity(struct index_state *istate)
 		istate->sparse_index = 1;
 }
 
+static int peek_index_version(int fd)
+{
+	struct cache_header hdr;
+
+	if (pread_in_full(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		return -1;
+	return ntohl(hdr.hdr_version);
+}
+
 /* remember to discard_cache() before reading a different cache! */
 int do_read_index(struct index_state *istate, const char *path, int must_exist)
 {
@@ -2259,6 +2461,7 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	size_t extension_offset = 0;
 	int nr_threads, cpus;
 	struct index_entry_offset_table *ieot = NULL;
+	int prot = PROT_READ;
 
 	if (istate->initialized)
 		return istate->cache_nr;
@@ -2282,7 +2485,11 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	if (mmap_size < sizeof(struct cache_header) + the_hash_algo->rawsz)
 		die(_("%s: index file smaller than expected"), path);
 
-	mmap = xmmap_gently(NULL, mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	/* version 5 entries are used in place, and may be modified there */
+	if (ce_v5_in_place() && peek_index_version(fd) == 5)
+		prot |= PROT_WRITE;
+
+	mmap = xmmap_gently(NULL, mmap_size, prot, MAP_PRIVATE, fd, 0);
 	if (mmap == MAP_FAILED)
 		die_errno(_("%s: unable to map index file%s"), path,
 			mmap_os_err());
@@ -2338,10 +2545,13 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	 * Locate and read the index entry offset table so that we can use it
 	 * to multi-thread the reading of the cache entries.
 	 */
-	if (extension_offset && nr_threads > 1)
+	if (extension_offset && nr_threads > 1 && istate->version != 5)
 		ieot = read_ieot_extension(mmap, mmap_size, extension_offset);
 
-	if (ieot) {
+	if (istate->version == 5) {
+		src_offset += load_v5_cache_entries(istate, mmap, mmap_size,
+						    src_offset, prot & PROT_WRITE);
+	} else if (ieot) {
 		src_offset += load_cache_entries_threaded(istate, mmap, mmap_size, nr_threads, ieot);
 		free(ieot);
 	} else {
@@ -2360,7 +2570,18 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 		p.src_offset = src_offset;
 		load_index_extensions(&p);
 	}
-	munmap((void *)mmap, mmap_size);
+	if (prot & PROT_WRITE)
+		mem_pool_add_mapping(istate->ce_mem_pool, (void *)mmap, mmap_size);
+	else
+		munmap((void *)mmap, mmap_size);
+
+	/* remember where the blocks are, to reuse them when writing */
+	if (istate->blocks) {
+		istate->blocks->path = xstrdup(path);
+		oidcpy(&istate->blocks->oid, &istate->oid);
+		istate->blocks->offset = sizeof(*hdr) +
+			(istate->version == 5 ? sizeof(uint32_t) : 0);
+	}
 
 	/*
 	 * TODO trace2: replace "the_repository" with the actual repo instance
@@ -2501,6 +2722,8 @@ void release_index(struct index_state *istate)
 	free(istate->cache);
 	discard_split_index(istate);
 	free_untracked_cache(istate->untracked);
+	free_manifest_cache(istate);
+	free_index_blocks(istate->blocks);
 
 	if (istate->sparse_checkout_patterns) {
 		clear_pattern_list(istate->sparse_checkout_patterns);
@@ -2695,7 +2918,7 @@ static void copy_cache_entry_to_ondisk(struct ondisk_cache_entry *ondisk,
 	}
 }
 
-static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
+static int ce_write_entry(struct strbuf *sb, struct cache_entry *ce,
 			  struct strbuf *previous_name, struct ondisk_cache_entry *ondisk)
 {
 	int size;
@@ -2714,9 +2937,9 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 	if (!previous_name) {
 		int len = ce_namelen(ce);
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		hashwrite(f, ondisk, size);
-		hashwrite(f, ce->name, len);
-		hashwrite(f, padding, align_padding_size(size, len));
+		strbuf_add(sb, ondisk, size);
+		strbuf_add(sb, ce->name, len);
+		strbuf_add(sb, padding, align_padding_size(size, len));
 	} else {
 		int common, to_remove, prefix_size;
 		unsigned char to_remove_vi[16];
@@ -2730,10 +2953,10 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 		prefix_size = encode_varint(to_remove, to_remove_vi);
 
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		hashwrite(f, ondisk, size);
-		hashwrite(f, to_remove_vi, prefix_size);
-		hashwrite(f, ce->name + common, ce_namelen(ce) - common);
-		hashwrite(f, padding, 1);
+		strbuf_add(sb, ondisk, size);
+		strbuf_add(sb, to_remove_vi, prefix_size);
+		strbuf_add(sb, ce->name + common, ce_namelen(ce) - common);
+		strbuf_add(sb, padding, 1);
 
 		strbuf_splice(previous_name, common, to_remove,
 			      ce->name + common, ce_namelen(ce) - common);
@@ -2746,6 +2969,39 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 	return 0;
 }
 
+static void ce_write_entry_v5(struct strbuf *sb, struct cache_entry *ce)
+{
+	unsigned char ondisk[CE_V5_NAME];
+	static unsigned char padding[8] = { 0x00 };
+	unsigned int namelen = ce_namelen(ce);
+
+	if (ce->ce_flags & CE_STRIP_NAME) {
+		namelen = 0;
+		ce->ce_flags &= ~CE_STRIP_NAME;
+	}
+
+	memset(ondisk, 0, sizeof(ondisk));
+	put_le32(ondisk + CE_V5_CTIME, ce->ce_stat_data.sd_ctime.sec);
+	put_le32(ondisk + CE_V5_CTIME + 4, ce->ce_stat_data.sd_ctime.nsec);
+	put_le32(ondisk + CE_V5_MTIME, ce->ce_stat_data.sd_mtime.sec);
+	put_le32(ondisk + CE_V5_MTIME + 4, ce->ce_stat_data.sd_mtime.nsec);
+	put_le32(ondisk + CE_V5_DEV, ce->ce_stat_data.sd_dev);
+	put_le32(ondisk + CE_V5_INO, ce->ce_stat_data.sd_ino);
+	put_le32(ondisk + CE_V5_UID, ce->ce_stat_data.sd_uid);
+	put_le32(ondisk + CE_V5_GID, ce->ce_stat_data.sd_gid);
+	put_le32(ondisk + CE_V5_SIZE, ce->ce_stat_data.sd_size);
+	put_le32(ondisk + CE_V5_MODE, ce->ce_mode);
+	put_le32(ondisk + CE_V5_FLAGS, ce->ce_flags & CE_V5_ONDISK_FLAGS);
+	put_le32(ondisk + CE_V5_POOL, 1);
+	put_le32(ondisk + CE_V5_NAMELEN, namelen);
+	hashcpy(ondisk + CE_V5_OID, ce->oid.hash, the_repository->hash_algo);
+	put_le32(ondisk + CE_V5_ALGO, hash_algo_by_ptr(the_hash_algo));
+
+	strbuf_add(sb, ondisk, sizeof(ondisk));
+	strbuf_add(sb, ce->name, namelen);
+	strbuf_add(sb, padding, ce_v5_size(namelen) - CE_V5_NAME - namelen);
+}
+
 /*
  * This function verifies if index_state has the correct sha1 of the
  * index file.  Don't die if we have any other failure, just return 0.
@@ -2844,6 +3100,195 @@ static int record_ieot(void)
 	return !repo_config_get_index_threads(the_repository, &val) && val != 1;
 }
 
+/*
+ * Cut a block after an entry whose name hashes to zero in the bits of
+ * INDEX_BLOCK_CUT_MASK, once it has INDEX_BLOCK_MIN bytes, so that the
+ * blocks follow the entries rather than their offsets: adding or
+ * removing an entry only changes the blocks around it.
+ */
+#define INDEX_BLOCK_MIN (4 * 1024)
+#define INDEX_BLOCK_MAX (64 * 1024)
+#define INDEX_BLOCK_CUT_MASK 31
+
+/* A block of the file being replaced, keyed by its length and start. */
+struct old_block {
+	struct hashmap_entry ent;
+	const struct index_block *block;
+	size_t offset;
+};
+
+struct old_block_key {
+	const char *buf;
+	size_t len;
+};
+
+struct block_writer {
+	struct hashfile *f;
+	/* the blocks being written */
+	struct index_blocks *blocks;
+	/* the file being replaced, when its blocks can be reused */
+	int fd;
+	const char *map;
+	size_t map_size;
+	struct old_block *old;
+	struct hashmap old_map;
+	/* a run of its blocks still to be copied */
+	size_t copy_offset, copy_len;
+	size_t reused;
+};
+
+static unsigned int old_block_hash(const char *buf, size_t len)
+{
+	return memhash(buf, len < 64 ? len : 64) ^ len;
+}
+
+static int old_block_cmp(const void *cmp_data,
+			 const struct hashmap_entry *eptr,
+			 const struct hashmap_entry *entry_or_key,
+			 const void *keydata)
+{
+	const struct block_writer *bw = cmp_data;
+	const struct old_block *a = container_of(eptr, const struct old_block, ent);
+	const struct old_block_key *key = keydata;
+
+	if (!key) {
+		const struct old_block *b =
+			container_of(entry_or_key, const struct old_block, ent);
+		return a->block->len != b->block->len ||
+			memcmp(bw->map + a->offset, bw->map + b->offset, a->block->len);
+	}
+	return a->block->len != key->len ||
+		memcmp(bw->map + a->offset, key->buf, key->len);
+}
+
+static void block_writer_init(struct block_writer *bw,
+			      struct index_state *istate,
+			      struct hashfile *f, off_t offset)
+{
+	const struct index_blocks *old = istate->blocks;
+	const unsigned rawsz = the_hash_algo->rawsz;
+	struct stat st;
+	size_t i, pos;
+	int fd;
+
+	bw->f = f;
+	bw->fd = -1;
+	CALLOC_ARRAY(bw->blocks, 1);
+	bw->blocks->offset = offset;
+	hashmap_init(&bw->old_map, old_block_cmp, bw, 0);
+
+	/*
+	 * Reuse the blocks of the file only if it still is the one they
+	 * were read from or written to.
+	 */
+	if (!old || !old->path)
+		return;
+	fd = open(old->path, O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) || xsize_t(st.st_size) < old->offset + rawsz) {
+		close(fd);
+		return;
+	}
+	bw->map_size = xsize_t(st.st_size);
+	bw->map = xmmap_gently(NULL, bw->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (bw->map == MAP_FAILED ||
+	    !hasheq((const unsigned char *)bw->map + bw->map_size - rawsz,
+		    old->oid.hash, the_repository->hash_algo)) {
+		if (bw->map != MAP_FAILED)
+			munmap((void *)bw->map, bw->map_size);
+		bw->map = NULL;
+		close(fd);
+		return;
+	}
+	bw->fd = fd;
+
+	ALLOC_ARRAY(bw->old, old->nr);
+	pos = old->offset;
+	for (i = 0; i < old->nr; i++) {
+		struct old_block *ob = &bw->old[i];
+
+		if (old->block[i].len > bw->map_size - rawsz - pos)
+			break;
+		ob->block = &old->block[i];
+		ob->offset = pos;
+		hashmap_entry_init(&ob->ent,
+				   old_block_hash(bw->map + pos, ob->block->len));
+		hashmap_add(&bw->old_map, &ob->ent);
+		pos += ob->block->len;
+	}
+}
+
+static void block_writer_flush(struct block_writer *bw)
+{
+	if (!bw->copy_len)
+		return;
+	hashcopy_unhashed(bw->f, bw->fd, bw->copy_offset, bw->copy_len);
+	bw->copy_len = 0;
+}
+
+static void block_writer_release(struct block_writer *bw)
+{
+	hashmap_clear(&bw->old_map);
+	free(bw->old);
+	if (bw->map)
+		munmap((void *)bw->map, bw->map_size);
+	if (bw->fd >= 0)
+		close(bw->fd);
+	free_index_blocks(bw->blocks);
+}
+
+/*
+ * Write out a block of entries.  Without "bw" this is a plain write.
+ * Otherwise, a block that is the same as one in the file being
+ * replaced is copied from there with its checksum; any other block is
+ * hashed and written.  Either way, only its checksum goes into the
+ * trailing checksum of the file.
+ */
+static void write_entry_block(struct block_writer *bw, struct hashfile *f,
+			      struct strbuf *block)
+{
+	struct old_block_key key = { block->buf, block->len };
+	struct old_block *ob;
+	struct index_block *b;
+
+	if (!bw) {
+		hashwrite(f, block->buf, block->len);
+		strbuf_reset(block);
+		return;
+	}
+
+	ALLOC_GROW(bw->blocks->block, bw->blocks->nr + 1, bw->blocks->alloc);
+	b = &bw->blocks->block[bw->blocks->nr++];
+	b->len = block->len;
+
+	ob = hashmap_get_entry_from_hash(&bw->old_map,
+					 old_block_hash(block->buf, block->len),
+					 &key, struct old_block, ent);
+	if (ob) {
+		memcpy(b->hash, ob->block->hash, the_hash_algo->rawsz);
+		bw->reused++;
+		if (bw->copy_len &&
+		    bw->copy_offset + bw->copy_len == ob->offset) {
+			bw->copy_len += b->len;
+		} else {
+			block_writer_flush(bw);
+			bw->copy_offset = ob->offset;
+			bw->copy_len = b->len;
+		}
+	} else {
+		struct git_hash_ctx c;
+
+		block_writer_flush(bw);
+		unsafe_hash_algo(the_hash_algo)->init_fn(&c);
+		git_hash_update(&c, block->buf, block->len);
+		git_hash_final(b->hash, &c);
+		hashwrite_unhashed(f, block->buf, block->len);
+	}
+	hashfile_update(f, b->hash, the_hash_algo->rawsz);
+	strbuf_reset(block);
+}
+
 enum write_extensions {
 	WRITE_NO_EXTENSION =              0,
 	WRITE_SPLIT_INDEX_EXTENSION =     1<<0,
@@ -2851,6 +3296,7 @@ enum write_extensions {
 	WRITE_RESOLVE_UNDO_EXTENSION =    1<<2,
 	WRITE_UNTRACKED_CACHE_EXTENSION = 1<<3,
 	WRITE_FSMONITOR_EXTENSION =       1<<4,
+	WRITE_MANIFEST_CACHE_EXTENSION =  1<<5,
 };
 #define WRITE_ALL_EXTENSIONS ((enum write_extensions)-1)
 
@@ -2881,22 +3327,33 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	struct index_entry_offset_table *ieot = NULL;
 	struct repository *r = istate->repo;
 	struct strbuf sb = STRBUF_INIT;
-	int nr, nr_threads, ret;
+	struct strbuf block = STRBUF_INIT;
+	struct block_writer bw = { .fd = -1 };
+	off_t entries_offset;
+	size_t written = 0;
+	int nr, nr_threads, ret, use_blocks;
 
 	f = hashfd(the_repository->hash_algo, tempfile->fd, tempfile->filename.buf);
 
 	prepare_repo_settings(r);
 	f->skip_hash = r->settings.index_skip_hash;
+	use_blocks = r->settings.index_block_checksums && !f->skip_hash;
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
 			removed++;
 
-		/* reduce extended entries if possible */
-		cache[i]->ce_flags &= ~CE_EXTENDED;
+		/*
+		 * reduce extended entries if possible, without touching
+		 * entries that are right (they may be in a mapping, see
+		 * ce_v5_in_place())
+		 */
 		if (cache[i]->ce_flags & CE_EXTENDED_FLAGS) {
 			extended++;
-			cache[i]->ce_flags |= CE_EXTENDED;
+			if (!(cache[i]->ce_flags & CE_EXTENDED))
+				cache[i]->ce_flags |= CE_EXTENDED;
+		} else if (cache[i]->ce_flags & CE_EXTENDED) {
+			cache[i]->ce_flags &= ~CE_EXTENDED;
 		}
 	}
 
@@ -2914,11 +3371,14 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	hdr.hdr_entries = htonl(entries - removed);
 
 	hashwrite(f, &hdr, sizeof(hdr));
+	if (hdr_version == 5)
+		hashwrite_be32(f, CE_V5_NAME);
 
 	if (!HAVE_THREADS || repo_config_get_index_threads(the_repository, &nr_threads))
 		nr_threads = 1;
 
-	if (nr_threads != 1 && record_ieot()) {
+	/* version 5 entries are not parsed, there is nothing to spread */
+	if (nr_threads != 1 && hdr_version != 5 && record_ieot()) {
 		int ieot_blocks, cpus;
 
 		/*
@@ -2948,7 +3408,9 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		}
 	}
 
-	offset = hashfile_total(f);
+	offset = entries_offset = hashfile_total(f);
+	if (use_blocks)
+		block_writer_init(&bw, istate, f, entries_offset);
 
 	nr = 0;
 	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
@@ -2985,15 +3447,28 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 				previous_name->buf[0] = 0;
 			nr = 0;
 
-			offset = hashfile_total(f);
+			offset = entries_offset + written + block.len;
 		}
-		if (ce_write_entry(f, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
+		if (hdr_version == 5)
+			ce_write_entry_v5(&block, ce);
+		else if (ce_write_entry(&block, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
 			err = -1;
 
 		if (err)
 			break;
 		nr++;
+
+		if (block.len >= INDEX_BLOCK_MAX ||
+		    (use_blocks && block.len >= INDEX_BLOCK_MIN &&
+		     !(memhash(ce->name, ce_namelen(ce)) & INDEX_BLOCK_CUT_MASK))) {
+			written += block.len;
+			write_entry_block(use_blocks ? &bw : NULL, f, &block);
+		}
 	}
+	if (!err && block.len)
+		write_entry_block(use_blocks ? &bw : NULL, f, &block);
+	if (use_blocks)
+		block_writer_flush(&bw);
 	if (ieot && nr) {
 		ieot->entries[ieot->nr].nr = nr;
 		ieot->entries[ieot->nr].offset = offset;
@@ -3011,8 +3486,9 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	/*
 	 * The extension headers must be hashed on their own for the
 	 * EOIE extension. Create a hashfile here to compute that hash.
+	 * The block checksums are found through it when verifying them.
 	 */
-	if (offset && record_eoie()) {
+	if (offset && (use_blocks || record_eoie())) {
 		CALLOC_ARRAY(eoie_c, 1);
 		the_hash_algo->init_fn(eoie_c);
 	}
@@ -3036,6 +3512,19 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		}
 	}
 
+	/* regardless of write_extensions, as the trailer depends on it */
+	if (use_blocks) {
+		strbuf_reset(&sb);
+
+		write_blocks_extension(&sb, bw.blocks);
+		err = write_index_ext_header(f, eoie_c, CACHE_EXT_BLOCKS, sb.len) < 0;
+		hashwrite(f, sb.buf, sb.len);
+		if (err) {
+			ret = -1;
+			goto out;
+		}
+	}
+
 	if (write_extensions & WRITE_SPLIT_INDEX_EXTENSION &&
 	    istate->split_index) {
 		strbuf_reset(&sb);
@@ -3102,6 +3591,18 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 			goto out;
 		}
 	}
+	if (write_extensions & WRITE_MANIFEST_CACHE_EXTENSION &&
+	    want_manifest_cache_extension(istate)) {
+		strbuf_reset(&sb);
+
+		write_manifest_cache_extension(&sb, istate);
+		err = write_index_ext_header(f, eoie_c, CACHE_EXT_MANIFEST, sb.len) < 0;
+		hashwrite(f, sb.buf, sb.len);
+		if (err) {
+			ret = -1;
+			goto out;
+		}
+	}
 	if (istate->sparse_index) {
 		if (write_index_ext_header(f, eoie_c, CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0) {
 			ret = -1;
@@ -3135,6 +3636,19 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 			  CSUM_HASH_IN_STREAM | csum_fsync_flag);
 	f = NULL;
 
+	if (use_blocks) {
+		const char *path = get_tempfile_path(tempfile);
+		size_t len;
+
+		/* the blocks can be reused once the lock is committed */
+		free_index_blocks(istate->blocks);
+		istate->blocks = bw.blocks;
+		bw.blocks = NULL;
+		if (strip_suffix(path, LOCK_SUFFIX, &len))
+			istate->blocks->path = xmemdupz(path, len);
+		oidcpy(&istate->blocks->oid, &istate->oid);
+	}
+
 	if (close_tempfile_gently(tempfile)) {
 		ret = error(_("could not close '%s'"), get_tempfile_path(tempfile));
 		goto out;
@@ -3155,12 +3669,21 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 			   istate->version);
 	trace2_data_intmax("index", the_repository, "write/cache_nr",
 			   istate->cache_nr);
+	if (use_blocks) {
+		trace2_data_intmax("index", the_repository, "write/blocks",
+				   istate->blocks->nr);
+		trace2_data_intmax("index", the_repository, "write/reused_blocks",
+				   bw.reused);
+	}
 
 	ret = 0;
 
 out:
 	if (f)
 		free_hashfile(f);
+	if (use_blocks)
+		block_writer_release(&bw);
+	strbuf_release(&block);
 	strbuf_release(&sb);
 	free(eoie_c);
 	free(ieot);
@@ -3215,6 +3738,14 @@ static int do_write_locked_index(struct index_state *istate,
 	else
 		ret = close_lock_file_gently(lock);
 
+	/*
+	 * Only a changed untracked cache is worth sending; the daemon
+	 * can bring an older copy up to date from its token.
+	 */
+	if (!ret && istate->fsmonitor_last_update &&
+	    (istate->cache_changed & UNTRACKED_CHANGED))
+		fsmonitor_share_untracked_cache(istate);
+
 	run_hooks_l(the_repository, "post-index-change",
 		    istate->updated_workdir ? "1" : "0",
 		    istate->updated_skipworktree ? "1" : "0", NULL);
@@ -3566,6 +4097,10 @@ void move_index_extensions(struct index_state *dst, struct index_state *src)
 	src->untracked = NULL;
 	dst->cache_tree = src->cache_tree;
 	src->cache_tree = NULL;
+	dst->manifest_cache = src->manifest_cache;
+	src->manifest_cache = NULL;
+	dst->blocks = src->blocks;
+	src->blocks = NULL;
 }
 
 struct cache_entry *dup_cache_entry(const struct cache_entry *ce,
@@ -3606,7 +4141,7 @@ int should_validate_cache_entries(void)
 	return validate_index_cache_entries;
 }
 
-#define EOIE_SIZE (4 + GIT_SHA1_RAWSZ) /* <4-byte offset> + <20-byte hash> */
+#define EOIE_SIZE (4 + the_hash_algo->rawsz) /* <4-byte offset> + <hash> */
 #define EOIE_SIZE_WITH_HEADER (4 + 4 + EOIE_SIZE) /* <4-byte signature> + <4-byte length> + EOIE_SIZE */
 
 static size_t read_eoie_extension(const char *mmap, size_t mmap_size)
@@ -3618,7 +4153,7 @@ static size_t read_eoie_extension(const char *mmap, size_t mmap_size)
 	 * "EOIE"
 	 * <4-byte length>
 	 * <4-byte offset>
-	 * <20-byte hash>
+	 * <hash>, of the size of the repository's hash
 	 */
 	const char *index, *eoie;
 	uint32_t extsize;
@@ -4042,3 +4577,108 @@ int add_files_to_cache(struct repository *repo, const char *prefix,
 	release_revisions(&rev);
 	return !!data.add_errors;
 }
+
+static void free_index_blocks(struct index_blocks *blocks)
+{
+	if (!blocks)
+		return;
+	free(blocks->path);
+	free(blocks->block);
+	free(blocks);
+}
+
+static struct index_blocks *read_blocks_extension(const char *data, unsigned long sz)
+{
+	const size_t entry_size = sizeof(uint32_t) + the_hash_algo->rawsz;
+	struct index_blocks *blocks;
+	size_t i;
+
+	if (sz % entry_size) {
+		error(_("index block table is corrupt"));
+		return NULL;
+	}
+	CALLOC_ARRAY(blocks, 1);
+	blocks->nr = blocks->alloc = sz / entry_size;
+	ALLOC_ARRAY(blocks->block, blocks->nr);
+	for (i = 0; i < blocks->nr; i++) {
+		blocks->block[i].len = get_be32(data);
+		memcpy(blocks->block[i].hash, data + sizeof(uint32_t),
+		       the_hash_algo->rawsz);
+		data += entry_size;
+	}
+	return blocks;
+}
+
+static void write_blocks_extension(struct strbuf *sb, const struct index_blocks *blocks)
+{
+	size_t i;
+
+	for (i = 0; i < blocks->nr; i++) {
+		uint32_t len = htonl(blocks->block[i].len);
+
+		strbuf_add(sb, &len, sizeof(len));
+		strbuf_add(sb, blocks->block[i].hash, the_hash_algo->rawsz);
+	}
+}
+
+/*
+ * Compute the trailing checksum of an index with block checksums into
+ * "result", verifying the checksum of each block on the way.  Returns
+ * 1 if the index has no block checksums.
+ */
+static int verify_index_blocks(const char *mmap, size_t mmap_size,
+			       unsigned char *result)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+	const size_t entry_size = sizeof(uint32_t) + rawsz;
+	size_t end = mmap_size - rawsz;
+	size_t ext = read_eoie_extension(mmap, mmap_size);
+	size_t offset, pos, total = 0, nr, i;
+	const char *table = NULL;
+	uint32_t extsize = 0;
+	struct git_hash_ctx c;
+
+	if (!ext)
+		return 1;
+	for (offset = ext; offset + 8 <= end; offset += 8 + extsize) {
+		extsize = get_be32(mmap + offset + 4);
+		if (CACHE_EXT((mmap + offset)) == CACHE_EXT_BLOCKS) {
+			table = mmap + offset + 8;
+			break;
+		}
+	}
+	if (!table)
+		return 1;
+
+	if (extsize % entry_size || extsize > end - (table - mmap))
+		return error(_("index block table is corrupt"));
+	nr = extsize / entry_size;
+	for (i = 0; i < nr; i++) {
+		total += get_be32(table + i * entry_size);
+		if (total > ext - sizeof(struct cache_header))
+			return error(_("index block table is corrupt"));
+	}
+
+	pos = ext - total;
+	the_hash_algo->init_fn(&c);
+	git_hash_update(&c, mmap, pos);
+	for (i = 0; i < nr; i++) {
+		const char *t = table + i * entry_size;
+		uint32_t len = get_be32(t);
+		unsigned char hash[GIT_MAX_RAWSZ];
+		struct git_hash_ctx bc;
+
+		the_hash_algo->init_fn(&bc);
+		git_hash_update(&bc, mmap + pos, len);
+		git_hash_final(hash, &bc);
+		if (!hasheq(hash, (const unsigned char *)t + sizeof(uint32_t),
+			    the_repository->hash_algo))
+			return error(_("bad index block checksum at offset %"PRIuMAX),
+				     (uintmax_t)pos);
+		git_hash_update(&c, t + sizeof(uint32_t), rawsz);
+		pos += len;
+	}
+	git_hash_update(&c, mmap + ext, end - ext);
+	git_hash_final(result, &c);
+	return 0;
+}
@@ -22,6 +22,7 @@
 #include "remote.h"
 #include "color.h"
 #include "tag.h"
+#include "tree-size.h"
 #include "quote.h"
 #include "ref-filter.h"
 #include "revision.h"
@@ -130,6 +131,8 @@ enum atom_type {
 	ATOM_OBJECTSIZE,
 	ATOM_OBJECTNAME,
 	ATOM_DELTABASE,
+	ATOM_CHECKOUTSIZE,
+	ATOM_FILECOUNT,
 	ATOM_TREE,
 	ATOM_PARENT,
 	ATOM_NUMPARENT,
@@ -500,6 +503,21 @@ static int objectsize_atom_parser(struct ref_format *format UNUSED,
 	return 0;
 }
 
+static int checkoutsize_atom_parser(struct ref_format *format UNUSED,
+				    struct used_atom *atom,
+				    const char *arg, struct strbuf *err)
+{
+	if (arg)
+		return err_no_arg(err, atom->atom_type == ATOM_FILECOUNT ?
+				  "filecount" : "checkoutsize");
+	/* we only need the object to exist; the size is computed later */
+	if (*atom->name == '*')
+		oi_deref.info.typep = &oi_deref.type;
+	else
+		oi.info.typep = &oi.type;
+	return 0;
+}
+
 static int deltabase_atom_parser(struct ref_format *format UNUSED,
 				 struct used_atom *atom,
 				 const char *arg, struct strbuf *err)
@@ -948,6 +966,8 @@ static struct {
 	[ATOM_OBJECTSIZE] = { "objectsize", SOURCE_OTHER, FIELD_ULONG, objectsize_atom_parser },
 	[ATOM_OBJECTNAME] = { "objectname", SOURCE_OTHER, FIELD_STR, oid_atom_parser },
 	[ATOM_DELTABASE] = { "deltabase", SOURCE_OTHER, FIELD_STR, deltabase_atom_parser },
+	[ATOM_CHECKOUTSIZE] = { "checkoutsize", SOURCE_OTHER, FIELD_ULONG, checkoutsize_atom_parser },
+	[ATOM_FILECOUNT] = { "filecount", SOURCE_OTHER, FIELD_ULONG, checkoutsize_atom_parser },
 	[ATOM_TREE] = { "tree", SOURCE_OBJ, FIELD_STR, oid_atom_parser },
 	[ATOM_PARENT] = { "parent", SOURCE_OBJ, FIELD_STR, oid_atom_parser },
 	[ATOM_NUMPARENT] = { "numparent", SOURCE_OBJ, FIELD_ULONG },
@@ -1470,6 +1490,16 @@ static void grab_common_values(struct atom_value *val, int deref, struct expand_
 			}
 		} else if (atom_type == ATOM_DELTABASE)
 			v->s = xstrdup(oid_to_hex(&oi->delta_base_oid));
+		else if (atom_type == ATOM_CHECKOUTSIZE ||
+			 atom_type == ATOM_FILECOUNT) {
+			struct tree_size size;
+
+			if (repo_logical_size(the_repository, &oi->oid, &size))
+				continue;
+			v->value = atom_type == ATOM_CHECKOUTSIZE ?
+				size.bytes : size.files;
+			v->s = xstrfmt("%"PRIuMAX, (uintmax_t)v->value);
+		}
 		else if (atom_type == ATOM_OBJECTNAME && deref)
 			grab_oid(name, "objectname", &oi->oid, v, &used_atom[i]);
 	}
@@ -2093,6 +2123,8 @@ static void grab_values(struct atom_value *val, int deref, struct object *obj, s
 		/* grab_blob_values(val, deref, obj, buf, sz); */
 		grab_sub_body_contents(val, deref, data);
 		break;
+	case OBJ_MANIFEST:
+		break;
 	default:
 		die("Eh?  Object of type %d?", obj->type);
 	}
@@ -3320,6 +3352,7 @@ void filter_and_format_refs(struct ref_filter *filter, unsigned int type,
 		save_commit_buffer = 0;
 
 		do_filter_refs(filter, type, filter_and_format_one, &ref_cbdata);
+		write_tree_size_cache(the_repository);
 
 		save_commit_buffer = save_commit_buffer_orig;
 	} else {
@@ -3534,6 +3567,7 @@ void print_formatted_ref_array(struct ref_array *array, struct ref_format *forma
 			putchar('\n');
 		}
 	}
+	write_tree_size_cache(the_repository);
 
 	strbuf_release(&err);
 	strbuf_release(&output);
@@ -79,11 +79,17 @@ void prepare_repo_settings(struct repository *r)
 	repo_cfg_bool(r, "core.multipackindex", &r->settings.core_multi_pack_index, 1);
 	repo_cfg_bool(r, "index.sparse", &r->settings.sparse_index, 0);
 	repo_cfg_bool(r, "index.skiphash", &r->settings.index_skip_hash, r->settings.index_skip_hash);
+	repo_cfg_bool(r, "index.blockchecksums", &r->settings.index_block_checksums, 0);
 	repo_cfg_bool(r, "pack.readreverseindex", &r->settings.pack_read_reverse_index, 1);
 	repo_cfg_bool(r, "pack.usebitmapboundarytraversal",
 		      &r->settings.pack_use_bitmap_boundary_traversal,
 		      r->settings.pack_use_bitmap_boundary_traversal);
 	repo_cfg_bool(r, "core.usereplacerefs", &r->settings.read_replace_refs, 1);
+	repo_cfg_bool(r, "bench.storeincompressible", &r->settings.store_incompressible,
+		      repo_has_bench_extensions(r));
+	repo_cfg_bool(r, "index.manifestcache", &r->settings.index_manifest_cache,
+		      repo_has_bench_extensions(r));
+	repo_cfg_int(r, "core.dirscanthreads", &r->settings.core_dir_scan_threads, 1);
 
 	/*
 	 * The GIT_TEST_MULTI_PACK_INDEX variable is special in that
@@ -53,7 +53,10 @@ struct repo_settings {
 
 	int index_version;
 	int index_skip_hash;
+	int index_block_checksums;
+	int index_manifest_cache;
 	enum untracked_cache_setting core_untracked_cache;
+	int core_dir_scan_threads;
 
 	int pack_use_sparse;
 	int pack_use_path_walk;
@@ -66,6 +69,7 @@ struct repo_settings {
 	size_t packed_git_window_size;
 	size_t packed_git_limit;
 	unsigned long big_file_threshold;
+	int store_incompressible;
 
 	char *hooks_path;
 };
@@ -180,6 +180,8 @@ struct rev_info {
 			tag_objects:1,
 			tree_objects:1,
 			blob_objects:1,
+			/* show only the chunks of manifests, nothing else */
+			chunk_objects_only:1,
 			verify_objects:1,
 			edge_hint:1,
 			edge_hint_aggressive:1,
@@ -316,6 +318,14 @@ struct rev_info {
 	int (*include_check_obj)(struct object *obj, void *);
 	void *include_check_data;
 
+	/*
+	 * If set, called by the object traversal after showing a chunk of
+	 * a manifest, with the data given to the show functions and the
+	 * offset of the chunk in the file.
+	 */
+	void (*chunk_position)(struct object *chunk, uint64_t offset,
+			       void *show_data);
+
 	/* diff info for patches and for paths limiting */
 	struct diff_options diffopt;
 	struct diff_options pruning;
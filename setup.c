@@ -6,6 +6,7 @@
 #include "copy.h"
 #include "environment.h"
 #include "exec-cmd.h"
+#include "manifest.h"
 #include "gettext.h"
 #include "hex.h"
 #include "object-file.h"
@@ -698,7 +699,7 @@ static enum extension_result handle_extension(const char *var,
 		if (!value)
 			return config_error_nonbool(var);
 		version = atoi(value);
-		if (version != 1)
+		if (version < 1 || version > MANIFEST_VERSION_MAX)
 			return error(_("unsupported bench manifest version: %s"), value);
 		return EXTENSION_OK;
 	}
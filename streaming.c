@@ -496,6 +496,50 @@ struct git_istream *open_istream(struct repository *r,
 	return st;
 }
 
+struct git_istream *open_istream_pack_entry(struct repository *r,
+					    const struct pack_entry *e,
+					    const struct object_id *oid,
+					    enum object_type *type,
+					    unsigned long *size)
+{
+	struct git_istream *st;
+	struct pack_window *w_curs = NULL;
+	off_t curpos = e->offset;
+	enum object_type in_pack_type;
+	unsigned long in_pack_size;
+
+	if (lookup_replace_object(r, oid) != oid)
+		return open_istream(r, oid, type, size, NULL);
+
+	in_pack_type = unpack_object_header(e->p, &w_curs, &curpos,
+					    &in_pack_size);
+	unuse_pack(&w_curs);
+
+	st = xmalloc(sizeof(*st));
+	if (in_pack_type == OBJ_BLOB &&
+	    repo_settings_get_big_file_threshold(r) < in_pack_size) {
+		st->u.in_pack.pack = e->p;
+		st->u.in_pack.pos = e->offset;
+		if (!open_istream_pack_non_delta(st, r, oid, type)) {
+			*type = in_pack_type;
+			*size = st->size;
+			return st;
+		}
+	}
+
+	st->u.incore.read_ptr = 0;
+	st->close = close_istream_incore;
+	st->read = read_istream_incore;
+	st->u.incore.buf = unpack_entry(r, e->p, e->offset, type, &st->size);
+	if (!st->u.incore.buf) {
+		/* let the lookup find another copy, or report the error */
+		free(st);
+		return open_istream(r, oid, type, size, NULL);
+	}
+	*size = st->size;
+	return st;
+}
+
 int stream_blob_to_fd(int fd, const struct object_id *oid, struct stream_filter *filter,
 		      int can_seek)
 {
@@ -9,10 +9,19 @@
 /* opaque */
 struct git_istream;
 struct stream_filter;
+struct pack_entry;
 
 struct git_istream *open_istream(struct repository *, const struct object_id *,
 				 enum object_type *, unsigned long *,
 				 struct stream_filter *);
+/*
+ * Like open_istream() without a filter, for an object the caller has
+ * already found at "e" in a pack, which saves looking it up again.
+ */
+struct git_istream *open_istream_pack_entry(struct repository *,
+					    const struct pack_entry *e,
+					    const struct object_id *,
+					    enum object_type *, unsigned long *);
 int close_istream(struct git_istream *);
 ssize_t read_istream(struct git_istream *, void *, size_t);
 
@@ -0,0 +1,226 @@
+/*
+ * Generate and edit large files for the manifest perf tests.
+ *
+ * "generate" writes <size> bytes to stdout, made of 64 KiB blocks that
+ * are either random or repetitive text, so that the data is neither
+ * fully compressible nor fully random. "edit" changes a file in place
+ * the way a workload would: by overwriting, inserting, appending or
+ * truncating <count> 4 KiB blocks. Both are reproducible for a given
+ * seed.
+ */
+
+#include "test-tool.h"
+#include "git-compat-util.h"
+#include "parse.h"
+#include "strbuf.h"
+
+#define BLOCK_SIZE (64 * 1024)
+#define EDIT_SIZE 4096
+
+static const char usage_str[] =
+	"test-tool bench-data generate <seed> <size> [<text-percent>]\n"
+	"   or: test-tool bench-data edit <seed> <file> "
+	"(overwrite|insert|append|truncate) <count>";
+
+static uint64_t seed_from(const char *s)
+{
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+	do {
+		state = state * 11 + (unsigned char)*s;
+	} while (*s++);
+	return state ? state : 1;
+}
+
+/* xorshift64*, plenty for test data */
+static uint64_t next_random(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+static void fill_random(uint64_t *state, unsigned char *buf, size_t len)
+{
+	while (len) {
+		uint64_t r = next_random(state);
+		size_t n = len < sizeof(r) ? len : sizeof(r);
+
+		memcpy(buf, &r, n);
+		buf += n;
+		len -= n;
+	}
+}
+
+static void fill_text(uint64_t *state, unsigned char *buf, size_t len)
+{
+	static const char *words[] = {
+		"manifest", "chunk", "blob", "tree", "commit", "index",
+		"object", "delta", "pack", "checkout", "status", "refresh",
+	};
+	struct strbuf sb = STRBUF_INIT;
+
+	while (sb.len < len) {
+		uint64_t r = next_random(state);
+
+		strbuf_addf(&sb, "%s %s %"PRIu64"\n",
+			    words[r % ARRAY_SIZE(words)],
+			    words[(r >> 8) % ARRAY_SIZE(words)],
+			    (r >> 16) % 1000);
+	}
+	memcpy(buf, sb.buf, len);
+	strbuf_release(&sb);
+}
+
+static int generate(const char **argv, int argc)
+{
+	unsigned char *buf = xmalloc(BLOCK_SIZE);
+	unsigned long size, text_percent = 50;
+	uint64_t state;
+
+	if (argc < 2 || argc > 3 || !git_parse_ulong(argv[1], &size) ||
+	    (argc == 3 && (!git_parse_ulong(argv[2], &text_percent) ||
+			   text_percent > 100)))
+		usage(usage_str);
+	state = seed_from(argv[0]);
+
+	while (size) {
+		size_t n = size < BLOCK_SIZE ? size : BLOCK_SIZE;
+
+		if (next_random(&state) % 100 < text_percent)
+			fill_text(&state, buf, n);
+		else
+			fill_random(&state, buf, n);
+		if (write_in_full(1, buf, n) < 0)
+			die_errno("write error");
+		size -= n;
+	}
+	free(buf);
+	return 0;
+}
+
+static void write_at(int fd, off_t offset, const void *buf, size_t len)
+{
+	if (lseek(fd, offset, SEEK_SET) < 0 ||
+	    write_in_full(fd, buf, len) < 0)
+		die_errno("unable to write at %"PRIuMAX, (uintmax_t)offset);
+}
+
+static int cmp_off(const void *va, const void *vb)
+{
+	off_t a = *(const off_t *)va, b = *(const off_t *)vb;
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Copy "path" to a temporary file with a random block inserted at each
+ * of the sorted "offsets", then rename it over the original.
+ */
+static void insert_blocks(uint64_t *state, const char *path, int fd,
+			  off_t *offsets, unsigned long nr)
+{
+	struct strbuf tmp = STRBUF_INIT;
+	unsigned char *buf = xmalloc(BLOCK_SIZE);
+	unsigned char edit[EDIT_SIZE];
+	off_t pos = 0;
+	unsigned long i = 0;
+	int out;
+
+	strbuf_addf(&tmp, "%s.tmp", path);
+	out = xopen(tmp.buf, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+	for (;;) {
+		size_t want = BLOCK_SIZE;
+		ssize_t got;
+
+		while (i < nr && offsets[i] == pos) {
+			fill_random(state, edit, sizeof(edit));
+			if (write_in_full(out, edit, sizeof(edit)) < 0)
+				die_errno("write error");
+			i++;
+		}
+		if (i < nr && offsets[i] - pos < (off_t)want)
+			want = offsets[i] - pos;
+		got = read_in_full(fd, buf, want);
+		if (got < 0)
+			die_errno("unable to read '%s'", path);
+		if (!got)
+			break;
+		if (write_in_full(out, buf, got) < 0)
+			die_errno("write error");
+		pos += got;
+	}
+	if (close(out) || rename(tmp.buf, path))
+		die_errno("unable to replace '%s'", path);
+	strbuf_release(&tmp);
+	free(buf);
+}
+
+static int edit(const char **argv, int argc)
+{
+	unsigned char buf[EDIT_SIZE];
+	unsigned long count, i;
+	const char *path, *pattern;
+	uint64_t state;
+	struct stat st;
+	off_t *offsets;
+	int fd;
+
+	if (argc != 4 || !git_parse_ulong(argv[3], &count))
+		usage(usage_str);
+	state = seed_from(argv[0]);
+	path = argv[1];
+	pattern = argv[2];
+
+	fd = xopen(path, O_RDWR);
+	if (fstat(fd, &st))
+		die_errno("unable to stat '%s'", path);
+
+	if (!strcmp(pattern, "append")) {
+		for (i = 0; i < count; i++) {
+			fill_random(&state, buf, sizeof(buf));
+			write_at(fd, st.st_size + (off_t)i * EDIT_SIZE,
+				 buf, sizeof(buf));
+		}
+	} else if (!strcmp(pattern, "truncate")) {
+		off_t cut = (off_t)count * EDIT_SIZE;
+
+		if (ftruncate(fd, cut < st.st_size ? st.st_size - cut : 0))
+			die_errno("unable to truncate '%s'", path);
+	} else if (!strcmp(pattern, "overwrite") ||
+		   !strcmp(pattern, "insert")) {
+		ALLOC_ARRAY(offsets, count);
+		for (i = 0; i < count; i++)
+			offsets[i] = st.st_size ?
+				next_random(&state) % st.st_size : 0;
+
+		if (*pattern == 'o') {
+			for (i = 0; i < count; i++) {
+				fill_random(&state, buf, sizeof(buf));
+				write_at(fd, offsets[i], buf,
+					 st.st_size - offsets[i] < EDIT_SIZE ?
+					 st.st_size - offsets[i] : EDIT_SIZE);
+			}
+		} else {
+			QSORT(offsets, count, cmp_off);
+			insert_blocks(&state, path, fd, offsets, count);
+		}
+		free(offsets);
+	} else {
+		usage(usage_str);
+	}
+
+	if (close(fd))
+		die_errno("unable to close '%s'", path);
+	return 0;
+}
+
+int cmd__bench_data(int argc, const char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "generate"))
+		return generate(argv + 2, argc - 2);
+	if (argc > 1 && !strcmp(argv[1], "edit"))
+		return edit(argv + 2, argc - 2);
+	usage(usage_str);
+}
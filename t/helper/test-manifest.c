@@ -0,0 +1,89 @@
+#define USE_THE_REPOSITORY_VARIABLE
+
+#include "test-tool.h"
+#include "git-compat-util.h"
+#include "hex.h"
+#include "manifest.h"
+#include "manifest-cache.h"
+#include "object-name.h"
+#include "parse.h"
+#include "read-cache-ll.h"
+#include "repository.h"
+#include "setup.h"
+#include "write-or-die.h"
+
+static const char usage_str[] =
+	"test-tool manifest read <manifest> <offset> [<length>]\n"
+	"   or: test-tool manifest dump-cache";
+
+static void print_cache_record(const struct object_id *oid,
+			       const struct manifest_cache_info *info,
+			       void *data UNUSED)
+{
+	printf("%s %s %"PRIuMAX" %"PRIu32" %"PRIu32"\n", oid_to_hex(oid),
+	       oid_to_hex(&info->content_oid), (uintmax_t)info->size,
+	       info->version, info->nr_entries);
+}
+
+/*
+ * "dump-cache" prints the records of the "MNFT" extension of the index.
+ */
+static int dump_cache(void)
+{
+	struct index_state *istate = the_repository->index;
+
+	if (do_read_index(istate, the_repository->index_file, 0) < 0)
+		die("unable to read index file");
+	if (for_each_manifest_cache_record(istate, print_cache_record, NULL) < 0)
+		printf("no manifest cache\n");
+	return 0;
+}
+
+/*
+ * "read" prints the content of a manifest from <offset> on, seeking to
+ * it rather than reading up to it.
+ */
+int cmd__manifest(int argc, const char **argv)
+{
+	struct manifest_stream *stream;
+	struct object_id oid;
+	unsigned long offset, size, len;
+	char buf[8192];
+
+	if (argc == 2 && !strcmp(argv[1], "dump-cache")) {
+		setup_git_directory();
+		return dump_cache();
+	}
+	if (argc < 4 || argc > 5 || strcmp(argv[1], "read"))
+		usage(usage_str);
+
+	setup_git_directory();
+	if (repo_get_oid(the_repository, argv[2], &oid))
+		die("cannot parse %s as an object name", argv[2]);
+	if (!git_parse_ulong(argv[3], &offset))
+		die("bad offset: %s", argv[3]);
+
+	stream = open_manifest_stream(the_repository, &oid, &size);
+	if (!stream)
+		die("cannot open manifest %s", argv[2]);
+	if (argc < 5)
+		len = offset < size ? size - offset : 0;
+	else if (!git_parse_ulong(argv[4], &len))
+		die("bad length: %s", argv[4]);
+
+	if (seek_manifest_stream(stream, offset) < 0)
+		die("cannot seek to %lu", offset);
+	while (len) {
+		ssize_t n = read_manifest_stream(stream, buf,
+						 len < sizeof(buf) ? len : sizeof(buf));
+
+		if (n < 0)
+			die("cannot read manifest %s", argv[2]);
+		if (!n)
+			break;
+		write_or_die(1, buf, n);
+		len -= n;
+	}
+	close_manifest_stream(stream);
+	return 0;
+}
@@ -26,6 +26,7 @@ struct path_walk_test_data {
 	uintmax_t tree_nr;
 	uintmax_t blob_nr;
 	uintmax_t tag_nr;
+	uintmax_t manifest_nr;
 };
 
 static int emit_block(const char *path, struct oid_array *oids,
@@ -42,6 +43,8 @@ static int emit_block(const char *path, struct oid_array *oids,
 		tdata->commit_nr += oids->nr;
 	else if (type == OBJ_TAG)
 		tdata->tag_nr += oids->nr;
+	else if (type == OBJ_MANIFEST)
+		tdata->manifest_nr += oids->nr;
 	else
 		BUG("we do not understand this type");
 
@@ -123,6 +126,8 @@ int cmd__path_walk(int argc, const char **argv)
 	       "blobs:%" PRIuMAX "\n"
 	       "tags:%" PRIuMAX "\n",
 	       data.commit_nr, data.tree_nr, data.blob_nr, data.tag_nr);
+	if (data.manifest_nr)
+		printf("manifests:%" PRIuMAX "\n", data.manifest_nr);
 
 	if (info.pl) {
 		clear_pattern_list(info.pl);
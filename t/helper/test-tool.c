@@ -11,6 +11,7 @@ static const char * const test_tool_usage[] = {
 
 static struct test_cmd cmds[] = {
 	{ "advise", cmd__advise_if_enabled },
+	{ "bench-data", cmd__bench_data },
 	{ "bitmap", cmd__bitmap },
 	{ "bloom", cmd__bloom },
 	{ "bundle-uri", cmd__bundle_uri },
@@ -41,6 +42,7 @@ static struct test_cmd cmds[] = {
 	{ "hexdump", cmd__hexdump },
 	{ "json-writer", cmd__json_writer },
 	{ "lazy-init-name-hash", cmd__lazy_init_name_hash },
+	{ "manifest", cmd__manifest },
 	{ "match-trees", cmd__match_trees },
 	{ "mergesort", cmd__mergesort },
 	{ "mktemp", cmd__mktemp },
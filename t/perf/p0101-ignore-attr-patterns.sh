@@ -0,0 +1,92 @@
+#!/bin/sh
+
+test_description='performance of long ignore and attributes files
+
+Matches a tree of files against a long .benchignore and
+.benchattributes, mixing literal names, extensions, anchored paths,
+globs, directory-only and negated patterns, with and without the
+pattern index (GIT_TEST_PATTERN_INDEX=0). The results must be the
+same either way. The shape of the data can be changed with:
+
+  GIT_PERF_0101_PATTERNS   number of patterns per file (default 4000)
+  GIT_PERF_0101_DIRS       number of directories (default 200)
+  GIT_PERF_0101_FILES      number of files per directory (default 50)
+'
+. ./perf-lib.sh
+
+patterns=${GIT_PERF_0101_PATTERNS:-4000}
+dirs=${GIT_PERF_0101_DIRS:-200}
+files=${GIT_PERF_0101_FILES:-50}
+
+# Outputs go into .bench, so that they do not show up in "status".
+
+# One pattern of each kind per line number, cycling through the kinds.
+write_patterns () {
+	awk -v n="$patterns" -v dirs="$dirs" -v files="$files" -v suffix="$1" '
+	BEGIN {
+		for (i = 0; i < n; i++) {
+			d = i % dirs; f = i % files
+			k = i % 8
+			if (k == 0)      p = "name" f ".txt"
+			else if (k == 1) p = "*.ext" i
+			else if (k == 2) p = "/d" d "/name" f ".c"
+			else if (k == 3) p = "d" d "/sub/"
+			else if (k == 4) p = "!name" f ".txt"
+			else if (k == 5) p = "*.o"
+			else if (k == 6) p = "d" d "/*" f ".h"
+			else             p = "build-" i "-*/"
+			print p suffix
+		}
+	}'
+}
+
+test_expect_success 'setup' '
+	bench init -q . &&
+	for d in $(test_seq 0 $((dirs - 1)))
+	do
+		mkdir -p d$d/sub d$d/build-$d-x &&
+		for f in $(test_seq 0 $((files - 1)))
+		do
+			for e in txt c h o ext$f
+			do
+				echo "$d $f" >d$d/name$f.$e || return 1
+			done
+		done &&
+		echo sub >d$d/sub/file &&
+		echo build >d$d/build-$d-x/file || return 1
+	done &&
+	write_patterns >.benchignore &&
+	write_patterns " text -diff mark" >.benchattributes &&
+	find d* -type f | sort >.bench/paths
+'
+
+test_expect_success 'ignored files are the same with and without the index' '
+	GIT_TEST_PATTERN_INDEX=0 bench status --porcelain --ignored=matching \
+		-uall >.bench/expect &&
+	bench status --porcelain --ignored=matching -uall >.bench/actual &&
+	test_cmp .bench/expect .bench/actual
+'
+
+test_expect_success 'attributes are the same with and without the index' '
+	GIT_TEST_PATTERN_INDEX=0 bench check-attr --stdin -a <.bench/paths >.bench/expect &&
+	bench check-attr --stdin -a <.bench/paths >.bench/actual &&
+	test_cmp .bench/expect .bench/actual
+'
+
+test_perf 'status --ignored (walk)' '
+	GIT_TEST_PATTERN_INDEX=0 bench status --porcelain --ignored -uall >/dev/null
+'
+
+test_perf 'status --ignored (index)' '
+	bench status --porcelain --ignored -uall >/dev/null
+'
+
+test_perf 'check-attr (walk)' '
+	GIT_TEST_PATTERN_INDEX=0 bench check-attr --stdin -a <.bench/paths >/dev/null
+'
+
+test_perf 'check-attr (index)' '
+	bench check-attr --stdin -a <.bench/paths >/dev/null
+'
+
+test_done
@@ -0,0 +1,148 @@
+#!/bin/sh
+
+test_description='performance of large files stored as manifests
+
+Builds a repository of large generated files, which "bench add" stores
+as manifests of chunks, edits them and times the everyday commands on
+it. The shape of the data can be changed with:
+
+  GIT_PERF_9400_FILES      number of files (default 2)
+  GIT_PERF_9400_SIZE       size of each file (default 100m)
+  GIT_PERF_9400_TEXT       percentage of compressible text (default 50)
+  GIT_PERF_9400_EDIT       overwrite, insert, append or truncate
+                           (default overwrite)
+  GIT_PERF_9400_EDITS      number of 4 KiB blocks edited per file
+                           (default 16)
+'
+. ./perf-lib.sh
+
+files=${GIT_PERF_9400_FILES:-2}
+size=${GIT_PERF_9400_SIZE:-100m}
+text=${GIT_PERF_9400_TEXT:-50}
+edit=${GIT_PERF_9400_EDIT:-overwrite}
+edits=${GIT_PERF_9400_EDITS:-16}
+
+# Sum of the sizes of the files under "data".
+data_bytes () {
+	bytes=0 &&
+	for f in data/*
+	do
+		bytes=$((bytes + $(test_file_size "$f"))) || return 1
+	done &&
+	echo $bytes
+}
+
+# These are run as --setup steps, which cannot take quoted arguments.
+drop_objects () {
+	rm -rf .bench/index .bench/objects &&
+	mkdir -p .bench/objects/info .bench/objects/pack
+}
+
+drop_head () {
+	bench update-ref -d HEAD
+}
+
+touch_data () {
+	test-tool chmtime +1 data/*
+}
+
+checkout_edited () {
+	bench checkout -q -f edited
+}
+
+remove_data () {
+	rm -rf data
+}
+
+remove_clones () {
+	rm -rf clone-filtered clone-full
+}
+
+test_expect_success 'setup' '
+	bench init -q . &&
+	bench config gc.auto 0 &&
+	bench config uploadpack.allowFilter true &&
+	mkdir data &&
+	for i in $(test_seq $files)
+	do
+		test-tool bench-data generate "file-$i" $size $text \
+			>data/file-$i.bin || return 1
+	done &&
+	base_bytes=$(data_bytes)
+'
+
+test_perf 'add' --setup drop_objects --bytes "$base_bytes" '
+	bench add data
+'
+
+test_perf 'commit' --setup drop_head '
+	bench commit -q -m base
+'
+
+test_expect_success 'tag base' '
+	bench tag base
+'
+
+test_perf 'status' '
+	bench status --porcelain >/dev/null
+'
+
+test_perf 'status (stat-dirty)' --setup touch_data --bytes "$base_bytes" '
+	bench status --porcelain >/dev/null
+'
+
+test_expect_success "edit files ($edit)" '
+	for f in data/*
+	do
+		test-tool bench-data edit "$f" "$f" $edit $edits || return 1
+	done &&
+	edited_bytes=$(data_bytes) &&
+	history_bytes=$((base_bytes + edited_bytes))
+'
+
+test_perf 'diff --stat (worktree)' --bytes "$edited_bytes" '
+	bench diff --stat >/dev/null
+'
+
+test_perf 'add (edited)' --setup touch_data --bytes "$edited_bytes" '
+	bench add data
+'
+
+test_expect_success 'commit edited' '
+	bench commit -q -m edited &&
+	bench tag edited
+'
+
+test_perf 'diff --stat (commits)' '
+	bench diff --stat base edited >/dev/null
+'
+
+test_perf 'checkout' --setup checkout_edited --bytes "$base_bytes" '
+	bench checkout -q -f base
+'
+
+test_perf 'checkout (empty worktree)' --setup remove_data --bytes "$edited_bytes" '
+	bench checkout -q -f edited
+'
+
+test_perf 'clone --filter=blob:none' --setup remove_clones '
+	bench clone -q --no-local --no-checkout --filter=blob:none . clone-filtered
+'
+
+test_perf 'clone' --setup remove_clones --bytes "$history_bytes" '
+	bench clone -q --no-local --no-checkout . clone-full
+'
+
+test_perf 'repack' --bytes "$history_bytes" '
+	bench repack -adf -q
+'
+
+test_perf 'gc' --bytes "$history_bytes" '
+	bench gc -q
+'
+
+test_size 'object store size' '
+	du -sk .bench/objects | awk "{ print \$1 * 1024 }"
+'
+
+test_done
@@ -243,6 +243,7 @@ test_wrapper_ () {
 	test_start_
 	test_prereq=
 	test_perf_setup_=
+	test_perf_bytes_=
 	while test $# != 0
 	do
 		case $1 in
@@ -250,6 +251,10 @@ test_wrapper_ () {
 			test_prereq=$2
 			shift
 			;;
+		--bytes)
+			test_perf_bytes_=$2
+			shift
+			;;
 		--setup)
 			test_perf_setup_=$2
 			shift
@@ -314,6 +319,12 @@ test_perf_ () {
 	fi
 	"$PERL_PATH" "$TEST_DIRECTORY"/perf/min_time.perl test_time.* >"$base".result
 	rm test_time.*
+	if test -n "$test_perf_bytes_"
+	then
+		echo "$test_perf_bytes_" >"$base".bytes
+	else
+		rm -f "$base".bytes
+	fi
 }
 
 # Usage: test_perf 'title' [options] 'perf-test'
@@ -322,6 +333,8 @@ test_perf_ () {
 # Options:
 #	--prereq prerequisites: Skip the test if prerequisites aren't met
 #	--setup "setup-steps": Run setup steps prior to each measured iteration
+#	--bytes count: Number of bytes the test processes; the aggregated
+#		output then shows the throughput next to the time
 #
 test_perf () {
 	test_wrapper_ test_perf_ "$@"
@@ -0,0 +1,91 @@
+#!/bin/sh
+
+test_description='cache-tree update on several threads
+
+The invalid subtrees of the cache tree are rebuilt on several threads
+for large indexes. GIT_TEST_CACHE_TREE_THREADS forces the threads on
+small ones; the trees must come out the same as on one thread.'
+
+. ./test-lib.sh
+
+# write the tree of the index on <n> threads, with a fresh trace in <trace>
+write_tree () {
+	rm -f "$2" &&
+	GIT_TEST_CACHE_TREE_THREADS=$1 GIT_TRACE2_EVENT="$(pwd)/$2" \
+		bench write-tree
+}
+
+# the value of the cache_tree <key> traced in <trace>
+traced () {
+	sed -n "s|.*\"key\":\"update/$1\",\"value\":\"\([0-9]*\)\".*|\1|p" "$2"
+}
+
+test_expect_success 'setup' '
+	blob=$(echo content | bench hash-object -w --stdin) &&
+	for a in $(test_seq 8)
+	do
+		for b in $(test_seq 8)
+		do
+			for c in $(test_seq 8)
+			do
+				printf "100644 $blob\t%s\n" \
+					"dir$a/sub$b/file$c" "dir$a/file$b$c" ||
+				return 1
+			done || return 1
+		done &&
+		printf "100644 $blob\t%s\n" "file$a" || return 1
+	done >index-info &&
+	bench update-index --index-info <index-info &&
+	bench ls-files >files &&
+	test_line_count = 1032 files
+'
+
+test_expect_success 'rebuild the whole cache tree on threads' '
+	test-tool scrap-cache-tree &&
+	write_tree 4 threaded.trace >threaded &&
+	test-tool dump-cache-tree >threaded.dump &&
+	test "$(traced threads threaded.trace)" = 4 &&
+	test "$(traced jobs threaded.trace)" -gt 4 &&
+
+	test-tool scrap-cache-tree &&
+	write_tree 1 serial.trace >serial &&
+	test-tool dump-cache-tree >serial.dump &&
+	test -z "$(traced threads serial.trace)" &&
+
+	test_cmp serial threaded &&
+	test_cmp serial.dump threaded.dump &&
+	bench ls-tree -r $(cat threaded) >actual &&
+	sed "s/^100644 /100644 blob /" index-info | sort -k 4 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rebuild a partly invalid cache tree on threads' '
+	other=$(echo other | bench hash-object -w --stdin) &&
+	printf "100644 $other\t%s\n" dir2/sub3/file4 dir5/file55 dir7/new \
+		>changes &&
+	bench update-index --index-info <changes &&
+	cp .bench/index index.partial &&
+
+	write_tree 4 threaded.trace >threaded &&
+	test-tool dump-cache-tree >threaded.dump &&
+	test "$(traced threads threaded.trace)" -gt 1 &&
+
+	cp index.partial .bench/index &&
+	write_tree 1 serial.trace >serial &&
+	test-tool dump-cache-tree >serial.dump &&
+
+	test_cmp serial threaded &&
+	test_cmp serial.dump threaded.dump &&
+	test "$(bench rev-parse $(cat threaded):dir2/sub3/file4)" = $other &&
+	test "$(bench rev-parse $(cat threaded):dir7/new)" = $other &&
+	test "$(bench rev-parse $(cat threaded):dir1)" = \
+		"$(bench rev-parse $(cat serial):dir1)"
+'
+
+test_expect_success 'a valid cache tree is not rebuilt' '
+	write_tree 4 valid.trace >valid &&
+	test_cmp serial valid &&
+	test -z "$(traced threads valid.trace)"
+'
+
+test_done
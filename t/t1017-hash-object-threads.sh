@@ -0,0 +1,83 @@
+#!/bin/sh
+
+test_description='hash-object --stdin-paths --threads
+
+Files are hashed and written by several threads, but their names are
+still printed in the order of the input, and come out the same as
+with a single thread.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 200)
+	do
+		test_seq $i >file-$i || return 1
+	done &&
+	test-tool genrandom big 100000 >big &&
+	printf "one\ntwo\n" >crlf.txt &&
+	echo "*.txt text eol=crlf" >.gitattributes &&
+	{
+		ls file-* &&
+		echo big &&
+		echo crlf.txt
+	} >paths &&
+	while read path
+	do
+		bench hash-object "$path" || return 1
+	done <paths >expect
+'
+
+for threads in 1 4 0
+do
+	test_expect_success "hash with --threads=$threads" '
+		bench -c core.bigFileThreshold=50k \
+			hash-object --stdin-paths --threads=$threads <paths >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success 'write with several threads' '
+	bench init -q --bare written.git &&
+	bench --git-dir=written.git -c core.bigFileThreshold=50k \
+		hash-object -w --stdin-paths --threads=4 <paths >actual &&
+	test_cmp expect actual &&
+	while read oid
+	do
+		bench --git-dir=written.git cat-file -e $oid || return 1
+	done <actual &&
+	bench --git-dir=written.git cat-file blob $(sed -n 201p actual) >big.actual &&
+	test_cmp_bin big big.actual
+'
+
+test_expect_success 'write with several threads and batched fsync' '
+	bench init -q --bare batched.git &&
+	bench --git-dir=batched.git -c core.bigFileThreshold=50k \
+		-c core.fsync=loose-object -c core.fsyncMethod=batch \
+		hash-object -w --stdin-paths --threads=4 <paths >actual &&
+	test_cmp expect actual &&
+	bench --git-dir=batched.git fsck --no-dangling &&
+	bench --git-dir=batched.git cat-file blob $(sed -n 201p actual) >big.actual &&
+	test_cmp_bin big big.actual
+'
+
+test_expect_success 'store manifests with several threads' '
+	bench hash-object --manifest --stdin-paths <paths >expect.manifests &&
+	bench hash-object --manifest --stdin-paths --threads=4 <paths >actual &&
+	test_cmp expect.manifests actual
+'
+
+test_expect_success 'a missing file stops the threads' '
+	{
+		head -n 100 paths &&
+		echo missing &&
+		tail -n +101 paths
+	} >broken-paths &&
+	test_must_fail bench hash-object --stdin-paths --threads=4 \
+		<broken-paths >actual 2>err &&
+	test_grep missing err &&
+	# whatever was printed before is right
+	head -n $(wc -l <actual) expect >expect.head &&
+	test_cmp expect.head actual
+'
+
+test_done
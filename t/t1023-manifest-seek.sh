@@ -0,0 +1,93 @@
+#!/bin/sh
+
+test_description='seeking into the content of a manifest
+
+Reading a manifest from an offset descends version 2 manifests through
+their sub-manifests, and looks up chunk sizes for version 1. Chunks are
+read in pack order, whether they are packed or loose.'
+
+. ./test-lib.sh
+
+store_chunked () {
+	size=$(wc -c <"$1") &&
+	{
+		echo blob &&
+		echo "mark :1" &&
+		echo "data $size" &&
+		cat "$1" &&
+		echo &&
+		echo "get-mark :1"
+	} | bench fast-import --chunk-size=16 --quiet
+}
+
+check_reads () {
+	for offset in 0 1 15 16 8191 8192 9000 18000 18892 18893 20000
+	do
+		test-tool manifest read "$1" $offset 100 >actual &&
+		tail -c +$(($offset + 1)) data | head -c 100 >expect &&
+		test_cmp expect actual || return 1
+	done
+}
+
+test_expect_success 'setup' '
+	test_seq 4000 >data &&
+	test_line_count = 4000 data
+'
+
+test_expect_success 'seek into a version 1 manifest' '
+	bench init -q v1 &&
+	(
+		cd v1 &&
+		cp ../data . &&
+		manifest=$(store_chunked data) &&
+		echo manifest >expect.type &&
+		bench cat-file -t $manifest >actual.type &&
+		test_cmp expect.type actual.type &&
+		check_reads $manifest
+	)
+'
+
+test_expect_success 'seek into a version 2 manifest with sub-manifests' '
+	bench init -q v2 &&
+	(
+		cd v2 &&
+		bench config extensions.benchManifestVersion 2 &&
+		bench config bench.manifestVersion 2 &&
+		cp ../data . &&
+		manifest=$(store_chunked data) &&
+		bench cat-file -p $manifest >listing &&
+		grep "^manifest " listing &&
+		check_reads $manifest &&
+		test-tool manifest read $manifest 5000 >actual &&
+		tail -c +5001 data >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'read chunks that are partly packed and partly loose' '
+	bench init -q mixed &&
+	manifest=$(cd v1 && store_chunked data) &&
+	bench -C v1 cat-file -p $manifest | sed 1,4d >chunks &&
+	# every other chunk goes into a pack, the others stay loose
+	{
+		echo $manifest &&
+		awk "NR % 2" chunks
+	} | bench -C v1 pack-objects --stdout >mixed.pack &&
+	bench -C mixed index-pack --stdin <mixed.pack >/dev/null &&
+	for chunk in $(awk "NR % 2 == 0" chunks)
+	do
+		bench -C v1 cat-file blob $chunk |
+		bench -C mixed hash-object -w --stdin || return 1
+	done >/dev/null &&
+	(
+		cd mixed &&
+		cp ../data . &&
+		check_reads $manifest &&
+		test-tool manifest read $manifest 0 >actual &&
+		test_cmp data actual &&
+		bench config core.bigFileThreshold 1 &&
+		check_reads $manifest
+	)
+'
+
+test_done
@@ -0,0 +1,82 @@
+#!/bin/sh
+
+test_description='cat-file --batch-command logical
+
+The "logical" command prints the content a manifest stands for, after
+a header announcing its size, and must never print a different number
+of bytes than it announced.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_seq 1000 >data &&
+	size=$(wc -c <data) &&
+	{
+		echo blob &&
+		echo "mark :1" &&
+		echo "data $size" &&
+		cat data &&
+		echo &&
+		echo "get-mark :1"
+	} | bench fast-import --chunk-size=64 --quiet >manifest &&
+	test "$(bench cat-file -t $(cat manifest))" = manifest &&
+	echo small >small &&
+	blob=$(bench hash-object -w --literally small)
+'
+
+test_expect_success 'logical prints the content of a manifest' '
+	m=$(cat manifest) &&
+	{
+		echo "$m manifest $(wc -c <data)" &&
+		cat data &&
+		echo
+	} >expect &&
+	echo "logical $m" | bench cat-file --batch-command >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'logical prints other objects as they are' '
+	{
+		echo "$blob blob 6" &&
+		cat small &&
+		echo
+	} >expect &&
+	echo "logical $blob" | bench cat-file --batch-command >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'logical keeps the stream in step with other commands' '
+	m=$(cat manifest) &&
+	{
+		echo "$m manifest $(wc -c <data)" &&
+		cat data &&
+		echo &&
+		echo "$blob blob 6" &&
+		echo "$m manifest $(wc -c <data)" &&
+		cat data &&
+		echo
+	} >expect &&
+	printf "logical %s\ninfo %s\nlogical %s\nflush\n" $m $blob $m |
+	bench cat-file --batch-command --buffer >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'logical dies before the header when a chunk is missing' '
+	m=$(cat manifest) &&
+	bench init -q broken &&
+	{
+		echo $m &&
+		# skip the version, size, content OID, chunk count and
+		# the first chunk
+		bench cat-file -p $m | sed 1,5d
+	} | bench pack-objects --stdout >partial.pack &&
+	bench -C broken unpack-objects <partial.pack &&
+	echo "info $m" | bench -C broken cat-file --batch-command >info &&
+	test_grep manifest info &&
+	echo "logical $m" >cmd &&
+	test_must_fail bench -C broken cat-file --batch-command <cmd >actual 2>err &&
+	test_must_be_empty actual &&
+	test_grep "unable to read chunk" err
+'
+
+test_done
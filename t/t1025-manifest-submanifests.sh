@@ -0,0 +1,72 @@
+#!/bin/sh
+
+test_description='sub-manifests of version 2 manifests
+
+Entries are grouped into sub-manifests at boundaries that depend on
+the entries themselves, so that inserting a chunk leaves the groups
+after it alone. Walks refuse sub-manifests nested absurdly deep.'
+
+. ./test-lib.sh
+
+store_chunked () {
+	size=$(wc -c <"$1") &&
+	{
+		echo blob &&
+		echo "mark :1" &&
+		echo "data $size" &&
+		cat "$1" &&
+		echo &&
+		echo "get-mark :1"
+	} | bench fast-import --chunk-size=16 --quiet
+}
+
+test_expect_success 'setup' '
+	bench config extensions.benchManifestVersion 2 &&
+	bench config bench.manifestVersion 2 &&
+	test_seq 4000 >data &&
+	{
+		# exactly one chunk in front of the old ones
+		printf "%015d\n" 0 &&
+		cat data
+	} >inserted
+'
+
+test_expect_success 'an inserted chunk changes only its own sub-manifest' '
+	old=$(store_chunked data) &&
+	new=$(store_chunked inserted) &&
+	bench cat-file -p $old | grep "^manifest " | sort >old.entries &&
+	bench cat-file -p $new | grep "^manifest " | sort >new.entries &&
+	test_line_count -gt 2 old.entries &&
+	test_line_count = $(wc -l <old.entries) new.entries &&
+	comm -12 old.entries new.entries >shared &&
+	test_line_count = $(($(wc -l <old.entries) - 1)) shared &&
+	test-tool manifest read $new 16 >actual &&
+	test_cmp data actual
+'
+
+# Write a chain of $1 manifests, each holding the next as its only entry.
+nested_manifest () {
+	blob=$(echo chunk | bench hash-object -w --stdin) &&
+	entry="blob $blob 6" &&
+	for i in $(test_seq $1)
+	do
+		m=$(printf "2\n6\n%s\n1\n%s\n" $ZERO_OID "$entry" |
+		    bench hash-object -t manifest --literally -w --stdin) &&
+		entry="manifest $m 6" || return 1
+	done &&
+	echo $m
+}
+
+test_expect_success 'walks follow sub-manifests up to the maximum depth' '
+	m=$(nested_manifest 16) &&
+	bench rev-list --objects $m >objects &&
+	test_line_count = 17 objects
+'
+
+test_expect_success 'walks refuse sub-manifests nested deeper' '
+	m=$(nested_manifest 17) &&
+	test_must_fail bench rev-list --objects $m 2>err &&
+	test_grep "is nested too deeply" err
+'
+
+test_done
@@ -0,0 +1,153 @@
+#!/bin/sh
+
+test_description='fsck checks manifests against their chunks
+
+Manifests whose header, chunk list, sizes or content OID do not match
+their chunks are reported under their own message IDs, whichever thread
+ends up checking them.'
+
+. ./test-lib.sh
+
+# Start a repository holding just the intact manifest and its chunks.
+new_repo () {
+	bench init -q "$1" &&
+	bench -C "$1" unpack-objects -q <good.pack
+}
+
+# Write a manifest from the text on stdin, bypassing all sanity checks.
+write_manifest () {
+	bench hash-object -t manifest --literally -w --stdin
+}
+
+test_expect_success 'setup' '
+	test_seq 100 >data &&
+	size=$(wc -c <data) &&
+	{
+		echo blob &&
+		echo "mark :1" &&
+		echo "data $size" &&
+		cat data &&
+		echo &&
+		echo "get-mark :1"
+	} | bench fast-import --chunk-size=64 --quiet >manifest &&
+	m=$(cat manifest) &&
+	bench cat-file manifest $m >good &&
+	test "$(sed -n 4p good)" -gt 1 &&
+	# the version, size, content OID and chunk count
+	sed -n 1,4p good >header &&
+	sed 1,4d good >chunks &&
+	cat manifest chunks | bench pack-objects --stdout >good.pack &&
+	bench update-ref refs/manifests/good $m
+'
+
+for threads in 1 4
+do
+	test_expect_success "intact manifests pass (threads=$threads)" '
+		bench fsck --threads=$threads --manifest-content 2>err &&
+		test_grep ! badManifest err
+	'
+done
+
+test_expect_success 'badManifest: unparsable header' '
+	new_repo unparsable &&
+	(
+		cd unparsable &&
+		bad=$(printf "x\n" | write_manifest) &&
+		bench update-ref refs/manifests/bad $bad &&
+		test_must_fail bench fsck 2>err &&
+		test_grep "manifest $bad: badManifest: manifest missing version number" err
+	)
+'
+
+test_expect_success 'badManifestChunk: chunk count does not match' '
+	new_repo count &&
+	(
+		cd count &&
+		bad=$({
+			sed -n 1,3p ../header &&
+			echo 1 &&
+			cat ../chunks
+		} | write_manifest) &&
+		bench update-ref refs/manifests/bad $bad &&
+		test_must_fail bench fsck 2>err &&
+		test_grep "manifest $bad: badManifestChunk: lists" err
+	)
+'
+
+test_expect_success 'badManifestChunk: chunk of the wrong type' '
+	new_repo type &&
+	(
+		cd type &&
+		tree=$(bench write-tree) &&
+		bad=$({
+			sed -n 1,3p ../header &&
+			echo 2 &&
+			head -n 1 ../chunks &&
+			echo $tree
+		} | write_manifest) &&
+		bench update-ref refs/manifests/bad $bad &&
+		test_must_fail bench fsck 2>err &&
+		test_grep "manifest $bad: badManifestChunk: entry 1 ($tree) is a tree, not a blob" err
+	)
+'
+
+for threads in 1 4
+do
+	test_expect_success "badManifestSize: total size does not match (threads=$threads)" '
+		new_repo size-$threads &&
+		(
+			cd size-$threads &&
+			bad=$({
+				echo 1 &&
+				echo $(($size + 1)) &&
+				sed -n 3,4p ../header &&
+				cat ../chunks
+			} | write_manifest) &&
+			bench update-ref refs/manifests/bad $bad &&
+			test_must_fail bench fsck --threads=$threads 2>err &&
+			test_grep "manifest $bad: badManifestSize: chunks add up to $size bytes, manifest records $(($size + 1))" err &&
+			test_grep ! "manifest $m" err
+		)
+	'
+done
+
+test_expect_success 'badManifestContent: content OID does not match' '
+	new_repo content &&
+	(
+		cd content &&
+		other=$(echo other | bench hash-object --stdin) &&
+		bad=$({
+			sed -n 1,2p ../header &&
+			echo $other &&
+			sed -n 4p ../header &&
+			cat ../chunks
+		} | write_manifest) &&
+		bench update-ref refs/manifests/bad $bad &&
+		bench fsck 2>err &&
+		test_grep ! badManifestContent err &&
+		test_must_fail bench fsck --manifest-content 2>err &&
+		test_grep "manifest $bad: badManifestContent: content hashes to $(bench hash-object ../data), manifest records $other" err
+	)
+'
+
+test_expect_success 'every broken manifest is reported with many threads' '
+	new_repo many &&
+	(
+		cd many &&
+		for i in $(test_seq 20)
+		do
+			bad=$({
+				echo 1 &&
+				echo $(($size + $i)) &&
+				sed -n 3,4p ../header &&
+				cat ../chunks
+			} | write_manifest) &&
+			bench update-ref refs/manifests/bad-$i $bad || return 1
+		done &&
+		test_must_fail bench fsck --threads=4 2>err &&
+		grep badManifestSize err >reports &&
+		test_line_count = 20 reports
+	)
+'
+
+test_done
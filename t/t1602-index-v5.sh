@@ -0,0 +1,173 @@
+#!/bin/sh
+
+test_description='index file version 5
+
+Write an index in version 5, read it back and update it, which on
+hosts where the entries are used in place modifies them in the
+mapping of the old file before it is replaced.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	bench init -q repo &&
+	(
+		cd repo &&
+		mkdir -p dir/sub &&
+		echo one >one &&
+		echo two >dir/two &&
+		echo three >dir/sub/three &&
+		bench add . &&
+		bench commit -q -m initial &&
+		bench ls-files -s >../expect-v2
+	)
+'
+
+test_expect_success 'write a version 5 index' '
+	(
+		cd repo &&
+		bench update-index --index-version 5 &&
+		test "$(bench update-index --show-index-version)" = 5
+	)
+'
+
+test_expect_success 'read it back' '
+	(
+		cd repo &&
+		bench ls-files -s >../actual &&
+		bench diff-index --cached --exit-code HEAD &&
+		bench diff-files --exit-code
+	) &&
+	test_cmp expect-v2 actual
+'
+
+test_expect_success 'update it' '
+	(
+		cd repo &&
+		echo changed >one &&
+		echo four >dir/four &&
+		bench rm -q dir/two &&
+		bench add one dir/four &&
+		bench update-index --assume-unchanged dir/sub/three &&
+		bench update-index --skip-worktree dir/four &&
+		test "$(bench update-index --show-index-version)" = 5 &&
+		bench ls-files -v >../actual
+	) &&
+	cat >expect <<-\EOF &&
+	S dir/four
+	h dir/sub/three
+	H one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'updates survive rereading' '
+	(
+		cd repo &&
+		bench update-index --no-assume-unchanged dir/sub/three &&
+		bench update-index --no-skip-worktree dir/four &&
+		bench commit -q -m update &&
+		bench ls-files -s >../actual &&
+		bench ls-tree -r --format="%(objectmode) %(objectname) 0	%(path)" HEAD >../expect &&
+		bench diff-files --exit-code
+	) &&
+	test_cmp expect actual
+'
+
+test_expect_success 'convert back to version 2' '
+	(
+		cd repo &&
+		bench update-index --index-version 2 &&
+		test "$(bench update-index --show-index-version)" = 2 &&
+		bench ls-files -s >../actual
+	) &&
+	test_cmp expect actual
+'
+
+# the version in the header of the index file <file>, without
+# rewriting it the way "update-index --show-index-version" does
+index_version () {
+	head -c 8 "$1" | test-tool hexdump | cut -d" " -f8
+}
+
+test_expect_success 'split index with a version 5 shared index' '
+	bench init -q split &&
+	(
+		cd split &&
+		bench config index.version 5 &&
+		bench config core.splitIndex true &&
+		mkdir dir &&
+		for f in one two dir/three dir/four
+		do
+			echo $f >$f || return 1
+		done &&
+		bench add . &&
+		bench update-index --split-index &&
+		test-tool dump-split-index .bench/index >../dump &&
+		base=$(sed -n "s/^base //p" ../dump) &&
+		test -n "$base" &&
+		test "$(index_version .bench/sharedindex.$base)" = 05 &&
+		test "$(index_version .bench/index)" = 05 &&
+		bench ls-files -s >../split-expect &&
+		bench diff-files --exit-code
+	) &&
+	test_line_count = 4 split-expect
+'
+
+test_expect_success 'update entries of a version 5 shared index' '
+	(
+		cd split &&
+		echo changed >one &&
+		bench add one &&
+		rm dir/four &&
+		bench update-index --remove dir/four &&
+		test-tool dump-split-index .bench/index >../dump &&
+		bench ls-files -s >../actual &&
+		bench diff-files --exit-code
+	) &&
+	# dir/four, dir/three, one, two in the shared index
+	test_grep "^deletions: 0$" dump &&
+	grep "^replacements:" dump >replacements &&
+	test_grep " 2\( \|$\)" replacements &&
+	grep -v -e "	one$" -e "	dir/four$" split-expect >expect &&
+	grep -v "	one$" actual >unchanged &&
+	test_cmp expect unchanged &&
+	grep "	one$" split-expect >old &&
+	grep "	one$" actual >new &&
+	! test_cmp old new
+'
+
+test_expect_success 'new shared index from a version 5 one' '
+	(
+		cd split &&
+		test-tool dump-split-index .bench/index >../dump.old &&
+		bench ls-files -s >../expect &&
+		bench update-index --split-index &&
+		test-tool dump-split-index .bench/index >../dump &&
+		bench ls-files -s >../actual &&
+		bench diff-files --exit-code
+	) &&
+	test_cmp expect actual &&
+	grep "^base " dump.old >old &&
+	grep "^base " dump >new &&
+	! test_cmp old new &&
+	test_grep "^deletions:$" dump
+'
+
+test_expect_success 'unsplit an index with a version 5 shared index' '
+	(
+		cd split &&
+		echo again >two &&
+		bench add two &&
+		bench ls-files -s >../expect &&
+		bench config core.splitIndex false &&
+		bench update-index --no-split-index &&
+		test-tool dump-split-index .bench/index >../dump &&
+		test "$(index_version .bench/index)" = 05 &&
+		bench ls-files -s >../actual &&
+		bench diff-files --exit-code
+	) &&
+	test_grep "^not a split index$" dump &&
+	test_cmp expect actual
+'
+
+test_done
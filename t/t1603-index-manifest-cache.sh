@@ -0,0 +1,103 @@
+#!/bin/sh
+
+test_description='the manifest cache index extension
+
+An index with manifest entries records the content OID and size of
+their manifests, so that refreshing it does not read the manifests.
+Records must follow the manifest entries of the index.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	bench init -q src &&
+	test_seq 1000 >one &&
+	test_seq 2000 >two &&
+	{
+		n=0 &&
+		for f in one two
+		do
+			n=$((n + 1)) &&
+			echo blob &&
+			echo "mark :$n" &&
+			echo "data $(wc -c <$f)" &&
+			cat $f &&
+			echo || return 1
+		done &&
+		echo "commit refs/heads/main" &&
+		echo "committer C O Mitter <committer@example.com> 1112912053 -0700" &&
+		echo "data 0" &&
+		echo "M 100644 :1 one" &&
+		echo "M 100644 :2 two" &&
+		echo
+	} | bench -C src fast-import --chunk-size=64 --quiet &&
+	bench -C src ls-tree main >tree &&
+	test_line_count = 2 tree &&
+	test_grep ! -v "^110644 manifest" tree &&
+	m1=$(bench -C src rev-parse main:one) &&
+	m2=$(bench -C src rev-parse main:two) &&
+	for f in one two
+	do
+		m=$(bench -C src rev-parse main:$f) &&
+		echo "$m $(bench hash-object $f) $(wc -c <$f) 1 $(
+			bench -C src cat-file -p $m | sed -n 4p)" || return 1
+	done | sort >expect-both &&
+
+	# a repository that borrows the manifests and chunks of src,
+	# and can lose them
+	bench init -q user &&
+	echo "$(pwd)/src/.bench/objects" >user/.bench/objects/info/alternates &&
+	bench -C user read-tree -u --reset $(bench -C src rev-parse main)
+'
+
+test_expect_success 'the index records the manifests of its entries' '
+	test-tool -C user manifest dump-cache >actual &&
+	test_cmp expect-both actual
+'
+
+test_expect_success 'entries are compared without reading the manifests' '
+	mv user/.bench/objects/info/alternates alternates &&
+	test_when_finished "mv alternates user/.bench/objects/info/" &&
+	test-tool chmtime +10 user/one user/two &&
+	bench -C user update-index --refresh &&
+	sed s/^1$/x/ one >user/one &&
+	test_must_fail bench -C user update-index --refresh >out &&
+	echo "one: needs update" >expect &&
+	test_cmp expect out
+'
+
+test_expect_success 'records of manifests leaving the index are dropped' '
+	cp one two user/ &&
+	bench -C user rm -q --cached two &&
+	grep "^$m1 " expect-both >expect &&
+	test-tool -C user manifest dump-cache >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'records of manifests entering the index are added' '
+	bench -C user update-index --add --cacheinfo 110644,$m2,two &&
+	test-tool -C user manifest dump-cache >actual &&
+	test_cmp expect-both actual
+'
+
+test_expect_success 'no extension with index.manifestCache=false' '
+	bench -C user -c index.manifestCache=false \
+		update-index --force-write-index &&
+	echo "no manifest cache" >expect &&
+	test-tool -C user manifest dump-cache >actual &&
+	test_cmp expect actual &&
+
+	bench -C user -c index.manifestCache=false update-index --refresh &&
+	mv user/.bench/objects/info/alternates alternates &&
+	test_when_finished "mv alternates user/.bench/objects/info/" &&
+	test-tool chmtime +10 user/one &&
+	test_must_fail bench -C user update-index --refresh
+'
+
+test_expect_success 'no extension without manifest entries' '
+	bench -C user rm -q --cached one two &&
+	echo "no manifest cache" >expect &&
+	test-tool -C user manifest dump-cache >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,90 @@
+#!/bin/sh
+
+test_description='index.blockChecksums
+
+The entries of the index are cut into blocks with a checksum each, the
+trailing checksum is computed over those, and writing the index again
+copies the blocks that did not change.'
+
+. ./test-lib.sh
+
+# the value of the trace2 datum <key> in <trace>
+trace_value () {
+	sed -n "s|.*\"key\":\"$2\",\"value\":\"\([0-9]*\)\".*|\1|p" "$1"
+}
+
+# whether the trailer of <file> is the checksum of all that precedes it
+plain_trailer () {
+	size=$(wc -c <"$1") &&
+	rawsz=$(test_oid rawsz) &&
+	head -c $((size - rawsz)) "$1" | test-tool $(test_oid algo) >expect.hash &&
+	tail -c $rawsz "$1" | test-tool hexdump | tr -d " " >actual.hash &&
+	test_cmp expect.hash actual.hash
+}
+
+test_expect_success 'setup' '
+	blob=$(echo content | bench hash-object -w --stdin) &&
+	for i in $(test_seq 3000)
+	do
+		printf "100644 %s\tdir%d/file%d\n" $blob $((i / 100)) $i ||
+		return 1
+	done >index-info &&
+	bench update-index --index-info <index-info &&
+	bench ls-files >expect &&
+	test_line_count = 3000 expect &&
+	plain_trailer .bench/index
+'
+
+test_expect_success 'write the index in blocks' '
+	bench config index.blockChecksums true &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.write" bench update-index --force-write-index &&
+	blocks=$(trace_value trace.write write/blocks) &&
+	test "$blocks" -gt 4 &&
+	! plain_trailer .bench/index &&
+	bench ls-files >actual &&
+	test_cmp expect actual &&
+	bench fsck --no-dangling
+'
+
+test_expect_success 'unchanged blocks are reused' '
+	other=$(echo other | bench hash-object -w --stdin) &&
+	bench update-index --cacheinfo 100644,$other,dir15/file1500 &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.reuse" \
+		bench update-index --cacheinfo 100644,$blob,dir15/file1500 &&
+	blocks=$(trace_value trace.reuse write/blocks) &&
+	reused=$(trace_value trace.reuse write/reused_blocks) &&
+	test "$reused" -gt 0 &&
+	test "$reused" -lt "$blocks" &&
+	bench ls-files -s dir15/file1500 >actual &&
+	test_grep "^100644 $blob 0	dir15/file1500$" actual &&
+	bench fsck --no-dangling
+'
+
+test_expect_success 'fsck finds a corrupt block' '
+	cp .bench/index index.good &&
+	test_when_finished "mv index.good .bench/index" &&
+	# a byte in the middle of the entries
+	offset=$(($(wc -c <.bench/index) / 2)) &&
+	old=$(dd if=.bench/index bs=1 skip=$offset count=1 2>/dev/null |
+	      test-tool hexdump) &&
+	if test "$old" = "00 "
+	then
+		printf "\001"
+	else
+		printf "\000"
+	fi | dd of=.bench/index bs=1 seek=$offset conv=notrunc 2>/dev/null &&
+	test_must_fail bench fsck --no-dangling 2>err &&
+	test_grep "bad index block checksum" err
+'
+
+test_expect_success 'without the option the index gets a plain trailer' '
+	bench config index.blockChecksums false &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.off" bench update-index --force-write-index &&
+	test_grep ! "write/blocks" trace.off &&
+	plain_trailer .bench/index &&
+	bench ls-files >actual &&
+	test_cmp expect actual &&
+	bench fsck --no-dangling
+'
+
+test_done
@@ -0,0 +1,115 @@
+#!/bin/sh
+
+test_description='checkout of files stored as manifests
+
+Chunks kept uncompressed in a pack are copied straight from the pack
+file into the work tree, after checking the CRC that the pack index
+records for them. The file may be preallocated and written with
+O_DIRECT, neither of which may change what ends up in it.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test-tool genrandom seed 300000 >data &&
+	{
+		echo blob &&
+		echo "mark :1" &&
+		echo "data 300000" &&
+		cat data &&
+		echo &&
+		echo "commit refs/heads/main" &&
+		echo "committer C O Mitter <committer@example.com> 1112912053 -0700" &&
+		echo "data 0" &&
+		echo "M 100644 :1 file" &&
+		echo
+	} | bench fast-import --chunk-size=65536 --quiet &&
+	bench -c bench.storeIncompressible=true repack -a -d -F -q &&
+	bench verify-pack -v .bench/objects/pack/pack-*.idx >verify &&
+	# a stored chunk takes 19 bytes more than its content: the object
+	# header, the zlib header, two stored block headers and the adler32
+	test_grep "^[0-9a-f]* blob   65536 65555 " verify
+'
+
+test_expect_success 'checkout copies stored chunks' '
+	bench checkout -f main &&
+	test_cmp_bin data file &&
+	rm file &&
+	bench checkout -- file &&
+	test_cmp_bin data file
+'
+
+test_expect_success 'checkout.preallocate reserves the size of the file' '
+	rm file &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" bench checkout -- file &&
+	test_cmp_bin data file &&
+	if test "$(uname -s)" = Linux
+	then
+		test_grep "\"key\":\"manifest/preallocated\",\"value\":\"300000\"" trace
+	fi &&
+
+	rm file trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		bench -c checkout.preallocate=false checkout -- file &&
+	test_cmp_bin data file &&
+	test_grep ! "manifest/preallocated" trace
+'
+
+test_expect_success 'checkout.directIO writes the same file' '
+	rm file &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		bench -c checkout.directIO=true checkout -- file &&
+	test_cmp_bin data file &&
+	test_when_finished "rm -f file.crlf && bench config unset core.autocrlf" &&
+	bench config core.autocrlf true &&
+	rm file &&
+	bench -c checkout.directIO=true checkout -- file &&
+	test_cmp_bin data file
+'
+
+test_expect_success 'stored and deflated chunks in one file' '
+	bench init -q mixed &&
+	(
+		cd mixed &&
+		for i in $(test_seq 20)
+		do
+			test-tool genrandom $i 4096 &&
+			test_seq $((i * 1000)) $((i * 1000 + 820)) | head -c 4096 ||
+			return 1
+		done >data &&
+		{
+			echo blob &&
+			echo "mark :1" &&
+			echo "data $(wc -c <data)" &&
+			cat data &&
+			echo &&
+			echo "commit refs/heads/main" &&
+			echo "committer C O Mitter <committer@example.com> 1112912053 -0700" &&
+			echo "data 0" &&
+			echo "M 100644 :1 file" &&
+			echo
+		} | bench fast-import --chunk-size=4096 --quiet &&
+		bench -c bench.storeIncompressible=true repack -a -d -F -q &&
+		bench verify-pack -v .bench/objects/pack/pack-*.idx >verify &&
+		grep "^[0-9a-f]* blob   4096 " verify >chunks &&
+		test_grep " 4096 4110 " chunks &&
+		test_grep -v " 4096 4110 " chunks &&
+		for direct in false true
+		do
+			rm -f file &&
+			bench -c checkout.directIO=$direct checkout -f main &&
+			test_cmp_bin data file || return 1
+		done
+	)
+'
+
+test_expect_success 'checkout rejects a corrupt stored chunk' '
+	pack=$(echo .bench/objects/pack/pack-*.pack) &&
+	offset=$(awk "/ blob   65536 65555 / { print \$5; exit }" verify) &&
+	chmod +w $pack &&
+	printf X | dd of=$pack bs=1 seek=$(($offset + 1000)) conv=notrunc &&
+	rm file &&
+	test_must_fail bench checkout -- file 2>err &&
+	test_grep "bad packed object CRC for chunk" err
+'
+
+test_done
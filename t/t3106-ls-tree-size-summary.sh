@@ -0,0 +1,85 @@
+#!/bin/sh
+
+test_description='ls-tree --size-summary and the tree size cache
+
+The logical checkout size and file count of a tree count files stored
+as manifests with their logical size. With bench.treeSizeCache, the
+sizes of the trees visited are kept in objects/info/tree-sizes, which
+is then used instead of reading the trees again.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir -p dir/sub &&
+	echo one >a &&
+	echo two >dir/b &&
+	echo three >dir/sub/c &&
+	bench add . &&
+	bench commit -q -m small &&
+	bench tag small &&
+	test_seq 1000 >big &&
+	{
+		echo blob &&
+		echo "mark :1" &&
+		echo "data $(wc -c <big)" &&
+		cat big &&
+		echo &&
+		echo "commit refs/heads/main" &&
+		echo "committer C O Mitter <committer@example.com> 1112912053 -0700" &&
+		echo "data 0" &&
+		echo "from small" &&
+		echo "M 100644 :1 big" &&
+		echo
+	} | bench fast-import --chunk-size=64 --quiet &&
+	bench ls-tree main big >entry &&
+	test_grep "^110644 manifest" entry
+'
+
+test_expect_success 'size summary counts logical sizes' '
+	echo "$(cat a dir/b dir/sub/c big | wc -c) 4" >expect &&
+	bench ls-tree --size-summary main >actual &&
+	test_cmp expect actual &&
+	echo "$(cat dir/b dir/sub/c | wc -c) 2" >expect &&
+	bench ls-tree --size-summary main:dir >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'for-each-ref reports the same sizes' '
+	cat >expect <<-EOF &&
+	$(bench ls-tree --size-summary main) refs/heads/main
+	$(bench ls-tree --size-summary small) refs/tags/small
+	EOF
+	bench for-each-ref --format="%(checkoutsize) %(filecount) %(refname)" \
+		refs/heads/main refs/tags/small >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'no cache is written unless asked for' '
+	test_path_is_missing .bench/objects/info/tree-sizes
+'
+
+test_expect_success 'the cache answers without reading the trees' '
+	bench ls-tree --size-summary main >expect &&
+	bench -c bench.treeSizeCache=true ls-tree --size-summary main >actual &&
+	test_cmp expect actual &&
+	test_path_is_file .bench/objects/info/tree-sizes &&
+	rm -rf copy &&
+	cp -R .bench copy &&
+	sub=$(bench rev-parse main:dir/sub) &&
+	rm copy/objects/$(test_oid_to_path $sub) &&
+	mv copy/objects/info/tree-sizes tree-sizes &&
+	test_must_fail bench --git-dir=copy ls-tree --size-summary main &&
+	mv tree-sizes copy/objects/info/tree-sizes &&
+	bench --git-dir=copy ls-tree --size-summary main >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a malformed cache is ignored' '
+	bench ls-tree --size-summary main >expect &&
+	printf X | dd of=.bench/objects/info/tree-sizes bs=1 seek=1100 conv=notrunc &&
+	bench -c bench.treeSizeCache=true ls-tree --size-summary main >actual 2>err &&
+	test_cmp expect actual &&
+	test_grep "ignoring malformed tree size cache" err
+'
+
+test_done
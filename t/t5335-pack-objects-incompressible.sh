@@ -0,0 +1,94 @@
+#!/bin/sh
+
+test_description='bench.storeIncompressible
+
+Blobs that deflate would not shrink are stored with zlib level 0, which
+writes exactly what core.compression=0 would write; other blobs are
+compressed as usual.'
+
+. ./test-lib.sh
+
+# Print the path of loose object $2 in repository $1.
+loose_path () {
+	echo "$1/.bench/objects/$(test_oid_to_path $2)"
+}
+
+test_expect_success 'setup' '
+	test-tool genrandom random 200000 >random &&
+	test_seq 20000 >text &&
+	for repo in incompressible level0 default
+	do
+		bench init -q $repo || return 1
+	done &&
+	bench -C incompressible config bench.storeIncompressible true &&
+	bench -C level0 config bench.storeIncompressible false &&
+	bench -C level0 config core.compression 0 &&
+	bench -C default config bench.storeIncompressible false
+'
+
+test_expect_success 'incompressible loose blob is stored' '
+	for repo in incompressible level0 default
+	do
+		bench -C $repo hash-object -w ../random >oid-$repo || return 1
+	done &&
+	test_cmp oid-incompressible oid-level0 &&
+	oid=$(cat oid-incompressible) &&
+	test_cmp_bin "$(loose_path level0 $oid)" \
+		"$(loose_path incompressible $oid)" &&
+	! test_cmp_bin "$(loose_path default $oid)" \
+		"$(loose_path incompressible $oid)" &&
+	bench -C incompressible cat-file blob $oid >actual &&
+	test_cmp_bin random actual
+'
+
+test_expect_success 'compressible loose blob is deflated' '
+	for repo in incompressible default
+	do
+		bench -C $repo hash-object -w ../text >oid-$repo || return 1
+	done &&
+	oid=$(cat oid-incompressible) &&
+	test_cmp_bin "$(loose_path default $oid)" \
+		"$(loose_path incompressible $oid)" &&
+	test $(test_file_size "$(loose_path incompressible $oid)") -lt \
+		$(test_file_size text)
+'
+
+test_expect_success 'pack-objects stores incompressible blobs' '
+	bench -C incompressible hash-object -w ../random >oid &&
+	bench -C incompressible pack-objects --stdout <oid >stored.pack &&
+	bench -C level0 pack-objects --stdout <oid >level0.pack &&
+	test_cmp_bin level0.pack stored.pack
+'
+
+test_expect_success 'pack-objects does not delta incompressible blobs' '
+	{
+		cat random &&
+		echo tail
+	} >random2 &&
+	for repo in incompressible default
+	do
+		bench -C $repo hash-object -w ../random ../random2 >objects &&
+		bench -C $repo pack-objects --window=10 --depth=10 \
+			.bench/objects/pack/pack <objects >name &&
+		bench -C $repo verify-pack -v \
+			.bench/objects/pack/pack-$(cat name).idx >verify-$repo || return 1
+	done &&
+	test_grep "chain length = 1" verify-default &&
+	test_grep ! "chain length" verify-incompressible
+'
+
+test_expect_success 'large incompressible files are stored by add' '
+	for config in "bench.storeIncompressible=true" "core.compression=0"
+	do
+		rm -rf add &&
+		bench init -q add &&
+		cp random add/big &&
+		bench -C add -c $config -c core.bigFileThreshold=1k add big &&
+		ls add/.bench/objects/pack/*.pack >packs &&
+		test_line_count = 1 packs &&
+		mv "$(cat packs)" add-${config%%=*}.pack || return 1
+	done &&
+	test_cmp_bin add-core.compression.pack add-bench.storeIncompressible.pack
+'
+
+test_done
@@ -0,0 +1,112 @@
+#!/bin/sh
+
+test_description='count-objects --manifests
+
+The manifests are found from the object headers of loose objects and
+packs, deltified manifests included, and their chunks are counted once
+however many manifests reference them.'
+
+. ./test-lib.sh
+
+# the counts, leaving out the sizes on disk
+counts () {
+	bench count-objects --manifests >out &&
+	grep -e "^manifests:" -e "^sub-manifests:" -e "^chunks:" \
+		-e "^chunk-references:" -e "^shared-chunks:" out
+}
+
+test_expect_success 'setup' '
+	test_seq 1000 >one &&
+	{
+		cat one &&
+		test_seq 5000 5100
+	} >two &&
+	n=0 &&
+	{
+		for f in one two
+		do
+			n=$((n + 1)) &&
+			echo blob &&
+			echo "mark :$n" &&
+			echo "data $(wc -c <$f)" &&
+			cat $f &&
+			echo || return 1
+		done &&
+		echo "commit refs/heads/main" &&
+		echo "committer C O Mitter <committer@example.com> 1112912053 -0700" &&
+		echo "data 0" &&
+		echo "M 100644 :1 one" &&
+		echo "M 100644 :2 two" &&
+		echo
+	} | bench fast-import --chunk-size=64 --quiet &&
+	bench ls-tree main >tree &&
+	test_grep ! -v "^110644 manifest" tree &&
+
+	# skip the version, size and content OID
+	bench cat-file -p main:one | sed 1,3d >one.chunks &&
+	bench cat-file -p main:two | sed 1,3d >two.chunks &&
+	n1=$(sed -n 1p one.chunks) &&
+	n2=$(sed -n 1p two.chunks) &&
+	sed 1d one.chunks | sort >one.sorted &&
+	sed 1d two.chunks | sort >two.sorted &&
+	shared=$(comm -12 one.sorted two.sorted | wc -l) &&
+	test $shared -gt 0 &&
+	cat >expect <<-EOF
+	manifests: 2
+	sub-manifests: 0
+	chunks: $((n1 + n2 - shared))
+	chunk-references: $((n1 + n2))
+	shared-chunks: $shared
+	EOF
+'
+
+test_expect_success 'count packed manifests' '
+	counts >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'count deltified manifests' '
+	bench repack -a -d -f --window=50 -q &&
+	bench verify-pack -v .bench/objects/pack/*.idx >verify &&
+	test_grep "manifest *[0-9]* [0-9]* [0-9]* 1 " verify &&
+	counts >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'count loose manifests' '
+	bench init -q loose &&
+	bench pack-objects --all --stdout </dev/null >all.pack &&
+	bench -C loose unpack-objects -q <all.pack &&
+	(
+		cd loose &&
+		counts
+	) >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the logical size is that of the files' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" bench count-objects --manifests &&
+	size=$(($(wc -c <one) + $(wc -c <two))) &&
+	test_grep "\"key\":\"logical-bytes\",\"value\":\"$size\"" trace
+'
+
+test_expect_success 'sub-manifests are counted apart' '
+	bench init -q nested &&
+	(
+		cd nested &&
+		bench config extensions.benchManifestVersion 2 &&
+		bench config bench.manifestVersion 2 &&
+		test_seq 4000 >data &&
+		{
+			echo blob &&
+			echo "data $(wc -c <data)" &&
+			cat data &&
+			echo
+		} | bench fast-import --chunk-size=16 --quiet &&
+		bench count-objects --manifests >out
+	) &&
+	test_grep "^manifests: 1$" nested/out &&
+	test_grep ! "^sub-manifests: 0$" nested/out
+'
+
+test_done
@@ -0,0 +1,66 @@
+#!/bin/sh
+
+test_description='pack-objects lines up chunks by their offset
+
+The chunks of different versions of a file are sorted by their offset
+in the file before their size for the delta search, so that even the
+smallest window compares each chunk with the same region of the other
+versions.'
+
+. ./test-lib.sh
+
+# commit <file> as a manifest with chunks of 4 KiB on branch <branch>
+store_branch () {
+	{
+		echo blob &&
+		echo "mark :1" &&
+		echo "data $(wc -c <"$2")" &&
+		cat "$2" &&
+		echo &&
+		echo "commit refs/heads/$1" &&
+		echo "committer C O Mitter <committer@example.com> 1112912053 -0700" &&
+		echo "data 0" &&
+		echo "M 100644 :1 file" &&
+		echo
+	} | bench fast-import --chunk-size=4096 --quiet
+}
+
+test_expect_success 'setup' '
+	test-tool genrandom seed 65536 >one &&
+	cp one two &&
+	# change every chunk a little; random data only deltas against
+	# the same chunk of the other version
+	for i in $(test_seq 0 15)
+	do
+		printf X | dd of=two bs=1 seek=$((i * 4096 + 100)) \
+			conv=notrunc 2>/dev/null || return 1
+	done
+'
+
+for version in 1 2
+do
+	test_expect_success "chunks of version $version manifests" '
+		test_when_finished "rm -rf repo" &&
+		bench init -q repo &&
+		(
+			cd repo &&
+			# random chunks would be stored whole otherwise
+			bench config bench.storeIncompressible false &&
+			if test $version = 2
+			then
+				bench config extensions.benchManifestVersion 2 &&
+				bench config bench.manifestVersion 2
+			fi &&
+			store_branch one ../one &&
+			store_branch two ../two &&
+			bench cat-file -p two:file >manifest &&
+			test_grep "^$version$" manifest &&
+			bench repack -a -d -f --window=1 --depth=1 -q &&
+			bench verify-pack -v .bench/objects/pack/pack-*.idx >verify &&
+			grep "^[0-9a-f]* blob .* 1 [0-9a-f]*$" verify >deltas &&
+			test_line_count = 16 deltas
+		)
+	'
+done
+
+test_done
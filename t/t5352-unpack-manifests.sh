@@ -0,0 +1,51 @@
+#!/bin/sh
+
+test_description='unpack-objects --check-manifests
+
+Small pushes are unpacked to loose objects rather than indexed, so
+unpack-objects has to check the chunks of received manifests, too.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	bench init -q src &&
+	test_seq 1000 >data &&
+	size=$(wc -c <data) &&
+	{
+		echo blob &&
+		echo "mark :1" &&
+		echo "data $size" &&
+		cat data &&
+		echo &&
+		echo "get-mark :1"
+	} | bench -C src fast-import --chunk-size=64 --quiet >manifest &&
+	test "$(bench -C src cat-file -t $(cat manifest))" = manifest &&
+	{
+		cat manifest &&
+		# skip the version, size, content OID and chunk count
+		bench -C src cat-file -p $(cat manifest) | sed 1,4d
+	} >objects &&
+	test_line_count -gt 2 objects &&
+	bench -C src pack-objects --stdout <objects >full.pack &&
+	bench -C src pack-objects --stdout <manifest >manifest-only.pack
+'
+
+test_expect_success 'complete manifest passes' '
+	bench init -q full &&
+	bench -C full unpack-objects --check-manifests <full.pack &&
+	bench -C full cat-file -p $(cat manifest) >/dev/null
+'
+
+test_expect_success 'manifest with missing chunks is rejected' '
+	bench init -q broken &&
+	test_must_fail bench -C broken unpack-objects --check-manifests \
+		<manifest-only.pack 2>err &&
+	test_grep "is missing" err
+'
+
+test_expect_success 'without --check-manifests nothing is checked' '
+	bench init -q unchecked &&
+	bench -C unchecked unpack-objects <manifest-only.pack
+'
+
+test_done
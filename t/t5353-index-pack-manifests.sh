@@ -0,0 +1,123 @@
+#!/bin/sh
+
+test_description='index-pack --check-manifests
+
+The entries of the manifests in a pack must be in the pack or in the
+repository, of the right type, and add up to the size the manifest
+records. receive-pack checks pushes that are indexed rather than
+unpacked with receive.fsckObjects.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	bench init -q src &&
+	test_seq 1000 >data &&
+	size=$(wc -c <data) &&
+	{
+		echo blob &&
+		echo "mark :1" &&
+		echo "data $size" &&
+		cat data &&
+		echo &&
+		echo "get-mark :1"
+	} | bench -C src fast-import --chunk-size=64 --quiet >manifest &&
+	m=$(cat manifest) &&
+	# skip the version, size, content OID and chunk count
+	bench -C src cat-file -p $m | sed 1,4d >chunks &&
+	first=$(head -n 1 chunks) &&
+	{
+		echo $m &&
+		cat chunks
+	} | bench -C src pack-objects --stdout >full.pack &&
+	echo $m | bench -C src pack-objects --stdout >manifest-only.pack &&
+	{
+		echo $m &&
+		sed 1d chunks
+	} | bench -C src pack-objects --stdout >partial.pack &&
+
+	# a manifest whose chunks do not add up to its size
+	bench -C src cat-file -p $m | sed "2s/.*/999/" |
+	bench -C src hash-object -t manifest --literally -w --stdin >bad &&
+	{
+		cat bad &&
+		cat chunks
+	} | bench -C src pack-objects --stdout >bad-size.pack &&
+
+	# a manifest whose first chunk is a tree
+	tree=$(bench -C src mktree </dev/null) &&
+	bench -C src cat-file -p $m | sed "5s/.*/$tree/" |
+	bench -C src hash-object -t manifest --literally -w --stdin >bad-type &&
+	{
+		cat bad-type &&
+		echo $tree &&
+		sed 1d chunks
+	} | bench -C src pack-objects --stdout >bad-type.pack
+'
+
+test_expect_success 'complete manifest passes' '
+	bench init -q full &&
+	bench -C full index-pack --stdin --strict --check-manifests <full.pack
+'
+
+test_expect_success 'complete manifest passes with threads' '
+	bench init -q threads &&
+	GIT_FORCE_THREADS=1 bench -C threads index-pack --stdin --threads=2 \
+		--strict --check-manifests <full.pack
+'
+
+test_expect_success 'missing chunks are rejected' '
+	bench init -q missing &&
+	test_must_fail bench -C missing index-pack --stdin --strict \
+		--check-manifests <manifest-only.pack 2>err &&
+	test_grep "manifest $(cat manifest): entry .* is missing" err
+'
+
+test_expect_success 'chunks already in the repository are found' '
+	bench init -q have &&
+	{
+		echo $first | bench -C src pack-objects --stdout
+	} >first.pack &&
+	bench -C have index-pack --stdin <first.pack &&
+	bench -C have index-pack --stdin --strict --check-manifests <partial.pack
+'
+
+test_expect_success 'chunks of the wrong type are rejected' '
+	bench init -q type &&
+	# --strict would notice first, when it links the objects
+	test_must_fail bench -C type index-pack --stdin \
+		--check-manifests <bad-type.pack 2>err &&
+	test_grep "entry 0 ($tree) is a tree, not a blob" err
+'
+
+test_expect_success 'chunks not adding up to the size are rejected' '
+	bench init -q size &&
+	test_must_fail bench -C size index-pack --stdin --strict \
+		--check-manifests <bad-size.pack 2>err &&
+	test_grep "chunks add up to $(wc -c <data) bytes, manifest records 999" err
+'
+
+test_expect_success 'without --check-manifests nothing is checked' '
+	bench init -q unchecked &&
+	bench -C unchecked index-pack --stdin <manifest-only.pack
+'
+
+test_expect_success 'push indexed by receive-pack is checked' '
+	bench init -q --bare dst.git &&
+	bench -C dst.git config receive.unpackLimit 1 &&
+	bench -C dst.git config receive.fsckObjects true &&
+
+	printf "110644 manifest %s\tfile\n" $(cat manifest) >good.tree &&
+	good=$(bench -C src commit-tree -m good $(bench -C src mktree <good.tree)) &&
+	bench -C src push ../dst.git $good:refs/heads/good &&
+	bench -C dst.git cat-file -e $(cat manifest) &&
+	ls dst.git/objects/pack/*.pack >packs &&
+	test_line_count = 1 packs &&
+
+	printf "110644 manifest %s\tfile\n" $(cat bad) >bad.tree &&
+	bad=$(bench -C src commit-tree -m bad $(bench -C src mktree <bad.tree)) &&
+	test_must_fail bench -C src push ../dst.git $bad:refs/heads/bad 2>err &&
+	test_grep "chunks add up to" err &&
+	test_must_fail bench -C dst.git rev-parse --verify refs/heads/bad
+'
+
+test_done
@@ -0,0 +1,109 @@
+#!/bin/sh
+
+test_description='read directories ahead of the untracked scan
+
+With core.dirScanThreads, threads read the directories ahead of the
+scan for untracked files. The results must be the same as without
+them, and the untracked cache must record what the directories were
+like when they were read.'
+
+. ./test-lib.sh
+
+GIT_FORCE_UNTRACKED_CACHE=true
+export GIT_FORCE_UNTRACKED_CACHE
+
+# the number of directories that the status traced to <trace> opened
+opendir_count () {
+	sed -n "s/.*\"key\":\"opendir\",\"value\":\"\([0-9]*\)\".*/\1/p" "$1"
+}
+
+# put the directories of the worktree in the past, so that the
+# untracked cache does not take them for racily changed
+age_dirs () {
+	find repo -path repo/.bench -prune -o -type d -print |
+	while read d
+	do
+		test-tool chmtime =-60 "$d" || return 1
+	done
+}
+
+test_expect_success 'setup' '
+	bench init -q repo &&
+	(
+		cd repo &&
+		for d in a a/b a/b/c d d/e f f/g/h
+		do
+			mkdir -p $d &&
+			echo tracked >$d/tracked &&
+			echo untracked >$d/untracked || return 1
+		done &&
+		mkdir -p only-untracked/x/y &&
+		echo 1 >only-untracked/x/y/file &&
+		mkdir empty &&
+		echo ignored >a/b/ignored &&
+		mkdir -p ignored-dir/z &&
+		echo 1 >ignored-dir/z/file &&
+		cat >.benchignore <<-\EOF &&
+		ignored
+		ignored-dir/
+		EOF
+		bench add .benchignore "*/tracked" &&
+		bench commit -q -m initial
+	)
+'
+
+for args in "" "-uall" "--ignored" "--ignored -uall" "-- a d/e"
+do
+	test_expect_success "status${args:+ $args} is the same with threads" '
+		bench -C repo -c core.untrackedCache=false \
+			status --porcelain $args >expect &&
+		bench -C repo -c core.untrackedCache=false \
+			-c core.dirScanThreads=4 status --porcelain $args >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success 'the untracked cache is filled from the read-ahead' '
+	bench -C repo -c core.untrackedCache=false status --porcelain >expect &&
+	bench -C repo config core.untrackedCache true &&
+	bench -C repo config core.dirScanThreads 4 &&
+	age_dirs &&
+	bench -C repo status --porcelain >actual &&
+	test_cmp expect actual &&
+
+	# the stat data recorded for the directories read ahead is that
+	# of the directories, so none of them is opened again
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		bench -C repo status --porcelain >actual &&
+	test_cmp expect actual &&
+	echo 0 >expect.count &&
+	opendir_count trace >actual.count &&
+	test_cmp expect.count actual.count
+'
+
+test_expect_success 'directories changed after the scan are read again' '
+	echo new >repo/a/b/c/new &&
+	rm repo/d/untracked &&
+	mkdir repo/only-untracked/x/y/sub &&
+	echo 1 >repo/only-untracked/x/y/sub/file &&
+	bench -C repo -c core.untrackedCache=false status --porcelain -uall >expect &&
+	bench -C repo status --porcelain -uall >actual &&
+	test_cmp expect actual &&
+	test_grep "^?? a/b/c/new$" actual &&
+	test_grep "^?? only-untracked/x/y/sub/file$" actual &&
+	test_grep ! "^?? d/untracked$" actual
+'
+
+test_expect_success SANITY 'unreadable directories are reported the same' '
+	test_when_finished "chmod 755 repo/a/b" &&
+	chmod 0 repo/a/b &&
+	bench -C repo -c core.untrackedCache=false -c core.dirScanThreads=1 \
+		status --porcelain >expect 2>expect.err &&
+	test_grep "could not open directory .a/b/." expect.err &&
+	bench -C repo -c core.untrackedCache=false -c core.dirScanThreads=4 \
+		status --porcelain >actual 2>actual.err &&
+	test_cmp expect actual &&
+	test_cmp expect.err actual.err
+'
+
+test_done
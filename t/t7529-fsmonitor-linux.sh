@@ -0,0 +1,153 @@
+#!/bin/sh
+
+test_description='fsmonitor--daemon on Linux
+
+The inotify backend reports the paths created, changed, deleted and
+renamed in the worktree, watches the directories created after it
+started, and shuts the daemon down when the repository goes away.'
+
+. ./test-lib.sh
+
+if ! bench version --build-options | grep -q "feature: fsmonitor--daemon"
+then
+	skip_all="fsmonitor--daemon is not supported on this platform"
+	test_done
+fi
+
+case "$(uname -s)" in
+Linux)
+	;;
+*)
+	skip_all="not the Linux backend"
+	test_done
+	;;
+esac
+
+stop_daemon_delete_repo () {
+	test_might_fail bench -C "$1" fsmonitor--daemon stop &&
+	rm -rf "$1"
+}
+
+# the paths changed since <token>, one per line, without the new token;
+# the output of the tests goes outside of the watched worktree
+changed_since () {
+	test-tool fsmonitor-client query --token "$1" >../out &&
+	nul_to_q <../out | tr Q "\n" | sed 1d | sort
+}
+
+# the token the daemon answers with
+current_token () {
+	test-tool fsmonitor-client query --token 0 >../out &&
+	nul_to_q <../out | sed "s/Q.*//"
+}
+
+test_expect_success 'start and stop the daemon' '
+	test_when_finished "stop_daemon_delete_repo explicit" &&
+	bench init -q explicit &&
+	bench -C explicit fsmonitor--daemon start &&
+	bench -C explicit fsmonitor--daemon status &&
+	bench -C explicit fsmonitor--daemon stop &&
+	test_must_fail bench -C explicit fsmonitor--daemon status
+'
+
+test_expect_success 'changes in the worktree are reported' '
+	test_when_finished "stop_daemon_delete_repo changes" &&
+	bench init -q changes &&
+	(
+		cd changes &&
+		echo 1 >modified &&
+		echo 1 >deleted &&
+		echo 1 >renamed &&
+		mkdir dir &&
+		echo 1 >dir/file &&
+		bench fsmonitor--daemon start &&
+		token=$(current_token) &&
+		test -n "$token" &&
+
+		echo 2 >>modified &&
+		echo 1 >created &&
+		rm deleted &&
+		mv renamed moved &&
+		changed_since "$token" >../actual &&
+		cat >../expect <<-\EOF &&
+		created
+		deleted
+		modified
+		moved
+		renamed
+		EOF
+		test_cmp ../expect ../actual
+	)
+'
+
+test_expect_success 'new directories are watched' '
+	test_when_finished "stop_daemon_delete_repo newdir" &&
+	bench init -q newdir &&
+	(
+		cd newdir &&
+		bench fsmonitor--daemon start &&
+		mkdir -p a/b &&
+		token=$(current_token) &&
+		echo 1 >a/b/file &&
+		changed_since "$token" >../actual &&
+		test_grep "^a/b/file$" ../actual &&
+
+		token=$(current_token) &&
+		mv a c &&
+		changed_since "$token" >../actual &&
+		test_grep "^a/$" ../actual &&
+		test_grep "^c/$" ../actual
+	)
+'
+
+test_expect_success 'status agrees with and without the daemon' '
+	test_when_finished "stop_daemon_delete_repo status" &&
+	bench init -q status &&
+	(
+		cd status &&
+		echo 1 >tracked &&
+		mkdir dir &&
+		echo 1 >dir/tracked &&
+		bench add tracked dir &&
+		bench commit -q -m initial &&
+		bench config core.fsmonitor true &&
+		bench fsmonitor--daemon start &&
+		bench status --porcelain >../actual &&
+		test_must_be_empty ../actual &&
+
+		echo 2 >>dir/tracked &&
+		echo 1 >untracked &&
+		rm tracked &&
+		bench status --porcelain >../actual &&
+		bench -c core.fsmonitor=false status --porcelain >../expect &&
+		test_cmp ../expect ../actual &&
+		test_grep "^ M dir/tracked$" ../actual &&
+		test_grep "^ D tracked$" ../actual &&
+		test_grep "^?? untracked$" ../actual
+	)
+'
+
+# the detached daemon traces under a session nested in that of "start"
+daemon_exited () {
+	grep "\"event\":\"exit\",\"sid\":\"[^\"]*/" "$1"
+}
+
+test_expect_success 'the daemon stops when the repository is removed' '
+	test_when_finished "stop_daemon_delete_repo removed" &&
+	bench init -q removed &&
+	GIT_TRACE2_EVENT="$(pwd)/removed.trace" \
+		bench -C removed fsmonitor--daemon start &&
+	! daemon_exited removed.trace &&
+	rm -rf removed/.bench &&
+	for i in $(test_seq 100)
+	do
+		if daemon_exited removed.trace
+		then
+			break
+		fi &&
+		sleep 0.1 || return 1
+	done &&
+	daemon_exited removed.trace
+'
+
+test_done
@@ -0,0 +1,65 @@
+#!/bin/sh
+
+test_description='the untracked cache shared with fsmonitor--daemon
+
+Commands share the untracked cache with the daemon, and one reading an
+index without it starts from that copy. The copy only holds for the
+paths that the index tracked when it was built.'
+
+. ./test-lib.sh
+
+if ! bench version --build-options | grep -q "feature: fsmonitor--daemon"
+then
+	skip_all="fsmonitor--daemon is not supported on this platform"
+	test_done
+fi
+
+test_expect_success 'setup' '
+	bench init -q repo &&
+	(
+		cd repo &&
+		bench config core.fsmonitor true &&
+		bench config core.untrackedCache true &&
+		mkdir -p e/f &&
+		echo 1 >e/f/c &&
+		echo 1 >e/f/y &&
+		echo 1 >e/f/z &&
+		bench add e/f/c e/f/y &&
+		bench commit -q -m initial
+	) &&
+	# status starts the daemon again on its own
+	bench -C repo fsmonitor--daemon stop
+'
+
+test_expect_success 'an index without the extension starts from the shared copy' '
+	test_when_finished "test_might_fail bench -C repo fsmonitor--daemon stop" &&
+	bench -C repo status --porcelain >actual &&
+	bench -C repo status --porcelain >actual &&
+	echo "?? e/f/z" >expect &&
+	test_cmp expect actual &&
+
+	bench -C repo -c core.untrackedCache=false update-index \
+		--force-write-index &&
+	GIT_TRACE2_EVENT="$(pwd)/warm.trace" \
+		bench -C repo status --porcelain >actual &&
+	test_cmp expect actual &&
+	test_grep "\"key\":\"untracked-cache/warm-count\"" warm.trace
+'
+
+test_expect_success 'the shared copy is not used for other tracked paths' '
+	test_when_finished "test_might_fail bench -C repo fsmonitor--daemon stop" &&
+	bench -C repo status --porcelain >actual &&
+	bench -C repo status --porcelain >actual &&
+	bench -C repo -c core.untrackedCache=false rm -q --cached e/f/y &&
+	GIT_TRACE2_EVENT="$(pwd)/mismatch.trace" \
+		bench -C repo status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	D  e/f/y
+	?? e/f/y
+	?? e/f/z
+	EOF
+	test_cmp expect actual &&
+	test_grep "\"key\":\"untracked-cache/index-mismatch\"" mismatch.trace
+'
+
+test_done
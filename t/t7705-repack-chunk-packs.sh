@@ -0,0 +1,176 @@
+#!/bin/sh
+
+test_description='repack --chunk-packs
+
+The chunks of manifests are kept in chunk packs of their own, marked
+with a .chunks file. Chunk packs are left alone by later repacks, gc
+included, until they are rolled up, or until some of their chunks
+become unreachable.'
+
+. ./test-lib.sh
+
+packdir=.bench/objects/pack
+
+# store <file> as a manifest on branch <branch>
+store_branch () {
+	{
+		echo blob &&
+		echo "mark :1" &&
+		echo "data $(wc -c <"$2")" &&
+		cat "$2" &&
+		echo &&
+		echo "commit refs/heads/$1" &&
+		echo "committer C O Mitter <committer@example.com> 1112912053 -0700" &&
+		echo "data 0" &&
+		echo "M 100644 :1 $2" &&
+		echo
+	} | bench fast-import --chunk-size=64 --quiet
+}
+
+# the sorted chunks of the manifest <rev>
+chunks_of () {
+	# skip the version, size, content OID and chunk count
+	bench cat-file -p "$1" | sed 1,4d | sort -u
+}
+
+# the sorted objects of the pack <idx>
+objects_of () {
+	bench show-index <"$1" | cut -d" " -f2 | sort
+}
+
+# the .idx files of the chunk packs, or of the other packs with "!"
+list_packs () {
+	for idx in $packdir/pack-*.idx
+	do
+		if test -f "${idx%.idx}.chunks"
+		then
+			test "$1" = "!" || echo "$idx"
+		else
+			test "$1" != "!" || echo "$idx"
+		fi
+	done
+}
+
+test_expect_success 'setup' '
+	test_seq 1000 >small &&
+	test_seq 10000 15000 >large &&
+	store_branch small small &&
+	chunks_of small:small >small.chunks
+'
+
+test_expect_success 'pack-objects --chunks-only packs only chunks' '
+	bench pack-objects --chunks-only --all --stdout </dev/null >only.pack &&
+	bench index-pack -o only.idx only.pack &&
+	objects_of only.idx >actual &&
+	test_cmp small.chunks actual
+'
+
+test_expect_success 'repack --chunk-packs writes the chunks apart' '
+	bench repack -a -d --chunk-packs &&
+	list_packs >chunk-packs &&
+	test_line_count = 1 chunk-packs &&
+	test_must_be_empty $(sed "s/idx$/chunks/" chunk-packs) &&
+	objects_of $(cat chunk-packs) >actual &&
+	test_cmp small.chunks actual &&
+
+	list_packs ! >other-packs &&
+	test_line_count = 1 other-packs &&
+	objects_of $(cat other-packs) >others &&
+	comm -12 small.chunks others >common &&
+	test_must_be_empty common &&
+	bench fsck
+'
+
+test_expect_success 'chunk packs are kept' '
+	store_branch large large &&
+	chunks_of large:large >large.chunks &&
+	comm -13 small.chunks large.chunks >new.chunks &&
+	test_line_count -gt $((2 * $(wc -l <small.chunks))) new.chunks &&
+	cp chunk-packs chunk-packs.old &&
+
+	bench repack -a -d --chunk-packs &&
+	list_packs >chunk-packs &&
+	test_line_count = 2 chunk-packs &&
+	grep -F -f chunk-packs.old chunk-packs &&
+	objects_of $(grep -v -F -f chunk-packs.old chunk-packs) >actual &&
+	test_cmp new.chunks actual &&
+	list_packs ! >other-packs &&
+	test_line_count = 1 other-packs &&
+	bench fsck
+'
+
+test_expect_success 'gc leaves chunk packs alone' '
+	cp chunk-packs chunk-packs.old &&
+	bench -c repack.chunkPacks=true -c gc.writeCommitGraph=false gc &&
+	list_packs >chunk-packs &&
+	test_cmp chunk-packs.old chunk-packs &&
+
+	# chunk packs do not count towards gc.autoPackLimit
+	ls $packdir >before &&
+	bench -c repack.chunkPacks=true -c gc.autoPackLimit=1 gc --auto &&
+	ls $packdir >after &&
+	test_cmp before after
+'
+
+test_expect_success 'chunk packs out of progression are rolled up' '
+	bench -c repack.chunkPackFactor=1000 repack -a -d --chunk-packs &&
+	list_packs >chunk-packs &&
+	test_line_count = 1 chunk-packs &&
+	sort -u small.chunks large.chunks >expect &&
+	objects_of $(cat chunk-packs) >actual &&
+	test_cmp expect actual &&
+	bench fsck
+'
+
+test_expect_success 'unreachable chunks of a kept chunk pack are dropped' '
+	cp chunk-packs chunk-packs.old &&
+	test_seq 20000 20300 >other &&
+	store_branch other other &&
+	chunks_of other:other >other.chunks &&
+	bench repack -a -d --chunk-packs &&
+	list_packs >chunk-packs &&
+	test_line_count = 2 chunk-packs &&
+	grep -F -f chunk-packs.old chunk-packs &&
+
+	bench update-ref -d refs/heads/large &&
+	bench repack -a -d --chunk-packs &&
+	list_packs >chunk-packs &&
+	test_line_count = 2 chunk-packs &&
+	! grep -F -f chunk-packs.old chunk-packs &&
+	sort -u small.chunks other.chunks >expect &&
+	cat chunk-packs | while read idx
+	do
+		objects_of $idx || return 1
+	done | sort >actual &&
+	test_cmp expect actual &&
+	comm -13 small.chunks large.chunks | head -n 1 >gone &&
+	test_must_fail bench cat-file -e $(cat gone) &&
+	bench fsck
+'
+
+test_expect_success 'with -A, unreachable chunks are turned loose' '
+	bench update-ref -d refs/heads/other &&
+	bench repack -A -d --chunk-packs &&
+	list_packs >chunk-packs &&
+	test_line_count = 1 chunk-packs &&
+	objects_of $(cat chunk-packs) >actual &&
+	test_cmp small.chunks actual &&
+	comm -13 small.chunks other.chunks >loose &&
+	while read oid
+	do
+		test_path_is_file .bench/objects/$(test_oid_to_path $oid) ||
+		return 1
+	done <loose
+'
+
+test_expect_success 'repack -a -d -k keeps unreachable chunks' '
+	store_branch other other &&
+	bench repack -a -d --chunk-packs &&
+	list_packs >chunk-packs.old &&
+	bench update-ref -d refs/heads/other &&
+	bench repack -a -d -k --chunk-packs &&
+	list_packs >chunk-packs &&
+	test_cmp chunk-packs.old chunk-packs
+'
+
+test_done
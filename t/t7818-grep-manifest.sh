@@ -0,0 +1,70 @@
+#!/bin/sh
+
+test_description='grep in files stored as manifests
+
+The content of a manifest is grepped a few chunks at a time. Lines
+that straddle chunks, and segments of chunks searched by different
+threads, must match as they would in the whole file.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	{
+		test_seq 500 &&
+		printf "start%070000dend\n" 0 &&
+		test_seq 501 1000
+	} >data &&
+	size=$(wc -c <data) &&
+	{
+		echo blob &&
+		echo "mark :1" &&
+		echo "data $size" &&
+		cat data &&
+		echo &&
+		echo "commit refs/heads/main" &&
+		echo "committer C O Mitter <committer@example.com> 1112912053 -0700" &&
+		echo "data 0" &&
+		echo "M 100644 :1 file" &&
+		echo
+	} | bench fast-import --chunk-size=64 --quiet &&
+	bench ls-tree main >tree &&
+	test_grep "^110644 manifest" tree
+'
+
+for threads in 1 4
+do
+	test_expect_success "lines across chunks match (threads=$threads)" '
+		grep -e "^99" -e "0$" data | sed "s/^/main:file:/" >expect &&
+		bench grep --threads=$threads -e "^99" -e "0$" main >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "a line longer than a segment (threads=$threads)" '
+		grep "0end$" data | sed "s/^/main:file:/" >expect &&
+		bench grep --threads=$threads "0end$" main >actual &&
+		test_cmp expect actual &&
+		test_must_fail bench grep --threads=$threads -c "^0" main >actual &&
+		test_must_be_empty actual &&
+		test_must_fail bench grep --threads=$threads "^0" main
+	'
+
+	test_expect_success "-n counts lines across chunks (threads=$threads)" '
+		grep -n -e "^99" -e "end" data | sed "s/^/main:file:/" >expect &&
+		bench grep --threads=$threads -n -e "^99" -e "end" main >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "-c counts matches across chunks (threads=$threads)" '
+		echo "main:file:$(grep -c 1 data)" >expect &&
+		bench grep --threads=$threads -c 1 main >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "-l reports the file once (threads=$threads)" '
+		echo main:file >expect &&
+		bench grep --threads=$threads -l 5 main >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_done
@@ -0,0 +1,100 @@
+#!/bin/sh
+
+test_description='fast-import stores file content as manifests
+
+Data larger than the chunk size is cut into chunks, either every
+--chunk-size bytes or, with --content-defined-chunks, where the content
+says, so that chunks after an insertion are shared with the old
+version.'
+
+. ./test-lib.sh
+
+# Import file $1 with fast-import options $2 and print its manifest.
+import_file () {
+	size=$(wc -c <"$1") &&
+	{
+		echo blob &&
+		echo "mark :1" &&
+		echo "data $size" &&
+		cat "$1" &&
+		echo &&
+		echo "get-mark :1"
+	} | bench fast-import --quiet $2
+}
+
+# Print the chunks of manifest $1, one per line.
+list_chunks () {
+	# skip the version, size, content OID and chunk count
+	bench cat-file -p $1 | sed 1,4d
+}
+
+test_expect_success 'setup' '
+	test-tool genrandom old 200000 >old &&
+	{
+		head -c 1000 old &&
+		echo inserted &&
+		tail -c +1001 old
+	} >new
+'
+
+test_expect_success 'small data is a single chunk' '
+	echo small >small &&
+	m=$(import_file small --chunk-size=1k) &&
+	list_chunks $m >chunks &&
+	test_line_count = 1 chunks &&
+	test "$(cat chunks)" = "$(bench hash-object small)"
+'
+
+test_expect_success 'fixed chunks are --chunk-size long' '
+	m=$(import_file old --chunk-size=16k) &&
+	test-tool manifest read $m 0 >actual &&
+	test_cmp_bin old actual &&
+	list_chunks $m >chunks &&
+	test_line_count = 13 chunks &&
+	for chunk in $(sed \$d chunks)
+	do
+		echo 16384 >expect &&
+		bench cat-file -s $chunk >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	list_chunks $(import_file new --chunk-size=16k) >new-chunks &&
+	sort chunks >old.sorted &&
+	sort new-chunks >new.sorted &&
+	comm -12 old.sorted new.sorted >shared &&
+	test_line_count = 0 shared
+'
+
+test_expect_success 'content-defined chunks survive an insertion' '
+	m=$(import_file old "--chunk-size=16k --content-defined-chunks") &&
+	test-tool manifest read $m 0 >actual &&
+	test_cmp_bin old actual &&
+	list_chunks $m >chunks &&
+	test_line_count -gt 4 chunks &&
+	for chunk in $(sed \$d chunks)
+	do
+		size=$(bench cat-file -s $chunk) &&
+		test $size -ge 4096 &&
+		test $size -le 65536 || return 1
+	done &&
+	new=$(import_file new "--chunk-size=16k --content-defined-chunks") &&
+	test-tool manifest read $new 0 >actual &&
+	test_cmp_bin new actual &&
+	list_chunks $new >new-chunks &&
+	sort chunks >old.sorted &&
+	sort new-chunks >new.sorted &&
+	comm -12 old.sorted new.sorted >shared &&
+	test_line_count = $(($(wc -l <chunks) - 1)) shared
+'
+
+test_expect_success 'content-defined chunks are the same every time' '
+	import_file old "--chunk-size=16k --content-defined-chunks" >first &&
+	rm -rf again &&
+	bench init -q again &&
+	(
+		cd again &&
+		import_file ../old "--chunk-size=16k --content-defined-chunks"
+	) >second &&
+	test_cmp first second
+'
+
+test_done
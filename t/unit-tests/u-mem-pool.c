@@ -23,3 +23,29 @@ void test_mem_pool__tiny_block(void)
 {
 	test_many_pool_allocations(1);
 }
+
+void test_mem_pool__mapping(void)
+{
+	struct mem_pool src = { 0 }, dst = { 0 };
+	char path[] = "mem-pool-XXXXXX";
+	int fd = xmkstemp(path);
+	char *map;
+
+	cl_assert_equal_i(8, write_in_full(fd, "mapping\n", 8));
+	map = xmmap(NULL, 8, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	unlink(path);
+
+	mem_pool_add_mapping(&src, map, 8);
+	cl_assert(mem_pool_contains(&src, map + 7));
+	cl_assert(!mem_pool_contains(&src, map + 8));
+
+	mem_pool_combine(&dst, &src);
+	cl_assert(!mem_pool_contains(&src, map));
+	cl_assert(mem_pool_contains(&dst, map));
+	cl_assert_equal_i('m', *map);
+
+	mem_pool_discard(&src, 0);
+	mem_pool_discard(&dst, 0);
+	cl_assert(dst.mappings == NULL);
+}
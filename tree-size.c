@@ -0,0 +1,360 @@
+/*
+ * tree-size.c: logical checkout sizes of trees, with an on-disk cache.
+ *
+ * The cache lives in "objects/info/tree-sizes":
+ *
+ *   4-byte signature "TSIZ"
+ *   4-byte version (1)
+ *   4-byte hash format id
+ *   256 4-byte fanout entries, as in a pack index
+ *   sorted records of: raw tree OID, 8-byte size, 8-byte file count
+ *   trailing checksum of the above
+ *
+ * All numbers are in network byte order. Trees are immutable, so an
+ * entry never goes stale; deleting the file just drops the cache.
+ */
+#include "git-compat-util.h"
+#include "tree-size.h"
+#include "commit.h"
+#include "config.h"
+#include "csum-file.h"
+#include "gettext.h"
+#include "hash-lookup.h"
+#include "hex.h"
+#include "lockfile.h"
+#include "manifest.h"
+#include "object.h"
+#include "odb.h"
+#include "oidmap.h"
+#include "path.h"
+#include "repository.h"
+#include "tag.h"
+#include "tree-walk.h"
+#include "write-or-die.h"
+
+#define TREE_SIZE_SIGNATURE 0x5453495a /* "TSIZ" */
+#define TREE_SIZE_VERSION 1
+#define TREE_SIZE_HEADER_SIZE 12
+#define TREE_SIZE_FANOUT_SIZE (256 * 4)
+
+struct tree_size_entry {
+	struct oidmap_entry ent;
+	struct tree_size size;
+};
+
+static struct tree_size_cache {
+	struct repository *repo;
+	int loaded;
+
+	/* the on-disk cache, if any */
+	const unsigned char *map;
+	size_t map_size;
+	const uint32_t *fanout;
+	const unsigned char *records;
+	uint32_t nr;
+
+	/* sizes computed by this process */
+	struct oidmap computed;
+} cache;
+
+static size_t record_size(const struct git_hash_algo *algo)
+{
+	return algo->rawsz + 16;
+}
+
+static char *tree_size_cache_filename(struct repository *r)
+{
+	return xstrfmt("%s/info/tree-sizes", r->objects->sources->path);
+}
+
+static void load_tree_size_cache(struct repository *r)
+{
+	const struct git_hash_algo *algo = r->hash_algo;
+	char *path;
+	struct stat st;
+	size_t expect, max_nr;
+	int fd, i;
+
+	if (cache.loaded && cache.repo == r)
+		return;
+	if (cache.loaded) {
+		if (cache.map)
+			munmap((void *)cache.map, cache.map_size);
+		oidmap_clear(&cache.computed, 1);
+		memset(&cache, 0, sizeof(cache));
+	}
+	cache.repo = r;
+	cache.loaded = 1;
+	oidmap_init(&cache.computed, 0);
+
+	path = tree_size_cache_filename(r);
+	fd = git_open(path);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st) ||
+	    xsize_t(st.st_size) < TREE_SIZE_HEADER_SIZE + TREE_SIZE_FANOUT_SIZE + algo->rawsz) {
+		close(fd);
+		goto out;
+	}
+	cache.map_size = xsize_t(st.st_size);
+	cache.map = xmmap(NULL, cache.map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(cache.map) != TREE_SIZE_SIGNATURE ||
+	    get_be32(cache.map + 4) != TREE_SIZE_VERSION ||
+	    get_be32(cache.map + 8) != algo->format_id)
+		goto bad;
+
+	cache.fanout = (const uint32_t *)(cache.map + TREE_SIZE_HEADER_SIZE);
+	cache.records = cache.map + TREE_SIZE_HEADER_SIZE + TREE_SIZE_FANOUT_SIZE;
+	for (i = 0; i < 256; i++) {
+		uint32_t n = ntohl(cache.fanout[i]);
+		if (n < cache.nr)
+			goto bad; /* non-monotonic fanout */
+		cache.nr = n;
+	}
+
+	max_nr = (cache.map_size - TREE_SIZE_HEADER_SIZE -
+		  TREE_SIZE_FANOUT_SIZE - algo->rawsz) / record_size(algo);
+	if (cache.nr > max_nr)
+		goto bad;
+	expect = st_add3(TREE_SIZE_HEADER_SIZE + TREE_SIZE_FANOUT_SIZE,
+			 st_mult(cache.nr, record_size(algo)), algo->rawsz);
+	if (expect != cache.map_size ||
+	    !hashfile_checksum_valid(algo, cache.map, cache.map_size))
+		goto bad;
+	goto out;
+
+bad:
+	warning(_("ignoring malformed tree size cache '%s'"), path);
+	munmap((void *)cache.map, cache.map_size);
+	cache.map = NULL;
+	cache.fanout = NULL;
+	cache.records = NULL;
+	cache.nr = 0;
+out:
+	free(path);
+}
+
+static int lookup_tree_size(struct repository *r, const struct object_id *oid,
+			    struct tree_size *out)
+{
+	struct tree_size_entry *e = oidmap_get(&cache.computed, oid);
+	uint32_t pos;
+
+	if (e) {
+		*out = e->size;
+		return 1;
+	}
+	if (!cache.map ||
+	    !bsearch_hash(oid->hash, cache.fanout, cache.records,
+			  record_size(r->hash_algo), &pos))
+		return 0;
+
+	out->bytes = get_be64(cache.records + st_mult(pos, record_size(r->hash_algo)) +
+			      r->hash_algo->rawsz);
+	out->files = get_be64(cache.records + st_mult(pos, record_size(r->hash_algo)) +
+			      r->hash_algo->rawsz + 8);
+	return 1;
+}
+
+static int compute_tree_size(struct repository *r, const struct object_id *oid,
+			     struct tree_size *out)
+{
+	struct tree_size total = { 0 };
+	struct tree_size_entry *e;
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buffer;
+	int ret = 0;
+
+	if (lookup_tree_size(r, oid, out))
+		return 0;
+
+	buffer = odb_read_object(r->objects, oid, &type, &size);
+	if (!buffer || type != OBJ_TREE) {
+		free(buffer);
+		return error(_("unable to read tree %s"), oid_to_hex(oid));
+	}
+	if (init_tree_desc_gently(&desc, oid, buffer, size, 0)) {
+		free(buffer);
+		return -1;
+	}
+
+	while (!ret && tree_entry_gently(&desc, &entry)) {
+		struct tree_size sub;
+		unsigned long entry_size;
+
+		switch (object_type(entry.mode)) {
+		case OBJ_TREE:
+			ret = compute_tree_size(r, &entry.oid, &sub);
+			total.bytes += sub.bytes;
+			total.files += sub.files;
+			break;
+		case OBJ_BLOB:
+			if (odb_read_object_info(r->objects, &entry.oid,
+						 &entry_size) < 0)
+				ret = error(_("unable to get size of %s"),
+					    oid_to_hex(&entry.oid));
+			total.bytes += entry_size;
+			total.files++;
+			break;
+		case OBJ_MANIFEST:
+			if (get_manifest_size(r, &entry.oid, &entry_size) < 0)
+				ret = error(_("unable to get size of %s"),
+					    oid_to_hex(&entry.oid));
+			total.bytes += entry_size;
+			total.files++;
+			break;
+		default:
+			/* submodules are not checked out with the tree */
+			break;
+		}
+	}
+	free(buffer);
+	if (ret)
+		return ret;
+
+	CALLOC_ARRAY(e, 1);
+	oidcpy(&e->ent.oid, oid);
+	e->size = total;
+	oidmap_put(&cache.computed, e);
+
+	*out = total;
+	return 0;
+}
+
+int repo_logical_size(struct repository *r, const struct object_id *oid,
+		      struct tree_size *out)
+{
+	struct commit *commit;
+	struct tag *tag;
+	unsigned long size;
+
+	load_tree_size_cache(r);
+
+	switch (odb_read_object_info(r->objects, oid, &size)) {
+	case OBJ_TREE:
+		return compute_tree_size(r, oid, out);
+	case OBJ_COMMIT:
+		/* with a commit-graph, this does not even read the commit */
+		commit = lookup_commit(r, oid);
+		if (!commit || repo_parse_commit(r, commit))
+			return error(_("unable to parse commit %s"), oid_to_hex(oid));
+		return compute_tree_size(r, get_commit_tree_oid(commit), out);
+	case OBJ_TAG:
+		tag = lookup_tag(r, oid);
+		if (!tag || parse_tag(tag) || !tag->tagged)
+			return error(_("unable to parse tag %s"), oid_to_hex(oid));
+		return repo_logical_size(r, &tag->tagged->oid, out);
+	case OBJ_BLOB:
+		out->bytes = size;
+		out->files = 1;
+		return 0;
+	case OBJ_MANIFEST:
+		if (get_manifest_size(r, oid, &size) < 0)
+			return -1;
+		out->bytes = size;
+		out->files = 1;
+		return 0;
+	default:
+		return error(_("unable to read object %s"), oid_to_hex(oid));
+	}
+}
+
+struct tree_size_record {
+	struct object_id oid;
+	struct tree_size size;
+};
+
+static int tree_size_record_cmp(const void *va, const void *vb)
+{
+	const struct tree_size_record *a = va, *b = vb;
+	return oidcmp(&a->oid, &b->oid);
+}
+
+int write_tree_size_cache(struct repository *r)
+{
+	const struct git_hash_algo *algo = r->hash_algo;
+	struct lock_file lk = LOCK_INIT;
+	struct tree_size_record *records;
+	struct oidmap_iter iter;
+	struct tree_size_entry *e;
+	struct hashfile *f;
+	uint32_t fanout[256] = { 0 };
+	size_t i, nr = 0, alloc;
+	char *path;
+	int enabled;
+
+	if (!cache.loaded || cache.repo != r ||
+	    !oidmap_get_size(&cache.computed))
+		return 0;
+	if (repo_config_get_bool(r, "bench.treesizecache", &enabled) || !enabled)
+		return 0;
+
+	path = tree_size_cache_filename(r);
+	if (safe_create_leading_directories(r, path) < 0 ||
+	    hold_lock_file_for_update(&lk, path, 0) < 0) {
+		/* someone else is updating it; our sizes can wait */
+		free(path);
+		return 0;
+	}
+
+	alloc = st_add(cache.nr, oidmap_get_size(&cache.computed));
+	ALLOC_ARRAY(records, alloc);
+	for (i = 0; i < cache.nr; i++) {
+		const unsigned char *rec = cache.records + st_mult(i, record_size(algo));
+
+		oidread(&records[nr].oid, rec, algo);
+		records[nr].size.bytes = get_be64(rec + algo->rawsz);
+		records[nr].size.files = get_be64(rec + algo->rawsz + 8);
+		nr++;
+	}
+	oidmap_iter_init(&cache.computed, &iter);
+	while ((e = oidmap_iter_next(&iter))) {
+		/* trees found in the file were never computed again */
+		oidcpy(&records[nr].oid, &e->ent.oid);
+		records[nr].size = e->size;
+		nr++;
+	}
+	QSORT(records, nr, tree_size_record_cmp);
+
+	for (i = 0; i < nr; i++)
+		fanout[records[i].oid.hash[0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	f = hashfd(algo, get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	hashwrite_be32(f, TREE_SIZE_SIGNATURE);
+	hashwrite_be32(f, TREE_SIZE_VERSION);
+	hashwrite_be32(f, algo->format_id);
+	for (i = 0; i < 256; i++)
+		hashwrite_be32(f, fanout[i]);
+	for (i = 0; i < nr; i++) {
+		hashwrite(f, records[i].oid.hash, algo->rawsz);
+		hashwrite_be64(f, records[i].size.bytes);
+		hashwrite_be64(f, records[i].size.files);
+	}
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_NONE, CSUM_HASH_IN_STREAM);
+	free(records);
+
+	/*
+	 * Everything is copied into the new file; drop the old mapping
+	 * before renaming over it (Windows refuses to replace a mapped
+	 * file) and reload on next use.
+	 */
+	if (cache.map)
+		munmap((void *)cache.map, cache.map_size);
+	oidmap_clear(&cache.computed, 1);
+	memset(&cache, 0, sizeof(cache));
+
+	if (commit_lock_file(&lk) < 0) {
+		int ret = error_errno(_("unable to write '%s'"), path);
+		free(path);
+		return ret;
+	}
+	free(path);
+	return 0;
+}
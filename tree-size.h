@@ -0,0 +1,36 @@
+#ifndef TREE_SIZE_H
+#define TREE_SIZE_H
+
+struct object_id;
+struct repository;
+
+/*
+ * What checking out a tree amounts to: the number of bytes written to
+ * the working tree (manifests count with their logical size, not the
+ * size of the manifest object) and the number of files, symlinks
+ * included. Submodules count for nothing.
+ */
+struct tree_size {
+	uint64_t bytes;
+	uint64_t files;
+};
+
+/*
+ * Compute the logical size of the tree, commit or tag "oid" peels to;
+ * a blob or manifest is a single file. Sizes of trees are remembered
+ * for the rest of the process and, with bench.treeSizeCache, in
+ * "objects/info/tree-sizes", so that asking again for a commit (or any
+ * tree seen before) is a single lookup.
+ * Returns 0 on success, -1 on error.
+ */
+int repo_logical_size(struct repository *r, const struct object_id *oid,
+		      struct tree_size *out);
+
+/*
+ * Write the sizes computed so far to "objects/info/tree-sizes" if
+ * bench.treeSizeCache is enabled and anything new was computed.
+ * Returns 0 on success (or when there is nothing to do), -1 on error.
+ */
+int write_tree_size_cache(struct repository *r);
+
+#endif /* TREE_SIZE_H */
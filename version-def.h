@@ -0,0 +1,9 @@
+#ifndef VERSION_DEF_H
+#define VERSION_DEF_H
+
+#define GIT_VERSION "2.50.GIT"
+#define GIT_BUILT_FROM_COMMIT "07c7a9ed012f66f57d533a50a67ab579978178f7"
+#define GIT_USER_AGENT "git/2.50.GIT"
+#define BENCH_VERSION "0.0"
+
+#endif /* VERSION_DEF_H */